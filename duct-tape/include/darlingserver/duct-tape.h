@@ -21,6 +21,30 @@ void dtape_init(const dtape_hooks_t* hooks);
 void dtape_init_in_thread(void);
 void dtape_deinit(void);
 
+void dtape_log_zone_stats(void);
+
+typedef struct dtape_zone_stats {
+	const char* name;
+	uint64_t element_size;
+	uint64_t live_count;
+	uint64_t peak_count;
+	uint64_t free_count;
+	uint64_t alloc_count;
+} dtape_zone_stats_t;
+
+typedef void (*dtape_zone_stats_iterator_f)(void* context, const dtape_zone_stats_t* stats);
+
+/**
+ * Invokes the given iterator with a snapshot of the statistics for each live zone.
+ *
+ * The iterator is invoked with the zone list locked, so it must not create or destroy zones
+ * (or allocate from duct-tape zones at all).
+ */
+void dtape_zone_stats_iterate(dtape_zone_stats_iterator_f iterator, void* context);
+void dtape_log_lock_stats(void);
+void dtape_lock_profile_dump(void);
+void dtape_log_timer_stats(void);
+
 uint32_t dtape_task_self_trap(void);
 uint32_t dtape_host_self_trap(void);
 uint32_t dtape_thread_self_trap(void);
@@ -72,6 +96,19 @@ dtape_thread_t* dtape_thread_for_port(uint32_t thread_port);
 void* dtape_thread_context(dtape_thread_t* thread);
 int dtape_thread_load_state_from_user(dtape_thread_t* thread, uintptr_t thread_state_address, uintptr_t float_state_address);
 int dtape_thread_save_state_to_user(dtape_thread_t* thread, uintptr_t thread_state_address, uintptr_t float_state_address);
+/**
+ * Retrieves the reason the given thread is currently blocking for.
+ *
+ * This is valid when called by the thread itself while it's in the process of suspending (i.e. within the `thread_suspend` hook)
+ * and remains valid until the thread runs again. While the thread is running, the reason will be `dtape_block_reason_none`.
+ */
+void dtape_thread_get_block_info(dtape_thread_t* thread, dtape_block_info_t* info);
+
+/**
+ * Returns a short, human-readable name for the given XNU block hint (as found in `dtape_block_info_t::hint`).
+ */
+const char* dtape_block_hint_name(int hint);
+
 void dtape_thread_process_signal(dtape_thread_t* thread, int bsd_signal_number, int linux_signal_number, int code, uintptr_t signal_address);
 void dtape_thread_wait_while_user_suspended(dtape_thread_t* thread);
 void dtape_thread_retain(dtape_thread_t* thread);
@@ -96,6 +133,13 @@ bool dtape_task_try_resume(dtape_task_t* task);
  */
 void dtape_timer_fired(void);
 
+/**
+ * Returns the number of timer calls currently pending in the timer queue.
+ *
+ * This is only meant for statistics; the value may be slightly out of date by the time it's returned.
+ */
+uint64_t dtape_timer_pending_count(void);
+
 void dtape_kqchan_mach_port_modify(dtape_kqchan_mach_port_t* kqchan, uint64_t receive_buffer, uint64_t receive_buffer_size, uint64_t saved_filter_flags);
 void dtape_kqchan_mach_port_disable_notifications(dtape_kqchan_mach_port_t* kqchan);
 bool dtape_kqchan_mach_port_fill(dtape_kqchan_mach_port_t* kqchan, dserver_kqchan_reply_mach_port_read_t* reply, uint64_t default_buffer, uint64_t default_buffer_size);
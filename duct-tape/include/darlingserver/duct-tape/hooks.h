@@ -24,8 +24,12 @@ typedef dtape_thread_t* (*dtape_hook_current_thread_f)(void);
  * Normally, the deadline will only be updated if the given deadline is less than
  * the current deadline (with an exception for 0/UINT64_MAX). If @p override is `true`,
  * this will forcibly update the timer deadline, even if it is later than the current deadline.
+ *
+ * @p leeway_ns indicates how much earlier than the deadline the timer is allowed to fire.
+ * If the timer is already armed to fire within `[absolute_ns - leeway_ns, absolute_ns]`,
+ * it does not need to be re-armed.
  */
-typedef void (*dtape_hook_timer_arm_f)(uint64_t absolute_ns, bool override);
+typedef void (*dtape_hook_timer_arm_f)(uint64_t absolute_ns, uint64_t leeway_ns, bool override);
 
 typedef void (*dtape_hook_log_f)(dtape_log_level_t level, const char* message);
 typedef void (*dtape_hook_get_load_info_f)(dtape_load_info_t* load_info);
@@ -55,6 +59,12 @@ typedef bool (*dtape_hook_task_get_memory_region_info_f)(void* task_context, uin
 typedef uintptr_t (*dtape_hook_task_allocate_pages_f)(void* task_context, size_t page_count, int protection, uintptr_t address_hint, dtape_memory_flags_t flags);
 typedef int (*dtape_hook_task_free_pages_f)(void* task_context, uintptr_t address, size_t page_count);
 typedef uintptr_t (*dtape_hook_task_map_file_f)(void* task_context, int fd, size_t page_count, int protection, uintptr_t address_hint, size_t page_offset, dtape_memory_flags_t flags);
+
+/**
+ * Performs the given memory operations in the task in order (ideally with a single round trip), filling in their results.
+ * Once an operation fails, the ones after it aren't performed (and report DTAPE_MEMORY_OP_ERROR_SKIPPED).
+ */
+typedef void (*dtape_hook_task_batch_memory_f)(void* task_context, dtape_memory_op_t* ops, size_t op_count);
 typedef uintptr_t (*dtape_hook_task_get_next_region_f)(void* task_context, uintptr_t address);
 typedef bool (*dtape_hook_task_change_protection_f)(void* task_context, uintptr_t address, size_t page_count, int protection);
 typedef bool (*dtape_hook_task_sync_memory_f)(void* task_context, uintptr_t address, size_t size, int sync_flags);
@@ -102,6 +112,7 @@ typedef struct dtape_hooks {
 	dtape_hook_task_allocate_pages_f task_allocate_pages;
 	dtape_hook_task_free_pages_f task_free_pages;
 	dtape_hook_task_map_file_f task_map_file;
+	dtape_hook_task_batch_memory_f task_batch_memory;
 	dtape_hook_task_get_next_region_f task_get_next_region;
 	dtape_hook_task_change_protection_f task_change_protection;
 	dtape_hook_task_sync_memory_f task_sync_memory;
@@ -1,6 +1,7 @@
 #ifndef _DARLINGSERVER_DUCT_TAPE_TYPES_H_
 #define _DARLINGSERVER_DUCT_TAPE_TYPES_H_
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -54,8 +55,47 @@ typedef enum dtape_memory_flags {
 	dtape_memory_flag_none = 0,
 	dtape_memory_flag_fixed = 1ULL << 0,
 	dtape_memory_flag_overwrite = 1ULL << 1,
+	// only valid for `task_map_file`; maps the file copy-on-write rather than shared
+	dtape_memory_flag_private = 1ULL << 2,
 } dtape_memory_flags_t;
 
+typedef enum dtape_memory_op_type {
+	// like `task_allocate_pages`
+	dtape_memory_op_allocate_pages,
+	// like `task_map_file`
+	dtape_memory_op_map_file,
+	// like `task_free_pages`
+	dtape_memory_op_free_pages,
+} dtape_memory_op_type_t;
+
+/**
+ * One of the operations in a `task_batch_memory` call.
+ */
+typedef struct dtape_memory_op {
+	dtape_memory_op_type_t type;
+	// only used for `dtape_memory_op_map_file`
+	int fd;
+	// not used for `dtape_memory_op_free_pages`
+	int protection;
+	// not used for `dtape_memory_op_free_pages`
+	dtape_memory_flags_t flags;
+	// the address hint for allocations and mappings; the address to free for `dtape_memory_op_free_pages`
+	uintptr_t address;
+	size_t page_count;
+	// only used for `dtape_memory_op_map_file`
+	size_t page_offset;
+
+	// set by the hook: the new address for allocations and mappings (0 if it failed)
+	uintptr_t result;
+	// set by the hook: 0 on success, a (Linux) error number or one of the DTAPE_MEMORY_OP_ERROR_* values on failure
+	int error;
+} dtape_memory_op_t;
+
+// the operation wasn't performed because an earlier one in the same batch failed
+#define DTAPE_MEMORY_OP_ERROR_SKIPPED (-1)
+// the operation failed, but we don't know why
+#define DTAPE_MEMORY_OP_ERROR_UNKNOWN (-2)
+
 #if DSERVER_EXTENDED_DEBUG
 	typedef uintptr_t dtape_port_id_t;
 	typedef uintptr_t dtape_port_set_id_t;
@@ -69,6 +109,29 @@ typedef enum dtape_thread_state {
 	dtape_thread_state_uninterruptible,
 } dtape_thread_state_t;
 
+typedef enum dtape_block_reason {
+	// not blocked by duct-tape (e.g. a suspension requested directly by darlingserver)
+	dtape_block_reason_none,
+	// blocked in `thread_block_parameter` on a waitq event
+	dtape_block_reason_waitq,
+	// blocked acquiring a duct-tape mutex
+	dtape_block_reason_mutex,
+	// blocked waiting on a duct-tape condition variable
+	dtape_block_reason_condvar,
+	// blocked because the thread was suspended by userspace (e.g. `thread_suspend`)
+	dtape_block_reason_user_suspended,
+} dtape_block_reason_t;
+
+typedef struct dtape_block_info {
+	dtape_block_reason_t reason;
+
+	// the XNU block hint (`block_hint_t`); only meaningful for `dtape_block_reason_waitq`
+	int hint;
+
+	// the wait event for waitq blocks or the address of the mutex/condvar for lock blocks
+	uintptr_t site;
+} dtape_block_info_t;
+
 typedef struct dtape_load_info {
 	uint64_t task_count;
 	uint64_t thread_count;
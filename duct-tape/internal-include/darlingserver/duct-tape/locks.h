@@ -8,14 +8,25 @@
 
 typedef struct dtape_mutex_link {
 	TAILQ_ENTRY(dtape_mutex_link) link;
+
+	// only used for waiters that aren't microthreads (which park on this futex instead of suspending)
+	volatile uint32_t* native_futex;
 } dtape_mutex_link_t;
 
 typedef TAILQ_HEAD(dtape_mutex_head, dtape_mutex_link) dtape_mutex_head_t;
 
+// the low bit of `dtape_owner` indicates that there may be microthreads waiting in the queue
+#define DTAPE_MUTEX_WAITERS ((uintptr_t)1)
+#define DTAPE_MUTEX_OWNER_MASK (~DTAPE_MUTEX_WAITERS)
+
 typedef struct dtape_mutex {
 	volatile uintptr_t dtape_owner;
 	libsimple_lock_t dtape_queue_lock;
 	dtape_mutex_head_t dtape_queue_head;
+#if DSERVER_LOCK_PROFILING
+	struct dtape_lock_profile* dtape_profile;
+	uint64_t dtape_acquired_at;
+#endif
 } dtape_mutex_t;
 
 typedef struct lck_mtx {
@@ -26,6 +37,25 @@ typedef struct lck_spin {
 	lck_mtx_t dtape_interlock;
 } lck_spin_t;
 
+void dtape_locks_init(void);
+
+/**
+ * Tells the CPU that we're in a spin-wait loop.
+ */
+static inline void dtape_cpu_relax(void) {
+#if __x86_64__ || __i386__
+	__builtin_ia32_pause();
+#elif __aarch64__
+	__asm__ volatile("yield");
+#endif
+};
+
+/**
+ * Records the microthread (i.e. XNU thread pointer) that the calling worker is now running, or 0 if it's not running one anymore.
+ * Contending lockers use this to decide whether it's worth spinning on a mutex's owner.
+ */
+void dtape_mutex_note_running(uintptr_t thread);
+
 void dtape_mutex_init(dtape_mutex_t* mutex);
 void dtape_mutex_lock(dtape_mutex_t* mutex);
 void dtape_mutex_unlock(dtape_mutex_t* mutex);
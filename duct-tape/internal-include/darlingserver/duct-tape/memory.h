@@ -7,6 +7,7 @@
 #include <sys/tree.h>
 
 #include <darlingserver/duct-tape/locks.h>
+#include <darlingserver/duct-tape/types.h>
 
 struct dtape_task;
 
@@ -51,7 +52,12 @@ struct vm_map_copy {
 		struct vm_map_header hdr;
 		vm_object_t object;
 		void* kdata;
+		dtape_map_shared_descriptor_t* dtape_descriptor;
 	} c_u;
+	// darlingserver-specific: where the copy will be copied out to, if that's already been set up (see dtape_vm_map_copyout_prepare).
+	// the copy holds a reference on `dtape_prepared_map` while it's set.
+	vm_map_t dtape_prepared_map;
+	uintptr_t dtape_prepared_address;
 	char dtape_copy_data[];
 };
 
@@ -59,13 +65,55 @@ struct vm_map_copy {
 
 #define cpy_object c_u.object
 #define cpy_kdata c_u.kdata
+#define cpy_dtape_descriptor c_u.dtape_descriptor
 
 #define VM_MAP_COPY_ENTRY_LIST 1
 #define VM_MAP_COPY_OBJECT 2
 #define VM_MAP_COPY_KERNEL_BUFFER 3
+// darlingserver-specific: the copy data lives in a memfd (`cpy_dtape_descriptor`) that can be mapped directly into the destination
+#define VM_MAP_COPY_DTAPE_SHARED 4
 
 void dtape_memory_init(void);
 vm_map_t dtape_vm_map_create(struct dtape_task* task);
 void dtape_vm_map_destroy(vm_map_t map);
 
+/**
+ * Creates a descriptor that takes ownership of the given memfd. The caller owns the initial reference;
+ * each shared entry created with the descriptor holds another one.
+ */
+dtape_map_shared_descriptor_t* dtape_map_shared_descriptor_create(int memfd, uint64_t size);
+void dtape_map_shared_descriptor_release(dtape_map_shared_descriptor_t* desc);
+
+dtape_map_shared_entry_t* dtape_map_shared_entry_create(uint64_t address, uint64_t size, uint64_t page_offset, dtape_map_shared_descriptor_t* descriptor);
+
+void dtape_map_insert_shared_entry(dtape_map_t* map, dtape_map_shared_entry_t* shared_entry);
+void dtape_map_remove_shared_entries(dtape_map_t* map, uint64_t address, uint64_t size);
+size_t dtape_map_find_shared_entries_locked(dtape_map_t* map, uint64_t address, uint64_t size, dtape_map_shared_entry_t** out_entries, size_t entry_count);
+
+/**
+ * Sets up the destinations of the given copies in @p map with a single `task_batch_memory` call, so that copying them out
+ * afterwards (with vm_map_copyout or vm_map_copyout_size) doesn't need a round trip to the task for each one.
+ *
+ * Copies that don't need anything set up in the task (or that fail to get it) are copied out as usual.
+ */
+void dtape_vm_map_copyout_prepare(vm_map_t map, vm_map_copy_t* copies, size_t count);
+
+#define DTAPE_MAP_REMOVAL_BATCH_MAX 16
+
+/**
+ * While a removal batch is active on a thread, vm_map_remove on the batch's map drops the region's shared entries right away
+ * but queues up the actual unmapping, which is then done with as few `task_batch_memory` calls as possible.
+ *
+ * This is only meant for teardown where nothing looks at the regions again before the batch ends
+ * (e.g. deallocating the sender's OOL regions while copying in a message).
+ */
+typedef struct dtape_map_removal_batch {
+	vm_map_t map;
+	size_t count;
+	dtape_memory_op_t ops[DTAPE_MAP_REMOVAL_BATCH_MAX];
+} dtape_map_removal_batch_t;
+
+void dtape_vm_map_removal_batch_begin(vm_map_t map, dtape_map_removal_batch_t* batch);
+void dtape_vm_map_removal_batch_end(dtape_map_removal_batch_t* batch);
+
 #endif // _DARLINGSERVER_DUCT_TAPE_MEMORY_H_
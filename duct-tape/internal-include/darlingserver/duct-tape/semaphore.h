@@ -8,6 +8,11 @@
 struct dtape_semaphore {
 	dtape_task_t* owning_task;
 	semaphore_t xnu_semaphore;
+
+	// when positive, this is the number of available permits.
+	// when negative, this is the number of threads waiting (or about to wait) on `xnu_semaphore`.
+	// the XNU semaphore is only touched when we actually need to block or wake someone up.
+	volatile int32_t count;
 };
 
 #endif // _DARLINGSERVER_DUCT_TAPE_SEMAPHORE_H_
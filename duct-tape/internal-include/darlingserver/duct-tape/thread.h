@@ -37,10 +37,16 @@ struct dtape_thread {
 	dtape_thread_user_state_t default_state;
 	bool processing_signal;
 
+	// only valid while the thread is suspending itself in the thread_suspend hook
+	dtape_block_info_t block_info;
+
 	bool waiting_suspended;
 	dtape_mutex_t suspension_mutex;
 	dtape_condvar_t suspension_condvar;
 
+	// the active removal batch, if any (see dtape_vm_map_removal_batch_begin)
+	struct dtape_map_removal_batch* map_removal_batch;
+
 	//
 	// uthread stuff for psynch
 	//
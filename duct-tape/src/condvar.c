@@ -40,6 +40,10 @@ void dtape_condvar_wait(dtape_condvar_t* condvar, dtape_mutex_t* mutex) {
 	// add ourselves to the wait queue
 	TAILQ_INSERT_TAIL(&condvar->queue_head, &thread->mutex_link, link);
 
+	thread->block_info.reason = dtape_block_reason_condvar;
+	thread->block_info.hint = 0;
+	thread->block_info.site = (uintptr_t)condvar;
+
 	// now let's suspend ourselves to wait;
 	// this also drops the queue lock.
 	dtape_hooks->thread_suspend(thread->context, NULL, NULL, &condvar->queue_lock);
@@ -2,6 +2,7 @@
 #include <darlingserver/duct-tape/hooks.internal.h>
 #include <darlingserver/duct-tape/thread.h>
 #include <darlingserver/duct-tape/log.h>
+#include <darlingserver/probes.h>
 
 #include <kern/locks.h>
 #include <kern/waitq.h>
@@ -34,15 +35,311 @@
 // that's why the thread_suspend hook has an optional `libsimple_lock_t*` parameter.
 // the hook is supposed to unlock the lock passed in for that argument once the microthread is fully suspended.
 // this way, we can be certain that we won't miss any wakeups (from someone trying to resume us just after we add ourselves to the queue but before we suspend).
+//
+// most of the time, though, the mutex isn't contended at all, so we don't even touch the queue lock in that case:
+// locking is a single CAS on the owner word (0 -> current thread) and unlocking is the reverse.
+// waiters set the low bit of the owner word (DTAPE_MUTEX_WAITERS) under the queue lock before they enqueue themselves,
+// so an unlocking thread only needs to take the slow path (and touch the queue) when that bit is set.
+//
+// before going to sleep, a contending microthread spins for a little while if the owner is currently running on another worker,
+// since the owner will most likely drop the lock soon (the critical sections in XNU code are generally short)
+// and suspending and resuming a microthread is far more expensive than a brief spin.
+//
+// to know whether the owner is running, each worker publishes the microthread it's currently running in its own slot of
+// `dtape_worker_running` (see dtape_mutex_note_running()). spinners only ever compare the owner word against those slots;
+// the owner may suspend, exit, and be freed at any moment, so we never look at the owner thread itself.
+// this also means that spinning naturally stops being attempted when there's only a single worker (e.g. with DSERVER_SINGLE_THREADED):
+// if the owner is suspended, it's not in any slot.
+
+// the maximum number of times we'll spin waiting for a running owner to drop the lock before we go to sleep
+#define DTAPE_MUTEX_SPIN_LIMIT 1000
+
+// native owners aren't microthreads, so we can't tell whether they're running; they're only supposed to hold the lock briefly,
+// so they get a much shorter spin before we give up and go to sleep
+#define DTAPE_MUTEX_NATIVE_SPIN_LIMIT 64
+
+// used as the owner for threads that have no duct-taped thread (see dtape_mutex_lock)
+#define DTAPE_MUTEX_OWNER_NATIVE (DTAPE_MUTEX_OWNER_MASK & ~(uintptr_t)0xf)
+
+// the maximum number of workers we track for spinning; workers beyond this never look like they're running an owner (so their microthreads are never spun on)
+#define DTAPE_WORKER_SLOT_COUNT 64
+
+// stored in `dtape_worker_slot` for workers that couldn't get a slot
+#define DTAPE_WORKER_SLOT_NONE (-2)
+
+static struct dtape_mutex_stats {
+	uint64_t contended;
+	uint64_t spin_acquired;
+	uint64_t sleeps;
+	uint64_t parks;
+	uint64_t wakeups;
+} dtape_mutex_stats;
+
+long syscall(long number, ...);
+int snprintf(char* str, size_t size, const char* format, ...);
+
+typedef unsigned int dtape_pthread_key_t;
+
+int pthread_key_create(dtape_pthread_key_t* key, void (*destructor)(void*));
+int pthread_setspecific(dtape_pthread_key_t key, const void* value);
+
+// the microthread (i.e. XNU thread pointer) that each worker is currently running, or 0
+static volatile uintptr_t dtape_worker_running[DTAPE_WORKER_SLOT_COUNT];
+// bit `i` is set if slot `i` belongs to a worker
+static volatile uint64_t dtape_worker_slots_used;
+// -1 until this worker claims a slot
+static __thread int dtape_worker_slot = -1;
+// releases a worker's slot when it exits
+static dtape_pthread_key_t dtape_worker_slot_key;
+
+#if __x86_64__
+	#define DTAPE_SYS_futex 202
+#elif __aarch64__
+	#define DTAPE_SYS_futex 98
+#else
+	#error Unknown futex syscall number for this architecture
+#endif
 
-void dtape_mutex_init(dtape_mutex_t* mutex) {
+#define DTAPE_FUTEX_WAIT_PRIVATE 128
+#define DTAPE_FUTEX_WAKE_PRIVATE 129
+
+static void dtape_futex_wait(volatile uint32_t* address, uint32_t expected) {
+	// spurious wakeups and EINTR/EAGAIN are fine; the caller re-checks the value
+	syscall(DTAPE_SYS_futex, address, DTAPE_FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+};
+
+static void dtape_futex_wake_one(volatile uint32_t* address) {
+	syscall(DTAPE_SYS_futex, address, DTAPE_FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+};
+
+#if DSERVER_LOCK_PROFILING
+
+//
+// lock profiling
+//
+// every lock is assigned a profile record when it's initialized, keyed by its lock group, the kind of lock, and the site that initialized it.
+// since most XNU locks are initialized in just a few places (e.g. all port locks are initialized in io_lock_init),
+// this gives a pretty good picture of which locks are hot without having to track each lock instance separately.
+//
+
+#define DTAPE_LOCK_PROFILE_MAX 1024
+#define DTAPE_LOCK_PROFILE_HISTOGRAM_BUCKETS 32
+
+typedef struct dtape_lock_profile {
+	lck_grp_t* grp;
+	const char* kind;
+	void* site;
+
+	uint64_t acquires;
+	uint64_t contended;
+	uint64_t wait_total;
+	uint64_t wait_max;
+	uint64_t hold_total;
+	uint64_t hold_max;
+
+	// bucket `i` counts contended acquisitions that waited for [2^i, 2^(i + 1)) nanoseconds
+	uint64_t wait_histogram[DTAPE_LOCK_PROFILE_HISTOGRAM_BUCKETS];
+} dtape_lock_profile_t;
+
+typedef struct dtape_dl_info {
+	const char* dli_fname;
+	void* dli_fbase;
+	const char* dli_sname;
+	void* dli_saddr;
+} dtape_dl_info_t;
+
+int dladdr(const void* addr, dtape_dl_info_t* info);
+
+static libsimple_lock_t dtape_lock_profiles_lock;
+static dtape_lock_profile_t dtape_lock_profiles[DTAPE_LOCK_PROFILE_MAX];
+
+// used once the table fills up
+static dtape_lock_profile_t dtape_lock_profile_overflow = {
+	.kind = "overflow",
+};
+
+static dtape_lock_profile_t* dtape_lock_profile_for(lck_grp_t* grp, const char* kind, void* site) {
+	dtape_lock_profile_t* profile = &dtape_lock_profile_overflow;
+	size_t start = (((uintptr_t)site >> 2) ^ ((uintptr_t)grp >> 4)) % DTAPE_LOCK_PROFILE_MAX;
+
+	libsimple_lock_lock(&dtape_lock_profiles_lock);
+
+	for (size_t i = 0; i < DTAPE_LOCK_PROFILE_MAX; ++i) {
+		dtape_lock_profile_t* candidate = &dtape_lock_profiles[(start + i) % DTAPE_LOCK_PROFILE_MAX];
+
+		if (candidate->kind == NULL) {
+			candidate->grp = grp;
+			candidate->kind = kind;
+			candidate->site = site;
+			profile = candidate;
+			break;
+		}
+
+		if (candidate->grp == grp && candidate->site == site && candidate->kind == kind) {
+			profile = candidate;
+			break;
+		}
+	}
+
+	libsimple_lock_unlock(&dtape_lock_profiles_lock);
+
+	return profile;
+};
+
+static void dtape_lock_profile_update_max(uint64_t* max, uint64_t value) {
+	os_atomic_max(max, value, relaxed);
+};
+
+static void dtape_lock_profile_acquired(dtape_mutex_t* mutex, bool contended, uint64_t wait_time) {
+	dtape_lock_profile_t* profile = mutex->dtape_profile;
+	uint64_t now = mach_absolute_time();
+
+	// locks declared statically (e.g. with LCK_MTX_DECLARE) never go through an init function, so they're not profiled
+	if (!profile) {
+		return;
+	}
+
+	mutex->dtape_acquired_at = now;
+
+	os_atomic_inc(&profile->acquires, relaxed);
+
+	if (!contended) {
+		return;
+	}
+
+	uint64_t wait_ns = 0;
+	absolutetime_to_nanoseconds(wait_time, &wait_ns);
+
+	size_t bucket = (wait_ns == 0) ? 0 : (63 - __builtin_clzll(wait_ns));
+	if (bucket >= DTAPE_LOCK_PROFILE_HISTOGRAM_BUCKETS) {
+		bucket = DTAPE_LOCK_PROFILE_HISTOGRAM_BUCKETS - 1;
+	}
+
+	os_atomic_inc(&profile->contended, relaxed);
+	os_atomic_add(&profile->wait_total, wait_ns, relaxed);
+	dtape_lock_profile_update_max(&profile->wait_max, wait_ns);
+	os_atomic_inc(&profile->wait_histogram[bucket], relaxed);
+};
+
+static void dtape_lock_profile_releasing(dtape_mutex_t* mutex) {
+	dtape_lock_profile_t* profile = mutex->dtape_profile;
+	uint64_t hold_ns = 0;
+
+	if (!profile) {
+		return;
+	}
+
+	absolutetime_to_nanoseconds(mach_absolute_time() - mutex->dtape_acquired_at, &hold_ns);
+
+	os_atomic_add(&profile->hold_total, hold_ns, relaxed);
+	dtape_lock_profile_update_max(&profile->hold_max, hold_ns);
+};
+
+static int dtape_lock_profile_compare_wait(const void* a, const void* b) {
+	const dtape_lock_profile_t* first = *(const dtape_lock_profile_t* const*)a;
+	const dtape_lock_profile_t* second = *(const dtape_lock_profile_t* const*)b;
+	uint64_t first_wait = os_atomic_load(&first->wait_total, relaxed);
+	uint64_t second_wait = os_atomic_load(&second->wait_total, relaxed);
+
+	// descending order
+	return (first_wait < second_wait) ? 1 : ((first_wait > second_wait) ? -1 : 0);
+};
+
+static void dtape_lock_profile_log(const dtape_lock_profile_t* profile) {
+	const char* group_name = (profile->grp && profile->grp->lck_grp_name[0] != '\0') ? profile->grp->lck_grp_name : "-";
+	const char* symbol = "?";
+	uintptr_t offset = (uintptr_t)profile->site;
+	dtape_dl_info_t info;
+	char histogram[512];
+	size_t histogram_length = 0;
+
+	if (profile->site && dladdr(profile->site, &info) != 0) {
+		if (info.dli_sname) {
+			symbol = info.dli_sname;
+			offset = (uintptr_t)profile->site - (uintptr_t)info.dli_saddr;
+		} else {
+			offset = (uintptr_t)profile->site - (uintptr_t)info.dli_fbase;
+		}
+	}
+
+	histogram[0] = '\0';
+	for (size_t i = 0; i < DTAPE_LOCK_PROFILE_HISTOGRAM_BUCKETS && histogram_length < sizeof(histogram); ++i) {
+		uint64_t count = os_atomic_load(&profile->wait_histogram[i], relaxed);
+		if (count == 0) {
+			continue;
+		}
+		histogram_length += snprintf(&histogram[histogram_length], sizeof(histogram) - histogram_length, " <%lluns:%llu", 1ull << (i + 1), (unsigned long long)count);
+	}
+
+	dtape_log_info("%-24s %-8s %s+0x%lx: %llu acquires, %llu contended, wait %llu ns total (%llu max), hold %llu ns total (%llu max);%s",
+		group_name,
+		profile->kind,
+		symbol,
+		(unsigned long)offset,
+		(unsigned long long)os_atomic_load(&profile->acquires, relaxed),
+		(unsigned long long)os_atomic_load(&profile->contended, relaxed),
+		(unsigned long long)os_atomic_load(&profile->wait_total, relaxed),
+		(unsigned long long)os_atomic_load(&profile->wait_max, relaxed),
+		(unsigned long long)os_atomic_load(&profile->hold_total, relaxed),
+		(unsigned long long)os_atomic_load(&profile->hold_max, relaxed),
+		histogram
+	);
+};
+
+void dtape_lock_profile_dump(void) {
+	static dtape_lock_profile_t* sorted[DTAPE_LOCK_PROFILE_MAX + 1];
+	size_t count = 0;
+
+	// profiles are never removed, so we only need the lock to get a consistent snapshot of which ones are in use
+	libsimple_lock_lock(&dtape_lock_profiles_lock);
+	for (size_t i = 0; i < DTAPE_LOCK_PROFILE_MAX; ++i) {
+		if (dtape_lock_profiles[i].kind != NULL) {
+			sorted[count++] = &dtape_lock_profiles[i];
+		}
+	}
+	libsimple_lock_unlock(&dtape_lock_profiles_lock);
+
+	sorted[count++] = &dtape_lock_profile_overflow;
+
+	qsort(sorted, count, sizeof(*sorted), dtape_lock_profile_compare_wait);
+
+	dtape_log_info("lock profile (%zu lock sites, sorted by total wait time):", count);
+	for (size_t i = 0; i < count; ++i) {
+		if (os_atomic_load(&sorted[i]->acquires, relaxed) == 0) {
+			continue;
+		}
+		dtape_lock_profile_log(sorted[i]);
+	}
+};
+
+#else
+
+void dtape_lock_profile_dump(void) {
+	dtape_log_info("lock profiling is not enabled in this build (build with DSERVER_LOCK_PROFILING)");
+};
+
+#endif // DSERVER_LOCK_PROFILING
+
+static void dtape_mutex_init_common(dtape_mutex_t* mutex, lck_grp_t* grp, const char* kind, void* site) {
 	mutex->dtape_owner = 0;
 	libsimple_lock_init(&mutex->dtape_queue_lock);
 	TAILQ_INIT(&mutex->dtape_queue_head);
+
+#if DSERVER_LOCK_PROFILING
+	mutex->dtape_profile = dtape_lock_profile_for(grp, kind, site);
+	mutex->dtape_acquired_at = 0;
+#endif
+};
+
+void dtape_mutex_init(dtape_mutex_t* mutex) {
+	dtape_mutex_init_common(mutex, LCK_GRP_NULL, "dtape", __builtin_return_address(0));
 };
 
 void dtape_mutex_assert(dtape_mutex_t* mutex, bool should_be_owned) {
-	bool owned = mutex->dtape_owner == (uintptr_t)current_thread();
+	thread_t thread = current_thread();
+	// native (non-microthread) holders all share a single owner value, so the best we can do for them is check that *some* native context owns it
+	uintptr_t expected_owner = thread ? (uintptr_t)thread : DTAPE_MUTEX_OWNER_NATIVE;
+	bool owned = (os_atomic_load(&mutex->dtape_owner, relaxed) & DTAPE_MUTEX_OWNER_MASK) == expected_owner;
 
 	if (should_be_owned && !owned) {
 		panic("Lock assertion failed (not owned but expected to be owned)");
@@ -51,119 +348,327 @@ void dtape_mutex_assert(dtape_mutex_t* mutex, bool should_be_owned) {
 	}
 };
 
-void dtape_mutex_lock(dtape_mutex_t* mutex) {
+/**
+ * Tries to acquire the mutex for the given owner, preserving the waiters bit.
+ * Returns `true` if the mutex was acquired.
+ */
+static bool dtape_mutex_try_acquire(dtape_mutex_t* mutex, uintptr_t new_owner) {
+	uintptr_t owner = os_atomic_load(&mutex->dtape_owner, relaxed);
+
+	while ((owner & DTAPE_MUTEX_OWNER_MASK) == 0) {
+		if (os_atomic_cmpxchgv(&mutex->dtape_owner, owner, new_owner | (owner & DTAPE_MUTEX_WAITERS), &owner, acquire)) {
+			return true;
+		}
+	}
+
+	return false;
+};
+
+static void dtape_worker_slot_release(void* context) {
+	int slot = (int)(uintptr_t)context - 1;
+
+	os_atomic_store(&dtape_worker_running[slot], 0, relaxed);
+	os_atomic_andnot(&dtape_worker_slots_used, 1ull << slot, release);
+};
+
+static int dtape_worker_slot_claim(void) {
+	uint64_t used = os_atomic_load(&dtape_worker_slots_used, relaxed);
+
+	while (~used != 0) {
+		int slot = __builtin_ctzll(~used);
+
+		if (os_atomic_cmpxchgv(&dtape_worker_slots_used, used, used | (1ull << slot), &used, acquire)) {
+			// the key stores `slot + 1` because the destructor isn't called for NULL values
+			pthread_setspecific(dtape_worker_slot_key, (const void*)(uintptr_t)(slot + 1));
+			return slot;
+		}
+	}
+
+	dtape_log_warning("More than %d workers; microthreads on this worker won't be spun on when they hold a mutex", DTAPE_WORKER_SLOT_COUNT);
+	return DTAPE_WORKER_SLOT_NONE;
+};
+
+void dtape_locks_init(void) {
+	if (pthread_key_create(&dtape_worker_slot_key, dtape_worker_slot_release) != 0) {
+		panic("Failed to create worker slot key");
+	}
+};
+
+void dtape_mutex_note_running(uintptr_t thread) {
+	if (dtape_worker_slot == -1) {
+		if (thread == 0) {
+			// no need to claim a slot just to say we're not running anything
+			return;
+		}
+		dtape_worker_slot = dtape_worker_slot_claim();
+	}
+
+	if (dtape_worker_slot != DTAPE_WORKER_SLOT_NONE) {
+		os_atomic_store(&dtape_worker_running[dtape_worker_slot], thread, relaxed);
+	}
+};
+
+static bool dtape_mutex_owner_is_running(uintptr_t owner) {
+	owner &= DTAPE_MUTEX_OWNER_MASK;
+
+	if (owner == DTAPE_MUTEX_OWNER_NATIVE) {
+		// native owners never have a worker slot, so we don't know whether they're running (see dtape_mutex_spin)
+		return false;
+	}
+
+	// NOTE: this is only a heuristic; the owner may stop running right after we look (or a new thread at the same address may start running),
+	//       but the worst case is a wasted (bounded) spin.
+	uint64_t used = os_atomic_load(&dtape_worker_slots_used, relaxed);
+
+	while (used != 0) {
+		int slot = __builtin_ctzll(used);
+		used &= used - 1;
+
+		if (os_atomic_load(&dtape_worker_running[slot], relaxed) == owner) {
+			return true;
+		}
+	}
+
+	return false;
+};
+
+static bool dtape_mutex_spin(dtape_mutex_t* mutex, uintptr_t new_owner) {
+	for (size_t i = 0; i < DTAPE_MUTEX_SPIN_LIMIT; ++i) {
+		uintptr_t owner = os_atomic_load(&mutex->dtape_owner, relaxed);
+
+		if ((owner & DTAPE_MUTEX_OWNER_MASK) == 0) {
+			if (dtape_mutex_try_acquire(mutex, new_owner)) {
+				return true;
+			}
+			continue;
+		}
+
+		if ((owner & DTAPE_MUTEX_OWNER_MASK) == DTAPE_MUTEX_OWNER_NATIVE) {
+			if (i >= DTAPE_MUTEX_NATIVE_SPIN_LIMIT) {
+				return false;
+			}
+		} else if (!dtape_mutex_owner_is_running(owner)) {
+			// the owner is suspended (or waiting to be scheduled); it won't be releasing the lock any time soon
+			return false;
+		}
+
+		dtape_cpu_relax();
+	}
+
+	return false;
+};
+
+/**
+ * Parks the calling (non-microthread) thread on a futex until an unlocker wakes it up.
+ *
+ * Must be called with the queue lock held; it is dropped before parking.
+ */
+static void dtape_mutex_park_locked(dtape_mutex_t* mutex) {
+	volatile uint32_t futex_word = 0;
+	dtape_mutex_link_t link = {
+		.native_futex = &futex_word,
+	};
+
+	TAILQ_INSERT_TAIL(&mutex->dtape_queue_head, &link, link);
+
+	os_atomic_inc(&dtape_mutex_stats.parks, relaxed);
+
+	libsimple_lock_unlock(&mutex->dtape_queue_lock);
+
+	while (os_atomic_load(&futex_word, acquire) == 0) {
+		dtape_futex_wait(&futex_word, 0);
+	}
+};
+
+/**
+ * Returns `true` if the lock was contended (i.e. we had to spin or wait for it).
+ */
+static bool dtape_mutex_lock_internal(dtape_mutex_t* mutex) {
 	thread_t xthread = current_thread();
 	dtape_thread_t* thread = dtape_thread_for_xnu_thread(xthread);
+	uintptr_t new_owner = (uintptr_t)xthread;
 
 	if (!thread) {
 		dtape_log_warning("Trying to lock mutex without an active thread!");
-		// if we don't have an active thread, we fall back to using the queue lock (which is a native lock).
-		// note that this means that any microthreads that want to lock the lock will sleep for real!
+		// if we don't have an active thread, we can't suspend a microthread to wait for the lock.
+		// instead, we park the entire thread on a futex (see dtape_mutex_park_locked()).
+		// note that this means that the whole worker sleeps for real!
 		// therefore, callers that try to do this must only lock the lock for short periods
-		while (true) {
-			// FIXME: we really should be using a condvar here; right now, we're just spinning until the owner drops the lock.
-			//        we'd need to implement condvars in libsimple first, though.
-			libsimple_lock_lock(&mutex->dtape_queue_lock);
-			if (mutex->dtape_owner == 0) {
-				return;
-			}
-			libsimple_lock_unlock(&mutex->dtape_queue_lock);
-			__builtin_ia32_pause();
-		}
+		new_owner = DTAPE_MUTEX_OWNER_NATIVE;
+	} else {
+		dtape_mutex_assert(mutex, false);
+	}
+
+	// fast path: uncontended
+	if (os_atomic_cmpxchg(&mutex->dtape_owner, 0, new_owner, acquire)) {
+		return false;
 	}
 
-	dtape_mutex_assert(mutex, false);
+	os_atomic_inc(&dtape_mutex_stats.contended, relaxed);
+
+	if (dtape_mutex_spin(mutex, new_owner)) {
+		os_atomic_inc(&dtape_mutex_stats.spin_acquired, relaxed);
+		return true;
+	}
 
 	while (true) {
 		libsimple_lock_lock(&mutex->dtape_queue_lock);
 
-		if (mutex->dtape_owner == 0 || mutex->dtape_owner == (uintptr_t)xthread) {
-			// lock successfully acquired
-			mutex->dtape_owner = (uintptr_t)xthread;
+		uintptr_t owner = os_atomic_load(&mutex->dtape_owner, relaxed);
+
+		if ((owner & DTAPE_MUTEX_OWNER_MASK) == 0) {
+			if (os_atomic_cmpxchg(&mutex->dtape_owner, owner, new_owner | (owner & DTAPE_MUTEX_WAITERS), acquire)) {
+				// lock successfully acquired
+				libsimple_lock_unlock(&mutex->dtape_queue_lock);
+				return true;
+			}
+
+			// someone changed the owner word in the meantime; try again
 			libsimple_lock_unlock(&mutex->dtape_queue_lock);
-			__atomic_thread_fence(__ATOMIC_ACQUIRE);
-			return;
+			continue;
+		}
+
+		// make sure the owner knows to wake us up when it unlocks.
+		// if the owner word changed (e.g. the owner unlocked it), we need to re-evaluate the state.
+		if (!(owner & DTAPE_MUTEX_WAITERS) && !os_atomic_cmpxchg(&mutex->dtape_owner, owner, owner | DTAPE_MUTEX_WAITERS, relaxed)) {
+			libsimple_lock_unlock(&mutex->dtape_queue_lock);
+			continue;
 		}
 
 		// lock not acquired; let's wait
+
+		if (!thread) {
+			// this call drops the lock
+			dtape_mutex_park_locked(mutex);
+			continue;
+		}
+
+		thread->mutex_link.native_futex = NULL;
 		TAILQ_INSERT_TAIL(&mutex->dtape_queue_head, &thread->mutex_link, link);
 
+		os_atomic_inc(&dtape_mutex_stats.sleeps, relaxed);
+
+		DSERVER_PROBE2(mutex__contended, mutex, owner & DTAPE_MUTEX_OWNER_MASK);
+
+		thread->block_info.reason = dtape_block_reason_mutex;
+		thread->block_info.hint = 0;
+		thread->block_info.site = (uintptr_t)mutex;
+
 		// this call drops the lock
 		dtape_hooks->thread_suspend(thread->context, NULL, NULL, &mutex->dtape_queue_lock);
 	}
 };
 
+void dtape_mutex_lock(dtape_mutex_t* mutex) {
+#if DSERVER_LOCK_PROFILING
+	uint64_t start = mach_absolute_time();
+	bool contended = dtape_mutex_lock_internal(mutex);
+	dtape_lock_profile_acquired(mutex, contended, contended ? (mach_absolute_time() - start) : 0);
+#else
+	dtape_mutex_lock_internal(mutex);
+#endif
+};
+
 bool dtape_mutex_try_lock(dtape_mutex_t* mutex) {
 	thread_t xthread = current_thread();
 	dtape_thread_t* thread = dtape_thread_for_xnu_thread(xthread);
 
+	uintptr_t new_owner = (uintptr_t)xthread;
+
 	if (!thread) {
 		dtape_log_warning("Trying to lock mutex without an active thread!");
-		// see lck_mtx_lock()
-		if (libsimple_lock_try_lock(&mutex->dtape_queue_lock)) {
-			if (mutex->dtape_owner == 0) {
-				return TRUE;
-			}
-			libsimple_lock_unlock(&mutex->dtape_queue_lock);
-		}
-		return FALSE;
+		// see dtape_mutex_lock()
+		new_owner = DTAPE_MUTEX_OWNER_NATIVE;
+	} else {
+		dtape_mutex_assert(mutex, false);
 	}
 
-	dtape_mutex_assert(mutex, false);
+	if (!dtape_mutex_try_acquire(mutex, new_owner)) {
+		return false;
+	}
+
+#if DSERVER_LOCK_PROFILING
+	dtape_lock_profile_acquired(mutex, false, 0);
+#endif
+
+	return true;
+};
+
+static void dtape_mutex_unlock_slow(dtape_mutex_t* mutex) {
+	libsimple_lock_lock(&mutex->dtape_queue_lock);
+
+	dtape_mutex_link_t* link = TAILQ_FIRST(&mutex->dtape_queue_head);
+
+	if (link) {
+		TAILQ_REMOVE(&mutex->dtape_queue_head, link, link);
+	}
 
-	if (mutex->dtape_owner == 0 || mutex->dtape_owner == (uintptr_t)xthread) {
-		// lock successfully acquired
-		mutex->dtape_owner = (uintptr_t)xthread;
-		libsimple_lock_unlock(&mutex->dtape_queue_lock);
-		__atomic_thread_fence(__ATOMIC_ACQUIRE);
-		return TRUE;
+	// no one else can modify the owner word while we own the lock and hold the queue lock
+	// (new waiters need the queue lock to set the waiters bit and everyone else needs the owner to be 0 to acquire it)
+	os_atomic_store(&mutex->dtape_owner, TAILQ_EMPTY(&mutex->dtape_queue_head) ? 0 : DTAPE_MUTEX_WAITERS, release);
+
+	if (link) {
+		// one or more waiters are waiting; wake the oldest waiter (the one at the head of queue).
+		// it still has to compete for the lock with anyone else trying to acquire it right now.
+		os_atomic_inc(&dtape_mutex_stats.wakeups, relaxed);
+
+		if (link->native_futex) {
+			// the waiter is a parked native thread.
+			// once we store to the futex word, the waiter is free to return and its link (on its stack) may disappear,
+			// so grab the address first. waking an address that's no longer in use is harmless.
+			volatile uint32_t* futex_word = link->native_futex;
+			os_atomic_store(futex_word, 1, release);
+			dtape_futex_wake_one(futex_word);
+		} else {
+			dtape_thread_t* thread = __container_of(link, dtape_thread_t, mutex_link);
+			dtape_hooks->thread_resume(thread->context);
+		}
 	}
 
-	// lock not acquired
-	return FALSE;
+	libsimple_lock_unlock(&mutex->dtape_queue_lock);
 };
 
 void dtape_mutex_unlock(dtape_mutex_t* mutex) {
 	thread_t xcurr_thread = current_thread();
 	dtape_thread_t* curr_thread = dtape_thread_for_xnu_thread(xcurr_thread);
+	uintptr_t owner = (uintptr_t)xcurr_thread;
 
 	if (!curr_thread) {
 		dtape_log_warning("Trying to unlock mutex without an active thread!");
-		// see lck_mtx_lock()
-		return libsimple_lock_unlock(&mutex->dtape_queue_lock);
+		// see dtape_mutex_lock()
+		owner = DTAPE_MUTEX_OWNER_NATIVE;
+	} else {
+		dtape_mutex_assert(mutex, true);
 	}
 
-	dtape_mutex_assert(mutex, true);
-
-	libsimple_lock_lock(&mutex->dtape_queue_lock);
-	mutex->dtape_owner = 0;
-
-	dtape_mutex_link_t* link = TAILQ_FIRST(&mutex->dtape_queue_head);
+#if DSERVER_LOCK_PROFILING
+	dtape_lock_profile_releasing(mutex);
+#endif
 
-	if (!link) {
-		// uncontended case
-		// no one is waiting for the lock, so we don't need to wake anyone up.
-		goto out;
+	// fast path: no waiters
+	if (os_atomic_cmpxchg(&mutex->dtape_owner, owner, 0, release)) {
+		return;
 	}
 
-	// contended case
-	// one or more microthreads are waiting; wake the oldest waiter (the one at the head of queue).
-	TAILQ_REMOVE(&mutex->dtape_queue_head, link, link);
-	dtape_thread_t* thread = __container_of(link, dtape_thread_t, mutex_link);
-	dtape_hooks->thread_resume(thread->context);
+	dtape_mutex_unlock_slow(mutex);
+};
 
-out:
-	libsimple_lock_unlock(&mutex->dtape_queue_lock);
-	__atomic_thread_fence(__ATOMIC_RELEASE);
-	return;
+void dtape_log_lock_stats(void) {
+	dtape_log_info("mutexes: %llu contended acquisition(s), %llu acquired by spinning, %llu sleep(s), %llu native park(s), %llu wakeup(s)",
+		(unsigned long long)os_atomic_load(&dtape_mutex_stats.contended, relaxed),
+		(unsigned long long)os_atomic_load(&dtape_mutex_stats.spin_acquired, relaxed),
+		(unsigned long long)os_atomic_load(&dtape_mutex_stats.sleeps, relaxed),
+		(unsigned long long)os_atomic_load(&dtape_mutex_stats.parks, relaxed),
+		(unsigned long long)os_atomic_load(&dtape_mutex_stats.wakeups, relaxed)
+	);
 };
 
 void lck_mtx_init(lck_mtx_t* lock, lck_grp_t* grp, lck_attr_t* attr) {
-	dtape_mutex_init(&lock->dtape_mutex);
+	dtape_mutex_init_common(&lock->dtape_mutex, grp, "mtx", __builtin_return_address(0));
 };
 
 void lck_mtx_destroy(lck_mtx_t* lock, lck_grp_t* grp) {
-	if (lock->dtape_mutex.dtape_owner != 0) {
+	if ((lock->dtape_mutex.dtape_owner & DTAPE_MUTEX_OWNER_MASK) != 0) {
 		panic("Attempt to destroy lock while being held");
 	}
 };
@@ -193,7 +698,7 @@ void lck_mtx_unlock(lck_mtx_t* lock) {
 };
 
 void lck_mtx_init_ext(lck_mtx_t* lck, struct _lck_mtx_ext_* lck_ext, lck_grp_t* grp, lck_attr_t* attr) {
-	lck_mtx_init(lck, grp, attr);
+	dtape_mutex_init_common(&lck->dtape_mutex, grp, "mtx", __builtin_return_address(0));
 };
 
 lck_mtx_t* lck_mtx_alloc_init(lck_grp_t* grp, lck_attr_t* attr) {
@@ -201,7 +706,7 @@ lck_mtx_t* lck_mtx_alloc_init(lck_grp_t* grp, lck_attr_t* attr) {
 	if (!lck) {
 		return NULL;
 	}
-	lck_mtx_init(lck, grp, attr);
+	dtape_mutex_init_common(&lck->dtape_mutex, grp, "mtx", __builtin_return_address(0));
 	return lck;
 }
 
@@ -219,7 +724,7 @@ void lck_mtx_free(lck_mtx_t* lck, lck_grp_t* grp) {
 //
 
 void lck_spin_init(lck_spin_t* lock, lck_grp_t* grp, lck_attr_t* attr) {
-	lck_mtx_init(&lock->dtape_interlock, grp, attr);
+	dtape_mutex_init_common(&lock->dtape_interlock.dtape_mutex, grp, "spin", __builtin_return_address(0));
 };
 
 void lck_spin_assert(lck_spin_t* lock, unsigned int type) {
@@ -255,7 +760,7 @@ boolean_t lck_spin_try_lock_grp(lck_spin_t* lock, lck_grp_t* grp) {
 //
 
 void waitq_lock_init(struct waitq* wq) {
-	usimple_lock_init(&wq->dtape_waitq_interlock, 0);
+	dtape_mutex_init_common(&wq->dtape_waitq_interlock.dtape_interlock.dtape_interlock.dtape_mutex, LCK_GRP_NULL, "waitq", __builtin_return_address(0));
 };
 
 void waitq_lock(struct waitq *wq) {
@@ -278,7 +783,7 @@ void (usimple_lock)(usimple_lock_t lock) {
 };
 
 void usimple_lock_init(usimple_lock_t lock, unsigned short tag) {
-	lck_spin_init(&lock->dtape_interlock, LCK_GRP_NULL, LCK_ATTR_NULL);
+	dtape_mutex_init_common(&lock->dtape_interlock.dtape_interlock.dtape_mutex, LCK_GRP_NULL, "usimple", __builtin_return_address(0));
 };
 
 void usimple_unlock(usimple_lock_t lock) {
@@ -294,7 +799,7 @@ unsigned int usimple_lock_try(usimple_lock_t lock, lck_grp_t* grp) {
 //
 
 void lck_ticket_init(lck_ticket_t* tlock, lck_grp_t* grp) {
-	lck_spin_init(&tlock->dtape_lock, LCK_GRP_NULL, LCK_ATTR_NULL);
+	dtape_mutex_init_common(&tlock->dtape_lock.dtape_interlock.dtape_mutex, grp, "ticket", __builtin_return_address(0));
 };
 
 void (lck_ticket_lock)(lck_ticket_t* tlock) {
@@ -13,11 +13,102 @@
 
 #include <mach_debug/mach_debug.h>
 
+#define DTAPE_ZONE_MAX 128
+#define DTAPE_ZONE_MAGAZINE_SIZE 16
+#define DTAPE_ZONE_SLAB_SIZE (16 * 1024)
+#define DTAPE_ZONE_SLAB_MIN_ELEMENTS 8
+
+typedef struct dtape_zone_element {
+	struct dtape_zone_element* next;
+} dtape_zone_element_t;
+
+typedef struct dtape_zone_slab {
+	struct dtape_zone_slab* next;
+	uintptr_t elements_start;
+	uintptr_t elements_end;
+} dtape_zone_slab_t;
+
+#define DTAPE_ZONE_SLAB_HEADER_SIZE ((sizeof(dtape_zone_slab_t) + 15) & ~(size_t)15)
+
 struct zone {
 	const char* name;
 	vm_size_t size;
+	vm_size_t slot_size;
+	vm_size_t slab_size;
+	zone_id_t id;
+	zone_create_flags_t flags;
+	boolean_t use_magazines;
+	boolean_t exhaustible;
+
+	// 0 means the zone can grow without bound
+	vm_size_t max_elements;
+
+	// the depot is the shared free list that magazines are refilled from and flushed into
+	libsimple_lock_t depot_lock;
+	dtape_zone_element_t* depot;
+	dtape_zone_slab_t* slabs;
+	uint64_t depot_count;
+	uint64_t element_count;
+	uint64_t slab_count;
+
+	// these are updated atomically (outside the depot lock)
+	uint64_t live_count;
+	uint64_t peak_count;
+	uint64_t alloc_count;
+};
+
+// kalloc allocations are prefixed with a header so that we can find the right zone to free them to
+// (`kheap_free_addr` doesn't give us a size and even `kfree` sizes can't always be trusted)
+typedef struct dtape_kalloc_header {
+	uint32_t size_class;
+	uint32_t magic;
+	vm_size_t size;
+} dtape_kalloc_header_t;
+
+#define DTAPE_KALLOC_MAGIC 0x6b616c63
+#define DTAPE_KALLOC_CLASS_LARGE UINT32_MAX
+#define DTAPE_KALLOC_GRANULE 16
+#define DTAPE_KALLOC_MAX_SIZE (32 * 1024)
+
+// these are total element sizes (including the header); they grow roughly geometrically (by ~1.25x) like XNU's kalloc zones
+static const uint32_t dtape_kalloc_class_sizes[] = {
+	32, 48, 64, 80, 96, 128, 160, 192, 256, 320,
+	384, 512, 640, 768, 1024, 1280, 1536, 2048, 2560, 3072,
+	4096, 5120, 6144, 8192, 10240, 12288, 16384, 20480, 24576, DTAPE_KALLOC_MAX_SIZE,
 };
 
+static zone_t dtape_kalloc_zones[sizeof(dtape_kalloc_class_sizes) / sizeof(*dtape_kalloc_class_sizes)];
+static char dtape_kalloc_zone_names[sizeof(dtape_kalloc_class_sizes) / sizeof(*dtape_kalloc_class_sizes)][16];
+
+// maps (total_size - 1) / DTAPE_KALLOC_GRANULE to an index into dtape_kalloc_class_sizes
+static uint8_t dtape_kalloc_class_lookup[DTAPE_KALLOC_MAX_SIZE / DTAPE_KALLOC_GRANULE];
+
+static uint64_t dtape_kalloc_large_count = 0;
+static uint64_t dtape_kalloc_large_live_count = 0;
+
+typedef struct dtape_zone_magazine {
+	zone_t zone;
+	uint32_t count;
+	void* elements[DTAPE_ZONE_MAGAZINE_SIZE];
+} dtape_zone_magazine_t;
+
+typedef unsigned int dtape_pthread_key_t;
+
+int pthread_key_create(dtape_pthread_key_t* key, void (*destructor)(void*));
+int pthread_setspecific(dtape_pthread_key_t key, const void* value);
+
+int snprintf(char* str, size_t size, const char* format, ...);
+
+static libsimple_lock_t dtape_zones_lock;
+static zone_t dtape_zones[DTAPE_ZONE_MAX];
+static zone_id_t dtape_zone_next_dynamic_id = ZONE_ID__FIRST_DYNAMIC;
+
+// each worker thread gets its own set of magazines (indexed by zone ID) so that
+// the common alloc/free cases don't need to touch any shared state
+static __thread dtape_zone_magazine_t dtape_zone_magazines[DTAPE_ZONE_MAX];
+static __thread boolean_t dtape_zone_magazines_registered = FALSE;
+static dtape_pthread_key_t dtape_zone_magazines_key;
+
 // stub
 struct kalloc_heap KHEAP_DEFAULT[1];
 // stub
@@ -52,8 +143,17 @@ int ftruncate(int fd, off_t length);
 
 #define MFD_CLOEXEC 0x1
 
+static void dtape_zone_magazines_flush(void* context);
+static void dtape_kalloc_init(void);
+
 void dtape_memory_init(void) {
+	libsimple_lock_init(&dtape_zones_lock);
+
+	if (pthread_key_create(&dtape_zone_magazines_key, dtape_zone_magazines_flush) != 0) {
+		panic("Failed to create zone magazine key");
+	}
 
+	dtape_kalloc_init();
 };
 
 static uint64_t dtape_byte_count_to_page_count_round_up(uint64_t byte_count) {
@@ -74,8 +174,8 @@ static int dtape_map_shared_entry_compare(dtape_map_shared_entry_t* first, dtape
 	}
 };
 
-RB_PROTOTYPE_SC(static, dtape_map_shared_entry_head, dtape_map_shared_entry, link, dtape_map_shared_entry_compare);
-RB_GENERATE(dtape_map_shared_entry_head, dtape_map_shared_entry, link, dtape_map_shared_entry_compare);
+RB_PROTOTYPE_SC_PREV(static, dtape_map_shared_entry_head, dtape_map_shared_entry, link, dtape_map_shared_entry_compare);
+RB_GENERATE_PREV(dtape_map_shared_entry_head, dtape_map_shared_entry, link, dtape_map_shared_entry_compare);
 
 vm_map_t dtape_vm_map_create(struct dtape_task* task) {
 	vm_map_t map = malloc(sizeof(struct _vm_map));
@@ -96,7 +196,7 @@ vm_map_t dtape_vm_map_create(struct dtape_task* task) {
 	return map;
 };
 
-static dtape_map_shared_descriptor_t* dtape_map_shared_descriptor_create(int memfd, uint64_t size) {
+dtape_map_shared_descriptor_t* dtape_map_shared_descriptor_create(int memfd, uint64_t size) {
 	dtape_map_shared_descriptor_t* desc = malloc(sizeof(dtape_map_shared_descriptor_t));
 	if (!desc) {
 		return NULL;
@@ -114,7 +214,7 @@ static void dtape_map_shared_descriptor_retain(dtape_map_shared_descriptor_t* de
 	os_ref_retain(&desc->refcount);
 };
 
-static void dtape_map_shared_descriptor_release(dtape_map_shared_descriptor_t* desc) {
+void dtape_map_shared_descriptor_release(dtape_map_shared_descriptor_t* desc) {
 	if (os_ref_release(&desc->refcount) != 0) {
 		return;
 	}
@@ -123,7 +223,7 @@ static void dtape_map_shared_descriptor_release(dtape_map_shared_descriptor_t* d
 	free(desc);
 };
 
-static dtape_map_shared_entry_t* dtape_map_shared_entry_create(uint64_t address, uint64_t size, uint64_t page_offset, dtape_map_shared_descriptor_t* descriptor) {
+dtape_map_shared_entry_t* dtape_map_shared_entry_create(uint64_t address, uint64_t size, uint64_t page_offset, dtape_map_shared_descriptor_t* descriptor) {
 	dtape_map_shared_entry_t* shared_entry = malloc(sizeof(dtape_map_shared_entry_t));
 	if (!shared_entry) {
 		return NULL;
@@ -144,14 +244,26 @@ static void dtape_map_shared_entry_destroy(dtape_map_shared_entry_t* shared_entr
 	free(shared_entry);
 };
 
-static void dtape_map_insert_shared_entry_locked(dtape_map_t* map, dtape_map_shared_entry_t* shared_entry) {
-	RB_INSERT(dtape_map_shared_entry_head, &map->shared_entries, shared_entry);
-};
+/**
+ * Returns the first entry (in address order) that overlaps the given region, or `NULL` if there is none.
+ *
+ * Entries in a map never overlap each other (see dtape_map_insert_shared_entry_locked), so only the entry immediately
+ * preceding `address` can extend into the region; this lets us find the first entry with a single descent.
+ */
+static dtape_map_shared_entry_t* dtape_map_first_overlapping_shared_entry_locked(dtape_map_t* map, uint64_t address, uint64_t size) {
+	dtape_map_shared_entry_t key = { .address = address };
+	dtape_map_shared_entry_t* entry = RB_NFIND(dtape_map_shared_entry_head, &map->shared_entries, &key);
+	dtape_map_shared_entry_t* prev = entry ? RB_PREV(dtape_map_shared_entry_head, &map->shared_entries, entry) : RB_MAX(dtape_map_shared_entry_head, &map->shared_entries);
 
-static void dtape_map_insert_shared_entry(dtape_map_t* map, dtape_map_shared_entry_t* shared_entry) {
-	dtape_mutex_lock(&map->shared_entry_lock);
-	dtape_map_insert_shared_entry_locked(map, shared_entry);
-	dtape_mutex_unlock(&map->shared_entry_lock);
+	if (prev && prev->address + prev->size > address) {
+		return prev;
+	}
+
+	if (entry && entry->address < address + size) {
+		return entry;
+	}
+
+	return NULL;
 };
 
 /**
@@ -160,7 +272,7 @@ static void dtape_map_insert_shared_entry(dtape_map_t* map, dtape_map_shared_ent
  * within the target region, there may be additional entries intersecting the region. You can call this function again with
  * the address just after the last entry to continue searching.
  */
-static size_t dtape_map_find_shared_entries_locked(dtape_map_t* map, uint64_t address, uint64_t size, dtape_map_shared_entry_t** out_entries, size_t entry_count) {
+size_t dtape_map_find_shared_entries_locked(dtape_map_t* map, uint64_t address, uint64_t size, dtape_map_shared_entry_t** out_entries, size_t entry_count) {
 	dtape_map_shared_entry_t* entry;
 	size_t count = 0;
 
@@ -168,11 +280,11 @@ static size_t dtape_map_find_shared_entries_locked(dtape_map_t* map, uint64_t ad
 		return count;
 	}
 
-	RB_FOREACH(entry, dtape_map_shared_entry_head, &map->shared_entries) {
-		if (entry->address + entry->size < address || entry->address > address + size) {
-			continue;
-		}
-
+	for (
+		entry = dtape_map_first_overlapping_shared_entry_locked(map, address, size);
+		entry != NULL && entry->address < address + size;
+		entry = RB_NEXT(dtape_map_shared_entry_head, &map->shared_entries, entry)
+	) {
 		out_entries[count++] = entry;
 
 		if (count == entry_count) {
@@ -183,8 +295,78 @@ static size_t dtape_map_find_shared_entries_locked(dtape_map_t* map, uint64_t ad
 	return count;
 };
 
+/**
+ * Removes the given region from all the shared entries that overlap it.
+ * Entries that lie entirely within the region are removed (and released), entries that partially overlap it are trimmed,
+ * and an entry that contains the entire region is split in two.
+ *
+ * Once the last entry referencing a memfd is gone, the memfd is closed.
+ */
+static void dtape_map_remove_shared_entries_locked(dtape_map_t* map, uint64_t address, uint64_t size) {
+	dtape_map_shared_entry_t* entry = dtape_map_first_overlapping_shared_entry_locked(map, address, size);
+	dtape_map_shared_entry_t* next;
+	uint64_t end = address + size;
+	uint64_t page_size = sysconf(_SC_PAGESIZE);
+
+	for (; entry != NULL && entry->address < end; entry = next) {
+		uint64_t entry_end = entry->address + entry->size;
+
+		next = RB_NEXT(dtape_map_shared_entry_head, &map->shared_entries, entry);
+
+		if (address <= entry->address && end >= entry_end) {
+			// the entry is entirely within the region
+			RB_REMOVE(dtape_map_shared_entry_head, &map->shared_entries, entry);
+			dtape_map_shared_entry_destroy(entry);
+		} else if (address <= entry->address) {
+			// the region covers the start of the entry.
+			// moving the start of the entry forward doesn't change its position relative to the other entries,
+			// so we can update it in-place.
+			entry->page_offset += (end - entry->address) / page_size;
+			entry->size = entry_end - end;
+			entry->address = end;
+		} else if (end >= entry_end) {
+			// the region covers the end of the entry
+			entry->size = address - entry->address;
+		} else {
+			// the region is in the middle of the entry; split it
+			dtape_map_shared_entry_t* tail = dtape_map_shared_entry_create(end, entry_end - end, entry->page_offset + ((end - entry->address) / page_size), entry->descriptor);
+
+			entry->size = address - entry->address;
+
+			if (tail) {
+				RB_INSERT(dtape_map_shared_entry_head, &map->shared_entries, tail);
+			} else {
+				dtape_log_error("failed to allocate shared entry for split; the memfd will be released early");
+			}
+
+			// nothing after this entry can overlap the region
+			break;
+		}
+	}
+};
+
+void dtape_map_remove_shared_entries(dtape_map_t* map, uint64_t address, uint64_t size) {
+	dtape_mutex_lock(&map->shared_entry_lock);
+	dtape_map_remove_shared_entries_locked(map, address, size);
+	dtape_mutex_unlock(&map->shared_entry_lock);
+};
+
+static void dtape_map_insert_shared_entry_locked(dtape_map_t* map, dtape_map_shared_entry_t* shared_entry) {
+	// a new mapping replaces whatever was previously mapped at the same addresses;
+	// this also keeps entries from overlapping, which lookups depend on
+	dtape_map_remove_shared_entries_locked(map, shared_entry->address, shared_entry->size);
+	RB_INSERT(dtape_map_shared_entry_head, &map->shared_entries, shared_entry);
+};
+
+void dtape_map_insert_shared_entry(dtape_map_t* map, dtape_map_shared_entry_t* shared_entry) {
+	dtape_mutex_lock(&map->shared_entry_lock);
+	dtape_map_insert_shared_entry_locked(map, shared_entry);
+	dtape_mutex_unlock(&map->shared_entry_lock);
+};
+
 // TODO: we should have the process inform us when it unmaps a shared entry that we remapped;
-//       right now, we only close the memfd when the process dies (so the memory is potentially in-use needlessly).
+//       right now, we only find out when the region is deallocated through Mach (vm_map_remove), when something else gets mapped
+//       over it through us, or when the process dies (so memory that the process munmaps on its own is potentially in-use needlessly).
 
 void dtape_vm_map_destroy(vm_map_t map) {
 	if (os_ref_release(&map->map_refcnt) != 0) {
@@ -212,57 +394,377 @@ void vm_map_deallocate(vm_map_t map) {
 	os_ref_release_live(&map->map_refcnt);
 };
 
-// TODO: zone-based allocations could be optimized to not just use malloc
+static void dtape_zone_depot_push_locked(zone_t zone, void* elem) {
+	dtape_zone_element_t* element = elem;
+	element->next = zone->depot;
+	zone->depot = element;
+	++zone->depot_count;
+};
 
-zone_t zone_create(const char* name, vm_size_t size, zone_create_flags_t flags) {
+static boolean_t dtape_zone_grow_locked(zone_t zone) {
+	vm_size_t element_count = (zone->slab_size - DTAPE_ZONE_SLAB_HEADER_SIZE) / zone->slot_size;
+
+	if (zone->max_elements != 0) {
+		if (zone->element_count >= zone->max_elements) {
+			return FALSE;
+		}
+		if (element_count > zone->max_elements - zone->element_count) {
+			element_count = zone->max_elements - zone->element_count;
+		}
+	}
+
+	dtape_zone_slab_t* slab = malloc(zone->slab_size);
+	if (!slab) {
+		return FALSE;
+	}
+
+	// `malloc` returns 16-byte-aligned memory and slots are a multiple of 16 bytes, so every element is 16-byte-aligned as well
+	slab->elements_start = (uintptr_t)slab + DTAPE_ZONE_SLAB_HEADER_SIZE;
+	slab->elements_end = slab->elements_start + (element_count * zone->slot_size);
+	slab->next = zone->slabs;
+	zone->slabs = slab;
+
+	// push them in reverse so that allocations walk the slab in address order
+	for (vm_size_t i = element_count; i > 0; --i) {
+		dtape_zone_depot_push_locked(zone, (void*)(slab->elements_start + ((i - 1) * zone->slot_size)));
+	}
+
+	zone->element_count += element_count;
+	++zone->slab_count;
+	return TRUE;
+};
+
+static void* dtape_zone_depot_pop_locked(zone_t zone) {
+	if (!zone->depot && !dtape_zone_grow_locked(zone)) {
+		return NULL;
+	}
+
+	dtape_zone_element_t* element = zone->depot;
+	zone->depot = element->next;
+	--zone->depot_count;
+	return element;
+};
+
+static boolean_t dtape_zone_owns_locked(zone_t zone, void* addr) {
+	uintptr_t address = (uintptr_t)addr;
+
+	for (dtape_zone_slab_t* slab = zone->slabs; slab != NULL; slab = slab->next) {
+		if (address >= slab->elements_start && address < slab->elements_end) {
+			return ((address - slab->elements_start) % zone->slot_size) == 0;
+		}
+	}
+
+	return FALSE;
+};
+
+static boolean_t dtape_zone_owns(zone_t zone, void* addr) {
+	libsimple_lock_lock(&zone->depot_lock);
+	boolean_t result = dtape_zone_owns_locked(zone, addr);
+	libsimple_lock_unlock(&zone->depot_lock);
+	return result;
+};
+
+static dtape_zone_magazine_t* dtape_zone_magazine_for(zone_t zone) {
+	dtape_zone_magazine_t* magazine = &dtape_zone_magazines[zone->id];
+
+	if (!dtape_zone_magazines_registered) {
+		// the value doesn't matter; it just has to be non-null for the destructor to run when the thread exits
+		pthread_setspecific(dtape_zone_magazines_key, dtape_zone_magazines);
+		dtape_zone_magazines_registered = TRUE;
+	}
+
+	magazine->zone = zone;
+	return magazine;
+};
+
+static void dtape_zone_magazine_refill(zone_t zone, dtape_zone_magazine_t* magazine) {
+	libsimple_lock_lock(&zone->depot_lock);
+	while (magazine->count < DTAPE_ZONE_MAGAZINE_SIZE / 2) {
+		void* element = dtape_zone_depot_pop_locked(zone);
+		if (!element) {
+			break;
+		}
+		magazine->elements[magazine->count++] = element;
+	}
+	libsimple_lock_unlock(&zone->depot_lock);
+};
+
+static void dtape_zone_magazine_drain(zone_t zone, dtape_zone_magazine_t* magazine, uint32_t keep) {
+	libsimple_lock_lock(&zone->depot_lock);
+	while (magazine->count > keep) {
+		dtape_zone_depot_push_locked(zone, magazine->elements[--magazine->count]);
+	}
+	libsimple_lock_unlock(&zone->depot_lock);
+};
+
+static void dtape_zone_magazines_flush(void* context) {
+	// called when a worker thread exits; give everything it had cached back to the depots
+	for (size_t i = 0; i < DTAPE_ZONE_MAX; ++i) {
+		dtape_zone_magazine_t* magazine = &dtape_zone_magazines[i];
+		if (magazine->zone && magazine->count > 0) {
+			dtape_zone_magazine_drain(magazine->zone, magazine, 0);
+		}
+	}
+};
+
+static void dtape_zone_register(zone_t zone, zone_id_t desired_zid) {
+	zone->id = ZONE_ID_ANY;
+
+	libsimple_lock_lock(&dtape_zones_lock);
+
+	if (desired_zid != ZONE_ID_ANY) {
+		if (desired_zid >= ZONE_ID__FIRST_DYNAMIC || dtape_zones[desired_zid] != NULL) {
+			panic("Zone ID %u requested for zone \"%s\" is invalid or already in use", desired_zid, zone->name);
+		}
+		zone->id = desired_zid;
+	} else if (dtape_zone_next_dynamic_id < DTAPE_ZONE_MAX) {
+		// IDs are never reused; this means magazines never have to worry about a zone changing underneath them
+		zone->id = dtape_zone_next_dynamic_id++;
+	}
+
+	if (zone->id != ZONE_ID_ANY) {
+		dtape_zones[zone->id] = zone;
+	}
+
+	libsimple_lock_unlock(&dtape_zones_lock);
+
+	if (zone->id == ZONE_ID_ANY) {
+		dtape_log_warning("Out of zone IDs; zone \"%s\" will not be cached or reported", zone->name);
+	}
+};
+
+zone_t zone_create_ext(const char* name, vm_size_t size, zone_create_flags_t flags, zone_id_t desired_zid, void (^extra_setup)(zone_t)) {
 	zone_t zone = malloc(sizeof(struct zone));
 	if (!zone) {
 		return ZONE_NULL;
 	}
+
+	memset(zone, 0, sizeof(*zone));
+
 	zone->name = name;
 	zone->size = size;
+	zone->flags = flags;
+	zone->slot_size = (size < sizeof(dtape_zone_element_t)) ? sizeof(dtape_zone_element_t) : size;
+	zone->slot_size = (zone->slot_size + 15) & ~(vm_size_t)15;
+	zone->slab_size = DTAPE_ZONE_SLAB_SIZE;
+	if (zone->slab_size < DTAPE_ZONE_SLAB_HEADER_SIZE + (zone->slot_size * DTAPE_ZONE_SLAB_MIN_ELEMENTS)) {
+		zone->slab_size = DTAPE_ZONE_SLAB_HEADER_SIZE + (zone->slot_size * DTAPE_ZONE_SLAB_MIN_ELEMENTS);
+	}
+	libsimple_lock_init(&zone->depot_lock);
+
+	dtape_zone_register(zone, desired_zid);
+
+	// destructible zones can go away while other threads still have elements from them cached,
+	// so only permanent zones get magazines.
+	// like XNU, zones that don't ask for caching still get it unless they explicitly opt out.
+	zone->use_magazines = zone->id != ZONE_ID_ANY && !(flags & (ZC_NOCACHING | ZC_DESTRUCTIBLE));
+
+	if (extra_setup) {
+		extra_setup(zone);
+	}
+
 	return zone;
 };
 
-void zdestroy(zone_t zone) {
-	free(zone);
+zone_t zone_create(const char* name, vm_size_t size, zone_create_flags_t flags) {
+	return zone_create_ext(name, size, flags, ZONE_ID_ANY, NULL);
 };
 
-void* zalloc(zone_or_view_t zone_or_view) {
-	return malloc(zone_or_view.zov_zone->size);
+void zone_set_exhaustible(zone_t zone, vm_size_t max_elements) {
+	zone->max_elements = max_elements;
+	zone->exhaustible = TRUE;
+};
+
+void zone_set_noexpand(zone_t zone, vm_size_t max_elements) {
+	zone->max_elements = max_elements;
+	zone->exhaustible = FALSE;
+};
+
+void zdestroy(zone_t zone) {
+	if (zone->use_magazines) {
+		panic("Zone \"%s\" is not destructible", zone->name);
+	}
+
+	if (zone->id != ZONE_ID_ANY) {
+		libsimple_lock_lock(&dtape_zones_lock);
+		dtape_zones[zone->id] = NULL;
+		libsimple_lock_unlock(&dtape_zones_lock);
+	}
+
+	uint64_t live_count = os_atomic_load(&zone->live_count, relaxed);
+	if (live_count != 0) {
+		dtape_log_warning("Destroying zone \"%s\" with %llu live element(s)", zone->name, (unsigned long long)live_count);
+	}
+
+	while (zone->slabs) {
+		dtape_zone_slab_t* slab = zone->slabs;
+		zone->slabs = slab->next;
+		free(slab);
+	}
+
+	free(zone);
 };
 
 void* zalloc_flags(zone_or_view_t zone_or_view, zalloc_flags_t flags) {
-	void* ptr = zalloc(zone_or_view);
+	zone_t zone = zone_or_view.zov_zone;
+	void* ptr = NULL;
+
+	if (zone->use_magazines) {
+		dtape_zone_magazine_t* magazine = dtape_zone_magazine_for(zone);
+		if (magazine->count == 0) {
+			dtape_zone_magazine_refill(zone, magazine);
+		}
+		if (magazine->count > 0) {
+			ptr = magazine->elements[--magazine->count];
+		}
+	} else {
+		libsimple_lock_lock(&zone->depot_lock);
+		ptr = dtape_zone_depot_pop_locked(zone);
+		libsimple_lock_unlock(&zone->depot_lock);
+	}
+
 	if (!ptr) {
+		if ((flags & Z_NOFAIL) || (zone->max_elements != 0 && !zone->exhaustible)) {
+			panic("Zone \"%s\" exhausted (%llu elements)", zone->name, (unsigned long long)zone->element_count);
+		}
 		return ptr;
 	}
 
+	uint64_t live_count = os_atomic_inc(&zone->live_count, relaxed);
+	os_atomic_max(&zone->peak_count, live_count, relaxed);
+	os_atomic_inc(&zone->alloc_count, relaxed);
+
 	if (flags & Z_ZERO) {
-		memset(ptr, 0, zone_or_view.zov_zone->size);
+		memset(ptr, 0, zone->size);
 	}
 
 	return ptr;
 };
 
+void* zalloc(zone_or_view_t zone_or_view) {
+	return zalloc_flags(zone_or_view, Z_WAITOK);
+};
+
 void (zfree)(zone_or_view_t zone_or_view, void* elem) {
-	free(elem);
+	zone_t zone = zone_or_view.zov_zone;
+
+	if (!elem) {
+		return;
+	}
+
+#if DSERVER_EXTENDED_DEBUG
+	if (!dtape_zone_owns(zone, elem)) {
+		panic("Element %p freed to zone \"%s\" does not belong to it", elem, zone->name);
+	}
+#endif
+
+	if (zone->flags & ZC_ZFREE_CLEARMEM) {
+		memset(elem, 0, zone->size);
+	}
+
+	os_atomic_dec(&zone->live_count, relaxed);
+
+	if (zone->use_magazines) {
+		dtape_zone_magazine_t* magazine = dtape_zone_magazine_for(zone);
+		if (magazine->count == DTAPE_ZONE_MAGAZINE_SIZE) {
+			dtape_zone_magazine_drain(zone, magazine, DTAPE_ZONE_MAGAZINE_SIZE / 2);
+		}
+		magazine->elements[magazine->count++] = elem;
+	} else {
+		libsimple_lock_lock(&zone->depot_lock);
+		dtape_zone_depot_push_locked(zone, elem);
+		libsimple_lock_unlock(&zone->depot_lock);
+	}
 };
 
 void zone_id_require(zone_id_t zone_id, vm_size_t elem_size, void* addr) {
-	dtape_stub_safe();
+#if DSERVER_EXTENDED_DEBUG
+	zone_t zone = NULL;
+
+	if (zone_id < DTAPE_ZONE_MAX) {
+		libsimple_lock_lock(&dtape_zones_lock);
+		zone = dtape_zones[zone_id];
+		libsimple_lock_unlock(&dtape_zones_lock);
+	}
+
+	if (!zone) {
+		// we don't create every zone that XNU reserves an ID for
+		return;
+	}
+
+	if (zone->size != elem_size || !dtape_zone_owns(zone, addr)) {
+		panic("zone_id_require failed: address %p is not an element of zone \"%s\"", addr, zone->name);
+	}
+#endif
 };
 
 void zone_require(zone_t zone, void* addr) {
-	dtape_stub_safe();
+#if DSERVER_EXTENDED_DEBUG
+	if (!dtape_zone_owns(zone, addr)) {
+		panic("zone_require failed: address %p is not an element of zone \"%s\"", addr, zone->name);
+	}
+#endif
 };
 
 zone_t zinit(vm_size_t size, vm_size_t max, vm_size_t alloc, const char* name) {
-	return zone_create(name, size, 0);
+	zone_t zone = zone_create(name, size, ZC_DESTRUCTIBLE);
+	if (zone) {
+		// like XNU, the maximum is a hard cap (exceeding it is fatal)
+		zone_set_noexpand(zone, max / size);
+	}
+	return zone;
+};
+
+static void dtape_kalloc_init(void) {
+	for (size_t i = 0; i < sizeof(dtape_kalloc_class_sizes) / sizeof(*dtape_kalloc_class_sizes); ++i) {
+		snprintf(dtape_kalloc_zone_names[i], sizeof(dtape_kalloc_zone_names[i]), "kalloc.%u", dtape_kalloc_class_sizes[i]);
+		dtape_kalloc_zones[i] = zone_create(dtape_kalloc_zone_names[i], dtape_kalloc_class_sizes[i], ZC_CACHING | ZC_KALLOC_HEAP);
+		if (!dtape_kalloc_zones[i]) {
+			panic("Failed to create kalloc zone for size %u", dtape_kalloc_class_sizes[i]);
+		}
+	}
+
+	uint8_t class = 0;
+	for (size_t i = 0; i < sizeof(dtape_kalloc_class_lookup) / sizeof(*dtape_kalloc_class_lookup); ++i) {
+		if (((i + 1) * DTAPE_KALLOC_GRANULE) > dtape_kalloc_class_sizes[class]) {
+			++class;
+		}
+		dtape_kalloc_class_lookup[i] = class;
+	}
+};
+
+static dtape_kalloc_header_t* dtape_kalloc_header_for(void* addr) {
+	dtape_kalloc_header_t* header = (dtape_kalloc_header_t*)((uintptr_t)addr - sizeof(dtape_kalloc_header_t));
+
+	if (header->magic != DTAPE_KALLOC_MAGIC) {
+		panic("kfree: %p was not allocated with kalloc", addr);
+	}
+
+	return header;
 };
 
 void (kheap_free)(kalloc_heap_t kheap, void* addr, vm_size_t size) {
-	free(addr);
+	if (!addr) {
+		return;
+	}
+
+	dtape_kalloc_header_t* header = dtape_kalloc_header_for(addr);
+
+#if DSERVER_EXTENDED_DEBUG
+	if (size != 0 && size != header->size) {
+		panic("kfree: size mismatch for %p (allocated with %llu, freed with %llu)", addr, (unsigned long long)header->size, (unsigned long long)size);
+	}
+#endif
+
+	// clear the magic so that double frees are caught
+	header->magic = 0;
+
+	if (header->size_class == DTAPE_KALLOC_CLASS_LARGE) {
+		os_atomic_dec(&dtape_kalloc_large_live_count, relaxed);
+		free(header);
+	} else {
+		zfree(dtape_kalloc_zones[header->size_class], header);
+	}
 };
 
 void (kheap_free_addr)(kalloc_heap_t kheap, void* addr) {
@@ -270,15 +772,42 @@ void (kheap_free_addr)(kalloc_heap_t kheap, void* addr) {
 };
 
 void (kfree)(void* addr, vm_size_t size) {
-	free(addr);
+	kheap_free(KHEAP_DEFAULT, addr, size);
 };
 
 struct kalloc_result kalloc_ext(kalloc_heap_t kheap, vm_size_t req_size, zalloc_flags_t flags, vm_allocation_site_t* site) {
-	if (flags & Z_ZERO) {
-		return (struct kalloc_result) { .addr = calloc(1, req_size), .size = req_size };
+	vm_size_t total_size = req_size + sizeof(dtape_kalloc_header_t);
+	dtape_kalloc_header_t* header = NULL;
+	uint32_t size_class = DTAPE_KALLOC_CLASS_LARGE;
+
+	if (total_size < req_size) {
+		// overflow
+		return (struct kalloc_result) { .addr = NULL, .size = 0 };
+	}
+
+	if (total_size <= DTAPE_KALLOC_MAX_SIZE) {
+		size_class = dtape_kalloc_class_lookup[(total_size - 1) / DTAPE_KALLOC_GRANULE];
+		header = zalloc_flags(dtape_kalloc_zones[size_class], flags);
 	} else {
-		return (struct kalloc_result) { .addr = malloc(req_size), .size = req_size };
+		// large allocations are rare enough that it's not worth caching them
+		header = (flags & Z_ZERO) ? calloc(1, total_size) : malloc(total_size);
+		if (header) {
+			os_atomic_inc(&dtape_kalloc_large_count, relaxed);
+			os_atomic_inc(&dtape_kalloc_large_live_count, relaxed);
+		} else if (flags & Z_NOFAIL) {
+			panic("kalloc: failed to allocate %llu bytes", (unsigned long long)req_size);
+		}
+	}
+
+	if (!header) {
+		return (struct kalloc_result) { .addr = NULL, .size = 0 };
 	}
+
+	header->size_class = size_class;
+	header->magic = DTAPE_KALLOC_MAGIC;
+	header->size = req_size;
+
+	return (struct kalloc_result) { .addr = header + 1, .size = req_size };
 };
 
 const char* zone_heap_name(zone_t zone) {
@@ -382,22 +911,131 @@ boolean_t vm_kernel_map_is_kernel(vm_map_t map) {
 	return map == kernel_map || map == ipc_kernel_map;
 };
 
+static uint64_t dtape_vm_map_copy_destination_page_count(vm_map_copy_t copy) {
+	if (copy->type == VM_MAP_COPY_DTAPE_SHARED) {
+		return dtape_byte_count_to_page_count_round_up(copy->cpy_dtape_descriptor->size);
+	}
+	return dtape_byte_count_to_page_count_round_up(copy->size);
+};
+
 void vm_map_copy_discard(vm_map_copy_t copy) {
 	if (copy == VM_MAP_COPY_NULL) {
 		return;
 	}
-	free(copy);
+	if (copy->dtape_prepared_map) {
+		// the copy was never copied out, so we have to clean up the destination we set up for it
+		if (dtape_hooks->task_free_pages(copy->dtape_prepared_map->dtape_task->context, copy->dtape_prepared_address, dtape_vm_map_copy_destination_page_count(copy)) < 0) {
+			dtape_log_warning("failed to free prepared copy-out destination");
+		}
+		vm_map_deallocate(copy->dtape_prepared_map);
+	}
+	if (copy->type == VM_MAP_COPY_DTAPE_SHARED) {
+		dtape_map_shared_descriptor_release(copy->cpy_dtape_descriptor);
+	}
+	kheap_free_addr(KHEAP_DEFAULT, copy);
+};
+
+// page-aligned OOL regions at least this large are copied into a memfd which is then mapped directly into the receiver,
+// rather than being copied into a kernel buffer and then copied out again into freshly allocated pages
+#define DTAPE_SHARED_COPY_THRESHOLD (256 * 1024)
+
+static kern_return_t vm_map_copyin_shared(vm_map_t src_map, vm_map_address_t src_addr, vm_map_size_t len, boolean_t src_destroy, vm_map_copy_t* copy_result) {
+	kern_return_t kr = KERN_SUCCESS;
+	int memfd = -1;
+	void* mapped_addr = NULL;
+	dtape_map_shared_descriptor_t* descriptor = NULL;
+	vm_map_copy_t copy = NULL;
+	uint64_t map_size = vm_map_round_page(len, VM_MAP_PAGE_MASK(src_map));
+
+	copy = kalloc(sizeof(struct vm_map_copy));
+	if (copy == NULL) {
+		kr = KERN_RESOURCE_SHORTAGE;
+		goto out;
+	}
+
+	// NOTE: even when the source is being destroyed and the region is backed by a memfd that only the source map knows about,
+	//       we always copy into a fresh memfd. the source process may have forked since it got that memfd mapped, and a child
+	//       would still share the mapping without us knowing about it, so handing the memfd itself over isn't safe.
+	memfd = memfd_create("darling-ool", MFD_CLOEXEC);
+	if (memfd < 0) {
+		kr = KERN_RESOURCE_SHORTAGE;
+		goto out;
+	}
+
+	if (ftruncate(memfd, map_size) < 0) {
+		kr = KERN_RESOURCE_SHORTAGE;
+		goto out;
+	}
+
+	mapped_addr = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+	if (mapped_addr == MAP_FAILED) {
+		mapped_addr = NULL;
+		kr = KERN_RESOURCE_SHORTAGE;
+		goto out;
+	}
+
+	kr = copyinmap(src_map, src_addr, mapped_addr, (vm_size_t)len);
+	if (kr != KERN_SUCCESS) {
+		goto out;
+	}
+
+	descriptor = dtape_map_shared_descriptor_create(memfd, map_size);
+	if (!descriptor) {
+		kr = KERN_RESOURCE_SHORTAGE;
+		goto out;
+	}
+	memfd = -1; // the descriptor now owns the memfd
+
+	if (src_destroy) {
+		vm_map_remove(src_map, vm_map_trunc_page(src_addr, VM_MAP_PAGE_MASK(src_map)), vm_map_round_page(src_addr + len, VM_MAP_PAGE_MASK(src_map)), 0);
+	}
+
+	copy->type = VM_MAP_COPY_DTAPE_SHARED;
+	copy->size = len;
+	copy->offset = 0;
+	copy->cpy_dtape_descriptor = descriptor;
+	copy->dtape_prepared_map = NULL;
+	copy->dtape_prepared_address = 0;
+	descriptor = NULL; // the copy now owns the descriptor
+
+	*copy_result = copy;
+	copy = NULL;
+
+out:
+	if (mapped_addr) {
+		if (munmap(mapped_addr, map_size) < 0) {
+			dtape_log_error("failed to unmap memfd");
+		}
+	}
+
+	if (descriptor) {
+		dtape_map_shared_descriptor_release(descriptor);
+	}
+
+	if (memfd >= 0) {
+		close(memfd);
+	}
+
+	if (copy) {
+		kheap_free_addr(KHEAP_DEFAULT, copy);
+	}
+
+	return kr;
 };
 
 kern_return_t vm_map_copyin_common(vm_map_t src_map, vm_map_address_t src_addr, vm_map_size_t len, boolean_t src_destroy, boolean_t src_volatile, vm_map_copy_t* copy_result, boolean_t use_maxprot) {
 	// XNU only performs a kernel buffer copy when the data is sufficiently small;
-	// however, we always perform a kernel buffer copy just to make it easier for ourselves
+	// we perform a kernel buffer copy for everything except large page-aligned regions, which we copy into a memfd instead
+
+	if (src_map != kernel_map && len >= DTAPE_SHARED_COPY_THRESHOLD && (src_addr & VM_MAP_PAGE_MASK(src_map)) == 0) {
+		return vm_map_copyin_shared(src_map, src_addr, len, src_destroy, copy_result);
+	}
 
 	// this code has been adapted from vm_map_copyin_kernel_buffer() in osfmk/vm/vm_map.c
 
 	kern_return_t kr;
 
-	vm_map_copy_t copy = malloc(sizeof(struct vm_map_copy) + len);
+	vm_map_copy_t copy = kalloc(sizeof(struct vm_map_copy) + len);
 	if (copy == NULL) {
 		return KERN_RESOURCE_SHORTAGE;
 	}
@@ -406,10 +1044,12 @@ kern_return_t vm_map_copyin_common(vm_map_t src_map, vm_map_address_t src_addr,
 	copy->size = len;
 	copy->offset = 0;
 	copy->cpy_kdata = copy->dtape_copy_data;
+	copy->dtape_prepared_map = NULL;
+	copy->dtape_prepared_address = 0;
 
 	kr = copyinmap(src_map, src_addr, copy->cpy_kdata, (vm_size_t)len);
 	if (kr != KERN_SUCCESS) {
-		free(copy);
+		kheap_free_addr(KHEAP_DEFAULT, copy);
 		return kr;
 	}
 
@@ -421,10 +1061,167 @@ kern_return_t vm_map_copyin_common(vm_map_t src_map, vm_map_address_t src_addr,
 	return KERN_SUCCESS;
 };
 
+/**
+ * Performs the given operations in the map's task with the `task_batch_memory` hook (or one at a time, if there isn't one).
+ */
+static void dtape_task_batch_memory(vm_map_t map, dtape_memory_op_t* ops, size_t op_count) {
+	void* task_context = map->dtape_task->context;
+	bool failed = false;
+
+	if (dtape_hooks->task_batch_memory) {
+		dtape_hooks->task_batch_memory(task_context, ops, op_count);
+		return;
+	}
+
+	for (size_t i = 0; i < op_count; ++i) {
+		dtape_memory_op_t* op = &ops[i];
+
+		if (failed) {
+			op->result = 0;
+			op->error = DTAPE_MEMORY_OP_ERROR_SKIPPED;
+			continue;
+		}
+
+		switch (op->type) {
+			case dtape_memory_op_allocate_pages:
+				op->result = dtape_hooks->task_allocate_pages(task_context, op->page_count, op->protection, op->address, op->flags);
+				op->error = op->result ? 0 : DTAPE_MEMORY_OP_ERROR_UNKNOWN;
+				break;
+			case dtape_memory_op_map_file:
+				op->result = dtape_hooks->task_map_file(task_context, op->fd, op->page_count, op->protection, op->address, op->page_offset, op->flags);
+				op->error = op->result ? 0 : DTAPE_MEMORY_OP_ERROR_UNKNOWN;
+				break;
+			case dtape_memory_op_free_pages:
+				op->result = 0;
+				op->error = (dtape_hooks->task_free_pages(task_context, op->address, op->page_count) < 0) ? DTAPE_MEMORY_OP_ERROR_UNKNOWN : 0;
+				break;
+		}
+
+		failed = op->error != 0;
+	}
+};
+
+// the most copies dtape_vm_map_copyout_prepare sets up with a single hook call
+#define DTAPE_COPYOUT_PREPARE_BATCH_MAX 16
+
+static void dtape_vm_map_copyout_prepare_flush(vm_map_t map, dtape_memory_op_t* ops, vm_map_copy_t* prepared, size_t op_count) {
+	if (op_count == 0) {
+		return;
+	}
+
+	dtape_task_batch_memory(map, ops, op_count);
+
+	for (size_t i = 0; i < op_count; ++i) {
+		// anything that failed is just copied out the usual way later
+		if (ops[i].error == 0) {
+			// the copy holds a reference on the map for as long as the destination is set up in it (it's dropped when the destination is taken or freed),
+			// so a copy that outlives the map trips the in-use check in dtape_vm_map_destroy rather than using a freed map
+			vm_map_reference(map);
+			prepared[i]->dtape_prepared_map = map;
+			prepared[i]->dtape_prepared_address = ops[i].result;
+		}
+	}
+};
+
+void dtape_vm_map_copyout_prepare(vm_map_t map, vm_map_copy_t* copies, size_t count) {
+	dtape_memory_op_t ops[DTAPE_COPYOUT_PREPARE_BATCH_MAX];
+	vm_map_copy_t prepared[DTAPE_COPYOUT_PREPARE_BATCH_MAX];
+	size_t op_count = 0;
+	size_t needed = 0;
+
+	if (map == kernel_map) {
+		return;
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		if (copies[i] != VM_MAP_COPY_NULL && !copies[i]->dtape_prepared_map) {
+			++needed;
+		}
+	}
+
+	// a single copy would need a round trip either way
+	if (needed < 2) {
+		return;
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		vm_map_copy_t copy = copies[i];
+
+		if (copy == VM_MAP_COPY_NULL || copy->dtape_prepared_map) {
+			continue;
+		}
+
+		dtape_memory_op_t* op = &ops[op_count];
+		memset(op, 0, sizeof(*op));
+
+		// these must match what vm_map_copyout_shared and vm_map_copyout_kernel_buffer would've done
+		if (copy->type == VM_MAP_COPY_DTAPE_SHARED) {
+			op->type = dtape_memory_op_map_file;
+			op->fd = copy->cpy_dtape_descriptor->memfd;
+			op->flags = dtape_memory_flag_private;
+		} else {
+			op->type = dtape_memory_op_allocate_pages;
+			op->fd = -1;
+			op->flags = dtape_memory_flag_none;
+		}
+		op->protection = PROT_READ | PROT_WRITE;
+		op->page_count = dtape_vm_map_copy_destination_page_count(copy);
+
+		prepared[op_count++] = copy;
+
+		if (op_count == DTAPE_COPYOUT_PREPARE_BATCH_MAX) {
+			dtape_vm_map_copyout_prepare_flush(map, ops, prepared, op_count);
+			op_count = 0;
+		}
+	}
+
+	dtape_vm_map_copyout_prepare_flush(map, ops, prepared, op_count);
+};
+
+static void dtape_vm_map_removal_batch_flush(dtape_map_removal_batch_t* batch) {
+	if (batch->count == 0) {
+		return;
+	}
+
+	dtape_task_batch_memory(batch->map, batch->ops, batch->count);
+
+	for (size_t i = 0; i < batch->count; ++i) {
+		dtape_memory_op_t* op = &batch->ops[i];
+
+		if (op->error == DTAPE_MEMORY_OP_ERROR_SKIPPED) {
+			// an earlier removal failed; that shouldn't keep the rest from being removed
+			op->error = (dtape_hooks->task_free_pages(batch->map->dtape_task->context, op->address, op->page_count) < 0) ? DTAPE_MEMORY_OP_ERROR_UNKNOWN : 0;
+		}
+
+		if (op->error != 0) {
+			dtape_log_warning("failed to unmap %zu page(s) at %p: %d", op->page_count, (void*)op->address, op->error);
+		}
+	}
+
+	batch->count = 0;
+};
+
+/**
+ * If a destination was already set up for the given copy in the given map, hands it over to the caller.
+ */
+static bool dtape_vm_map_copy_take_prepared(vm_map_t map, vm_map_copy_t copy, vm_map_address_t* addr) {
+	if (copy->dtape_prepared_map != map) {
+		return false;
+	}
+
+	*addr = copy->dtape_prepared_address;
+	copy->dtape_prepared_map = NULL;
+	copy->dtape_prepared_address = 0;
+	vm_map_deallocate(map);
+	return true;
+};
+
 static kern_return_t vm_map_copyout_kernel_buffer(vm_map_t map, vm_map_address_t* addr, vm_map_copy_t copy, vm_map_size_t copy_size, boolean_t overwrite, boolean_t consume_on_success) {
 	kern_return_t kr = KERN_SUCCESS;
 
-	if (!overwrite) {
+	if (!overwrite && dtape_vm_map_copy_take_prepared(map, copy, addr)) {
+		// the memory for this copy has already been allocated
+	} else if (!overwrite) {
 		// we need to allocate memory for this copy
 
 		if (map == kernel_map) {
@@ -453,18 +1250,89 @@ static kern_return_t vm_map_copyout_kernel_buffer(vm_map_t map, vm_map_address_t
 	} else {
 		// copy was successful
 		if (consume_on_success) {
-			free(copy);
+			// this also cleans up a destination that was prepared for it elsewhere (which we didn't use)
+			vm_map_copy_discard(copy);
 		}
 	}
 
 	return kr;
 };
 
+static kern_return_t vm_map_copyout_shared(vm_map_t map, vm_map_address_t* addr, vm_map_copy_t copy, vm_map_size_t copy_size, boolean_t overwrite, boolean_t consume_on_success) {
+	kern_return_t kr = KERN_SUCCESS;
+	dtape_map_shared_descriptor_t* descriptor = copy->cpy_dtape_descriptor;
+	void* mapped_addr = NULL;
+	uintptr_t target_addr = 0;
+
+	if (overwrite || map == kernel_map) {
+		// the destination already has its own memory (or it's our own address space), so we have to copy the data in;
+		// this is still one less copy than a kernel buffer copy-in would've needed
+		mapped_addr = mmap(NULL, descriptor->size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor->memfd, 0);
+		if (mapped_addr == MAP_FAILED) {
+			return KERN_RESOURCE_SHORTAGE;
+		}
+
+		if (!overwrite) {
+			*addr = (uintptr_t)mmap(NULL, copy_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (*addr == (uintptr_t)MAP_FAILED) {
+				*addr = 0;
+				kr = KERN_RESOURCE_SHORTAGE;
+				goto out;
+			}
+		}
+
+		if (copyoutmap(map, mapped_addr, *addr, (vm_size_t)copy_size)) {
+			if (!overwrite) {
+				munmap((void*)*addr, copy_size);
+				*addr = 0;
+			}
+			kr = KERN_INVALID_ADDRESS;
+			goto out;
+		}
+	} else {
+		// map the memfd directly into the destination; no copying required.
+		//
+		// the mapping must be private (copy-on-write): OOL data is a copy, so the receiver's writes must not be visible to anyone else,
+		// and if the receiver forks, the child must get its own copy rather than sharing the region with its parent (which is what
+		// would happen with a shared mapping). since the mapping keeps the memfd's pages alive on its own, it isn't recorded as
+		// a shared entry; this also means that forwarding the region later copies it into a new memfd (which is required anyway,
+		// since the memfd no longer reflects what the receiver sees once it writes to the region).
+		if (dtape_vm_map_copy_take_prepared(map, copy, addr)) {
+			goto out;
+		}
+
+		target_addr = dtape_hooks->task_map_file(map->dtape_task->context, descriptor->memfd, dtape_byte_count_to_page_count_round_up(descriptor->size), PROT_READ | PROT_WRITE, 0, 0, dtape_memory_flag_private);
+		if (!target_addr) {
+			kr = KERN_RESOURCE_SHORTAGE;
+			goto out;
+		}
+
+		*addr = target_addr;
+	}
+
+out:
+	if (mapped_addr) {
+		if (munmap(mapped_addr, descriptor->size) < 0) {
+			dtape_log_error("failed to unmap memfd");
+		}
+	}
+
+	if (kr == KERN_SUCCESS && consume_on_success) {
+		vm_map_copy_discard(copy);
+	}
+
+	return kr;
+};
+
 kern_return_t vm_map_copy_overwrite(vm_map_t dst_map, vm_map_offset_t dst_addr, vm_map_copy_t copy, vm_map_size_t copy_size, boolean_t interruptible) {
 	if (copy == VM_MAP_COPY_NULL) {
 		return KERN_SUCCESS;
 	}
 
+	if (copy->type == VM_MAP_COPY_DTAPE_SHARED) {
+		return vm_map_copyout_shared(dst_map, &dst_addr, copy, copy->size, TRUE, TRUE);
+	}
+
 	return vm_map_copyout_kernel_buffer(dst_map, &dst_addr, copy, copy->size, TRUE, TRUE);
 };
 
@@ -479,6 +1347,10 @@ kern_return_t vm_map_copyout_size(vm_map_t dst_map, vm_map_address_t* dst_addr,
 		return KERN_FAILURE;
 	}
 
+	if (copy->type == VM_MAP_COPY_DTAPE_SHARED) {
+		return vm_map_copyout_shared(dst_map, dst_addr, copy, copy_size, FALSE, TRUE);
+	}
+
 	return vm_map_copyout_kernel_buffer(dst_map, dst_addr, copy, copy_size, FALSE, TRUE);
 };
 
@@ -500,13 +1372,57 @@ kern_return_t vm_map_remove(vm_map_t map, vm_map_offset_t start, vm_map_offset_t
 		}
 		return KERN_SUCCESS;
 	} else {
-		if (dtape_hooks->task_free_pages(map->dtape_task->context, start, dtape_byte_count_to_page_count_round_down(end - start)) < 0) {
+		dtape_thread_t* thread = dtape_thread_for_xnu_thread(current_thread());
+		dtape_map_removal_batch_t* batch = thread ? thread->map_removal_batch : NULL;
+
+		if (batch && batch->map == map) {
+			// the unmapping is done when the batch is flushed; failures there are only logged, since nobody looks at our result
+			// during teardown anyway (see dtape_map_removal_batch_t)
+			if (batch->count == DTAPE_MAP_REMOVAL_BATCH_MAX) {
+				dtape_vm_map_removal_batch_flush(batch);
+			}
+
+			dtape_memory_op_t* op = &batch->ops[batch->count++];
+			memset(op, 0, sizeof(*op));
+			op->type = dtape_memory_op_free_pages;
+			op->fd = -1;
+			op->address = start;
+			op->page_count = dtape_byte_count_to_page_count_round_down(end - start);
+		} else if (dtape_hooks->task_free_pages(map->dtape_task->context, start, dtape_byte_count_to_page_count_round_down(end - start)) < 0) {
 			return KERN_FAILURE;
 		}
+
+		dtape_map_remove_shared_entries(map, start, end - start);
 		return KERN_SUCCESS;
 	}
 };
 
+void dtape_vm_map_removal_batch_begin(vm_map_t map, dtape_map_removal_batch_t* batch) {
+	dtape_thread_t* thread = dtape_thread_for_xnu_thread(current_thread());
+
+	batch->map = map;
+	batch->count = 0;
+
+	// batches don't nest; an inner batch (or one without a thread to hold it) just removes regions right away
+	if (!thread || thread->map_removal_batch || map == kernel_map) {
+		batch->map = NULL;
+		return;
+	}
+
+	thread->map_removal_batch = batch;
+};
+
+void dtape_vm_map_removal_batch_end(dtape_map_removal_batch_t* batch) {
+	dtape_thread_t* thread = dtape_thread_for_xnu_thread(current_thread());
+
+	if (!batch->map) {
+		return;
+	}
+
+	dtape_vm_map_removal_batch_flush(batch);
+	thread->map_removal_batch = NULL;
+};
+
 kern_return_t mach_vm_allocate_kernel(vm_map_t map, mach_vm_offset_t* addr, mach_vm_size_t size, int flags, vm_tag_t tag) {
 	if (map == kernel_map) {
 		vm_offset_t tmp;
@@ -542,8 +1458,140 @@ kern_return_t mach_memory_entry_purgable_control(ipc_port_t entry_port, vm_purga
 	dtape_stub_unsafe();
 };
 
+static void dtape_zone_get_info(zone_t zone, mach_zone_name_t* name, mach_zone_info_t* info) {
+	libsimple_lock_lock(&zone->depot_lock);
+	uint64_t slab_count = zone->slab_count;
+	libsimple_lock_unlock(&zone->depot_lock);
+
+	if (name) {
+		snprintf(name->mzn_name, sizeof(name->mzn_name), "%s", zone->name);
+	}
+
+	if (info) {
+		// "free" elements include those sitting in per-thread magazines
+		*info = (mach_zone_info_t) {
+			.mzi_count = os_atomic_load(&zone->live_count, relaxed),
+			.mzi_cur_size = slab_count * zone->slab_size,
+			.mzi_max_size = os_atomic_load(&zone->peak_count, relaxed) * zone->slot_size,
+			.mzi_elem_size = zone->size,
+			.mzi_alloc_size = zone->slab_size,
+			.mzi_sum_size = os_atomic_load(&zone->alloc_count, relaxed) * zone->size,
+			.mzi_exhaustible = zone->exhaustible,
+			.mzi_collectable = 0,
+		};
+	}
+};
+
+void dtape_zone_stats_iterate(dtape_zone_stats_iterator_f iterator, void* context) {
+	libsimple_lock_lock(&dtape_zones_lock);
+	for (size_t i = 0; i < DTAPE_ZONE_MAX; ++i) {
+		zone_t zone = dtape_zones[i];
+		if (!zone) {
+			continue;
+		}
+
+		libsimple_lock_lock(&zone->depot_lock);
+		uint64_t element_count = zone->element_count;
+		libsimple_lock_unlock(&zone->depot_lock);
+
+		uint64_t live_count = os_atomic_load(&zone->live_count, relaxed);
+
+		dtape_zone_stats_t stats = {
+			.name = zone->name,
+			.element_size = zone->size,
+			.live_count = live_count,
+			.peak_count = os_atomic_load(&zone->peak_count, relaxed),
+			// `live_count` is updated without the depot lock, so it may briefly exceed the element count we read
+			.free_count = (element_count > live_count) ? (element_count - live_count) : 0,
+			.alloc_count = os_atomic_load(&zone->alloc_count, relaxed),
+		};
+
+		iterator(context, &stats);
+	}
+	libsimple_lock_unlock(&dtape_zones_lock);
+};
+
+static void dtape_log_zone_stats_iterator(void* context, const dtape_zone_stats_t* stats) {
+	dtape_log_info("zone \"%s\" (%llu bytes): %llu live, %llu peak, %llu free, %llu total allocations",
+		stats->name,
+		(unsigned long long)stats->element_size,
+		(unsigned long long)stats->live_count,
+		(unsigned long long)stats->peak_count,
+		(unsigned long long)stats->free_count,
+		(unsigned long long)stats->alloc_count
+	);
+};
+
+void dtape_log_zone_stats(void) {
+	dtape_zone_stats_iterate(dtape_log_zone_stats_iterator, NULL);
+
+	dtape_log_info("kalloc: %llu large allocation(s), %llu live",
+		(unsigned long long)os_atomic_load(&dtape_kalloc_large_count, relaxed),
+		(unsigned long long)os_atomic_load(&dtape_kalloc_large_live_count, relaxed)
+	);
+};
+
+// like XNU's mach_memory_info, but we don't support the memory info (only zone info)
 kern_return_t mach_memory_info(host_priv_t host, mach_zone_name_array_t* namesp, mach_msg_type_number_t* namesCntp, mach_zone_info_array_t* infop, mach_msg_type_number_t* infoCntp, mach_memory_info_array_t* memoryInfop, mach_msg_type_number_t* memoryInfoCntp) {
-	dtape_stub_unsafe();
+	kern_return_t kr = KERN_SUCCESS;
+	mach_zone_name_t* names = NULL;
+	mach_zone_info_t* info = NULL;
+	vm_map_copy_t names_copy = VM_MAP_COPY_NULL;
+	vm_map_copy_t info_copy = VM_MAP_COPY_NULL;
+	mach_msg_type_number_t count = 0;
+
+	if (host == HOST_NULL) {
+		return KERN_INVALID_HOST;
+	}
+
+	names = malloc(sizeof(*names) * DTAPE_ZONE_MAX);
+	info = malloc(sizeof(*info) * DTAPE_ZONE_MAX);
+	if (!names || !info) {
+		kr = KERN_RESOURCE_SHORTAGE;
+		goto out;
+	}
+
+	// zones are only destroyed by their owners once they're no longer in use,
+	// so holding the registry lock is enough to keep them alive while we read them
+	libsimple_lock_lock(&dtape_zones_lock);
+	for (size_t i = 0; i < DTAPE_ZONE_MAX; ++i) {
+		if (!dtape_zones[i]) {
+			continue;
+		}
+		dtape_zone_get_info(dtape_zones[i], &names[count], &info[count]);
+		++count;
+	}
+	libsimple_lock_unlock(&dtape_zones_lock);
+
+	kr = vm_map_copyin(kernel_map, (vm_map_address_t)names, count * sizeof(*names), FALSE, &names_copy);
+	if (kr != KERN_SUCCESS) {
+		goto out;
+	}
+
+	kr = vm_map_copyin(kernel_map, (vm_map_address_t)info, count * sizeof(*info), FALSE, &info_copy);
+	if (kr != KERN_SUCCESS) {
+		vm_map_copy_discard(names_copy);
+		goto out;
+	}
+
+	*namesp = (mach_zone_name_t*)names_copy;
+	*namesCntp = count;
+	*infop = (mach_zone_info_t*)info_copy;
+	*infoCntp = count;
+
+	if (memoryInfop && memoryInfoCntp) {
+		*memoryInfop = NULL;
+		*memoryInfoCntp = 0;
+	}
+
+out:
+	if (names) {
+		free(names);
+	}
+	if (info) {
+		free(info);
+	}
+	return kr;
 };
 
 kern_return_t mach_memory_object_memory_entry(host_t host, boolean_t internal, vm_size_t size, vm_prot_t permission, memory_object_t pager, ipc_port_t* entry_handle) {
@@ -1057,15 +2105,66 @@ kern_return_t mach_zone_get_zlog_zones(host_priv_t host, mach_zone_name_array_t*
 };
 
 kern_return_t mach_zone_info(host_priv_t host, mach_zone_name_array_t* namesp, mach_msg_type_number_t* namesCntp, mach_zone_info_array_t* infop, mach_msg_type_number_t* infoCntp) {
-	dtape_stub_unsafe();
+	return mach_memory_info(host, namesp, namesCntp, infop, infoCntp, NULL, NULL);
 };
 
 kern_return_t mach_zone_info_for_largest_zone(host_priv_t host, mach_zone_name_t* namep, mach_zone_info_t* infop) {
-	dtape_stub_unsafe();
+	zone_t largest = NULL;
+	uint64_t largest_size = 0;
+
+	if (host == HOST_NULL) {
+		return KERN_INVALID_HOST;
+	}
+
+	if (namep == NULL || infop == NULL) {
+		return KERN_INVALID_ARGUMENT;
+	}
+
+	libsimple_lock_lock(&dtape_zones_lock);
+	for (size_t i = 0; i < DTAPE_ZONE_MAX; ++i) {
+		if (!dtape_zones[i]) {
+			continue;
+		}
+		mach_zone_info_t info;
+		dtape_zone_get_info(dtape_zones[i], NULL, &info);
+		if (largest == NULL || info.mzi_cur_size > largest_size) {
+			largest = dtape_zones[i];
+			largest_size = info.mzi_cur_size;
+		}
+	}
+	if (largest) {
+		dtape_zone_get_info(largest, namep, infop);
+	}
+	libsimple_lock_unlock(&dtape_zones_lock);
+
+	return largest ? KERN_SUCCESS : KERN_FAILURE;
 };
 
 kern_return_t mach_zone_info_for_zone(host_priv_t host, mach_zone_name_t name, mach_zone_info_t* infop) {
-	dtape_stub_unsafe();
+	kern_return_t kr = KERN_INVALID_ARGUMENT;
+
+	if (host == HOST_NULL) {
+		return KERN_INVALID_HOST;
+	}
+
+	if (infop == NULL) {
+		return KERN_INVALID_ARGUMENT;
+	}
+
+	// make sure the name is terminated before comparing against it
+	name.mzn_name[sizeof(name.mzn_name) - 1] = '\0';
+
+	libsimple_lock_lock(&dtape_zones_lock);
+	for (size_t i = 0; i < DTAPE_ZONE_MAX; ++i) {
+		if (dtape_zones[i] && strcmp(dtape_zones[i]->name, name.mzn_name) == 0) {
+			dtape_zone_get_info(dtape_zones[i], NULL, infop);
+			kr = KERN_SUCCESS;
+			break;
+		}
+	}
+	libsimple_lock_unlock(&dtape_zones_lock);
+
+	return kr;
 };
 
 kern_return_t vm_map_page_query_internal(vm_map_t target_map, vm_map_offset_t offset, int* disposition, int* ref_count) {
@@ -88,18 +88,23 @@ void dtape_log(dtape_log_level_t level, const char* format, ...) {
 void dtape_init(const dtape_hooks_t* hooks) {
 	dtape_hooks = hooks;
 
-	dtape_log_debug("dtape_processor_init");
-	dtape_processor_init();
-
+	// this has to come first: everything else (including processor init) allocates with kalloc/zalloc,
+	// which need the kalloc zones to exist
 	dtape_log_debug("dtape_memory_init");
 	dtape_memory_init();
 
+	dtape_log_debug("dtape_locks_init");
+	dtape_locks_init();
+
+	dtape_log_debug("dtape_processor_init");
+	dtape_processor_init();
+
 	ipc_space_zone = zone_create("ipc spaces", sizeof(struct ipc_space), ZC_NOENCRYPT);
 	ipc_kmsg_zone = zone_create("ipc kmsgs", IKM_SAVED_KMSG_SIZE, ZC_CACHING | ZC_ZFREE_CLEARMEM);
 	semaphore_zone = zone_create("semaphores", sizeof(struct semaphore), ZC_NONE);
 
-	ipc_object_zones[IOT_PORT] = zone_create("ipc ports", sizeof(struct ipc_port), ZC_NOENCRYPT | ZC_CACHING | ZC_ZFREE_CLEARMEM | ZC_NOSEQUESTER);
-	ipc_object_zones[IOT_PORT_SET] = zone_create("ipc port sets", sizeof(struct ipc_pset), ZC_NOENCRYPT | ZC_ZFREE_CLEARMEM | ZC_NOSEQUESTER);
+	ipc_object_zones[IOT_PORT] = zone_create_ext("ipc ports", sizeof(struct ipc_port), ZC_NOENCRYPT | ZC_CACHING | ZC_ZFREE_CLEARMEM | ZC_NOSEQUESTER, ZONE_ID_IPC_PORT, NULL);
+	ipc_object_zones[IOT_PORT_SET] = zone_create_ext("ipc port sets", sizeof(struct ipc_pset), ZC_NOENCRYPT | ZC_ZFREE_CLEARMEM | ZC_NOSEQUESTER, ZONE_ID_IPC_PORT_SET, NULL);
 
 	ipc_importance_task_zone = zone_create("ipc task importance", sizeof(struct ipc_importance_task), ZC_NOENCRYPT);
 	ipc_importance_inherit_zone = zone_create("ipc importance inherit", sizeof(struct ipc_importance_inherit), ZC_NOENCRYPT);
@@ -178,7 +183,9 @@ void dtape_init_in_thread(void) {
 };
 
 void dtape_deinit(void) {
-
+	dtape_log_zone_stats();
+	dtape_log_lock_stats();
+	dtape_log_timer_stats();
 };
 
 void read_frandom(void* buffer, unsigned int numBytes) {
@@ -218,7 +225,7 @@ void Assert(const char* file, int line, const char* expression) {
 };
 
 unsigned int waitq_held(struct waitq* wq) {
-	return wq->dtape_waitq_interlock.dtape_interlock.dtape_interlock.dtape_mutex.dtape_owner == (uintptr_t)current_thread();
+	return (wq->dtape_waitq_interlock.dtape_interlock.dtape_interlock.dtape_mutex.dtape_owner & DTAPE_MUTEX_OWNER_MASK) == (uintptr_t)current_thread();
 };
 
 #if __x86_64__
@@ -1,4 +1,5 @@
 #include <darlingserver/duct-tape/semaphore.h>
+#include <darlingserver/duct-tape/locks.h>
 #include <darlingserver/duct-tape/task.h>
 
 #include <mach/semaphore.h>
@@ -6,6 +7,15 @@
 
 #include <stdlib.h>
 
+// how many times a down will retry before blocking.
+// S2C handshakes hold these semaphores very briefly, so it's usually worth waiting a little while for an up instead of suspending.
+// with a single worker thread, though, nobody else could possibly be running to up the semaphore while we spin.
+#if DSERVER_SINGLE_THREADED
+	#define DTAPE_SEMAPHORE_SPIN_LIMIT 0
+#else
+	#define DTAPE_SEMAPHORE_SPIN_LIMIT 100
+#endif
+
 dtape_semaphore_t* dtape_semaphore_create(dtape_task_t* owning_task, int initial_value) {
 	dtape_semaphore_t* semaphore = malloc(sizeof(dtape_semaphore_t));
 	if (!semaphore) {
@@ -13,8 +23,10 @@ dtape_semaphore_t* dtape_semaphore_create(dtape_task_t* owning_task, int initial
 	}
 
 	semaphore->owning_task = owning_task;
+	semaphore->count = initial_value;
 
-	if (semaphore_create(&semaphore->owning_task->xnu_task, &semaphore->xnu_semaphore, 0, initial_value) != KERN_SUCCESS) {
+	// all the initial permits live in `count`; the XNU semaphore is only used to hand permits to waiters
+	if (semaphore_create(&semaphore->owning_task->xnu_task, &semaphore->xnu_semaphore, 0, 0) != KERN_SUCCESS) {
 		free(semaphore);
 		return NULL;
 	}
@@ -31,13 +43,72 @@ void dtape_semaphore_destroy(dtape_semaphore_t* semaphore) {
 };
 
 void dtape_semaphore_up(dtape_semaphore_t* semaphore) {
+	if (os_atomic_inc_orig(&semaphore->count, release) >= 0) {
+		// nobody's waiting; the permit just goes into the count
+		return;
+	}
+
+	// someone is waiting (or about to wait) on the XNU semaphore; hand the permit to them
 	if (semaphore_signal(semaphore->xnu_semaphore) != KERN_SUCCESS) {
 		panic("Failed to raise up-count of duct-taped XNU semaphore");
 	}
 };
 
+static bool dtape_semaphore_try_down(dtape_semaphore_t* semaphore) {
+	int32_t count = os_atomic_load(&semaphore->count, relaxed);
+
+	while (count > 0) {
+		if (os_atomic_cmpxchgv(&semaphore->count, count, count - 1, &count, acquire)) {
+			return true;
+		}
+	}
+
+	return false;
+};
+
+static bool dtape_semaphore_spin(dtape_semaphore_t* semaphore) {
+	for (size_t i = 0; i < DTAPE_SEMAPHORE_SPIN_LIMIT; ++i) {
+		if (dtape_semaphore_try_down(semaphore)) {
+			return true;
+		}
+
+		dtape_cpu_relax();
+	}
+
+	return false;
+};
+
 dtape_semaphore_wait_result_t dtape_semaphore_down(dtape_semaphore_t* semaphore) {
+	if (dtape_semaphore_try_down(semaphore) || dtape_semaphore_spin(semaphore)) {
+		return dtape_semaphore_wait_result_ok;
+	}
+
+	if (os_atomic_dec_orig(&semaphore->count, acquire) > 0) {
+		// someone upped it right before we registered ourselves as a waiter
+		return dtape_semaphore_wait_result_ok;
+	}
+
+	// we're now registered as a waiter, so the next up will signal the XNU semaphore for us
 	kern_return_t kr = semaphore_wait(semaphore->xnu_semaphore);
+
+	if (kr == KERN_ABORTED) {
+		int32_t count = os_atomic_load(&semaphore->count, relaxed);
+
+		// try to withdraw as a waiter
+		while (count < 0) {
+			if (os_atomic_cmpxchgv(&semaphore->count, count, count + 1, &count, relaxed)) {
+				return dtape_semaphore_wait_result_interrupted;
+			}
+		}
+
+		// an up has already committed to handing us a permit, so we have to take it
+		// (otherwise, it would be left in the XNU semaphore and the count would be off by one).
+		// interruptions are one-shot, so this can't keep failing.
+		do {
+			kr = semaphore_wait(semaphore->xnu_semaphore);
+		} while (kr == KERN_ABORTED);
+	}
+
 	switch (kr) {
 		case KERN_SUCCESS:
 			return dtape_semaphore_wait_result_ok;
@@ -53,6 +53,8 @@ dtape_thread_t* dtape_thread_create(dtape_task_t* task, uint64_t nsid, void* con
 	thread->processing_signal = false;
 	thread->name = NULL;
 	thread->waiting_suspended = false;
+	thread->map_removal_batch = NULL;
+	memset(&thread->block_info, 0, sizeof(thread->block_info));
 	LIST_INIT(&thread->user_states);
 	dtape_mutex_init(&thread->suspension_mutex);
 	dtape_condvar_init(&thread->suspension_condvar);
@@ -166,9 +168,16 @@ void dtape_thread_entering(dtape_thread_t* thread) {
 	thread->xnu_thread.state &= ~(TH_WAIT | TH_UNINT);
 	thread->xnu_thread.state |= TH_RUN;
 	thread->xnu_thread.block_hint = kThreadWaitNone;
+
+	// whatever we were blocked on (if anything), we're not blocked anymore
+	thread->block_info.reason = dtape_block_reason_none;
+
+	dtape_mutex_note_running((uintptr_t)&thread->xnu_thread);
 };
 
 void dtape_thread_exiting(dtape_thread_t* thread) {
+	dtape_mutex_note_running(0);
+
 	thread->xnu_thread.state &= ~TH_RUN;
 };
 
@@ -379,6 +388,37 @@ kern_return_t handle_ux_exception(thread_t xthread, int exception, mach_exceptio
 	return KERN_SUCCESS;
 };
 
+void dtape_thread_get_block_info(dtape_thread_t* thread, dtape_block_info_t* info) {
+	*info = thread->block_info;
+};
+
+const char* dtape_block_hint_name(int hint) {
+	switch (hint) {
+		case kThreadWaitNone:                return "none";
+		case kThreadWaitKernelMutex:         return "kernel-mutex";
+		case kThreadWaitPortReceive:         return "port-receive";
+		case kThreadWaitPortSetReceive:      return "portset-receive";
+		case kThreadWaitPortSend:            return "port-send";
+		case kThreadWaitPortSendInTransit:   return "port-send-in-transit";
+		case kThreadWaitSemaphore:           return "semaphore";
+		case kThreadWaitKernelRWLockRead:    return "kernel-rwlock-read";
+		case kThreadWaitKernelRWLockWrite:   return "kernel-rwlock-write";
+		case kThreadWaitKernelRWLockUpgrade: return "kernel-rwlock-upgrade";
+		case kThreadWaitUserLock:            return "user-lock";
+		case kThreadWaitPThreadMutex:        return "pthread-mutex";
+		case kThreadWaitPThreadRWLockRead:   return "pthread-rwlock-read";
+		case kThreadWaitPThreadRWLockWrite:  return "pthread-rwlock-write";
+		case kThreadWaitPThreadCondVar:      return "pthread-condvar";
+		case kThreadWaitParkedWorkQueue:     return "parked-workqueue";
+		case kThreadWaitWorkloopSyncWait:    return "workloop-sync-wait";
+		case kThreadWaitOnProcess:           return "on-process";
+		case kThreadWaitSleepWithInheritor:  return "sleep-with-inheritor";
+		case kThreadWaitEventlink:           return "eventlink";
+		case kThreadWaitCompressor:          return "compressor";
+		default:                             return "unknown";
+	}
+};
+
 void dtape_thread_wait_while_user_suspended(dtape_thread_t* thread) {
 	if (&thread->xnu_thread != current_thread()) {
 		panic("Cannot wait with non-current thread");
@@ -416,6 +456,10 @@ void dtape_thread_wait_while_user_suspended(dtape_thread_t* thread) {
 
 		thread->xnu_thread.wait_result = THREAD_WAITING;
 
+		thread->block_info.reason = dtape_block_reason_user_suspended;
+		thread->block_info.hint = kThreadWaitNone;
+		thread->block_info.site = 0;
+
 		dtape_hooks->thread_suspend(thread->context, NULL, NULL, NULL);
 
 		dtape_log_debug("sigexc: woken up");
@@ -532,6 +576,12 @@ wait_result_t thread_block_parameter(thread_continue_t continuation, void* param
 
 	bool waiting = thread->xnu_thread.state & TH_WAIT;
 
+	if (waiting) {
+		thread->block_info.reason = dtape_block_reason_waitq;
+		thread->block_info.hint = thread->xnu_thread.block_hint;
+		thread->block_info.site = (uintptr_t)thread->xnu_thread.wait_event;
+	}
+
 	thread_unlock(&thread->xnu_thread);
 
 	if (waiting) {
@@ -1,9 +1,11 @@
 #include <darlingserver/duct-tape/stubs.h>
 #include <darlingserver/duct-tape/hooks.internal.h>
+#include <darlingserver/duct-tape/log.h>
 
 #include <kern/timer.h>
 #include <kern/timer_call.h>
 #include <kern/timer_queue.h>
+#include <kern/thread.h>
 #include <mach/mach_time.h>
 
 #include <i386/rtclock_protos.h>
@@ -31,6 +33,7 @@ struct timespec
 };
 
 int clock_gettime(int clk_id, struct timespec *tp);
+int snprintf(char* str, size_t size, const char* format, ...);
 
 // stub
 pal_rtc_nanotime_t pal_rtc_nanotime_info;
@@ -40,10 +43,42 @@ int master_cpu = 0;
 // convince timer_call code not to use long term timers
 int serverperfmode = 1;
 
+// all timer calls go into this one queue. each mpqueue keeps its timers in a pairing heap (`mpq_pqhead`) ordered by deadline
+// along with an unordered list, so enqueueing is O(1) and dequeueing/rescheduling is amortized O(log n), even with a huge number of timers.
+// we keep the long-term timer queue disabled (see `serverperfmode` above) because that one *is* a plain list that has to be scanned.
 static mpqueue_head_t timer_queue;
 
+// when the timer fires, we also expire any timers due within this window so that bursts of timers get handled in a single pass
+#define DTAPE_TIMER_BATCH_SLACK_NS (50 * NSEC_PER_USEC)
+
+// bounds the number of times a single pass will go back to look for more timers (in case callouts keep re-arming themselves into the window)
+#define DTAPE_TIMER_BATCH_MAX_ROUNDS 16
+
+#define DTAPE_TIMER_LAG_HISTOGRAM_BUCKETS 32
+
+static libsimple_lock_t dtape_timer_expiry_lock;
+
+// the thread currently running an expiry pass (if any)
+static thread_t dtape_timer_expiry_thread = NULL;
+
+// set when the timer fires while a pass is already running
+static bool dtape_timer_expiry_rerun = false;
+
+static struct {
+	uint64_t passes;
+	uint64_t merged_passes;
+	uint64_t rounds;
+	uint64_t expired;
+	uint64_t suppressed_arms;
+	uint64_t lag_max;
+
+	// bucket `i` counts timers that expired [2^i, 2^(i + 1)) nanoseconds after their soft deadline (bucket 0 also includes on-time/early timers)
+	uint64_t lag_histogram[DTAPE_TIMER_LAG_HISTOGRAM_BUCKETS];
+} dtape_timer_stats;
+
 void dtape_timer_init(void) {
 	mpqueue_init(&timer_queue, LCK_GRP_NULL, LCK_ATTR_NULL);
+	libsimple_lock_init(&dtape_timer_expiry_lock);
 };
 
 uint64_t _rtc_nanotime_read(pal_rtc_nanotime_t* rntp) {
@@ -53,21 +88,128 @@ uint64_t _rtc_nanotime_read(pal_rtc_nanotime_t* rntp) {
 };
 
 void dtape_timer_fired(void) {
-	uint64_t next_deadline = timer_queue_expire(&timer_queue, mach_absolute_time());
-	dtape_hooks->timer_arm(next_deadline, true);
+	uint64_t next_deadline = UINT64_MAX;
+	uint64_t leeway = 0;
+	size_t rounds = 0;
+
+	libsimple_lock_lock(&dtape_timer_expiry_lock);
+	if (dtape_timer_expiry_thread != NULL) {
+		// someone else is already expiring timers; just let them know they need to take another look once they're done
+		dtape_timer_expiry_rerun = true;
+		libsimple_lock_unlock(&dtape_timer_expiry_lock);
+		os_atomic_inc(&dtape_timer_stats.merged_passes, relaxed);
+		return;
+	}
+	dtape_timer_expiry_thread = current_thread();
+	libsimple_lock_unlock(&dtape_timer_expiry_lock);
+
+	os_atomic_inc(&dtape_timer_stats.passes, relaxed);
+
+	while (true) {
+		// callouts that re-arm timers while we're in here won't poke the server (see dtape_timer_queue_assign_with_leeway);
+		// the deadline returned here already takes them into account, so we only need to arm the timer once we're done.
+		next_deadline = timer_queue_expire(&timer_queue, mach_absolute_time() + DTAPE_TIMER_BATCH_SLACK_NS);
+		++rounds;
+
+		if (rounds < DTAPE_TIMER_BATCH_MAX_ROUNDS && next_deadline != UINT64_MAX && next_deadline <= mach_absolute_time() + DTAPE_TIMER_BATCH_SLACK_NS) {
+			// more timers became due while we were running callouts
+			continue;
+		}
+
+		libsimple_lock_lock(&dtape_timer_expiry_lock);
+		if (dtape_timer_expiry_rerun && rounds < DTAPE_TIMER_BATCH_MAX_ROUNDS) {
+			dtape_timer_expiry_rerun = false;
+			libsimple_lock_unlock(&dtape_timer_expiry_lock);
+			continue;
+		}
+		dtape_timer_expiry_rerun = false;
+		dtape_timer_expiry_thread = NULL;
+		libsimple_lock_unlock(&dtape_timer_expiry_lock);
+		break;
+	}
+
+	os_atomic_add(&dtape_timer_stats.rounds, rounds, relaxed);
+
+	if (next_deadline != UINT64_MAX) {
+		uint64_t earliest_soft_deadline = os_atomic_load(&timer_queue.earliest_soft_deadline, relaxed);
+		if (earliest_soft_deadline < next_deadline) {
+			leeway = next_deadline - earliest_soft_deadline;
+		}
+	}
+
+	// the server disarms its timer when it fires, so we don't need to override it here.
+	// in fact, we *shouldn't* override it, since another thread might have already armed it for an earlier deadline.
+	dtape_hooks->timer_arm(next_deadline, leeway, false);
+};
+
+// called by timer_queue_expire_with_options right before a timer's callout is invoked
+void dtape_timer_record_expiry(uint64_t soft_deadline) {
+	uint64_t now = mach_absolute_time();
+	uint64_t lag = (now > soft_deadline) ? (now - soft_deadline) : 0;
+	size_t bucket = (lag == 0) ? 0 : (63 - __builtin_clzll(lag));
+
+	if (bucket >= DTAPE_TIMER_LAG_HISTOGRAM_BUCKETS) {
+		bucket = DTAPE_TIMER_LAG_HISTOGRAM_BUCKETS - 1;
+	}
+
+	os_atomic_inc(&dtape_timer_stats.expired, relaxed);
+	os_atomic_inc(&dtape_timer_stats.lag_histogram[bucket], relaxed);
+	os_atomic_max(&dtape_timer_stats.lag_max, lag, relaxed);
+};
+
+void dtape_log_timer_stats(void) {
+	char histogram[512];
+	size_t histogram_length = 0;
+
+	histogram[0] = '\0';
+	for (size_t i = 0; i < DTAPE_TIMER_LAG_HISTOGRAM_BUCKETS && histogram_length < sizeof(histogram); ++i) {
+		uint64_t count = os_atomic_load(&dtape_timer_stats.lag_histogram[i], relaxed);
+		if (count == 0) {
+			continue;
+		}
+		histogram_length += snprintf(&histogram[histogram_length], sizeof(histogram) - histogram_length, " <%lluns:%llu", 1ull << (i + 1), (unsigned long long)count);
+	}
+
+	dtape_log_info("timer expiry: %llu passes (%llu merged into running passes, %llu rounds), %llu timers expired, %llu arms deferred until the end of a pass",
+		(unsigned long long)os_atomic_load(&dtape_timer_stats.passes, relaxed),
+		(unsigned long long)os_atomic_load(&dtape_timer_stats.merged_passes, relaxed),
+		(unsigned long long)os_atomic_load(&dtape_timer_stats.rounds, relaxed),
+		(unsigned long long)os_atomic_load(&dtape_timer_stats.expired, relaxed),
+		(unsigned long long)os_atomic_load(&dtape_timer_stats.suppressed_arms, relaxed)
+	);
+	dtape_log_info("timer expiry lag: %llu ns max;%s", (unsigned long long)os_atomic_load(&dtape_timer_stats.lag_max, relaxed), histogram);
+};
+
+uint64_t dtape_timer_pending_count(void) {
+	return os_atomic_load(&timer_queue.count, relaxed);
 };
 
 void timer_call_nosync_cpu(int cpu, void (*fn)(void* arg), void* arg) {
 	fn(arg);
 };
 
-mpqueue_head_t* timer_queue_assign(uint64_t deadline) {
-	dtape_hooks->timer_arm(deadline, false);
+// called by timer_call_enter_internal with the slop it added to the soft deadline;
+// this lets the server avoid re-arming the timer if it's already armed to fire somewhere within the window.
+mpqueue_head_t* dtape_timer_queue_assign_with_leeway(uint64_t deadline, uint64_t leeway) {
+	// if this is being called by a callout during an expiry pass, the timer will be armed at the end of the pass
+	if (os_atomic_load(&dtape_timer_expiry_thread, relaxed) == current_thread()) {
+		os_atomic_inc(&dtape_timer_stats.suppressed_arms, relaxed);
+	} else {
+		dtape_hooks->timer_arm(deadline, leeway, false);
+	}
 	return &timer_queue;
 };
 
+mpqueue_head_t* timer_queue_assign(uint64_t deadline) {
+	return dtape_timer_queue_assign_with_leeway(deadline, 0);
+};
+
 void timer_queue_cancel(mpqueue_head_t* queue, uint64_t deadline, uint64_t new_deadline) {
-	dtape_hooks->timer_arm(new_deadline, true);
+	if (os_atomic_load(&dtape_timer_expiry_thread, relaxed) == current_thread()) {
+		os_atomic_inc(&dtape_timer_stats.suppressed_arms, relaxed);
+		return;
+	}
+	dtape_hooks->timer_arm(new_deadline, 0, true);
 };
 
 mpqueue_head_t* timer_queue_cpu(int cpu) {
@@ -87,7 +229,26 @@ boolean_t ml_timer_forced_evaluation(void) {
 	return FALSE;
 };
 
+// these are the same defaults XNU uses on x86_64 (see i386_timer.c).
+// without these, timer_call_slop always returns 0 and no timers get coalesced.
 timer_coalescing_priority_params_ns_t* timer_call_get_priority_params(void) {
-	static timer_coalescing_priority_params_ns_t params = {0};
+	static timer_coalescing_priority_params_ns_t params = {
+		.idle_entry_timer_processing_hdeadline_threshold_ns = 5000ULL * NSEC_PER_USEC,
+		.interrupt_timer_coalescing_ilat_threshold_ns = 30ULL * NSEC_PER_USEC,
+		.timer_resort_threshold_ns = 50 * NSEC_PER_MSEC,
+		.timer_coalesce_rt_shift = 0,
+		.timer_coalesce_bg_shift = -5,
+		.timer_coalesce_kt_shift = 3,
+		.timer_coalesce_fp_shift = 3,
+		.timer_coalesce_ts_shift = 3,
+		.timer_coalesce_rt_ns_max = 0ULL,
+		.timer_coalesce_bg_ns_max = 100 * NSEC_PER_MSEC,
+		.timer_coalesce_kt_ns_max = 1 * NSEC_PER_MSEC,
+		.timer_coalesce_fp_ns_max = 1 * NSEC_PER_MSEC,
+		.timer_coalesce_ts_ns_max = 1 * NSEC_PER_MSEC,
+		.latency_qos_scale = {3, 2, 1, -2, -15, -15},
+		.latency_qos_ns_max = {1 * NSEC_PER_MSEC, 5 * NSEC_PER_MSEC, 20 * NSEC_PER_MSEC, 75 * NSEC_PER_MSEC, 10000 * NSEC_PER_MSEC, 10000 * NSEC_PER_MSEC},
+		.latency_tier_rate_limited = {FALSE, FALSE, FALSE, FALSE, TRUE, TRUE},
+	};
 	return &params;
 }
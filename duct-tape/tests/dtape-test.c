@@ -0,0 +1,304 @@
+#include "dtape-test.h"
+
+#include <darlingserver/duct-tape/stubs.h>
+#include <darlingserver/duct-tape/hooks.internal.h>
+#include <darlingserver/duct-tape/memory.h>
+#include <darlingserver/duct-tape/task.h>
+#include <darlingserver/duct-tape/thread.h>
+#include <darlingserver/duct-tape/locks.h>
+#include <darlingserver/duct-tape/semaphore.h>
+
+#include <kern/kalloc.h>
+#include <kern/timer_call.h>
+#include <ipc/ipc_kmsg.h>
+#include <vm/vm_kern.h>
+
+#include <stdlib.h>
+
+void dtape_test_init(const dtape_hooks_t* hooks) {
+	dtape_hooks = hooks;
+	dtape_memory_init();
+	dtape_locks_init();
+};
+
+dtape_thread_t* dtape_test_thread_create(void* context) {
+	dtape_thread_t* thread = calloc(1, sizeof(dtape_thread_t));
+	if (!thread) {
+		return NULL;
+	}
+	thread->context = context;
+
+	// just enough of the XNU thread for it to wait on a waitq (see dtape_thread_create)
+	thread->xnu_thread.wait_result = THREAD_WAITING;
+	thread->xnu_thread.options = THREAD_ABORTSAFE;
+	thread->xnu_thread.state = TH_RUN;
+	thread_lock_init(&thread->xnu_thread);
+	wake_lock_init(&thread->xnu_thread);
+
+	return thread;
+};
+
+void dtape_test_thread_destroy(dtape_thread_t* thread) {
+	free(thread);
+};
+
+dtape_mutex_t* dtape_test_mutex_create(void) {
+	dtape_mutex_t* mutex = malloc(sizeof(dtape_mutex_t));
+	if (!mutex) {
+		return NULL;
+	}
+	dtape_mutex_init(mutex);
+	return mutex;
+};
+
+void dtape_test_mutex_destroy(dtape_mutex_t* mutex) {
+	free(mutex);
+};
+
+void dtape_test_mutex_lock(dtape_mutex_t* mutex) {
+	dtape_mutex_lock(mutex);
+};
+
+void dtape_test_mutex_unlock(dtape_mutex_t* mutex) {
+	dtape_mutex_unlock(mutex);
+};
+
+bool dtape_test_mutex_try_lock(dtape_mutex_t* mutex) {
+	return dtape_mutex_try_lock(mutex);
+};
+
+dtape_map_t* dtape_test_map_create(void* task_context) {
+	// the map only needs its task for the context
+	dtape_task_t* task = calloc(1, sizeof(dtape_task_t));
+	if (!task) {
+		return NULL;
+	}
+	task->context = task_context;
+
+	dtape_map_t* map = dtape_vm_map_create(task);
+	if (!map) {
+		free(task);
+	}
+	return map;
+};
+
+void dtape_test_map_destroy(dtape_map_t* map) {
+	dtape_task_t* task = map->dtape_task;
+	dtape_vm_map_destroy(map);
+	free(task);
+};
+
+int dtape_test_map_copy(dtape_map_t* src_map, uintptr_t src_address, size_t size, dtape_map_t* dst_map, uintptr_t* dst_address) {
+	vm_map_copy_t copy = VM_MAP_COPY_NULL;
+	vm_map_address_t address = 0;
+	kern_return_t kr;
+
+	kr = vm_map_copyin(src_map, src_address, size, FALSE, &copy);
+	if (kr != KERN_SUCCESS) {
+		return kr;
+	}
+
+	kr = vm_map_copyout(dst_map, &address, copy);
+	if (kr != KERN_SUCCESS) {
+		vm_map_copy_discard(copy);
+		return kr;
+	}
+
+	*dst_address = address;
+	return KERN_SUCCESS;
+};
+
+int dtape_test_map_deallocate(dtape_map_t* map, uintptr_t address, size_t size) {
+	return vm_map_remove(map, vm_map_trunc_page(address, VM_MAP_PAGE_MASK(map)), vm_map_round_page(address + size, VM_MAP_PAGE_MASK(map)), 0);
+};
+
+int dtape_test_map_copy_many(dtape_map_t* src_map, const uintptr_t* src_addresses, const size_t* sizes, size_t count, dtape_map_t* dst_map, uintptr_t* dst_addresses) {
+	vm_map_copy_t* copies = calloc(count, sizeof(vm_map_copy_t));
+	kern_return_t kr = KERN_SUCCESS;
+	size_t copied_out = 0;
+
+	if (!copies) {
+		return KERN_RESOURCE_SHORTAGE;
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		kr = vm_map_copyin(src_map, src_addresses[i], sizes[i], FALSE, &copies[i]);
+		if (kr != KERN_SUCCESS) {
+			goto out;
+		}
+	}
+
+	dtape_vm_map_copyout_prepare(dst_map, copies, count);
+
+	for (; copied_out < count; ++copied_out) {
+		vm_map_address_t address = 0;
+		kr = vm_map_copyout(dst_map, &address, copies[copied_out]);
+		if (kr != KERN_SUCCESS) {
+			goto out;
+		}
+		copies[copied_out] = VM_MAP_COPY_NULL;
+		dst_addresses[copied_out] = address;
+	}
+
+out:
+	if (kr != KERN_SUCCESS) {
+		for (size_t i = 0; i < copied_out; ++i) {
+			dtape_test_map_deallocate(dst_map, dst_addresses[i], sizes[i]);
+		}
+	}
+	for (size_t i = 0; i < count; ++i) {
+		vm_map_copy_discard(copies[i]);
+	}
+	free(copies);
+	return kr;
+};
+
+int dtape_test_map_deallocate_many(dtape_map_t* map, const uintptr_t* addresses, const size_t* sizes, size_t count) {
+	dtape_map_removal_batch_t batch;
+	kern_return_t kr = KERN_SUCCESS;
+
+	dtape_vm_map_removal_batch_begin(map, &batch);
+
+	for (size_t i = 0; i < count; ++i) {
+		kern_return_t this_kr = dtape_test_map_deallocate(map, addresses[i], sizes[i]);
+		if (kr == KERN_SUCCESS) {
+			kr = this_kr;
+		}
+	}
+
+	dtape_vm_map_removal_batch_end(&batch);
+
+	return kr;
+};
+
+dtape_map_shared_descriptor_t* dtape_test_shared_descriptor_create(int memfd, uint64_t size) {
+	return dtape_map_shared_descriptor_create(memfd, size);
+};
+
+void dtape_test_shared_descriptor_release(dtape_map_shared_descriptor_t* descriptor) {
+	dtape_map_shared_descriptor_release(descriptor);
+};
+
+bool dtape_test_map_insert_shared_entry(dtape_map_t* map, dtape_map_shared_descriptor_t* descriptor, uint64_t address, uint64_t size, uint64_t page_offset) {
+	dtape_map_shared_entry_t* entry = dtape_map_shared_entry_create(address, size, page_offset, descriptor);
+	if (!entry) {
+		return false;
+	}
+	dtape_map_insert_shared_entry(map, entry);
+	return true;
+};
+
+void dtape_test_map_remove_shared_entries(dtape_map_t* map, uint64_t address, uint64_t size) {
+	dtape_map_remove_shared_entries(map, address, size);
+};
+
+size_t dtape_test_map_find_shared_entries(dtape_map_t* map, uint64_t address, uint64_t size, dtape_test_shared_entry_t* out_entries, size_t count) {
+	dtape_map_shared_entry_t* entries[16];
+	size_t total = 0;
+
+	dtape_mutex_lock(&map->shared_entry_lock);
+
+	while (total < count) {
+		size_t batch = dtape_map_find_shared_entries_locked(map, address, size, entries, (count - total < 16) ? count - total : 16);
+
+		for (size_t i = 0; i < batch; ++i) {
+			out_entries[total + i].address = entries[i]->address;
+			out_entries[total + i].size = entries[i]->size;
+			out_entries[total + i].page_offset = entries[i]->page_offset;
+			out_entries[total + i].memfd = entries[i]->descriptor->memfd;
+		}
+		total += batch;
+
+		if (batch < 16) {
+			break;
+		}
+
+		// continue just after the last entry we got
+		uint64_t next = entries[batch - 1]->address + entries[batch - 1]->size;
+		if (next >= address + size) {
+			break;
+		}
+		size -= next - address;
+		address = next;
+	}
+
+	dtape_mutex_unlock(&map->shared_entry_lock);
+
+	return total;
+};
+
+extern zone_t semaphore_zone;
+
+static dtape_task_t* dtape_test_semaphore_task = NULL;
+
+void dtape_test_semaphore_init(void) {
+	semaphore_zone = zone_create("semaphores", sizeof(struct semaphore), ZC_NONE);
+
+	// semaphores only need their task for its lock and semaphore list
+	dtape_test_semaphore_task = calloc(1, sizeof(dtape_task_t));
+	if (!dtape_test_semaphore_task) {
+		panic("Failed to allocate semaphore task");
+	}
+	lck_mtx_init(&dtape_test_semaphore_task->xnu_task.lock, LCK_GRP_NULL, LCK_ATTR_NULL);
+	queue_init(&dtape_test_semaphore_task->xnu_task.semaphore_list);
+	dtape_test_semaphore_task->xnu_task.active = true;
+};
+
+dtape_semaphore_t* dtape_test_semaphore_create(int initial_value) {
+	return dtape_semaphore_create(dtape_test_semaphore_task, initial_value);
+};
+
+void dtape_timer_init(void);
+
+struct dtape_test_timer {
+	timer_call_data_t call;
+	dtape_test_timer_callback_f callback;
+	void* context;
+};
+
+static void dtape_test_timer_expired(timer_call_param_t param0, timer_call_param_t param1) {
+	dtape_test_timer_t* timer = param0;
+	timer->callback(timer->context);
+};
+
+void dtape_test_timer_init(void) {
+	dtape_timer_init();
+	timer_call_init();
+};
+
+dtape_test_timer_t* dtape_test_timer_create(dtape_test_timer_callback_f callback, void* context) {
+	dtape_test_timer_t* timer = calloc(1, sizeof(dtape_test_timer_t));
+	if (!timer) {
+		return NULL;
+	}
+	timer->callback = callback;
+	timer->context = context;
+	timer_call_setup(&timer->call, dtape_test_timer_expired, timer);
+	return timer;
+};
+
+void dtape_test_timer_destroy(dtape_test_timer_t* timer) {
+	timer_call_cancel(&timer->call);
+	free(timer);
+};
+
+bool dtape_test_timer_arm(dtape_test_timer_t* timer, uint64_t deadline) {
+	// a system urgency class, so that the leeway doesn't depend on the calling thread
+	return timer_call_enter(&timer->call, deadline, TIMER_CALL_SYS_NORMAL);
+};
+
+bool dtape_test_timer_cancel(dtape_test_timer_t* timer) {
+	return timer_call_cancel(&timer->call);
+};
+
+void dtape_test_ipc_init(void) {
+	ipc_kmsg_zone = zone_create("ipc kmsgs", IKM_SAVED_KMSG_SIZE, ZC_CACHING | ZC_ZFREE_CLEARMEM);
+};
+
+dtape_kmsg_t* dtape_test_kmsg_alloc(size_t message_size) {
+	return ipc_kmsg_alloc(message_size + MAX_TRAILER_SIZE);
+};
+
+void dtape_test_kmsg_free(dtape_kmsg_t* kmsg) {
+	ipc_kmsg_free(kmsg);
+};
@@ -0,0 +1,192 @@
+#ifndef _DARLINGSERVER_DUCT_TAPE_TEST_H_
+#define _DARLINGSERVER_DUCT_TAPE_TEST_H_
+
+//
+// test glue
+//
+// the standalone tests and benchmarks (in the top-level `tests` directory) are built like the rest of darlingserver,
+// so they can't include duct-tape's internal headers (those need the XNU build environment).
+// this is a small C API over the duct-tape internals they exercise; it's built with the duct-tape itself (see `dtape-test.c`).
+//
+// the tests provide their own hooks (e.g. microthreads are emulated with real threads), so none of this needs a running server
+// or a full `dtape_init`.
+//
+
+#include <darlingserver/duct-tape.h>
+#include <darlingserver/duct-tape/hooks.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Installs the given hooks and initializes just enough of the duct-tape for the functions below (i.e. the memory subsystem).
+ * The hooks must remain valid for the rest of the program.
+ */
+void dtape_test_init(const dtape_hooks_t* hooks);
+
+//
+// threads
+//
+
+/**
+ * Creates a duct-taped thread with the given context that isn't attached to any task.
+ * It's only good for acting as a microthread (i.e. for returning from the `current_thread` hook).
+ */
+dtape_thread_t* dtape_test_thread_create(void* context);
+void dtape_test_thread_destroy(dtape_thread_t* thread);
+
+//
+// mutexes
+//
+
+typedef struct dtape_mutex dtape_mutex_t;
+
+dtape_mutex_t* dtape_test_mutex_create(void);
+void dtape_test_mutex_destroy(dtape_mutex_t* mutex);
+void dtape_test_mutex_lock(dtape_mutex_t* mutex);
+void dtape_test_mutex_unlock(dtape_mutex_t* mutex);
+bool dtape_test_mutex_try_lock(dtape_mutex_t* mutex);
+
+//
+// VM maps
+//
+
+typedef struct _vm_map dtape_map_t;
+
+/**
+ * Creates a VM map for a task with the given context; the task memory hooks will be called with this context.
+ */
+dtape_map_t* dtape_test_map_create(void* task_context);
+void dtape_test_map_destroy(dtape_map_t* map);
+
+/**
+ * Copies the given region out of @p src_map and into a newly allocated region in @p dst_map (like an OOL descriptor in a Mach message).
+ * Returns the Mach status code; on success, @p dst_address is set to the address of the new region.
+ */
+int dtape_test_map_copy(dtape_map_t* src_map, uintptr_t src_address, size_t size, dtape_map_t* dst_map, uintptr_t* dst_address);
+
+/**
+ * Deallocates the given region in @p map (like `mach_vm_deallocate`), dropping any shared entries it overlaps.
+ */
+int dtape_test_map_deallocate(dtape_map_t* map, uintptr_t address, size_t size);
+
+/**
+ * Like dtape_test_map_copy, but for several regions at once (like a message with several OOL descriptors):
+ * everything is copied in first and then all the destinations are set up together before copying anything out.
+ * Returns the first failing Mach status code, in which case none of the regions are left in @p dst_map.
+ */
+int dtape_test_map_copy_many(dtape_map_t* src_map, const uintptr_t* src_addresses, const size_t* sizes, size_t count, dtape_map_t* dst_map, uintptr_t* dst_addresses);
+
+/**
+ * Like dtape_test_map_deallocate, but for several regions at once, with the unmapping batched up
+ * (like the sender's regions being deallocated while a message is copied in).
+ */
+int dtape_test_map_deallocate_many(dtape_map_t* map, const uintptr_t* addresses, const size_t* sizes, size_t count);
+
+//
+// shared entries (the memfd-backed regions that OOL copies map into a task)
+//
+
+typedef struct dtape_map_shared_descriptor dtape_map_shared_descriptor_t;
+
+typedef struct dtape_test_shared_entry {
+	uint64_t address;
+	uint64_t size;
+	uint64_t page_offset;
+	int memfd;
+} dtape_test_shared_entry_t;
+
+/**
+ * Creates a shared descriptor that takes ownership of @p memfd; the memfd is closed once the caller's reference
+ * and every entry using the descriptor have been released.
+ */
+dtape_map_shared_descriptor_t* dtape_test_shared_descriptor_create(int memfd, uint64_t size);
+void dtape_test_shared_descriptor_release(dtape_map_shared_descriptor_t* descriptor);
+
+/**
+ * Records that the given region of @p map has the given pages of the descriptor's memfd mapped into it,
+ * replacing (i.e. trimming or splitting) any entries it overlaps. Returns `false` if the entry couldn't be allocated.
+ */
+bool dtape_test_map_insert_shared_entry(dtape_map_t* map, dtape_map_shared_descriptor_t* descriptor, uint64_t address, uint64_t size, uint64_t page_offset);
+
+/**
+ * Removes the given region from the shared entries in @p map (without touching the actual mapping).
+ */
+void dtape_test_map_remove_shared_entries(dtape_map_t* map, uint64_t address, uint64_t size);
+
+/**
+ * Looks up (at most @p count of) the shared entries that overlap the given region, in address order.
+ */
+size_t dtape_test_map_find_shared_entries(dtape_map_t* map, uint64_t address, uint64_t size, dtape_test_shared_entry_t* out_entries, size_t count);
+
+//
+// semaphores
+//
+
+/**
+ * Creates the semaphore zone and a task to own the semaphores created below (the way `dtape_init` and `dtape_task_create` do).
+ */
+void dtape_test_semaphore_init(void);
+
+/**
+ * Creates a semaphore owned by that task. The rest of the semaphore API (up, down, and destroy) is usable as-is;
+ * a down that has to block suspends the calling microthread (see dtape_test_thread_create).
+ */
+dtape_semaphore_t* dtape_test_semaphore_create(int initial_value);
+
+//
+// timers
+//
+
+typedef struct dtape_test_timer dtape_test_timer_t;
+typedef void (*dtape_test_timer_callback_f)(void* context);
+
+/**
+ * Sets up the timer queue (the way `dtape_init` does). The test hooks must implement `timer_arm`.
+ */
+void dtape_test_timer_init(void);
+
+/**
+ * Creates an XNU timer call that invokes @p callback with @p context when it expires.
+ */
+dtape_test_timer_t* dtape_test_timer_create(dtape_test_timer_callback_f callback, void* context);
+void dtape_test_timer_destroy(dtape_test_timer_t* timer);
+
+/**
+ * Arms (or re-arms) the timer for the given deadline (in `mach_absolute_time` units, i.e. CLOCK_MONOTONIC nanoseconds) with `timer_call_enter`.
+ * Returns `true` if the timer was already armed.
+ */
+bool dtape_test_timer_arm(dtape_test_timer_t* timer, uint64_t deadline);
+
+/**
+ * Disarms the timer with `timer_call_cancel`. Returns `true` if it was armed.
+ */
+bool dtape_test_timer_cancel(dtape_test_timer_t* timer);
+
+//
+// IPC
+//
+
+typedef struct ipc_kmsg dtape_kmsg_t;
+
+/**
+ * Creates the IPC zones that the functions below need (the way `dtape_init` does).
+ */
+void dtape_test_ipc_init(void);
+
+/**
+ * Allocates (or frees) a kernel message buffer for a message of the given size (like `mach_msg` does for each message it copies in).
+ */
+dtape_kmsg_t* dtape_test_kmsg_alloc(size_t message_size);
+void dtape_test_kmsg_free(dtape_kmsg_t* kmsg);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif // _DARLINGSERVER_DUCT_TAPE_TEST_H_
@@ -102,6 +102,10 @@
 #include <vm/vm_object.h>
 #include <vm/vm_kern.h>
 
+#ifdef __DARLING__
+	#include <darlingserver/duct-tape/memory.h>
+#endif
+
 #include <ipc/port.h>
 #include <ipc/ipc_types.h>
 #include <ipc/ipc_entry.h>
@@ -3747,6 +3751,9 @@ ipc_kmsg_copyin_body(
 	mach_msg_guard_flags_t guard_flags = 0;
 	mach_port_context_t context;
 	mach_msg_type_name_t disp;
+#ifdef __DARLING__
+	dtape_map_removal_batch_t removal_batch;
+#endif
 
 	/*
 	 * Determine if the target is a kernel port.
@@ -3945,6 +3952,14 @@ ipc_kmsg_copyin_body(
 	/* kern_addr = just after base after it has been (conditionally) moved */
 	kern_addr = (mach_msg_descriptor_t *)((vm_offset_t)kmsg->ikm_header + sizeof(mach_msg_base_t));
 
+#ifdef __DARLING__
+	/*
+	 * the sender's regions that are deallocated as they're copied in are
+	 * unmapped with as few round trips to the sender as possible
+	 */
+	dtape_vm_map_removal_batch_begin(map, &removal_batch);
+#endif
+
 	/* handle the OOL regions and port descriptors. */
 	for (i = 0; i < dsc_count; i++) {
 		switch (user_addr->type.type) {
@@ -3992,6 +4007,9 @@ ipc_kmsg_copyin_body(
 		kmsg->ikm_header->msgh_bits &= ~MACH_MSGH_BITS_COMPLEX;
 	}
 out:
+#ifdef __DARLING__
+	dtape_vm_map_removal_batch_end(&removal_batch);
+#endif
 	return mr;
 
 clean_message:
@@ -5451,6 +5469,30 @@ ipc_kmsg_copyout_body(
 		sdsc_count = 0;
 	}
 
+#ifdef __DARLING__
+	/*
+	 * set up the receiver's side of all the OOL regions at once,
+	 * rather than with a round trip to the receiver for each one
+	 */
+	{
+		vm_map_copy_t copies[16];
+		size_t copy_count = 0;
+
+		for (i = 0; i < dsc_count; i++) {
+			if (kern_dsc[i].type.type != MACH_MSG_OOL_DESCRIPTOR && kern_dsc[i].type.type != MACH_MSG_OOL_VOLATILE_DESCRIPTOR) {
+				continue;
+			}
+			copies[copy_count++] = (vm_map_copy_t)((mach_msg_ool_descriptor_t *)&kern_dsc[i])->address;
+			if (copy_count == sizeof(copies) / sizeof(*copies)) {
+				dtape_vm_map_copyout_prepare(map, copies, copy_count);
+				copy_count = 0;
+			}
+		}
+
+		dtape_vm_map_copyout_prepare(map, copies, copy_count);
+	}
+#endif
+
 	/* Now process the descriptors - in reverse order */
 	for (i = dsc_count - 1; i >= 0; i--) {
 		switch (kern_dsc[i].type.type) {
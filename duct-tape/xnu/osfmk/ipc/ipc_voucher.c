@@ -205,7 +205,7 @@ static void
 ipc_voucher_init(void)
 {
 #ifdef __DARLING__
-	ipc_voucher_zone = zone_create("ipc vouchers", sizeof(struct ipc_voucher), ZC_NOENCRYPT | ZC_ZFREE_CLEARMEM | ZC_NOSEQUESTER);
+	ipc_voucher_zone = zone_create_ext("ipc vouchers", sizeof(struct ipc_voucher), ZC_NOENCRYPT | ZC_ZFREE_CLEARMEM | ZC_NOSEQUESTER, ZONE_ID_IPC_VOUCHERS, NULL);
 	ipc_voucher_attr_control_zone = zone_create("ipc voucher attr controls", sizeof(struct ipc_voucher_attr_control), ZC_NOENCRYPT | ZC_ZFREE_CLEARMEM);
 	lck_spin_init(&ivgt_lock_data, LCK_GRP_NULL, LCK_ATTR_NULL);
 #endif // __DARLING__
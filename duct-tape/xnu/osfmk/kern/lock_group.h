@@ -152,12 +152,19 @@ extern void lck_grp_startup_init(
 	STARTUP_ARG(LOCKS_EARLY, STARTUP_RANK_SECOND, lck_grp_attr_startup_init, \
 	    &__startup_lck_grp_attr_spec_ ## var)
 
+#ifdef __DARLING__
+// startup hooks don't run in darlingserver, so just initialize the name statically
+// (this is used by the lock profiler to report lock groups by name)
+#define LCK_GRP_DECLARE_ATTR(var, name, attr) \
+	lck_grp_t var = { .lck_grp_name = name }
+#else
 #define LCK_GRP_DECLARE_ATTR(var, name, attr) \
 	__PLACE_IN_SECTION("__DATA,__lock_grp") lck_grp_t var; \
 	static __startup_data struct lck_grp_startup_spec \
 	__startup_lck_grp_spec_ ## var = { &var, name, attr }; \
 	STARTUP_ARG(LOCKS_EARLY, STARTUP_RANK_THIRD, lck_grp_startup_init, \
 	    &__startup_lck_grp_spec_ ## var)
+#endif // __DARLING__
 
 #define LCK_GRP_DECLARE(var, name) \
 	LCK_GRP_DECLARE_ATTR(var, name, LCK_GRP_ATTR_NULL);
@@ -168,6 +168,11 @@ enum {PAST_DEADLINE_TIMER_ADJUSTMENT_NS = 10 * 1000};
 
 uint64_t past_deadline_timer_adjustment;
 
+#ifdef __DARLING__
+extern mpqueue_head_t* dtape_timer_queue_assign_with_leeway(uint64_t deadline, uint64_t leeway);
+extern void dtape_timer_record_expiry(uint64_t soft_deadline);
+#endif // __DARLING__
+
 static boolean_t timer_call_enter_internal(timer_call_t call, timer_call_param_t param1, uint64_t deadline, uint64_t leeway, uint32_t flags, boolean_t ratelimited);
 boolean_t       mach_timer_coalescing_enabled = TRUE;
 
@@ -674,7 +679,12 @@ timer_call_enter_internal(
 	}
 
 	if (queue == NULL) {
+#ifdef __DARLING__
+		// let the server know how much slop we added so it can coalesce this timer with the one it's already armed for
+		queue = dtape_timer_queue_assign_with_leeway(deadline, deadline - sdeadline);
+#else
 		queue = timer_queue_assign(deadline);
+#endif // __DARLING__
 		old_queue = timer_call_enqueue_deadline_unlocked(call, queue, deadline, sdeadline, ttd, param1, flags);
 	}
 
@@ -939,6 +949,8 @@ timer_queue_expire_with_options(
 			 */
 			uint64_t *ttdp = &current_processor()->timer_call_ttd;
 			*ttdp = call->tc_ttd;
+#else
+			dtape_timer_record_expiry(call->tc_soft_deadline);
 #endif // __DARLING__
 			(*func)(param0, param1);
 #ifndef __DARLING__
@@ -1,6 +1,7 @@
 #ifndef _DARLINGSERVER_RPC_SUPPLEMENT_H_
 #define _DARLINGSERVER_RPC_SUPPLEMENT_H_
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -150,6 +151,15 @@ enum dserver_s2c_msgnum {
 	dserver_s2c_msgnum_munmap,
 	dserver_s2c_msgnum_mprotect,
 	dserver_s2c_msgnum_msync,
+
+	/**
+	 * Performs multiple of the above operations in a single exchange.
+	 *
+	 * The client performs the operations in order and stops after the first one that fails.
+	 *
+	 * This is only sent to clients that have advertised `DSERVER_S2C_FEATURE_BATCH`.
+	 */
+	dserver_s2c_msgnum_batch,
 };
 
 typedef enum dserver_s2c_msgnum dserver_s2c_msgnum_t;
@@ -221,11 +231,153 @@ typedef struct dserver_s2c_reply_msync {
 	int errno_result;
 } dserver_s2c_reply_msync_t;
 
+/**
+ * Optional S2C features that a client can advertise to the server with the `s2c_features` call.
+ *
+ * Clients that don't advertise a feature never receive the messages it adds.
+ */
+#define DSERVER_S2C_FEATURE_BATCH (1ULL << 0)
+
+/**
+ * The maximum number of operations in a single batch.
+ *
+ * The server splits longer lists of operations into several batches (see `dserver_s2c_batch_pack`).
+ * The hard limit is the size of the buffers the server receives messages into: the reply has to fit in 256 bytes,
+ * which leaves room for 14 results. We stop at 8 so that the call (which the client has to receive in one piece)
+ * stays around 300 bytes. `tests/s2c-batch-bench` measures the cost per operation for batches of 1 to 64 operations:
+ * 8 operations per exchange already cut it to about a seventh of what individual calls cost, and while larger batches
+ * keep improving on that, they save much less per operation than the first 8 do (16 operations save about another third).
+ */
+#define DSERVER_S2C_BATCH_MAX_OPS 8
+
+/**
+ * The maximum number of descriptors that can be attached to a single batch.
+ */
+#define DSERVER_S2C_BATCH_MAX_FDS 4
+
+typedef struct dserver_s2c_batch_op {
+	// one of mmap, munmap, mprotect, or msync
+	dserver_s2c_msgnum_t op;
+	// index of the descriptor in the message (or -1); only used for mmap.
+	// (before packing, this is the sender's own descriptor instead; see `dserver_s2c_batch_pack`)
+	int32_t fd;
+	uint64_t address;
+	// the length for mmap, munmap, and mprotect; the size for msync
+	uint64_t length;
+	// only used for mmap and mprotect
+	int32_t protection;
+	// the mmap flags for mmap; the sync flags for msync
+	int32_t flags;
+	// only used for mmap
+	int64_t offset;
+} dserver_s2c_batch_op_t;
+
+typedef struct dserver_s2c_batch_result {
+	// the mapped address for mmap; the return value for everything else
+	uint64_t return_value;
+	// 0 on success
+	int32_t errno_result;
+	int32_t reserved;
+} dserver_s2c_batch_result_t;
+
+typedef struct dserver_s2c_call_batch {
+	dserver_s2c_callhdr_t header;
+	uint32_t op_count;
+	dserver_s2c_batch_op_t ops[DSERVER_S2C_BATCH_MAX_OPS];
+} dserver_s2c_call_batch_t;
+
+typedef struct dserver_s2c_reply_batch {
+	dserver_s2c_replyhdr_t header;
+	// the number of operations that were actually performed (including the one that failed, if any)
+	uint32_t op_count;
+	dserver_s2c_batch_result_t results[DSERVER_S2C_BATCH_MAX_OPS];
+} dserver_s2c_reply_batch_t;
+
+/**
+ * Fills @p call with as many of the given operations as fit in a single batch (at most `DSERVER_S2C_BATCH_MAX_OPS` operations
+ * and `DSERVER_S2C_BATCH_MAX_FDS` descriptors) and returns how many that was (which is only 0 if @p op_count is 0).
+ *
+ * The operations' `fd`s are the sender's own descriptors (or -1). In the call, they're replaced with indices into @p out_fds,
+ * which receives the descriptors that need to be attached to the message (@p out_fd_count of them, in order).
+ * The call's header is left for the caller to fill in.
+ */
+static inline uint32_t dserver_s2c_batch_pack(dserver_s2c_call_batch_t* call, const dserver_s2c_batch_op_t* ops, size_t op_count, int* out_fds, uint32_t* out_fd_count) {
+	uint32_t count = 0;
+	uint32_t fd_count = 0;
+
+	for (; count < op_count && count < DSERVER_S2C_BATCH_MAX_OPS; ++count) {
+		bool has_fd = ops[count].op == dserver_s2c_msgnum_mmap && ops[count].fd >= 0;
+
+		if (has_fd && fd_count == DSERVER_S2C_BATCH_MAX_FDS) {
+			break;
+		}
+
+		call->ops[count] = ops[count];
+
+		if (has_fd) {
+			out_fds[fd_count] = ops[count].fd;
+			call->ops[count].fd = fd_count++;
+		} else {
+			call->ops[count].fd = -1;
+		}
+	}
+
+	call->op_count = count;
+	*out_fd_count = fd_count;
+	return count;
+};
+
+/**
+ * Performs a single operation from a batch; @p fd is the received descriptor for the operation (or -1).
+ */
+typedef void (*dserver_s2c_batch_perform_f)(void* context, const dserver_s2c_batch_op_t* op, int fd, dserver_s2c_batch_result_t* out_result);
+
+/**
+ * Performs a batch call on the client side: runs each operation in order with @p perform, stops after the first one that fails,
+ * and fills in the reply's `op_count` and `results` (the header is left for the caller). The received descriptors are not closed.
+ *
+ * Returns `false` (without performing anything) if the call is malformed, i.e. it has too many operations or refers to
+ * a descriptor that wasn't received.
+ *
+ * Clients that handle batches (e.g. with this) should advertise `DSERVER_S2C_FEATURE_BATCH` after every checkin.
+ */
+static inline bool dserver_s2c_batch_perform(const dserver_s2c_call_batch_t* call, const int* fds, uint32_t fd_count, dserver_s2c_reply_batch_t* reply, dserver_s2c_batch_perform_f perform, void* context) {
+	if (call->op_count > DSERVER_S2C_BATCH_MAX_OPS) {
+		return false;
+	}
+
+	for (uint32_t i = 0; i < call->op_count; ++i) {
+		if (call->ops[i].fd >= 0 && (uint32_t)call->ops[i].fd >= fd_count) {
+			return false;
+		}
+	}
+
+	reply->op_count = 0;
+
+	for (uint32_t i = 0; i < call->op_count; ++i) {
+		const dserver_s2c_batch_op_t* op = &call->ops[i];
+
+		reply->results[i].return_value = (uint64_t)-1;
+		reply->results[i].errno_result = 0;
+		reply->results[i].reserved = 0;
+
+		perform(context, op, (op->fd >= 0) ? fds[op->fd] : -1, &reply->results[i]);
+		++reply->op_count;
+
+		if (reply->results[i].errno_result != 0) {
+			break;
+		}
+	}
+
+	return true;
+};
+
 typedef union dserver_s2c_call {
 	dserver_s2c_call_mmap_t mmap;
 	dserver_s2c_call_munmap_t munmap;
 	dserver_s2c_call_mprotect_t mprotect;
         dserver_s2c_call_msync_t msync;
+	dserver_s2c_call_batch_t batch;
 } dserver_s2c_call_t;
 
 #if __cplusplus
@@ -0,0 +1,134 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2022 Darling developers
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _DARLINGSERVER_CALL_STATS_HPP_
+#define _DARLINGSERVER_CALL_STATS_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace DarlingServer {
+	/**
+	 * A lock-free, log-bucketed histogram (in the style of HdrHistogram).
+	 *
+	 * Values are bucketed by their highest set bit and the 2 bits below it (so 4 sub-buckets per power of 2),
+	 * which keeps the relative error of reported percentiles under 25% while covering the full 64-bit range in 252 buckets.
+	 */
+	class LogHistogram {
+	public:
+		static constexpr size_t bucketCount = 252;
+
+	private:
+		std::atomic<uint64_t> _buckets[bucketCount] {};
+		std::atomic<uint64_t> _count = 0;
+		std::atomic<uint64_t> _sum = 0;
+		std::atomic<uint64_t> _max = 0;
+
+		static size_t _bucketForValue(uint64_t value);
+		static uint64_t _bucketUpperBound(size_t bucket);
+
+	public:
+		void record(uint64_t value);
+
+		uint64_t count() const;
+		uint64_t sum() const;
+		uint64_t max() const;
+
+		/**
+		 * Returns an upper bound for the given percentile (0-100) of the recorded values.
+		 */
+		uint64_t percentile(double percentile) const;
+	};
+
+	/**
+	 * Per-call-number statistics for RPC calls, cheap enough to always be collected.
+	 *
+	 * For each call number, this records the number of calls, a histogram of in-server latency
+	 * (from the call being received to its reply being sent), the total time spent queued, running, and suspended,
+	 * and the total and maximum reply sizes.
+	 *
+	 * Calls feed this automatically through the generated `_sendReply` wrappers; see `Call::_statsReplied`.
+	 */
+	class CallStats {
+	public:
+		struct Sample {
+			uint64_t latency;
+			uint64_t queued;
+			uint64_t running;
+			uint64_t suspended;
+			size_t replySize;
+		};
+
+		// CLOCK_MONOTONIC, in nanoseconds
+		static uint64_t now();
+
+		static void record(unsigned int callNumber, const Sample& sample);
+
+		/**
+		 * Returns the name of the given call number without the `dserver_callnum_` prefix (or `(unknown)`).
+		 */
+		static const char* callName(unsigned int callNumber);
+
+		/**
+		 * A snapshot of the statistics for a single call number. All times are in nanoseconds.
+		 */
+		struct Summary {
+			// without the `dserver_callnum_` prefix; never null
+			const char* name;
+			uint64_t count;
+			uint64_t latencyTotal;
+			uint64_t latencyP50;
+			uint64_t latencyP90;
+			uint64_t latencyP99;
+			uint64_t latencyMax;
+			uint64_t queued;
+			uint64_t running;
+			uint64_t suspended;
+			uint64_t replyBytes;
+			uint64_t maxReplySize;
+		};
+
+		/**
+		 * Returns a summary for every call that has been made at least once,
+		 * sorted by total in-server time (descending).
+		 */
+		static std::vector<Summary> summaries();
+
+		/**
+		 * Produces a human-readable table of the statistics for every call that has been made at least once,
+		 * sorted by total in-server time (descending).
+		 */
+		static std::string report();
+
+		/**
+		 * Writes report() to the given descriptor.
+		 */
+		static bool writeReport(int fd);
+
+		/**
+		 * Logs report() line-by-line (at the info level).
+		 */
+		static void logReport();
+	};
+};
+
+#endif // _DARLINGSERVER_CALL_STATS_HPP_
@@ -26,6 +26,7 @@
 #include <darlingserver/message.hpp>
 #include <darlingserver/registry.hpp>
 #include <darlingserver/logging.hpp>
+#include <darlingserver/call-stats.hpp>
 
 #include <memory>
 
@@ -52,8 +53,23 @@ namespace DarlingServer {
 
 		static DarlingServer::Log rpcReplyLog;
 
+		// timing for CallStats (all CLOCK_MONOTONIC, in nanoseconds).
+		// a call is only ever processed by one microthread at a time, so these don't need to be atomic.
+		uint64_t _statsReceivedAt;
+		uint64_t _statsStartedAt = 0;
+		uint64_t _statsLastTransitionAt = 0;
+		uint64_t _statsRunning = 0;
+		uint64_t _statsSuspended = 0;
+		bool _statsIsSuspended = false;
+		bool _statsRecorded = false;
+
 		static void sendReply(Message&& reply);
 
+		/**
+		 * Called by the generated `_sendReply` wrappers to record this call's statistics.
+		 */
+		void _statsReplied(size_t replySize);
+
 	public:
 		Call(std::shared_ptr<Thread> thread, Address replyAddress, dserver_rpc_callhdr_t* callHeader);
 		virtual ~Call();
@@ -72,6 +88,13 @@ namespace DarlingServer {
 		virtual bool isXNUTrap() const;
 		virtual bool isBSDTrap() const;
 
+		/**
+		 * Used by Thread to track how long this call spends running versus suspended.
+		 */
+		void statsStarted();
+		void statsSuspended();
+		void statsResumed();
+
 		DSERVER_CLASS_DECLS;
 	};
 
@@ -24,6 +24,8 @@
 #include <string>
 #include <sstream>
 #include <memory>
+#include <optional>
+#include <atomic>
 
 namespace DarlingServer {
 	class Thread;
@@ -33,6 +35,9 @@ namespace DarlingServer {
 	private:
 		std::string _category;
 
+		// 0 if this category uses the global level; otherwise, a `Type` value
+		const std::atomic<int>* _categoryLevel;
+
 		enum class Type {
 			Debug = 1,
 			Info = 2,
@@ -42,6 +47,9 @@ namespace DarlingServer {
 
 		void _log(Type type, std::string message) const;
 		static std::string _typeToString(Type type);
+		static std::optional<Type> _parseType(const char* string);
+		static std::atomic<int>& _globalLevel();
+		Type _minimumLevel() const;
 
 	public:
 		Log(std::string category);
@@ -60,6 +68,49 @@ namespace DarlingServer {
 		Stream info() const;
 		Stream warning() const;
 		Stream error() const;
+
+		/**
+		 * These can be used to skip expensive work that's only needed to produce a log message.
+		 *
+		 * Note that streams returned for disabled levels already ignore everything written to them,
+		 * so these are only necessary when computing the values themselves is expensive.
+		 */
+		bool debugEnabled() const;
+		bool infoEnabled() const;
+		bool warningEnabled() const;
+		bool errorEnabled() const;
+
+		/**
+		 * Changes logging settings at runtime; this is safe to call while other threads are logging.
+		 *
+		 * `spec` is a comma-separated list of settings, each of which is one of:
+		 *   * `<level>`: sets the global minimum level (one of `debug`, `info`, `warning`, or `error`).
+		 *   * `<category>=<level>`: sets the minimum level for a single category (e.g. `kqchan=debug`).
+		 *   * `<category>=default`: makes a category use the global level again.
+		 *   * `stderr=on` or `stderr=off`: enables or disables copying log output to stderr.
+		 *
+		 * Settings for categories that don't exist yet are kept and applied if they're created later.
+		 * If any setting is invalid, nothing is changed and `false` is returned.
+		 */
+		static bool configure(const std::string& spec);
+
+		/**
+		 * Waits for the background writer to write out every log record submitted before the call.
+		 *
+		 * This is meant for shutdown paths. It gives up after a second (e.g. if the writer is stuck on a full disk)
+		 * and returns `false` in that case.
+		 */
+		static bool flush();
+
+		/**
+		 * Synchronously writes out any log records that are still waiting in the background writer's buffer,
+		 * including the ones the writer is in the middle of writing.
+		 *
+		 * This is meant to be called from a fatal signal handler (so that the errors leading up to the crash aren't lost)
+		 * and is async-signal-safe, but it's best-effort: it doesn't synchronize with the writer thread,
+		 * so records the writer is writing at the same time may be written twice, and records still being submitted are skipped.
+		 */
+		static void flushForCrash();
 	};
 
 	class Loggable {
@@ -73,7 +124,10 @@ namespace DarlingServer {
 	private:
 		Type _type;
 		const Log& _log;
-		std::ostringstream _buffer;
+		bool _enabled;
+
+		// only constructed once something is actually written to an enabled stream
+		std::optional<std::ostringstream> _buffer;
 
 		Stream(Type type, const Log& log);
 
@@ -90,7 +144,13 @@ namespace DarlingServer {
 
 		template<class T>
 		std::enable_if_t<!std::is_base_of_v<Loggable, T>, Stream&> operator<<(const T& value) {
-			_buffer << value;
+			if (!_enabled) {
+				return *this;
+			}
+			if (!_buffer) {
+				_buffer.emplace();
+			}
+			*_buffer << value;
 			return *this;
 		};
 	};
@@ -174,6 +174,7 @@ namespace DarlingServer {
 		bool receiveMany(int socket);
 
 		bool empty() const;
+		size_t size() const;
 	};
 };
 
@@ -0,0 +1,78 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2022 Darling developers
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _DARLINGSERVER_METRICS_FORMAT_HPP_
+#define _DARLINGSERVER_METRICS_FORMAT_HPP_
+
+#include <cstdint>
+#include <string>
+
+namespace DarlingServer {
+	/**
+	 * Writes the Prometheus text exposition format (version 0.0.4) and wraps it in responses for the metrics socket.
+	 *
+	 * This is kept separate from `MetricsEndpoint` (and from the rest of the server) so that `tests/metrics-check`
+	 * can serve the same text and responses from a fixture listener.
+	 */
+	class MetricsWriter {
+	private:
+		std::string _text;
+
+	public:
+		/**
+		 * Adds the `# HELP` and `# TYPE` lines for a metric. Its samples must follow.
+		 */
+		void addHeader(const char* name, const char* type, const char* help);
+
+		/**
+		 * Adds a sample. `labels` is a comma-separated list of `name="value"` pairs (see `escapeLabelValue`), or empty for none.
+		 */
+		void addSample(const std::string& name, const std::string& labels, const std::string& value);
+
+		/**
+		 * Adds a metric with a single unlabeled sample.
+		 */
+		void addMetric(const char* name, const char* type, const char* help, uint64_t value);
+
+		std::string take();
+
+		static std::string escapeLabelValue(const char* value);
+		static std::string formatSeconds(uint64_t nanoseconds);
+
+		/**
+		 * Whether the request's first line is an HTTP request line (e.g. "GET /metrics HTTP/1.1"); anything else is treated as a raw request.
+		 */
+		static bool isHTTPRequest(const std::string& request);
+
+		/**
+		 * Whether enough of the request has been received to respond to it.
+		 *
+		 * Raw requests are complete after their first line (or at the end of input, so clients can send nothing at all);
+		 * HTTP requests are complete once all of their headers have been received (or at the end of input).
+		 */
+		static bool isRequestComplete(const std::string& request, bool endOfInput);
+
+		/**
+		 * Produces the response to send for the given request: an HTTP response for HTTP requests or just the body otherwise.
+		 */
+		static std::string response(const std::string& request, std::string body);
+	};
+};
+
+#endif // _DARLINGSERVER_METRICS_FORMAT_HPP_
@@ -0,0 +1,80 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2022 Darling developers
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _DARLINGSERVER_METRICS_HPP_
+#define _DARLINGSERVER_METRICS_HPP_
+
+#include <memory>
+#include <string>
+
+#include <darlingserver/monitor.hpp>
+#include <darlingserver/utility.hpp>
+
+namespace DarlingServer {
+	class Server;
+
+	/**
+	 * A local stream socket that serves the server's statistics in the Prometheus text exposition format.
+	 *
+	 * This is only created when the `DSERVER_METRICS` environment variable is set to a true value.
+	 * Clients may either send a plain HTTP GET request (e.g. `curl --unix-socket`), in which case they get an HTTP response,
+	 * or just send a newline (or shut down their write side), in which case they get the raw exposition text.
+	 * Either way, the connection is closed once the response has been written.
+	 * The text and responses themselves come from `MetricsWriter` (see `metrics-format.hpp`);
+	 * `tests/metrics-check` checks them in all of these ways (and can also scrape a running server with `--socket`).
+	 *
+	 * Everything here runs on the main event loop (through monitors), so none of it needs to be locked.
+	 */
+	class MetricsEndpoint {
+	private:
+		Server& _server;
+		std::string _socketPath;
+		std::shared_ptr<Monitor> _listenerMonitor;
+		size_t _clientCount = 0;
+
+		struct Client;
+
+		void _accept();
+		void _read(std::shared_ptr<Client> client, std::shared_ptr<Monitor> monitor, Monitor::Event events);
+		void _respond(std::shared_ptr<Client> client, std::shared_ptr<Monitor> monitor);
+		void _write(std::shared_ptr<Client> client, std::shared_ptr<Monitor> monitor);
+		void _close(std::shared_ptr<Client> client, std::shared_ptr<Monitor> monitor);
+
+	public:
+		MetricsEndpoint(Server& server, std::string socketPath);
+		~MetricsEndpoint();
+
+		MetricsEndpoint(const MetricsEndpoint&) = delete;
+		MetricsEndpoint& operator=(const MetricsEndpoint&) = delete;
+		MetricsEndpoint(MetricsEndpoint&&) = delete;
+		MetricsEndpoint& operator=(MetricsEndpoint&&) = delete;
+
+		/**
+		 * Whether the endpoint was requested with the `DSERVER_METRICS` environment variable.
+		 */
+		static bool enabled();
+
+		/**
+		 * Produces the current exposition text.
+		 */
+		std::string render();
+	};
+};
+
+#endif // _DARLINGSERVER_METRICS_HPP_
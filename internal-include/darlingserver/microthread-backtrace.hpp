@@ -0,0 +1,55 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2022 Darling developers
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _DARLINGSERVER_MICROTHREAD_BACKTRACE_HPP_
+#define _DARLINGSERVER_MICROTHREAD_BACKTRACE_HPP_
+
+#include <string>
+
+namespace DarlingServer {
+	/**
+	 * Dumps the state of every registered microthread, for diagnosing hangs.
+	 *
+	 * For each thread, this prints its IDs, its owning process's IDs, the call it's currently processing, and why it's blocked (if it is).
+	 * Threads that are suspended on their own stack (i.e. without a continuation) also get a backtrace, produced by walking the
+	 * frame pointer chain starting from the context they saved when they suspended. Every frame pointer is checked against the
+	 * bounds of the thread's stack before it's followed, so a broken chain just ends the backtrace early.
+	 *
+	 * The walk is only reliable when the server is built with frame pointers (e.g. with `DSERVER_EXTENDED_DEBUG`);
+	 * otherwise, backtraces are usually cut short after the first frame or two. Frames are symbolized with `dladdr`,
+	 * so static functions only show up as `module+offset` (which can be fed to `addr2line`).
+	 *
+	 * Running threads are not interrupted, so they're only reported as running. Threads whose lock is held by someone else
+	 * are reported as `(locked)` rather than waited on, so a thread stuck holding its own lock can't hang (or even slow down) the dump.
+	 */
+	class MicrothreadBacktrace {
+	public:
+		/**
+		 * Produces the human-readable dump.
+		 */
+		static std::string report();
+
+		/**
+		 * Writes report() to the given descriptor.
+		 */
+		static bool writeReport(int fd);
+	};
+};
+
+#endif // _DARLINGSERVER_MICROTHREAD_BACKTRACE_HPP_
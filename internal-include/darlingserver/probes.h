@@ -0,0 +1,69 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2022 Darling developers
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _DARLINGSERVER_PROBES_H_
+#define _DARLINGSERVER_PROBES_H_
+
+/**
+ * USDT (userspace statically-defined tracing) probes, enabled with the `DSERVER_USDT` CMake option.
+ *
+ * Each probe compiles down to a nop plus an ELF note describing where its arguments live,
+ * so tools like bpftrace and perf can attach to them in a running server without rebuilding it.
+ * When the option is off, the probes compile to nothing at all (and their arguments are not evaluated).
+ *
+ * All probes use the `darlingserver` provider. Probe arguments must be plain integers or pointers.
+ * The current probes (and their arguments) are:
+ *
+ *   call__receive(call number, pid, tid)            a call was received and its process/thread looked up
+ *   call__dispatch(call number, pid, tid)           a call started running on its microthread
+ *   call__reply(call number, reply size, latency)   a call's reply was queued (latency in nanoseconds)
+ *   microthread__switch__in(tid, nstid, resumed)    a worker switched to a microthread (resumed = continuing a suspended call)
+ *   microthread__switch__out(tid, nstid, suspended) a microthread returned to its worker
+ *   s2c__begin(tid, message number)                 an S2C call is starting
+ *   s2c__end(tid, message number, duration)         an S2C call finished (duration in nanoseconds)
+ *   kqchan__notify(pid, notification number)        a kqchan notification was sent
+ *   kqchan__read(pid, nstid, default buffer size)   a kqchan read request was received
+ *   timer__arm(deadline, leeway)                    the timer descriptor was (re)armed (absolute CLOCK_MONOTONIC nanoseconds; 0 = disarmed)
+ *   timer__fire(expirations)                        the timer descriptor expired
+ *   mutex__contended(mutex, owner)                  a microthread is about to block on a duct-tape mutex
+ *   process__register(pid, nspid)                   a process was registered
+ *   process__death(pid, nspid)                      a process died
+ *   thread__register(tid, nstid, pid)               a thread was registered
+ *   thread__death(tid, nstid, pid)                  a thread died
+ *
+ * See `tools/bpftrace` for example scripts that use these.
+ */
+
+#if DSERVER_USDT
+	#include <sys/sdt.h>
+
+	#define DSERVER_PROBE0(name) STAP_PROBE(darlingserver, name)
+	#define DSERVER_PROBE1(name, a1) STAP_PROBE1(darlingserver, name, a1)
+	#define DSERVER_PROBE2(name, a1, a2) STAP_PROBE2(darlingserver, name, a1, a2)
+	#define DSERVER_PROBE3(name, a1, a2, a3) STAP_PROBE3(darlingserver, name, a1, a2, a3)
+	#define DSERVER_PROBE4(name, a1, a2, a3, a4) STAP_PROBE4(darlingserver, name, a1, a2, a3, a4)
+#else
+	#define DSERVER_PROBE0(name) ((void)0)
+	#define DSERVER_PROBE1(name, a1) ((void)0)
+	#define DSERVER_PROBE2(name, a1, a2) ((void)0)
+	#define DSERVER_PROBE3(name, a1, a2, a3) ((void)0)
+	#define DSERVER_PROBE4(name, a1, a2, a3, a4) ((void)0)
+#endif
+
+#endif // _DARLINGSERVER_PROBES_H_
@@ -27,6 +27,8 @@
 #include <shared_mutex>
 #include <unordered_map>
 #include <unordered_set>
+#include <map>
+#include <set>
 
 #include <darlingserver/duct-tape.h>
 #include <darlingserver/utility.hpp>
@@ -91,6 +93,16 @@ namespace DarlingServer {
 		std::string _executablePath;
 		bool _dead = false;
 		std::shared_ptr<Process> _selfReference = nullptr;
+		mutable std::mutex _memoryFDLock;
+		mutable std::shared_ptr<FD> _memoryFD;
+		mutable bool _memoryFDUnavailable = false;
+		mutable int _memoryFDOpenError = 0;
+		uint64_t _s2cFeatures = 0;
+		std::mutex _arenaLock;
+		std::vector<std::pair<uintptr_t, size_t>> _arenaChunks;
+		std::map<uintptr_t, size_t> _arenaFreeRanges;
+		// the same ranges as `_arenaFreeRanges`, ordered by (size, address) for best-fit lookups
+		std::set<std::pair<size_t, uintptr_t>> _arenaFreeRangesBySize;
 
 #if DSERVER_EXTENDED_DEBUG
 		std::unordered_map<uint32_t, uintptr_t> _registeredNames;
@@ -102,6 +114,11 @@ namespace DarlingServer {
 		friend struct ::DTapeHooks;
 
 		bool _readOrWriteMemory(bool isWrite, uintptr_t remoteAddress, void* localBuffer, size_t length, int* errorCode) const;
+		bool _readOrWriteMemoryProcFS(const FD& memoryFD, bool isWrite, uintptr_t remoteAddress, void* localBuffer, size_t length, int* errorCode) const;
+		bool _readOrWriteMemoryVM(bool isWrite, uintptr_t remoteAddress, void* localBuffer, size_t length, int* errorCode) const;
+		std::shared_ptr<FD> _getMemoryFD(int* openError = nullptr) const;
+		void _dropMemoryFD(const std::shared_ptr<FD>& staleFD) const;
+		void _resetMemoryFD();
 
 		void _notifyListeningKqchannels(uint32_t event, int64_t data);
 
@@ -115,6 +132,17 @@ namespace DarlingServer {
 
 		std::shared_ptr<Thread> _pickS2CThread(void) const;
 
+		bool _arenaUsable() const;
+		uintptr_t _arenaAllocate(size_t size);
+		void _arenaAddFreeRange(uintptr_t address, size_t size);
+		void _arenaInsertFreeRangeLocked(uintptr_t address, size_t size);
+		void _arenaSetFreeRangeLocked(uintptr_t address, size_t size);
+		std::map<uintptr_t, size_t>::iterator _arenaEraseFreeRangeLocked(std::map<uintptr_t, size_t>::iterator it);
+		void _arenaClaimRange(uintptr_t address, size_t size);
+		void _arenaClaimRangeLocked(uintptr_t address, size_t size);
+		std::vector<std::pair<uintptr_t, size_t>> _arenaTakeReleasableChunks();
+		void _resetArena();
+
 		void _dispose();
 
 	public:
@@ -176,12 +204,25 @@ namespace DarlingServer {
 		std::string executablePath() const;
 		void setExecutablePath(std::string path);
 
+		/**
+		 * The optional S2C features (`DSERVER_S2C_FEATURE_*`) that the process has told us it supports.
+		 */
+		uint64_t s2cFeatures() const;
+		void setS2CFeatures(uint64_t features);
+
 		uintptr_t allocatePages(size_t pageCount, int protection, uintptr_t addressHint, bool fixed, bool overwrite);
 		void freePages(uintptr_t address, size_t pageCount);
-		uintptr_t mapFile(int fd, size_t pageCount, int protection, uintptr_t addressHint, size_t pageOffset, bool fixed, bool overwrite);
+		uintptr_t mapFile(int fd, size_t pageCount, int protection, uintptr_t addressHint, size_t pageOffset, bool fixed, bool overwrite, bool copyOnWrite = false);
 		void changeProtection(uintptr_t address, size_t pageCount, int protection);
 		void syncMemory(uintptr_t address, size_t size, int sync_flags);
 
+		/**
+		 * Performs the given memory operations in order, using as few S2C calls as possible, and fills in their results.
+		 *
+		 * Like the `task_batch_memory` duct-tape hook, this stops at the first operation that fails.
+		 */
+		void performMemoryOps(dtape_memory_op_t* ops, size_t opCount);
+
 		uintptr_t getNextRegion(uintptr_t address) const;
 
 		/**
@@ -215,6 +215,23 @@ namespace DarlingServer {
 			std::shared_lock lock(_rwlock);
 			return _map.size();
 		};
+
+		/**
+		 * Returns a snapshot of all the entries currently in the registry.
+		 *
+		 * Entries may be unregistered as soon as this returns, but the returned references keep them alive.
+		 */
+		std::vector<std::shared_ptr<Entry>> copyEntries() const {
+			std::vector<std::shared_ptr<Entry>> result;
+			std::shared_lock lock(_rwlock);
+
+			result.reserve(_map.size());
+			for (auto& [id, entry]: _map) {
+				result.push_back(entry);
+			}
+
+			return result;
+		};
 	};
 
 	Registry<Process>& processRegistry();
@@ -0,0 +1,93 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2022 Darling developers
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _DARLINGSERVER_SCHED_TRACE_HPP_
+#define _DARLINGSERVER_SCHED_TRACE_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace DarlingServer {
+	class Thread;
+	class Call;
+
+	/**
+	 * Optional microthread scheduling instrumentation, enabled with the `DSERVER_SCHED_TRACE` environment variable.
+	 *
+	 * For each microthread, this tracks why it blocked (using the block info duct-tape records before suspending) and for how long,
+	 * how long it sat in the work queue after becoming runnable before a worker picked it up, and how long each of its run slices lasted.
+	 * These are aggregated into per-reason histograms and into "off-CPU" totals per call and reason,
+	 * which can be exported in the folded-stack format used by flame graph tools.
+	 *
+	 * The hooks must be called in this order for each run of a microthread: blocked() (optional), runnable(), running(), stopped().
+	 */
+	class SchedTrace {
+	public:
+		struct ThreadState {
+			std::atomic<uint64_t> runningSince = 0;
+			std::atomic<uint64_t> blockedAt = 0;
+			std::atomic<uint64_t> runnableAt = 0;
+
+			// these are written by the thread itself before `blockedAt` is published
+			uint32_t blockCategory = 0;
+			uint32_t blockCallNumber = 0;
+			bool blockHasCall = false;
+		};
+
+		static bool enabled();
+
+		/**
+		 * Called by a microthread that's about to suspend itself. The thread's lock must be held.
+		 */
+		static void blocked(Thread& thread);
+
+		/**
+		 * Called whenever a microthread is queued to run.
+		 */
+		static void runnable(Thread& thread);
+
+		/**
+		 * Called when a worker starts running a microthread for the given call (which may be null). The thread's lock must be held.
+		 */
+		static void running(Thread& thread, const Call* call);
+
+		/**
+		 * Called when a microthread returns to its worker (either because it finished or because it suspended).
+		 */
+		static void stopped(Thread& thread);
+
+		/**
+		 * Produces a human-readable table of the block reason, queueing delay, and run slice histograms.
+		 */
+		static std::string report();
+
+		/**
+		 * Logs report() line-by-line (at the info level).
+		 */
+		static void logReport();
+
+		/**
+		 * Writes the off-CPU totals to the given path in the folded-stack format (`call;frame;reason microseconds`).
+		 */
+		static bool writeOffCPU(const std::string& path);
+	};
+};
+
+#endif // _DARLINGSERVER_SCHED_TRACE_HPP_
@@ -20,6 +20,7 @@
 #ifndef _DARLINGSERVER_SERVER_HPP_
 #define _DARLINGSERVER_SERVER_HPP_
 
+#include <memory>
 #include <string>
 #include <sys/epoll.h>
 #include <thread>
@@ -32,6 +33,8 @@
 #include <darlingserver/monitor.hpp>
 
 namespace DarlingServer {
+	class MetricsEndpoint;
+
 	// NOTE: server instances MUST be created with `new` rather than as a normal local/stack variable
 	class Server {
 		friend class Monitor;
@@ -50,13 +53,30 @@ namespace DarlingServer {
 		int _timerFD;
 		uint64_t _currentTimerDeadline = 0;
 		std::mutex _timerLock;
+
+		struct TimerStats {
+			uint64_t armRequests = 0;
+			uint64_t coalesced = 0;
+			uint64_t arms = 0;
+			uint64_t fires = 0;
+		};
+
+		// these are all protected by the timer lock
+		TimerStats _timerStats;
+		TimerStats _timerStatsWindow;
+		TimerStats _timerStatsPerSecond;
+		uint64_t _timerStatsWindowStart = 0;
 		std::vector<std::shared_ptr<Monitor>> _monitors;
 		std::vector<std::shared_ptr<Monitor>> _monitorsWaitingToDie;
 		std::mutex _monitorsLock;
 
 		void _worker(std::shared_ptr<Thread> thread);
+		void _rollTimerStats();
+
+		std::unique_ptr<MetricsEndpoint> _metrics;
 
 		friend struct ::DTapeHooks;
+		friend class MetricsEndpoint;
 
 	public:
 		Server(std::string prefix);
@@ -81,6 +101,8 @@ namespace DarlingServer {
 		void removeMonitor(std::shared_ptr<Monitor> monitor);
 
 		void sendMessage(Message&& message);
+
+		void logTimerStats();
 	};
 };
 
@@ -53,6 +53,7 @@ namespace DarlingServer {
 		size_t _stackSize;
 		bool _useGuardPages;
 		std::vector<void*> _stacks;
+		size_t _inUseCount = 0;
 		std::mutex _mutex;
 
 		static void* _allocate(size_t stackSize, bool useGuardPages);
@@ -63,6 +64,14 @@ namespace DarlingServer {
 
 		void allocate(Stack& stack);
 		void free(Stack& stack);
+
+		struct Stats {
+			size_t idleStacks;
+			size_t stacksInUse;
+			size_t stackSize;
+		};
+
+		Stats stats();
 	};
 };
 
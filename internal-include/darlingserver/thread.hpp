@@ -23,6 +23,7 @@
 #include <memory>
 #include <sys/types.h>
 #include <mutex>
+#include <atomic>
 #include <shared_mutex>
 #include <condition_variable>
 #include <stack>
@@ -32,6 +33,7 @@
 #include <darlingserver/duct-tape.h>
 #include <darlingserver/logging.hpp>
 #include <darlingserver/stack-pool.hpp>
+#include <darlingserver/sched-trace.hpp>
 
 #include <ucontext.h>
 
@@ -44,6 +46,8 @@ namespace DarlingServer {
 	class Thread: public std::enable_shared_from_this<Thread>, public Loggable {
 		friend class Process;
 		friend class Call; // HACK, see call.cpp
+		friend class SchedTrace;
+		friend class MicrothreadBacktrace;
 
 	public:
 		enum class RunState {
@@ -87,8 +91,6 @@ namespace DarlingServer {
 		std::shared_ptr<Thread> _impersonating = nullptr;
 		bool _processingSignal = false;
 		bool _pendingCallOverride = false;
-		dtape_semaphore_t* _s2cPerformSempahore = nullptr;
-		dtape_semaphore_t* _s2cReplySempahore = nullptr;
 		std::optional<Message> _s2cReply = std::nullopt;
 		std::condition_variable_any _runningCondvar;
 		DeferralState _deferralState = DeferralState::NotDeferred;
@@ -98,8 +100,16 @@ namespace DarlingServer {
 		ucontext_t _syscallReturnHereDuringInterrupt;
 		bool _didSyscallReturnDuringInterrupt = false;
 		bool _handlingInterruptedCall = false;
-		dtape_semaphore_t* _s2cInterruptEnterSemaphore = nullptr;
-		dtape_semaphore_t* _s2cInterruptExitSemaphore = nullptr;
+
+		struct S2CSemaphores {
+			dtape_semaphore_t* perform;
+			dtape_semaphore_t* reply;
+			dtape_semaphore_t* interruptEnter;
+			dtape_semaphore_t* interruptExit;
+		};
+
+		// most threads never perform an S2C call, so these are only created when they're first needed (see `_getS2CSemaphores`)
+		std::atomic<S2CSemaphores*> _s2cSemaphores = nullptr;
 		bool _deferReplyForS2C = false;
 		std::optional<Message> _deferredReply = std::nullopt;
 
@@ -114,6 +124,7 @@ namespace DarlingServer {
 		std::optional<Message> _pendingSavedReply = std::nullopt;
 		bool _dead = false;
 		std::shared_ptr<Thread> _selfReference = nullptr;
+		SchedTrace::ThreadState _schedState;
 
 		static void microthreadWorker();
 		static void microthreadContinuation();
@@ -127,6 +138,19 @@ namespace DarlingServer {
 		int _mprotect(uintptr_t address, size_t length, int protection, int& outErrno);
 		int _msync(uintptr_t address, size_t size, int sync_flags, int& outErrno);
 
+		/**
+		 * Performs multiple S2C memory operations using as few S2C exchanges as possible.
+		 *
+		 * The `fd` member of each operation should be a local descriptor (or -1); it's converted into a message descriptor index as necessary.
+		 * Operations are performed in order and processing stops after the first failure;
+		 * operations that were never performed report `ECANCELED` (or `EINTR` if we were interrupted).
+		 *
+		 * If the client hasn't advertised `DSERVER_S2C_FEATURE_BATCH`, the operations are performed one at a time
+		 * with the single-operation S2C calls instead.
+		 */
+		std::vector<dserver_s2c_batch_result_t> _s2cBatch(const std::vector<dserver_s2c_batch_op_t>& ops);
+		void _s2cPerformIndividually(const std::vector<dserver_s2c_batch_op_t>& ops, std::vector<dserver_s2c_batch_result_t>& results);
+
 		void _deferLocked(bool wait, std::unique_lock<std::shared_mutex>& lock);
 		void _undeferLocked(std::unique_lock<std::shared_mutex>& lock);
 
@@ -138,6 +162,25 @@ namespace DarlingServer {
 		void _dispose();
 		void _scheduleRelease();
 
+		/**
+		 * Returns this thread's S2C semaphores, creating them if necessary.
+		 *
+		 * Creating the semaphores requires a microthread context, so this must only be called on a microthread.
+		 * Code running outside of a microthread (e.g. the main loop) must use _existingS2CSemaphores() instead.
+		 *
+		 * Throws a `std::system_error` if the semaphores can't be created.
+		 */
+		S2CSemaphores& _getS2CSemaphores();
+
+		/**
+		 * Returns this thread's S2C semaphores if they've already been created, or `nullptr` otherwise.
+		 *
+		 * _s2cPerform() always creates them before sending an S2C call, so they're guaranteed to exist while a call is in flight.
+		 */
+		S2CSemaphores* _existingS2CSemaphores() const;
+
+		void _destroyS2CSemaphores();
+
 		static void _handleInterruptEnterForCurrentThread();
 
 		static StackPool stackPool;
@@ -152,6 +195,8 @@ namespace DarlingServer {
 		Thread(KernelThreadConstructorTag tag);
 		~Thread() noexcept(false);
 
+		static StackPool::Stats stackPoolStats();
+
 		void registerWithProcess();
 
 		Thread(const Thread&) = delete;
@@ -232,7 +277,7 @@ namespace DarlingServer {
 
 		uintptr_t allocatePages(size_t pageCount, int protection, uintptr_t addressHint, bool fixed, bool overwrite);
 		void freePages(uintptr_t address, size_t pageCount);
-		uintptr_t mapFile(int fd, size_t pageCount, int protection, uintptr_t addressHint, size_t pageOffset, bool fixed, bool overwrite);
+		uintptr_t mapFile(int fd, size_t pageCount, int protection, uintptr_t addressHint, size_t pageOffset, bool fixed, bool overwrite, bool copyOnWrite = false);
 		void changeProtection(uintptr_t address, size_t pageCount, int protection);
 		void syncMemory(uintptr_t address, size_t size, int sync_flags);
 
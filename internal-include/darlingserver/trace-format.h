@@ -0,0 +1,90 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2022 Darling developers
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _DARLINGSERVER_TRACE_FORMAT_H_
+#define _DARLINGSERVER_TRACE_FORMAT_H_
+
+#include <stdint.h>
+
+//
+// binary trace dump format
+//
+// a dump consists of a `dserver_trace_header_t`, followed by `ring_count` rings.
+// each ring consists of a `dserver_trace_ring_header_t` followed by `event_count` events (`dserver_trace_event_t`), oldest first.
+//
+// everything is in host byte order; dumps are only meant to be decoded on the same machine (or at least the same architecture).
+//
+
+#define DSERVER_TRACE_MAGIC "DSTRACE"
+#define DSERVER_TRACE_VERSION 1
+
+typedef enum dserver_trace_event_type {
+	dserver_trace_event_type_invalid = 0,
+
+	// `arg` is the call number
+	dserver_trace_event_type_call_start = 1,
+	dserver_trace_event_type_call_end = 2,
+
+	dserver_trace_event_type_microthread_suspend = 3,
+	dserver_trace_event_type_microthread_resume = 4,
+
+	// `arg` is the expected S2C reply number
+	dserver_trace_event_type_s2c_begin = 5,
+	dserver_trace_event_type_s2c_end = 6,
+
+	// `arg` is the kqchan's notification count
+	dserver_trace_event_type_kqchan_notify = 7,
+
+	// `arg` is the number of timerfd expirations
+	dserver_trace_event_type_timer_fire = 8,
+} dserver_trace_event_type_t;
+
+typedef struct dserver_trace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t ring_count;
+
+	// CLOCK_MONOTONIC and CLOCK_REALTIME timestamps (in nanoseconds) taken at the same time when the dump was created;
+	// these allow event timestamps (which use CLOCK_MONOTONIC) to be converted to wall-clock time
+	uint64_t monotonic_time;
+	uint64_t realtime_time;
+} dserver_trace_header_t;
+
+typedef struct dserver_trace_ring_header {
+	uint32_t ring_index;
+	uint32_t event_count;
+} dserver_trace_ring_header_t;
+
+typedef struct dserver_trace_event {
+	// CLOCK_MONOTONIC, in nanoseconds
+	uint64_t timestamp;
+	uint16_t type;
+	uint16_t reserved;
+
+	// the index of the ring this event was recorded in (one ring per darlingserver worker/thread)
+	uint32_t ring_index;
+
+	// Linux PID and TID (for kernel microthreads, the TID is the kernel thread ID)
+	int32_t pid;
+	int32_t tid;
+
+	uint64_t arg;
+} dserver_trace_event_t;
+
+#endif // _DARLINGSERVER_TRACE_FORMAT_H_
@@ -0,0 +1,75 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2022 Darling developers
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _DARLINGSERVER_TRACE_HPP_
+#define _DARLINGSERVER_TRACE_HPP_
+
+#include <string>
+#include <sys/types.h>
+
+#include <darlingserver/trace-format.h>
+
+namespace DarlingServer {
+	class Thread;
+
+	/**
+	 * An always-on, low-overhead binary event trace.
+	 *
+	 * Each darlingserver thread (workers, the main loop, etc.) records events into its own fixed-size ring,
+	 * so recording an event is just a timestamp and a few stores. When a thread exits, its ring is kept around
+	 * (and later reused by a new thread) so that its history is still available in dumps.
+	 *
+	 * Dumps can be decoded with the `dserver-trace-decode` tool.
+	 */
+	class Trace {
+	public:
+		enum class Event: uint16_t {
+			CallStart = dserver_trace_event_type_call_start,
+			CallEnd = dserver_trace_event_type_call_end,
+			MicrothreadSuspend = dserver_trace_event_type_microthread_suspend,
+			MicrothreadResume = dserver_trace_event_type_microthread_resume,
+			S2CBegin = dserver_trace_event_type_s2c_begin,
+			S2CEnd = dserver_trace_event_type_s2c_end,
+			KqchanNotify = dserver_trace_event_type_kqchan_notify,
+			TimerFire = dserver_trace_event_type_timer_fire,
+		};
+
+		static void record(Event event, pid_t pid, pid_t tid, uint64_t arg = 0);
+		static void record(Event event, const Thread& thread, uint64_t arg = 0);
+
+		/**
+		 * Sets the directory that dumps are written to.
+		 *
+		 * This must be called before any dumps are written (including crash dumps).
+		 */
+		static void setDumpDirectory(const std::string& directory);
+
+		/**
+		 * Writes all the rings to `dserver-trace.bin` in the dump directory.
+		 */
+		static bool dump();
+
+		/**
+		 * Like dump(), but writes to `dserver-trace-crash.bin` instead. This is async-signal-safe.
+		 */
+		static void dumpForCrash();
+	};
+};
+
+#endif // _DARLINGSERVER_TRACE_HPP_
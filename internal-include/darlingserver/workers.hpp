@@ -158,6 +158,17 @@ namespace DarlingServer {
 		WorkQueue(WorkQueue&&) = delete;
 		WorkQueue& operator=(WorkQueue&&) = delete;
 
+		struct Stats {
+			size_t pendingItems;
+			size_t workers;
+			size_t idleWorkers;
+		};
+
+		Stats stats() {
+			std::unique_lock lock(_queueMutex);
+			return Stats { _workItems.size(), _workerThreads.size(), _threadsAvailable };
+		};
+
 		void push(WorkItem workItem) {
 			std::unique_lock lock(_queueMutex);
 			_workItems.push(std::move(workItem));
@@ -16,6 +16,11 @@ XNU_BSD_TRAP_CALL      = XNU_TRAP_CALL | XNU_TRAP_NOPREFIX | XNU_TRAP_NOSUFFIX |
 UNMANAGED_CALL         = 1 << 6
 ALLOW_INTERRUPTIONS    = 1 << 7
 PUSH_UNKNOWN_REPLIES   = 1 << 8
+PRIVILEGED_CALL        = 1 << 9
+
+# must match DSERVER_S2C_BATCH_MAX_FDS in rpc-supplement.h;
+# this is how many descriptors an S2C call can carry, so it's how many a call that might receive one needs room for
+S2C_MAX_FD_COUNT = 4
 
 # NOTE: in Python 3.7+, we can rely on dictionaries having their items in insertion order.
 #       unfortunately, we can't expect everyone building Darling to have Python 3.7+ installed.
@@ -99,6 +104,10 @@ calls = [
 	#     the way this works is that calls with this flag allocate enough space in the reply buffer to hold all possible replies;
 	#     if they receive an unexpected reply, they push it back to the server. the server then holds on to the reply
 	#     and re-sends it when appropriate (e.g. for interrupt_enter, that's after interrupt_exit is called).
+	#   PRIVILEGED_CALL
+	#     this indicates that the call may only be made by privileged callers: processes outside the container running as root
+	#     or as the same user as darlingserver. other callers receive EPERM and the call is never processed.
+	#     this is meant for server administration calls (usually also UNMANAGED_CALL) and requires the call to have no reply parameters.
 	#
 	# TODO: we should probably add a class for these calls (so it's more readable).
 	#       we could even create a DSL (à-la-MIG), but that's probably overkill since
@@ -602,6 +611,39 @@ calls = [
 	], [
 		('retval', 'uint32_t'),
 	], XNU_BSD_TRAP_CALL | XNU_TRAP_NO_DTAPE_DEF | ALLOW_INTERRUPTIONS),
+
+	#
+	# server administration
+	#
+
+	# the spec (see `Log::configure`) is read from the given descriptor (usually a pipe) until EOF,
+	# since unmanaged callers have no memory the server can read from
+	('log_control', [
+		('spec_pipe', '@fd'),
+	], [], UNMANAGED_CALL | PRIVILEGED_CALL),
+
+	# writes a per-call-type statistics table (see `CallStats::report`) to the given descriptor
+	# (usually a memfd or a regular file; writing to a pipe the caller isn't reading from yet would block the server)
+	('call_stats_dump', [
+		('output_fd', '@fd'),
+	], [], UNMANAGED_CALL | PRIVILEGED_CALL),
+
+	# writes the state and backtrace of every microthread (see `MicrothreadBacktrace::report`) to the given descriptor
+	# (with the same caveats as `call_stats_dump`)
+	('microthread_backtraces', [
+		('output_fd', '@fd'),
+	], [], UNMANAGED_CALL | PRIVILEGED_CALL),
+
+	#
+	# client capabilities
+	#
+
+	# advertises the optional S2C features (`DSERVER_S2C_FEATURE_*`) that the calling process supports.
+	# these are reset on every checkin (since an exec may load a client that doesn't support the same features),
+	# so clients must send this again after each checkin.
+	('s2c_features', [
+		('features', 'uint64_t'),
+	], []),
 ]
 
 def parse_type(param_tuple, is_public):
@@ -826,6 +868,24 @@ for call in calls:
 	internal_header.write("\tcase dserver_callnum_" + call_name + ": \\\n")
 internal_header.write("\n")
 
+# one past the highest call number (without DSERVER_CALL_UNMANAGED_FLAG); useful for tables indexed by call number
+internal_header.write("#define DSERVER_CALLNUM_COUNT " + str(len(calls) + 1) + "U\n\n")
+
+internal_header.write("#define DSERVER_PRIVILEGED_CALLNUM_CASES \\\n")
+for call in calls:
+	call_name = call[0]
+	reply_parameters = call[2]
+	flags = call[3] if len(call) >= 4 else 0
+
+	if (flags & PRIVILEGED_CALL) == 0:
+		continue
+
+	if len(reply_parameters) > 0:
+		sys.exit("Privileged call " + call_name + " must not have reply parameters")
+
+	internal_header.write("\tcase dserver_callnum_" + call_name + ": \\\n")
+internal_header.write("\n")
+
 internal_header.write("#define DSERVER_CONSTRUCT_CASES \\\n")
 for call in calls:
 	call_name = call[0]
@@ -953,6 +1013,7 @@ for call in calls:
 			internal_header.write("\t\t\t} \\\n")
 
 		internal_header.write("\t\t\treplyStruct->body." + param_name + " = " + val + "; \\\n")
+	internal_header.write("\t\t\t_statsReplied(reply.data().size()); \\\n")
 	internal_header.write("\t\t\tif (auto thread = _thread.lock()) { \\\n")
 	internal_header.write("\t\t\t\tthread->pushCallReply(shared_from_this(), std::move(reply)); \\\n")
 	internal_header.write("\t\t\t} else { \\\n")
@@ -1258,8 +1319,11 @@ for call in calls:
 
 	library_source.write("\t} reply_msg;\n")
 
-	# we always allocate space for at least one FD, since S2C calls might send a descriptor
-	library_source.write("\tint fds[" + str(max(1, fd_count_in_call, fd_count_in_reply, max_reply_fd_count if (flags & PUSH_UNKNOWN_REPLIES) != 0 else 0)) + "];\n")
+	# S2C calls arrive in place of the reply while a thread is waiting in the server, so most calls need room to receive
+	# as many descriptors as an S2C call can carry. unmanaged calls may come from processes that the server doesn't manage
+	# (and so never sends S2C calls to), so they only need room for their own descriptors (but C doesn't allow empty arrays).
+	s2c_fd_count = S2C_MAX_FD_COUNT if (flags & UNMANAGED_CALL) == 0 else 0
+	library_source.write("\tint fds[" + str(max(1, s2c_fd_count, fd_count_in_call, fd_count_in_reply, max_reply_fd_count if (flags & PUSH_UNKNOWN_REPLIES) != 0 else 0)) + "];\n")
 	library_source.write("\tint valid_fd_count;\n")
 	library_source.write("\tchar controlbuf[DSERVER_RPC_HOOKS_CMSG_SPACE(sizeof(fds))];\n")
 
@@ -1291,8 +1355,9 @@ for call in calls:
 		library_source.write("\t\t.msg_control = NULL,\n")
 		library_source.write("\t\t.msg_controllen = 0,\n")
 	else:
+		# only send as much control data as the descriptors we're actually sending need (`controlbuf` may be larger for receiving S2C calls)
 		library_source.write("\t\t.msg_control = controlbuf,\n")
-		library_source.write("\t\t.msg_controllen = sizeof(controlbuf),\n")
+		library_source.write("\t\t.msg_controllen = DSERVER_RPC_HOOKS_CMSG_SPACE(sizeof(int) * valid_fd_count),\n")
 
 	library_source.write("\t};\n")
 
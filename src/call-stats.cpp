@@ -0,0 +1,266 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2022 Darling developers
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <darlingserver/call-stats.hpp>
+#include <darlingserver/call.hpp>
+#include <darlingserver/logging.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+static DarlingServer::Log callStatsLog("callstats");
+
+//
+// LogHistogram
+//
+
+size_t DarlingServer::LogHistogram::_bucketForValue(uint64_t value) {
+	if (value < 4) {
+		return value;
+	}
+
+	size_t highestBit = 63 - __builtin_clzll(value);
+	size_t subBucket = (value >> (highestBit - 2)) & 3;
+	return (highestBit - 1) * 4 + subBucket;
+};
+
+uint64_t DarlingServer::LogHistogram::_bucketUpperBound(size_t bucket) {
+	if (bucket < 4) {
+		return bucket;
+	}
+
+	size_t highestBit = bucket / 4 + 1;
+	uint64_t lowerBound = (uint64_t)(4 + (bucket % 4)) << (highestBit - 2);
+	return lowerBound + ((1ull << (highestBit - 2)) - 1);
+};
+
+void DarlingServer::LogHistogram::record(uint64_t value) {
+	_buckets[_bucketForValue(value)].fetch_add(1, std::memory_order_relaxed);
+	_count.fetch_add(1, std::memory_order_relaxed);
+	_sum.fetch_add(value, std::memory_order_relaxed);
+
+	uint64_t currentMax = _max.load(std::memory_order_relaxed);
+	while (value > currentMax && !_max.compare_exchange_weak(currentMax, value, std::memory_order_relaxed));
+};
+
+uint64_t DarlingServer::LogHistogram::count() const {
+	return _count.load(std::memory_order_relaxed);
+};
+
+uint64_t DarlingServer::LogHistogram::sum() const {
+	return _sum.load(std::memory_order_relaxed);
+};
+
+uint64_t DarlingServer::LogHistogram::max() const {
+	return _max.load(std::memory_order_relaxed);
+};
+
+uint64_t DarlingServer::LogHistogram::percentile(double percentile) const {
+	// the buckets may be updated while we're reading them, so use the sum of the buckets rather than `_count` as the total
+	uint64_t total = 0;
+	for (size_t i = 0; i < bucketCount; ++i) {
+		total += _buckets[i].load(std::memory_order_relaxed);
+	}
+
+	if (total == 0) {
+		return 0;
+	}
+
+	uint64_t target = (uint64_t)((percentile / 100.0) * total + 0.5);
+	if (target < 1) {
+		target = 1;
+	}
+
+	uint64_t seen = 0;
+	for (size_t i = 0; i < bucketCount; ++i) {
+		seen += _buckets[i].load(std::memory_order_relaxed);
+		if (seen >= target) {
+			// the max is exact, so don't report anything above it
+			return std::min(_bucketUpperBound(i), max());
+		}
+	}
+
+	return max();
+};
+
+//
+// CallStats
+//
+
+namespace {
+	struct CallNumberStats {
+		DarlingServer::LogHistogram latency;
+		std::atomic<uint64_t> queued = 0;
+		std::atomic<uint64_t> running = 0;
+		std::atomic<uint64_t> suspended = 0;
+		std::atomic<uint64_t> replyBytes = 0;
+		std::atomic<uint64_t> maxReplySize = 0;
+	};
+};
+
+// indexed by call number (without the unmanaged flag)
+static CallNumberStats callStats[DSERVER_CALLNUM_COUNT];
+
+uint64_t DarlingServer::CallStats::now() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (uint64_t)time.tv_sec * 1000000000ull + time.tv_nsec;
+};
+
+void DarlingServer::CallStats::record(unsigned int callNumber, const Sample& sample) {
+	callNumber &= ~DSERVER_CALL_UNMANAGED_FLAG;
+
+	if (callNumber >= DSERVER_CALLNUM_COUNT) {
+		return;
+	}
+
+	auto& stats = callStats[callNumber];
+
+	stats.latency.record(sample.latency);
+	stats.queued.fetch_add(sample.queued, std::memory_order_relaxed);
+	stats.running.fetch_add(sample.running, std::memory_order_relaxed);
+	stats.suspended.fetch_add(sample.suspended, std::memory_order_relaxed);
+	stats.replyBytes.fetch_add(sample.replySize, std::memory_order_relaxed);
+
+	uint64_t currentMax = stats.maxReplySize.load(std::memory_order_relaxed);
+	while (sample.replySize > currentMax && !stats.maxReplySize.compare_exchange_weak(currentMax, sample.replySize, std::memory_order_relaxed));
+};
+
+const char* DarlingServer::CallStats::callName(unsigned int callNumber) {
+	callNumber &= ~DSERVER_CALL_UNMANAGED_FLAG;
+
+	// unmanaged calls have the unmanaged flag in their call number, so try both
+	auto name = Call::callNumberToString(static_cast<Call::Number>(callNumber));
+	if (!name) {
+		name = Call::callNumberToString(static_cast<Call::Number>(callNumber | DSERVER_CALL_UNMANAGED_FLAG));
+	}
+	if (name && strncmp(name, "dserver_callnum_", 16) == 0) {
+		name += 16;
+	}
+
+	return name ? name : "(unknown)";
+};
+
+std::vector<DarlingServer::CallStats::Summary> DarlingServer::CallStats::summaries() {
+	std::vector<Summary> result;
+
+	for (unsigned int number = 0; number < DSERVER_CALLNUM_COUNT; ++number) {
+		auto& stats = callStats[number];
+		uint64_t count = stats.latency.count();
+
+		if (count == 0) {
+			continue;
+		}
+
+		result.push_back(Summary {
+			callName(number),
+			count,
+			stats.latency.sum(),
+			stats.latency.percentile(50),
+			stats.latency.percentile(90),
+			stats.latency.percentile(99),
+			stats.latency.max(),
+			stats.queued.load(std::memory_order_relaxed),
+			stats.running.load(std::memory_order_relaxed),
+			stats.suspended.load(std::memory_order_relaxed),
+			stats.replyBytes.load(std::memory_order_relaxed),
+			stats.maxReplySize.load(std::memory_order_relaxed),
+		});
+	}
+
+	std::sort(result.begin(), result.end(), [](const Summary& a, const Summary& b) {
+		return a.latencyTotal > b.latencyTotal;
+	});
+
+	return result;
+};
+
+std::string DarlingServer::CallStats::report() {
+	std::string result;
+	char line[512];
+
+	snprintf(line, sizeof(line), "%-40s %10s %12s %10s %10s %10s %10s %10s %10s %10s %10s %8s\n",
+		"call", "count", "total(us)", "p50(us)", "p90(us)", "p99(us)", "max(us)", "queued%", "running%", "susp%", "avg-reply", "max-reply");
+	result += line;
+
+	for (const auto& summary: summaries()) {
+		double totalForPercent = (summary.latencyTotal > 0) ? (double)summary.latencyTotal : 1.0;
+
+		snprintf(line, sizeof(line), "%-40s %10llu %12.1f %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %8llu\n",
+			summary.name,
+			(unsigned long long)summary.count,
+			(double)summary.latencyTotal / 1e3,
+			(double)summary.latencyP50 / 1e3,
+			(double)summary.latencyP90 / 1e3,
+			(double)summary.latencyP99 / 1e3,
+			(double)summary.latencyMax / 1e3,
+			100.0 * (double)summary.queued / totalForPercent,
+			100.0 * (double)summary.running / totalForPercent,
+			100.0 * (double)summary.suspended / totalForPercent,
+			(double)summary.replyBytes / (double)summary.count,
+			(unsigned long long)summary.maxReplySize
+		);
+		result += line;
+	}
+
+	return result;
+};
+
+bool DarlingServer::CallStats::writeReport(int fd) {
+	auto text = report();
+	const char* data = text.data();
+	size_t remaining = text.size();
+
+	while (remaining > 0) {
+		ssize_t written = write(fd, data, remaining);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		data += written;
+		remaining -= written;
+	}
+
+	return true;
+};
+
+void DarlingServer::CallStats::logReport() {
+	if (!callStatsLog.infoEnabled()) {
+		return;
+	}
+
+	auto text = report();
+	size_t start = 0;
+
+	while (start < text.size()) {
+		size_t end = text.find('\n', start);
+		if (end == std::string::npos) {
+			end = text.size();
+		}
+		callStatsLog.info() << text.substr(start, end - start) << callStatsLog.endLog;
+		start = end + 1;
+	}
+};
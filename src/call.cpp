@@ -28,6 +28,8 @@
 #include <sys/fcntl.h>
 #include <sys/syscall.h>
 #include <darlingserver/kqchan.hpp>
+#include <darlingserver/microthread-backtrace.hpp>
+#include <darlingserver/probes.h>
 
 static DarlingServer::Log callLog("calls");
 
@@ -76,6 +78,7 @@ std::shared_ptr<DarlingServer::Call> DarlingServer::Call::callFromMessage(Messag
 			}
 
 			Server::sharedInstance().monitorProcess(tmp);
+			DSERVER_PROBE2(process__register, tmp->id(), tmp->nsid());
 			return tmp;
 		});
 
@@ -105,6 +108,7 @@ std::shared_ptr<DarlingServer::Call> DarlingServer::Call::callFromMessage(Messag
 
 			tmp->setAddress(requestMessage.address());
 			tmp->registerWithProcess();
+			DSERVER_PROBE3(thread__register, tmp->id(), tmp->nsid(), process->id());
 			return tmp;
 		});
 
@@ -123,13 +127,25 @@ std::shared_ptr<DarlingServer::Call> DarlingServer::Call::callFromMessage(Messag
 		}
 	}
 
-	auto pidString = (process) ? (std::to_string(process->id()) + " (" + std::to_string(process->nsid()) + ")") : (std::to_string(header->pid) + " (-1)");
-	auto tidString = (thread) ? (std::to_string(thread->id()) + " (" + std::to_string(thread->nsid()) + ")") : (std::to_string(header->tid) + " (-1)");
-	callLog.debug() << "Received call #" << header->number << " (" << dserver_callnum_to_string(header->number) << ") from PID " << pidString << ", TID " << tidString << callLog.endLog;
+	// this is a very hot path, so avoid building these strings unless we're actually going to log them
+	if (callLog.debugEnabled()) {
+		auto pidString = (process) ? (std::to_string(process->id()) + " (" + std::to_string(process->nsid()) + ")") : (std::to_string(header->pid) + " (-1)");
+		auto tidString = (thread) ? (std::to_string(thread->id()) + " (" + std::to_string(thread->nsid()) + ")") : (std::to_string(header->tid) + " (-1)");
+		callLog.debug() << "Received call #" << header->number << " (" << dserver_callnum_to_string(header->number) << ") from PID " << pidString << ", TID " << tidString << callLog.endLog;
+	}
+
+	DSERVER_PROBE3(call__receive, header->number, (process) ? process->id() : requestMessage.pid(), (thread) ? thread->id() : -1);
 
 	if (header->number == dserver_callnum_s2c) {
 		// this is an S2C reply
 
+		// we're not on a microthread here, so we can't create the semaphores;
+		// they're created before any S2C call is sent, so if they don't exist, nobody is waiting for this reply
+		auto semaphores = thread->_existingS2CSemaphores();
+		if (!semaphores) {
+			throw std::runtime_error("Received S2C reply but thread has no S2C call in flight");
+		}
+
 		{
 			std::unique_lock lock(thread->_rwlock);
 
@@ -140,7 +156,7 @@ std::shared_ptr<DarlingServer::Call> DarlingServer::Call::callFromMessage(Messag
 			thread->_s2cReply = std::move(requestMessage);
 		}
 
-		dtape_semaphore_up(thread->_s2cReplySempahore);
+		dtape_semaphore_up(semaphores->reply);
 
 		return nullptr;
 	} else if (header->number == dserver_callnum_push_reply) {
@@ -195,6 +211,28 @@ std::shared_ptr<DarlingServer::Call> DarlingServer::Call::callFromMessage(Messag
 		return nullptr;
 	}
 
+	// privileged calls are only allowed from outside the container, by root or by the user running darlingserver
+	switch (header->number) {
+		DSERVER_PRIVILEGED_CALLNUM_CASES
+			if ((requestMessage.uid() != 0 && requestMessage.uid() != getuid()) || processRegistry().lookupEntryByID(requestMessage.pid())) {
+				callLog.warning() << "Rejecting privileged call #" << header->number << " (" << dserver_callnum_to_string(header->number) << ") from unprivileged PID " << requestMessage.pid() << callLog.endLog;
+
+				// privileged calls have no reply parameters, so the reply is just the header
+				Message reply(sizeof(dserver_rpc_replyhdr_t), 0);
+				reply.setAddress(requestMessage.address());
+				auto replyHeader = reinterpret_cast<dserver_rpc_replyhdr_t*>(reply.data().data());
+				replyHeader->number = header->number;
+				replyHeader->code = EPERM;
+				Server::sharedInstance().sendMessage(std::move(reply));
+
+				return nullptr;
+			}
+			break;
+
+		default:
+			break;
+	}
+
 	// finally, let's construct the call class
 
 	#define CALL_CASE(_callName, _className) \
@@ -228,7 +266,8 @@ std::shared_ptr<DarlingServer::Call> DarlingServer::Call::callFromMessage(Messag
 DarlingServer::Call::Call(std::shared_ptr<Thread> thread, Address replyAddress, dserver_rpc_callhdr_t* callHeader):
 	_thread(thread),
 	_replyAddress(replyAddress),
-	_header(*callHeader)
+	_header(*callHeader),
+	_statsReceivedAt(CallStats::now())
 	{};
 
 DarlingServer::Call::~Call() {};
@@ -253,6 +292,58 @@ bool DarlingServer::Call::isBSDTrap() const {
 	return false;
 };
 
+void DarlingServer::Call::statsStarted() {
+	_statsStartedAt = _statsLastTransitionAt = CallStats::now();
+};
+
+void DarlingServer::Call::statsSuspended() {
+	if (_statsStartedAt == 0 || _statsIsSuspended) {
+		return;
+	}
+	auto now = CallStats::now();
+	_statsRunning += now - _statsLastTransitionAt;
+	_statsLastTransitionAt = now;
+	_statsIsSuspended = true;
+};
+
+void DarlingServer::Call::statsResumed() {
+	if (_statsStartedAt == 0 || !_statsIsSuspended) {
+		return;
+	}
+	auto now = CallStats::now();
+	_statsSuspended += now - _statsLastTransitionAt;
+	_statsLastTransitionAt = now;
+	_statsIsSuspended = false;
+};
+
+void DarlingServer::Call::_statsReplied(size_t replySize) {
+	if (_statsRecorded) {
+		return;
+	}
+	_statsRecorded = true;
+
+	auto now = CallStats::now();
+	CallStats::Sample sample;
+
+	sample.latency = now - _statsReceivedAt;
+	sample.replySize = replySize;
+
+	if (_statsStartedAt == 0) {
+		// calls processed outside of their own microthread (e.g. unmanaged calls) don't track running/suspended time separately
+		sample.queued = 0;
+		sample.running = sample.latency;
+		sample.suspended = 0;
+	} else {
+		sample.queued = _statsStartedAt - _statsReceivedAt;
+		sample.running = _statsRunning + (_statsIsSuspended ? 0 : (now - _statsLastTransitionAt));
+		sample.suspended = _statsSuspended + (_statsIsSuspended ? (now - _statsLastTransitionAt) : 0);
+	}
+
+	CallStats::record(static_cast<unsigned int>(number()), sample);
+
+	DSERVER_PROBE3(call__reply, static_cast<unsigned int>(number()), replySize, sample.latency);
+};
+
 void DarlingServer::Call::sendReply(Message&& reply) {
 	Server::sharedInstance().sendMessage(std::move(reply));
 };
@@ -976,8 +1067,13 @@ void DarlingServer::Call::S2CPerform::processCall() {
 	int code = 0;
 
 	if (auto thread = _thread.lock()) {
-		dtape_semaphore_up(thread->_s2cInterruptEnterSemaphore);
-		dtape_semaphore_down_simple(thread->_s2cInterruptExitSemaphore);
+		try {
+			auto& semaphores = thread->_getS2CSemaphores();
+			dtape_semaphore_up(semaphores.interruptEnter);
+			dtape_semaphore_down_simple(semaphores.interruptExit);
+		} catch (std::system_error e) {
+			code = -e.code().value();
+		}
 	} else {
 		code = -ESRCH;
 	}
@@ -1036,4 +1132,82 @@ void DarlingServer::Call::GetExecutablePath::processCall() {
 	_sendReply(code, fullLength);
 }
 
+void DarlingServer::Call::LogControl::processCall() {
+	int code = 0;
+	std::string spec;
+	char buffer[256];
+
+	// the caller writes the whole spec and closes its end before making the call, so we should never block here;
+	// just in case, make the read non-blocking so a misbehaving caller can't wedge a kernel microthread
+	fcntl(_body.spec_pipe, F_SETFL, fcntl(_body.spec_pipe, F_GETFL) | O_NONBLOCK);
+
+	while (spec.size() < 4096) {
+		auto count = read(_body.spec_pipe, buffer, sizeof(buffer));
+		if (count < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno != EAGAIN) {
+				code = -errno;
+			}
+			break;
+		} else if (count == 0) {
+			break;
+		}
+		spec.append(buffer, count);
+	}
+
+	// allow a trailing newline (e.g. from `echo`)
+	while (!spec.empty() && (spec.back() == '\n' || spec.back() == ' ')) {
+		spec.pop_back();
+	}
+
+	if (code == 0) {
+		if (Log::configure(spec)) {
+			callLog.info() << "Logging reconfigured: " << spec << callLog.endLog;
+		} else {
+			// not negated because this is a user error
+			code = EINVAL;
+		}
+	}
+
+	_sendReply(code);
+};
+
+void DarlingServer::Call::CallStatsDump::processCall() {
+	int code = 0;
+
+	if (!CallStats::writeReport(_body.output_fd)) {
+		code = -errno;
+	}
+
+	_sendReply(code);
+};
+
+void DarlingServer::Call::S2CFeatures::processCall() {
+	int code = 0;
+
+	if (auto thread = _thread.lock()) {
+		if (auto process = thread->process()) {
+			process->setS2CFeatures(_body.features);
+		} else {
+			code = -ESRCH;
+		}
+	} else {
+		code = -ESRCH;
+	}
+
+	_sendReply(code);
+};
+
+void DarlingServer::Call::MicrothreadBacktraces::processCall() {
+	int code = 0;
+
+	if (!MicrothreadBacktrace::writeReport(_body.output_fd)) {
+		code = -errno;
+	}
+
+	_sendReply(code);
+};
+
 DSERVER_CLASS_SOURCE_DEFS;
@@ -37,12 +37,14 @@
 #include <linux/sched.h>
 #include <sys/syscall.h>
 #include <sys/signal.h>
+#include <pthread.h>
 #include <filesystem>
 
 #include <darling-config.h>
 
 #include <darlingserver/server.hpp>
 #include <darlingserver/config.hpp>
+#include <darlingserver/logging.hpp>
 
 #ifndef DARLINGSERVER_INIT_PROCESS
 	#define DARLINGSERVER_INIT_PROCESS "/sbin/launchd"
@@ -755,6 +757,13 @@ int main(int argc, char** argv) {
 	sigaction(SIGUSR1, &leak_info_action, NULL);
 #endif
 
+	// block SIGUSR2 in all of our threads; the server receives it via a signalfd and dumps its stats (and the event trace).
+	// SIGTERM is deliberately left alone so that it can still stop us if the main loop gets stuck (see `handleTermSignal`).
+	sigset_t statsSignals;
+	sigemptyset(&statsSignals);
+	sigaddset(&statsSignals, SIGUSR2);
+	pthread_sigmask(SIG_BLOCK, &statsSignals, NULL);
+
 	// create the server
 	auto server = new DarlingServer::Server(prefix);
 
@@ -769,5 +778,8 @@ int main(int argc, char** argv) {
 	std::cerr << "Server exited main loop!" << std::endl;
 	delete server;
 
+	// the log writer thread is about to die with us; make sure everything that led up to this makes it out
+	DarlingServer::Log::flush();
+
 	return 1;
 };
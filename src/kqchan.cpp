@@ -3,6 +3,8 @@
 #include <darlingserver/rpc-supplement.h>
 #include <darlingserver/thread.hpp>
 #include <darlingserver/logging.hpp>
+#include <darlingserver/trace.hpp>
+#include <darlingserver/probes.h>
 
 #include <sys/socket.h>
 #include <fcntl.h>
@@ -161,6 +163,14 @@ void DarlingServer::Kqchan::_sendNotification() {
 	// now that we're sending the notification, we shouldn't send another one until our peer acknowledges this one
 	_canSendNotification = false;
 
+	if (auto process = _process.lock()) {
+		Trace::record(Trace::Event::KqchanNotify, process->id(), -1, _notificationCount);
+		DSERVER_PROBE2(kqchan__notify, process->id(), _notificationCount);
+	} else {
+		Trace::record(Trace::Event::KqchanNotify, -1, -1, _notificationCount);
+		DSERVER_PROBE2(kqchan__notify, -1, _notificationCount);
+	}
+
 	Message msg(sizeof(dserver_kqchan_call_notification_t), 0);
 
 	auto notification = reinterpret_cast<dserver_kqchan_call_notification_t*>(msg.data().data());
@@ -345,6 +355,12 @@ void DarlingServer::Kqchan::MachPort::_modify(uint64_t receiveBuffer, uint64_t r
 void DarlingServer::Kqchan::MachPort::_read(uint64_t defaultBuffer, uint64_t defaultBufferSize, pid_t nstid) {
 	kqchanMachPortLog.debug() << *this << ": received read request with {defaultBuffer=" << defaultBuffer << ",defaultBufferSize=" << defaultBufferSize << "}" << kqchanMachPortLog.endLog;
 
+	if (auto process = _process.lock()) {
+		DSERVER_PROBE3(kqchan__read, process->id(), nstid, defaultBufferSize);
+	} else {
+		DSERVER_PROBE3(kqchan__read, -1, nstid, defaultBufferSize);
+	}
+
 	{
 		// our peer has acknowledged our notification by asking for the pending messages;
 		// we can now send a notification again if we receive more data
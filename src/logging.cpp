@@ -24,16 +24,52 @@
 #include <filesystem>
 #include <fcntl.h>
 #include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <map>
+#include <vector>
+#include <semaphore.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
 
 #define DEFAULT_LOG_CUTOFF DarlingServer::Log::Type::Error
 
+namespace {
+	/**
+	 * Per-category level overrides.
+	 *
+	 * Entries are never removed (std::map nodes are stable), so each Log can hold a pointer to its category's level
+	 * and check it with a single relaxed load. The lock only protects the map's structure.
+	 */
+	struct CategoryLevels {
+		std::mutex lock;
+		std::map<std::string, std::atomic<int>> levels;
+
+		std::atomic<int>& levelFor(const std::string& category) {
+			std::unique_lock guard(lock);
+			return levels.try_emplace(category, 0).first->second;
+		};
+	};
+};
+
+static CategoryLevels& categoryLevels() {
+	// intentionally leaked; loggers may be used during static destruction
+	static CategoryLevels* levels = new CategoryLevels();
+	return *levels;
+};
+
 DarlingServer::Log::Log(std::string category):
-	_category(category)
+	_category(category),
+	_categoryLevel(&categoryLevels().levelFor(category))
 	{};
 
 DarlingServer::Log::Stream::Stream(Type type, const Log& log):
 	_type(type),
-	_log(log)
+	_log(log),
+	_enabled(type >= log._minimumLevel())
 	{};
 
 DarlingServer::Log::Stream::~Stream() {
@@ -41,17 +77,22 @@ DarlingServer::Log::Stream::~Stream() {
 };
 
 DarlingServer::Log::Stream& DarlingServer::Log::Stream::operator<<(EndLog value) {
-	auto str = _buffer.str();
+	if (!_buffer) {
+		return *this;
+	}
+	auto str = _buffer->str();
 	if (!str.empty()) {
 		_log._log(_type, str);
-		_buffer.str(std::string());
-		_buffer.clear();
+		_buffer->str(std::string());
+		_buffer->clear();
 	}
 	return *this;
 };
 
 DarlingServer::Log::Stream& DarlingServer::Log::Stream::operator<<(const Loggable& loggable) {
-	loggable.logToStream(*this);
+	if (_enabled) {
+		loggable.logToStream(*this);
+	}
 	return *this;
 };
 
@@ -71,6 +112,53 @@ DarlingServer::Log::Stream DarlingServer::Log::error() const {
 	return Stream(Type::Error, *this);
 };
 
+bool DarlingServer::Log::debugEnabled() const {
+	return Type::Debug >= _minimumLevel();
+};
+
+bool DarlingServer::Log::infoEnabled() const {
+	return Type::Info >= _minimumLevel();
+};
+
+bool DarlingServer::Log::warningEnabled() const {
+	return Type::Warning >= _minimumLevel();
+};
+
+bool DarlingServer::Log::errorEnabled() const {
+	return Type::Error >= _minimumLevel();
+};
+
+std::optional<DarlingServer::Log::Type> DarlingServer::Log::_parseType(const char* val) {
+	if (strncmp(val, "err", 3) == 0) {
+		return Type::Error;
+	} else if (strncmp(val, "warn", 4) == 0) {
+		return Type::Warning;
+	} else if (strncmp(val, "info", 4) == 0) {
+		return Type::Info;
+	} else if (strncmp(val, "debug", 5) == 0) {
+		return Type::Debug;
+	}
+	return std::nullopt;
+};
+
+std::atomic<int>& DarlingServer::Log::_globalLevel() {
+	static std::atomic<int> level = []() {
+		auto val = getenv("DSERVER_LOG_LEVEL");
+		auto parsed = val ? _parseType(val) : std::nullopt;
+		return static_cast<int>(parsed.value_or(DEFAULT_LOG_CUTOFF));
+	}();
+
+	return level;
+};
+
+DarlingServer::Log::Type DarlingServer::Log::_minimumLevel() const {
+	int level = _categoryLevel->load(std::memory_order_relaxed);
+	if (level == 0) {
+		level = _globalLevel().load(std::memory_order_relaxed);
+	}
+	return static_cast<Type>(level);
+};
+
 std::string DarlingServer::Log::_typeToString(Type type) {
 	switch (type) {
 		case Type::Debug:
@@ -86,40 +174,385 @@ std::string DarlingServer::Log::_typeToString(Type type) {
 	}
 };
 
-void DarlingServer::Log::_log(Type type, std::string message) const {
-	// NOTE: we use POSIX file APIs because we want to append each message to the log file atomically,
-	//       and as far as i can tell, C++ fstreams provide no such guarantee (that they won't write in chunks).
-	static int logFile = []() {
-		std::filesystem::path path(Server::sharedInstance().prefix() + "/private/var/log/dserver.log");
-		std::filesystem::create_directories(path.parent_path());
-		return open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT);
-	}();
+namespace {
+	/**
+	 * A bounded, lock-free multi-producer/single-consumer ring of preformatted log records.
+	 *
+	 * This is a Vyukov-style bounded queue: each slot has a sequence number that tells producers and the consumer
+	 * whether the slot is ready for them, so the only contended operation is the CAS on the enqueue position.
+	 */
+	class LogRing {
+	private:
+		struct Slot {
+			std::atomic<size_t> sequence;
+			std::string record;
+		};
 
-	static bool logToStderr = []() {
-		auto val = getenv("DSERVER_LOG_STDERR");
-		return val && strlen(val) >= 1 && (val[0] == 't' || val[0] == 'T' || val[0] == '1');
-	}();
+		static constexpr size_t capacity = 4096;
 
-	static Type logMinLevel = []() {
-		auto val = getenv("DSERVER_LOG_LEVEL");
-		Type level = DEFAULT_LOG_CUTOFF;
-		if (val) {
-			if (strncmp(val, "err", 3) == 0) {
-				level = Type::Error;
-			} else if (strncmp(val, "warn", 4) == 0) {
-				level = Type::Warning;
-			} else if (strncmp(val, "info", 4) == 0) {
-				level = Type::Info;
-			} else if (strncmp(val, "debug", 5) == 0) {
-				level = Type::Debug;
+		std::unique_ptr<Slot[]> _slots;
+		alignas(64) std::atomic<size_t> _enqueuePosition = 0;
+		alignas(64) std::atomic<size_t> _dequeuePosition = 0;
+
+	public:
+		LogRing():
+			_slots(new Slot[capacity])
+		{
+			for (size_t i = 0; i < capacity; ++i) {
+				_slots[i].sequence.store(i, std::memory_order_relaxed);
 			}
-		}
-		return level;
+		};
+
+		// returns `false` if the ring is full
+		bool push(std::string&& record) {
+			size_t position = _enqueuePosition.load(std::memory_order_relaxed);
+
+			while (true) {
+				auto& slot = _slots[position % capacity];
+				size_t sequence = slot.sequence.load(std::memory_order_acquire);
+				intptr_t diff = (intptr_t)sequence - (intptr_t)position;
+
+				if (diff == 0) {
+					if (_enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+						slot.record = std::move(record);
+						slot.sequence.store(position + 1, std::memory_order_release);
+						return true;
+					}
+				} else if (diff < 0) {
+					// the consumer hasn't gotten to this slot yet
+					return false;
+				} else {
+					position = _enqueuePosition.load(std::memory_order_relaxed);
+				}
+			}
+		};
+
+		/**
+		 * Calls the given function with every record that's been pushed but not yet released, without consuming them.
+		 * This includes records the consumer is still writing out (see `peek`).
+		 *
+		 * This doesn't synchronize with the consumer, so it's only meant for signal handlers.
+		 * It doesn't allocate, so it's async-signal-safe as long as the function is.
+		 */
+		template<class Function>
+		void peekPending(Function&& function) {
+			size_t position = _dequeuePosition.load(std::memory_order_relaxed);
+			size_t end = _enqueuePosition.load(std::memory_order_relaxed);
+
+			for (; position < end; ++position) {
+				auto& slot = _slots[position % capacity];
+
+				if (slot.sequence.load(std::memory_order_acquire) != position + 1) {
+					// either the producer hasn't finished writing it or the consumer just released it
+					continue;
+				}
+
+				function(slot.record);
+			}
+		};
+
+		/**
+		 * Returns the record @p offset records past the oldest unreleased one, or `nullptr` if it hasn't been pushed yet.
+		 *
+		 * Records stay in the ring (and visible to `peekPending`) until they're released, so the consumer can write them
+		 * straight out of their slots without them ever being invisible to a signal handler.
+		 * Must only be called by the (single) consumer.
+		 */
+		std::string* peek(size_t offset) {
+			size_t position = _dequeuePosition.load(std::memory_order_relaxed) + offset;
+			auto& slot = _slots[position % capacity];
+			size_t sequence = slot.sequence.load(std::memory_order_acquire);
+
+			if (offset >= capacity || (intptr_t)sequence - (intptr_t)(position + 1) < 0) {
+				return nullptr;
+			}
+
+			return &slot.record;
+		};
+
+		/**
+		 * Consumes the @p count oldest records (which must have been peeked) and gives their slots back to producers.
+		 * Must only be called by the (single) consumer.
+		 */
+		void release(size_t count) {
+			size_t position = _dequeuePosition.load(std::memory_order_relaxed);
+
+			for (size_t i = 0; i < count; ++i) {
+				auto& slot = _slots[(position + i) % capacity];
+				slot.record.clear();
+				slot.sequence.store(position + i + capacity, std::memory_order_release);
+			}
+
+			_dequeuePosition.store(position + count, std::memory_order_seq_cst);
+		};
+
+		// the number of records that have been (or are being) pushed so far
+		size_t pushedCount() const {
+			return _enqueuePosition.load(std::memory_order_seq_cst);
+		};
+
+		// the number of records that have been released so far
+		size_t releasedCount() const {
+			return _dequeuePosition.load(std::memory_order_seq_cst);
+		};
+	};
+
+	/**
+	 * Writes log records out on a background thread so that workers and the main loop never block on disk I/O.
+	 *
+	 * The log file is rotated once it reaches DSERVER_LOG_MAX_SIZE bytes (16 MiB by default), keeping up to
+	 * DSERVER_LOG_MAX_FILES old logs (5 by default) as `dserver.log.1` (newest) through `dserver.log.N` (oldest).
+	 *
+	 * If the ring fills up, debug, info, and warning records are dropped (and counted); errors are written synchronously instead.
+	 */
+	class LogWriter {
+	private:
+		static constexpr size_t maxBatchSize = 64;
+
+		LogRing _ring;
+		std::atomic<uint64_t> _dropped = 0;
+		std::atomic<bool> _writerSleeping = false;
+		sem_t _wakeup;
+
+		std::filesystem::path _path;
+		int _file = -1;
+		uint64_t _fileSize = 0;
+		uint64_t _maxFileSize;
+		size_t _maxFiles;
+		std::atomic<bool> _logToStderr;
+
+		// protects the file descriptor for synchronous writes (which may race with the writer thread rotating the log)
+		std::mutex _fileLock;
+
+		// `flush` waits on this for the writer to catch up
+		std::mutex _drainLock;
+		std::condition_variable _drained;
+		std::atomic<size_t> _drainWaiters = 0;
+
+		static uint64_t _environmentNumber(const char* name, uint64_t defaultValue) {
+			auto val = getenv(name);
+			if (!val || !*val) {
+				return defaultValue;
+			}
+			char* end = nullptr;
+			auto result = strtoull(val, &end, 0);
+			return (end && *end == '\0') ? result : defaultValue;
+		};
+
+		void _openFile() {
+			// NOTE: we use POSIX file APIs because we want to append each batch to the log file atomically,
+			//       and as far as i can tell, C++ fstreams provide no such guarantee (that they won't write in chunks).
+			_file = open(_path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+
+			struct stat info;
+			_fileSize = (_file >= 0 && fstat(_file, &info) == 0) ? info.st_size : 0;
+		};
+
+		// must be called with the file lock held
+		void _rotate() {
+			if (_file >= 0) {
+				close(_file);
+				_file = -1;
+			}
+
+			std::error_code ec;
+			if (_maxFiles == 0) {
+				std::filesystem::remove(_path, ec);
+			} else {
+				for (size_t i = _maxFiles; i > 1; --i) {
+					std::filesystem::rename(_path.string() + "." + std::to_string(i - 1), _path.string() + "." + std::to_string(i), ec);
+				}
+				std::filesystem::rename(_path, _path.string() + ".1", ec);
+			}
+
+			_openFile();
+		};
+
+		void _write(const struct iovec* iov, int count, size_t size) {
+			std::unique_lock lock(_fileLock);
+
+			if (_fileSize > 0 && _fileSize + size > _maxFileSize) {
+				_rotate();
+			}
+
+			if (_file >= 0 && writev(_file, iov, count) > 0) {
+				_fileSize += size;
+			}
+
+			lock.unlock();
+
+			if (_logToStderr.load(std::memory_order_relaxed)) {
+				writev(STDERR_FILENO, iov, count);
+			}
+		};
+
+		void _wakeWriter() {
+			if (_writerSleeping.load(std::memory_order_relaxed) && _writerSleeping.exchange(false, std::memory_order_relaxed)) {
+				sem_post(&_wakeup);
+			}
+		};
+
+		void _writerLoop() {
+			std::string droppedNotice;
+			struct iovec iov[maxBatchSize + 1];
+
+			while (true) {
+				size_t count = 0;
+				size_t recordCount = 0;
+				size_t size = 0;
+
+				if (auto dropped = _dropped.exchange(0, std::memory_order_relaxed)) {
+					droppedNotice = "(log, Warning) dropped " + std::to_string(dropped) + " log line(s) because the log buffer was full\n";
+					iov[count].iov_base = droppedNotice.data();
+					iov[count].iov_len = droppedNotice.size();
+					size += droppedNotice.size();
+					++count;
+				}
+
+				// the records are written straight out of the ring and only released once they've been written,
+				// so `flushForCrash` can still see them while we're writing them
+				while (recordCount < maxBatchSize) {
+					auto record = _ring.peek(recordCount);
+					if (!record) {
+						break;
+					}
+					iov[count].iov_base = record->data();
+					iov[count].iov_len = record->size();
+					size += record->size();
+					++count;
+					++recordCount;
+				}
+
+				if (count == 0) {
+					// let producers know they need to wake us up, then check once more before actually going to sleep (so we don't miss anything)
+					_writerSleeping.store(true, std::memory_order_relaxed);
+					std::atomic_thread_fence(std::memory_order_seq_cst);
+					if (_ring.peek(0)) {
+						_writerSleeping.store(false, std::memory_order_relaxed);
+					} else {
+						while (sem_wait(&_wakeup) < 0 && errno == EINTR);
+					}
+					continue;
+				}
+
+				_write(iov, count, size);
+
+				_ring.release(recordCount);
+
+				// `release` is sequentially consistent, so either a new waiter sees the records as released or we see it waiting
+				if (_drainWaiters.load(std::memory_order_seq_cst) > 0) {
+					std::lock_guard lock(_drainLock);
+					_drained.notify_all();
+				}
+			}
+		};
+
+	public:
+		LogWriter():
+			_path(DarlingServer::Server::sharedInstance().prefix() + "/private/var/log/dserver.log"),
+			_maxFileSize(_environmentNumber("DSERVER_LOG_MAX_SIZE", 16 * 1024 * 1024)),
+			_maxFiles(_environmentNumber("DSERVER_LOG_MAX_FILES", 5))
+		{
+			auto val = getenv("DSERVER_LOG_STDERR");
+			_logToStderr = val && strlen(val) >= 1 && (val[0] == 't' || val[0] == 'T' || val[0] == '1');
+
+			std::error_code ec;
+			std::filesystem::create_directories(_path.parent_path(), ec);
+			_openFile();
+
+			sem_init(&_wakeup, 0, 0);
+
+			std::thread(&LogWriter::_writerLoop, this).detach();
+		};
+
+		void setLogToStderr(bool logToStderr) {
+			_logToStderr.store(logToStderr, std::memory_order_relaxed);
+		};
+
+		// see `Log::flush`
+		bool flush(std::chrono::milliseconds timeout) {
+			size_t target = _ring.pushedCount();
+
+			std::unique_lock lock(_drainLock);
+			_drainWaiters.fetch_add(1, std::memory_order_seq_cst);
+
+			// the writer might be asleep with records still on their way in; make sure it takes a look
+			_wakeWriter();
+
+			bool drained = _drained.wait_for(lock, timeout, [&]() {
+				return _ring.releasedCount() >= target;
+			});
+
+			_drainWaiters.fetch_sub(1, std::memory_order_relaxed);
+			return drained;
+		};
+
+		// async-signal-safe; see `Log::flushForCrash`
+		void flushForCrash() {
+			// we can't take the file lock here (the crashing thread may be holding it), so this may race with a rotation;
+			// that's acceptable since we're about to die anyway
+			int file = _file;
+			bool logToStderr = _logToStderr.load(std::memory_order_relaxed);
+
+			_ring.peekPending([&](const std::string& record) {
+				if (file >= 0) {
+					write(file, record.data(), record.size());
+				}
+				if (logToStderr) {
+					write(STDERR_FILENO, record.data(), record.size());
+				}
+			});
+		};
+
+		void submit(std::string&& record, bool mustNotDrop) {
+			if (!_ring.push(std::move(record))) {
+				if (mustNotDrop) {
+					struct iovec iov;
+					iov.iov_base = record.data();
+					iov.iov_len = record.size();
+					_write(&iov, 1, record.size());
+				} else {
+					_dropped.fetch_add(1, std::memory_order_relaxed);
+				}
+				return;
+			}
+
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+
+			_wakeWriter();
+		};
+	};
+};
+
+// set once the writer has been created, so that flushForCrash() doesn't have to create it (which isn't async-signal-safe)
+static std::atomic<LogWriter*> activeLogWriter = nullptr;
+
+static LogWriter& logWriter() {
+	// this is intentionally leaked; the writer thread must be able to keep using it until the process exits
+	static LogWriter* writer = []() {
+		auto writer = new LogWriter();
+		activeLogWriter.store(writer, std::memory_order_release);
+		return writer;
 	}();
+	return *writer;
+};
 
-	if (type < logMinLevel) {
-		return;
+bool DarlingServer::Log::flush() {
+	if (auto writer = activeLogWriter.load(std::memory_order_acquire)) {
+		// don't let a wedged writer hang whoever's shutting us down
+		return writer->flush(std::chrono::seconds(1));
 	}
+	return true;
+};
+
+void DarlingServer::Log::flushForCrash() {
+	if (auto writer = activeLogWriter.load(std::memory_order_acquire)) {
+		writer->flushForCrash();
+	}
+};
+
+void DarlingServer::Log::_log(Type type, std::string message) const {
+	// streams only call us for enabled levels, so there's no need to check the level here
 
 	struct timespec time;
 	clock_gettime(CLOCK_REALTIME, &time);
@@ -130,9 +563,74 @@ void DarlingServer::Log::_log(Type type, std::string message) const {
 	std::string tid = currentThread ? (std::string("[T:") + std::to_string(currentThread->id()) + "(" + std::to_string(currentThread->nsid()) + ")]") : "";
 	std::string messageToLog = "[" + std::to_string(secs) + "](" + _category + ", " + _typeToString(type) + ")" + pid + tid + " " + message + "\n";
 
-	write(logFile, messageToLog.c_str(), messageToLog.size());
+	logWriter().submit(std::move(messageToLog), type == Type::Error);
+};
+
+bool DarlingServer::Log::configure(const std::string& spec) {
+	std::optional<Type> globalLevel;
+	std::optional<bool> logToStderr;
+	std::vector<std::pair<std::string, int>> categories;
+
+	// parse everything first so that an invalid spec doesn't leave things half-applied
+	size_t start = 0;
+	while (start <= spec.size()) {
+		size_t end = spec.find(',', start);
+		if (end == std::string::npos) {
+			end = spec.size();
+		}
+
+		auto setting = spec.substr(start, end - start);
+		start = end + 1;
+
+		if (setting.empty()) {
+			continue;
+		}
+
+		auto equals = setting.find('=');
+
+		if (equals == std::string::npos) {
+			globalLevel = _parseType(setting.c_str());
+			if (!globalLevel) {
+				return false;
+			}
+			continue;
+		}
+
+		auto name = setting.substr(0, equals);
+		auto value = setting.substr(equals + 1);
+
+		if (name.empty()) {
+			return false;
+		}
+
+		if (name == "stderr") {
+			if (value == "on" || value == "1" || value == "true") {
+				logToStderr = true;
+			} else if (value == "off" || value == "0" || value == "false") {
+				logToStderr = false;
+			} else {
+				return false;
+			}
+		} else if (value == "default") {
+			categories.emplace_back(name, 0);
+		} else if (auto level = _parseType(value.c_str())) {
+			categories.emplace_back(name, static_cast<int>(*level));
+		} else {
+			return false;
+		}
+	}
+
+	if (globalLevel) {
+		_globalLevel().store(static_cast<int>(*globalLevel), std::memory_order_relaxed);
+	}
+
+	for (const auto& [name, level]: categories) {
+		categoryLevels().levelFor(name).store(level, std::memory_order_relaxed);
+	}
 
 	if (logToStderr) {
-		write(STDERR_FILENO, messageToLog.c_str(), messageToLog.size());
+		logWriter().setLogToStderr(*logToStderr);
 	}
+
+	return true;
 };
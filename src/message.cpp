@@ -614,3 +614,8 @@ bool DarlingServer::MessageQueue::empty() const {
 	std::unique_lock lock(_lock);
 	return _messages.empty();
 };
+
+size_t DarlingServer::MessageQueue::size() const {
+	std::unique_lock lock(_lock);
+	return _messages.size();
+};
@@ -0,0 +1,123 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2022 Darling developers
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <darlingserver/metrics-format.hpp>
+
+#include <cstdio>
+
+void DarlingServer::MetricsWriter::addHeader(const char* name, const char* type, const char* help) {
+	_text += "# HELP ";
+	_text += name;
+	_text += ' ';
+	_text += help;
+	_text += "\n# TYPE ";
+	_text += name;
+	_text += ' ';
+	_text += type;
+	_text += '\n';
+};
+
+void DarlingServer::MetricsWriter::addSample(const std::string& name, const std::string& labels, const std::string& value) {
+	_text += name;
+	if (!labels.empty()) {
+		_text += '{';
+		_text += labels;
+		_text += '}';
+	}
+	_text += ' ';
+	_text += value;
+	_text += '\n';
+};
+
+void DarlingServer::MetricsWriter::addMetric(const char* name, const char* type, const char* help, uint64_t value) {
+	addHeader(name, type, help);
+	addSample(name, "", std::to_string(value));
+};
+
+std::string DarlingServer::MetricsWriter::take() {
+	return std::move(_text);
+};
+
+std::string DarlingServer::MetricsWriter::escapeLabelValue(const char* value) {
+	std::string result;
+
+	for (; *value != '\0'; ++value) {
+		switch (*value) {
+			case '\\':
+				result += "\\\\";
+				break;
+			case '"':
+				result += "\\\"";
+				break;
+			case '\n':
+				result += "\\n";
+				break;
+			default:
+				result += *value;
+				break;
+		}
+	}
+
+	return result;
+};
+
+std::string DarlingServer::MetricsWriter::formatSeconds(uint64_t nanoseconds) {
+	char buffer[32];
+	snprintf(buffer, sizeof(buffer), "%.9g", (double)nanoseconds / 1e9);
+	return buffer;
+};
+
+bool DarlingServer::MetricsWriter::isHTTPRequest(const std::string& request) {
+	auto lineEnd = request.find('\n');
+	if (lineEnd == std::string::npos) {
+		return false;
+	}
+	auto versionStart = request.rfind(" HTTP/", lineEnd);
+	return versionStart != std::string::npos && versionStart > 0;
+};
+
+bool DarlingServer::MetricsWriter::isRequestComplete(const std::string& request, bool endOfInput) {
+	if (endOfInput) {
+		return true;
+	}
+
+	if (request.find('\n') == std::string::npos) {
+		return false;
+	}
+
+	if (isHTTPRequest(request)) {
+		return request.find("\r\n\r\n") != std::string::npos || request.find("\n\n") != std::string::npos;
+	}
+
+	return true;
+};
+
+std::string DarlingServer::MetricsWriter::response(const std::string& request, std::string body) {
+	if (!isHTTPRequest(request)) {
+		return body;
+	}
+
+	std::string result = "HTTP/1.0 200 OK\r\n"
+		"Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+		"Content-Length: " + std::to_string(body.size()) + "\r\n"
+		"Connection: close\r\n"
+		"\r\n";
+	result += body;
+	return result;
+};
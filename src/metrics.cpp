@@ -0,0 +1,339 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2022 Darling developers
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <darlingserver/metrics.hpp>
+#include <darlingserver/metrics-format.hpp>
+#include <darlingserver/server.hpp>
+#include <darlingserver/registry.hpp>
+#include <darlingserver/thread.hpp>
+#include <darlingserver/call-stats.hpp>
+#include <darlingserver/duct-tape.h>
+#include <darlingserver/logging.hpp>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <system_error>
+#include <vector>
+
+static DarlingServer::Log metricsLog("metrics");
+
+// more than enough for a request line and a few headers
+static constexpr size_t maxRequestSize = 8192;
+
+// scrapers only ever need one or two connections at a time; anything past this is dropped
+static constexpr size_t maxClients = 16;
+
+struct DarlingServer::MetricsEndpoint::Client {
+	std::shared_ptr<FD> fd;
+	std::string request;
+	std::string response;
+	size_t sent = 0;
+};
+
+bool DarlingServer::MetricsEndpoint::enabled() {
+	static const bool isEnabled = []() {
+		const char* value = getenv("DSERVER_METRICS");
+		return value && (value[0] == '1' || value[0] == 't' || value[0] == 'T');
+	}();
+	return isEnabled;
+};
+
+DarlingServer::MetricsEndpoint::MetricsEndpoint(Server& server, std::string socketPath):
+	_server(server),
+	_socketPath(socketPath)
+{
+	// remove the old socket (if it exists)
+	unlink(_socketPath.c_str());
+
+	int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listener < 0) {
+		throw std::system_error(errno, std::generic_category(), "Failed to create metrics socket");
+	}
+
+	auto listenerFD = std::make_shared<FD>(listener);
+
+	struct sockaddr_un addr;
+	addr.sun_family = AF_UNIX;
+	addr.sun_path[sizeof(addr.sun_path) - 1] = '\0';
+	strncpy(addr.sun_path, _socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+	if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		throw std::system_error(errno, std::generic_category(), "Failed to bind metrics socket");
+	}
+
+	if (listen(listener, SOMAXCONN) != 0) {
+		throw std::system_error(errno, std::generic_category(), "Failed to listen on metrics socket");
+	}
+
+	_listenerMonitor = std::make_shared<Monitor>(listenerFD, Monitor::Event::Readable, false, false, [this](std::shared_ptr<Monitor> monitor, Monitor::Event events) {
+		_accept();
+	});
+
+	_server.addMonitor(_listenerMonitor);
+};
+
+DarlingServer::MetricsEndpoint::~MetricsEndpoint() {
+	_server.removeMonitor(_listenerMonitor);
+	unlink(_socketPath.c_str());
+};
+
+void DarlingServer::MetricsEndpoint::_accept() {
+	while (true) {
+		int clientFD = accept4(_listenerMonitor->fd()->fd(), NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+		if (clientFD < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				metricsLog.warning() << "Failed to accept metrics connection: " << strerror(errno) << metricsLog.endLog;
+			}
+
+			return;
+		}
+
+		if (_clientCount >= maxClients) {
+			metricsLog.warning() << "Too many metrics connections; dropping a new one" << metricsLog.endLog;
+			close(clientFD);
+			continue;
+		}
+
+		auto client = std::make_shared<Client>();
+		client->fd = std::make_shared<FD>(clientFD);
+
+		++_clientCount;
+
+		_server.addMonitor(std::make_shared<Monitor>(client->fd, Monitor::Event::Readable | Monitor::Event::ReadHangUp, false, false, [this, client](std::shared_ptr<Monitor> monitor, Monitor::Event events) {
+			_read(client, monitor, events);
+		}));
+	}
+};
+
+void DarlingServer::MetricsEndpoint::_read(std::shared_ptr<Client> client, std::shared_ptr<Monitor> monitor, Monitor::Event events) {
+	char buffer[1024];
+	bool endOfInput = false;
+
+	while (true) {
+		ssize_t count = recv(client->fd->fd(), buffer, sizeof(buffer), MSG_DONTWAIT);
+
+		if (count < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+
+			_close(client, monitor);
+			return;
+		}
+
+		if (count == 0) {
+			endOfInput = true;
+			break;
+		}
+
+		client->request.append(buffer, count);
+
+		if (client->request.size() > maxRequestSize) {
+			_close(client, monitor);
+			return;
+		}
+	}
+
+	if (!MetricsWriter::isRequestComplete(client->request, endOfInput)) {
+		if (!!(events & (Monitor::Event::Error | Monitor::Event::HangUp))) {
+			_close(client, monitor);
+		}
+		return;
+	}
+
+	_respond(client, monitor);
+};
+
+void DarlingServer::MetricsEndpoint::_respond(std::shared_ptr<Client> client, std::shared_ptr<Monitor> monitor) {
+	client->response = MetricsWriter::response(client->request, render());
+
+	// we're done reading; anything else the client sends is ignored
+	_server.removeMonitor(monitor);
+
+	_write(client, nullptr);
+};
+
+void DarlingServer::MetricsEndpoint::_write(std::shared_ptr<Client> client, std::shared_ptr<Monitor> monitor) {
+	while (client->sent < client->response.size()) {
+		ssize_t written = send(client->fd->fd(), client->response.data() + client->sent, client->response.size() - client->sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				if (!monitor) {
+					// wait for the socket to drain a bit before writing the rest
+					_server.addMonitor(std::make_shared<Monitor>(client->fd, Monitor::Event::Writable, false, false, [this, client](std::shared_ptr<Monitor> monitor, Monitor::Event events) {
+						_write(client, monitor);
+					}));
+				}
+				return;
+			}
+
+			break;
+		}
+
+		client->sent += written;
+	}
+
+	_close(client, monitor);
+};
+
+void DarlingServer::MetricsEndpoint::_close(std::shared_ptr<Client> client, std::shared_ptr<Monitor> monitor) {
+	if (monitor) {
+		_server.removeMonitor(monitor);
+	}
+
+	// the descriptor is closed once the last monitor referencing the client is destroyed
+	--_clientCount;
+};
+
+//
+// exposition
+//
+
+std::string DarlingServer::MetricsEndpoint::render() {
+	MetricsWriter writer;
+
+	writer.addMetric("dserver_processes", "gauge", "Number of registered processes.", processRegistry().size());
+	writer.addMetric("dserver_threads", "gauge", "Number of registered threads.", threadRegistry().size());
+
+	auto workQueueStats = _server._workQueue.stats();
+	writer.addMetric("dserver_workqueue_pending", "gauge", "Number of microthreads waiting for a worker.", workQueueStats.pendingItems);
+	writer.addMetric("dserver_workqueue_workers", "gauge", "Number of worker threads.", workQueueStats.workers);
+	writer.addMetric("dserver_workqueue_idle_workers", "gauge", "Number of worker threads waiting for work.", workQueueStats.idleWorkers);
+
+	auto stackPoolStats = Thread::stackPoolStats();
+	writer.addMetric("dserver_stack_pool_idle", "gauge", "Number of microthread stacks cached in the stack pool.", stackPoolStats.idleStacks);
+	writer.addMetric("dserver_stack_pool_in_use", "gauge", "Number of microthread stacks handed out by the stack pool.", stackPoolStats.stacksInUse);
+	writer.addMetric("dserver_stack_pool_stack_bytes", "gauge", "Size of each pooled microthread stack in bytes.", stackPoolStats.stackSize);
+
+	writer.addMetric("dserver_outbox_messages", "gauge", "Number of replies waiting to be sent.", _server._outbox.size());
+	writer.addMetric("dserver_inbox_messages", "gauge", "Number of received messages waiting to be processed.", _server._inbox.size());
+	writer.addMetric("dserver_timers_pending", "gauge", "Number of pending duct-tape timer calls.", dtape_timer_pending_count());
+
+	Server::TimerStats timerStats;
+	{
+		std::unique_lock lock(_server._timerLock);
+		timerStats = _server._timerStats;
+	}
+	writer.addMetric("dserver_timer_arm_requests_total", "counter", "Number of timer arm requests from duct-tape.", timerStats.armRequests);
+	writer.addMetric("dserver_timer_coalesced_total", "counter", "Number of timer arm requests coalesced with an earlier deadline.", timerStats.coalesced);
+	writer.addMetric("dserver_timer_arms_total", "counter", "Number of times the timer descriptor was armed.", timerStats.arms);
+	writer.addMetric("dserver_timer_fires_total", "counter", "Number of timer descriptor expirations.", timerStats.fires);
+
+	//
+	// per-call statistics
+	//
+
+	auto summaries = CallStats::summaries();
+
+	struct CallCounter {
+		const char* name;
+		const char* type;
+		const char* help;
+		std::string (*value)(const CallStats::Summary& summary);
+	};
+
+	static const CallCounter callCounters[] = {
+		{ "dserver_calls_total", "counter", "Number of completed calls.", [](const CallStats::Summary& summary) { return std::to_string(summary.count); } },
+		{ "dserver_call_queued_seconds_total", "counter", "Time calls spent waiting for a worker.", [](const CallStats::Summary& summary) { return MetricsWriter::formatSeconds(summary.queued); } },
+		{ "dserver_call_running_seconds_total", "counter", "Time calls spent running on a worker.", [](const CallStats::Summary& summary) { return MetricsWriter::formatSeconds(summary.running); } },
+		{ "dserver_call_suspended_seconds_total", "counter", "Time calls spent suspended.", [](const CallStats::Summary& summary) { return MetricsWriter::formatSeconds(summary.suspended); } },
+		{ "dserver_call_reply_bytes_total", "counter", "Total size of call replies in bytes.", [](const CallStats::Summary& summary) { return std::to_string(summary.replyBytes); } },
+	};
+
+	for (const auto& counter: callCounters) {
+		writer.addHeader(counter.name, counter.type, counter.help);
+		for (const auto& summary: summaries) {
+			writer.addSample(counter.name, "call=\"" + MetricsWriter::escapeLabelValue(summary.name) + "\"", counter.value(summary));
+		}
+	}
+
+	writer.addHeader("dserver_call_latency_seconds", "summary", "In-server call latency, from receipt to reply.");
+	for (const auto& summary: summaries) {
+		auto label = "call=\"" + MetricsWriter::escapeLabelValue(summary.name) + "\"";
+
+		writer.addSample("dserver_call_latency_seconds", label + ",quantile=\"0.5\"", MetricsWriter::formatSeconds(summary.latencyP50));
+		writer.addSample("dserver_call_latency_seconds", label + ",quantile=\"0.9\"", MetricsWriter::formatSeconds(summary.latencyP90));
+		writer.addSample("dserver_call_latency_seconds", label + ",quantile=\"0.99\"", MetricsWriter::formatSeconds(summary.latencyP99));
+		writer.addSample("dserver_call_latency_seconds", label + ",quantile=\"1\"", MetricsWriter::formatSeconds(summary.latencyMax));
+		writer.addSample("dserver_call_latency_seconds_sum", label, MetricsWriter::formatSeconds(summary.latencyTotal));
+		writer.addSample("dserver_call_latency_seconds_count", label, std::to_string(summary.count));
+	}
+
+	//
+	// duct-tape zones
+	//
+
+	struct ZoneSnapshot {
+		std::vector<dtape_zone_stats_t> stats;
+		std::vector<std::string> names;
+	};
+
+	ZoneSnapshot zones;
+
+	// copy the stats out first; the zone list is locked while we're being called.
+	// the names are copied too since a zone may be destroyed once the lock is dropped.
+	dtape_zone_stats_iterate([](void* context, const dtape_zone_stats_t* stats) {
+		auto& snapshot = *static_cast<ZoneSnapshot*>(context);
+		snapshot.stats.push_back(*stats);
+		snapshot.names.push_back(stats->name);
+	}, &zones);
+
+	struct ZoneMetric {
+		const char* name;
+		const char* type;
+		const char* help;
+		uint64_t dtape_zone_stats_t::* field;
+	};
+
+	static const ZoneMetric zoneMetrics[] = {
+		{ "dserver_zone_element_bytes", "gauge", "Size of each element in the zone in bytes.", &dtape_zone_stats_t::element_size },
+		{ "dserver_zone_live_elements", "gauge", "Number of allocated elements in the zone.", &dtape_zone_stats_t::live_count },
+		{ "dserver_zone_peak_elements", "gauge", "Peak number of allocated elements in the zone.", &dtape_zone_stats_t::peak_count },
+		{ "dserver_zone_free_elements", "gauge", "Number of free elements cached by the zone.", &dtape_zone_stats_t::free_count },
+		{ "dserver_zone_allocations_total", "counter", "Number of allocations made from the zone.", &dtape_zone_stats_t::alloc_count },
+	};
+
+	for (const auto& metric: zoneMetrics) {
+		writer.addHeader(metric.name, metric.type, metric.help);
+		for (size_t i = 0; i < zones.stats.size(); ++i) {
+			writer.addSample(metric.name, "zone=\"" + MetricsWriter::escapeLabelValue(zones.names[i].c_str()) + "\"", std::to_string(zones.stats[i].*metric.field));
+		}
+	}
+
+	return writer.take();
+};
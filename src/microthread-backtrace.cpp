@@ -0,0 +1,298 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2022 Darling developers
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <darlingserver/microthread-backtrace.hpp>
+#include <darlingserver/registry.hpp>
+#include <darlingserver/thread.hpp>
+#include <darlingserver/process.hpp>
+#include <darlingserver/call.hpp>
+#include <darlingserver/call-stats.hpp>
+#include <darlingserver/duct-tape.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <shared_mutex>
+#include <unistd.h>
+#include <unordered_set>
+#include <vector>
+
+// deep enough for any reasonable microthread stack; this also keeps a looping chain from running forever
+static constexpr size_t maxFrames = 64;
+
+static bool initialFrame(const ucontext_t& context, uintptr_t& pc, uintptr_t& fp) {
+#if defined(__x86_64__)
+	pc = context.uc_mcontext.gregs[REG_RIP];
+	fp = context.uc_mcontext.gregs[REG_RBP];
+	return true;
+#elif defined(__aarch64__)
+	pc = context.uc_mcontext.pc;
+	fp = context.uc_mcontext.regs[29];
+	return true;
+#else
+	return false;
+#endif
+};
+
+/**
+ * Walks the frame pointer chain within the given stack.
+ *
+ * On both x86_64 and arm64, each frame record is a pair of words: the caller's frame pointer followed by the return address.
+ * Since the stack grows down, each caller's record must be at a higher address than its callee's.
+ */
+static std::vector<uintptr_t> walkFrames(uintptr_t pc, uintptr_t fp, uintptr_t stackBottom, uintptr_t stackTop) {
+	std::vector<uintptr_t> frames;
+
+	frames.push_back(pc);
+
+	while (frames.size() < maxFrames) {
+		if (fp < stackBottom || fp > stackTop - 2 * sizeof(uintptr_t) || (fp & (sizeof(uintptr_t) - 1)) != 0) {
+			break;
+		}
+
+		auto record = reinterpret_cast<const uintptr_t*>(fp);
+		uintptr_t nextFP = record[0];
+		uintptr_t returnAddress = record[1];
+
+		if (returnAddress == 0) {
+			break;
+		}
+
+		frames.push_back(returnAddress);
+
+		if (nextFP <= fp) {
+			break;
+		}
+
+		fp = nextFP;
+	}
+
+	return frames;
+};
+
+static std::string symbolize(uintptr_t address) {
+	char line[512];
+	Dl_info info;
+
+	if (dladdr(reinterpret_cast<void*>(address), &info) == 0) {
+		snprintf(line, sizeof(line), "0x%016lx ???", (unsigned long)address);
+		return line;
+	}
+
+	const char* module = info.dli_fname ? info.dli_fname : "???";
+	const char* slash = strrchr(module, '/');
+	if (slash) {
+		module = slash + 1;
+	}
+
+	uintptr_t moduleOffset = address - reinterpret_cast<uintptr_t>(info.dli_fbase);
+
+	if (!info.dli_sname) {
+		snprintf(line, sizeof(line), "0x%016lx %s+0x%lx", (unsigned long)address, module, (unsigned long)moduleOffset);
+		return line;
+	}
+
+	int status = 0;
+	char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+	const char* symbol = (status == 0 && demangled) ? demangled : info.dli_sname;
+
+	snprintf(line, sizeof(line), "0x%016lx %s+0x%lx (%s+0x%lx)", (unsigned long)address, module, (unsigned long)moduleOffset, symbol, (unsigned long)(address - reinterpret_cast<uintptr_t>(info.dli_saddr)));
+
+	free(demangled);
+	return line;
+};
+
+static std::string describeBlockInfo(const dtape_block_info_t& info) {
+	char line[128];
+
+	switch (info.reason) {
+		case dtape_block_reason_waitq:
+			snprintf(line, sizeof(line), "waitq:%s (event 0x%lx)", dtape_block_hint_name(info.hint), (unsigned long)info.site);
+			break;
+		case dtape_block_reason_mutex:
+			snprintf(line, sizeof(line), "mutex 0x%lx", (unsigned long)info.site);
+			break;
+		case dtape_block_reason_condvar:
+			snprintf(line, sizeof(line), "condvar 0x%lx", (unsigned long)info.site);
+			break;
+		case dtape_block_reason_user_suspended:
+			snprintf(line, sizeof(line), "user-suspended");
+			break;
+		default:
+			// suspensions that didn't come from duct-tape
+			snprintf(line, sizeof(line), "other");
+			break;
+	}
+
+	return line;
+};
+
+std::string DarlingServer::MicrothreadBacktrace::report() {
+	auto threads = threadRegistry().copyEntries();
+	auto kernelProcess = Process::kernelProcess();
+	std::unordered_set<Thread*> impersonated;
+	std::string result;
+	char line[512];
+
+	// sort them by process so that related threads end up next to each other
+	std::sort(threads.begin(), threads.end(), [](const std::shared_ptr<Thread>& a, const std::shared_ptr<Thread>& b) {
+		auto aPID = a->_process ? a->_process->id() : 0;
+		auto bPID = b->_process ? b->_process->id() : 0;
+		return (aPID != bPID) ? (aPID < bPID) : (a->id() < b->id());
+	});
+
+	// holding a thread's lock keeps it from being resumed (and its stack from changing) while we look at it.
+	// we only try each lock once, without waiting: a hung server is exactly when someone might be holding one forever,
+	// and this may be running on a worker that other threads are waiting on.
+	std::vector<std::shared_lock<std::shared_mutex>> locks;
+	locks.reserve(threads.size());
+	for (auto& thread: threads) {
+		locks.emplace_back(thread->_rwlock, std::try_to_lock);
+	}
+
+	// threads being impersonated are marked as running to keep them from actually running, so we need to know which ones those are
+	for (size_t i = 0; i < threads.size(); ++i) {
+		if (locks[i].owns_lock() && threads[i]->_impersonating) {
+			impersonated.insert(threads[i]->_impersonating.get());
+		}
+	}
+
+	snprintf(line, sizeof(line), "%zu microthread(s)\n", threads.size());
+	result += line;
+
+	for (size_t i = 0; i < threads.size(); ++i) {
+		auto& thread = threads[i];
+
+		// let the thread go again as soon as we're done with it
+		auto lock = std::move(locks[i]);
+
+		result += '\n';
+
+		if (!lock.owns_lock()) {
+			// someone's holding it (possibly forever, if that's why we're hung); don't hang the report too.
+			// the IDs are fixed once the thread is set up, so they're fine to read without the lock.
+			snprintf(line, sizeof(line), "thread %d (%d) (locked)\n", thread->id(), thread->nsid());
+			result += line;
+			continue;
+		}
+
+		auto& process = thread->_process;
+
+		snprintf(line, sizeof(line), "thread %d (%d) of process %d (%d)%s%s%s\n",
+			thread->_tid,
+			thread->_nstid,
+			process ? process->id() : -1,
+			process ? process->nsid() : -1,
+			(process == kernelProcess) ? " [kernel]" : "",
+			thread->_dead ? " [dead]" : "",
+			thread->_terminating ? " [terminating]" : ""
+		);
+		result += line;
+
+		if (thread->_activeCall) {
+			snprintf(line, sizeof(line), "  call: %s\n", CallStats::callName(static_cast<unsigned int>(thread->_activeCall->number())));
+		} else {
+			snprintf(line, sizeof(line), "  call: none\n");
+		}
+		result += line;
+
+		if (thread->_impersonating) {
+			snprintf(line, sizeof(line), "  impersonating: thread %d (%d)\n", thread->_impersonating->_tid, thread->_impersonating->_nstid);
+			result += line;
+		}
+
+		if (impersonated.count(thread.get()) > 0) {
+			result += "  state: being impersonated\n";
+			continue;
+		}
+
+		if (thread->_running) {
+			// we can't safely look at the stack of a thread that's currently running on a worker
+			result += "  state: running\n";
+			continue;
+		}
+
+		if (!thread->_suspended) {
+			// either waiting for a call or queued to run
+			result += "  state: idle or runnable\n";
+			continue;
+		}
+
+		// when impersonating, duct-tape thinks the impersonated thread is the one blocking
+		dtape_thread_t* dtapeThread = thread->_impersonating ? thread->_impersonating->_dtapeThread : thread->_dtapeThread;
+		dtape_block_info_t info;
+		dtape_thread_get_block_info(dtapeThread, &info);
+
+		snprintf(line, sizeof(line), "  state: suspended (%s)\n", describeBlockInfo(info).c_str());
+		result += line;
+
+		if (thread->_continuationCallback) {
+			// the stack was discarded when it suspended
+			result += "  (suspended with a continuation; no stack to unwind)\n";
+			continue;
+		}
+
+		if (!thread->_stack.isValid()) {
+			result += "  (no stack)\n";
+			continue;
+		}
+
+		uintptr_t pc;
+		uintptr_t fp;
+
+		if (!initialFrame(thread->_resumeContext, pc, fp)) {
+			result += "  (backtraces are not supported on this architecture)\n";
+			continue;
+		}
+
+		auto stackBottom = reinterpret_cast<uintptr_t>(thread->_stack.base);
+		auto frames = walkFrames(pc, fp, stackBottom, stackBottom + thread->_stack.size);
+
+		for (size_t i = 0; i < frames.size(); ++i) {
+			snprintf(line, sizeof(line), "  #%-2zu %s\n", i, symbolize(frames[i]).c_str());
+			result += line;
+		}
+	}
+
+	return result;
+};
+
+bool DarlingServer::MicrothreadBacktrace::writeReport(int fd) {
+	auto text = report();
+	const char* data = text.data();
+	size_t remaining = text.size();
+
+	while (remaining > 0) {
+		ssize_t written = write(fd, data, remaining);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		data += written;
+		remaining -= written;
+	}
+
+	return true;
+};
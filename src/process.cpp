@@ -23,11 +23,15 @@
 #include <unistd.h>
 #include <sys/uio.h>
 #include <darlingserver/logging.hpp>
+#include <darlingserver/probes.h>
 
 #include <fstream>
 #include <regex>
+#include <algorithm>
 
 #include <sys/mman.h>
+#include <fcntl.h>
+#include <cstring>
 
 static DarlingServer::Log processLog("process");
 
@@ -170,6 +174,7 @@ std::shared_ptr<DarlingServer::Process> DarlingServer::Process::kernelProcess()
 	static std::shared_ptr<Process> process = [&]() {
 		auto proc = std::make_shared<Process>(KernelProcessConstructorTag());
 		processRegistry().registerEntry(proc, true);
+		DSERVER_PROBE2(process__register, proc->id(), proc->nsid());
 		return proc;
 	}();
 	return process;
@@ -185,11 +190,141 @@ void DarlingServer::Process::setStartSuspended(bool startSuspended) {
 	_startSuspended = startSuspended;
 };
 
-bool DarlingServer::Process::_readOrWriteMemory(bool isWrite, uintptr_t remoteAddress, void* localBuffer, size_t length, int* errorCode) const {
+static DarlingServer::Log processMemoryAccessLog("procmem");
+
+namespace {
+	enum class MemoryBackend {
+		// use /proc/<pid>/mem for small accesses and process_vm_readv/writev for large ones, falling back to the other when one can't do the job
+		Automatic,
+		ProcFS,
+		ProcessVM,
+	};
+};
+
+// procfs is ~10-15% faster for accesses of up to a page, the two are about even at 8 KiB,
+// and process_vm_readv/writev is 1.5-2x faster from 16 KiB up (see tests/procmem-bench.cpp)
+static constexpr size_t automaticProcFSMaximumLength = 4 * 1024;
+
+// this can be set with the DSERVER_PROCMEM_BACKEND environment variable; valid values are "auto" (the default), "procfs", and "vm"
+static MemoryBackend memoryBackend() {
+	static const MemoryBackend backend = []() {
+		const char* value = getenv("DSERVER_PROCMEM_BACKEND");
+
+		if (!value || strcmp(value, "auto") == 0) {
+			return MemoryBackend::Automatic;
+		} else if (strcmp(value, "procfs") == 0) {
+			return MemoryBackend::ProcFS;
+		} else if (strcmp(value, "vm") == 0) {
+			return MemoryBackend::ProcessVM;
+		}
+
+		processMemoryAccessLog.warning() << "Unknown memory backend \"" << value << "\"; using automatic selection" << processMemoryAccessLog.endLog;
+		return MemoryBackend::Automatic;
+	}();
+	return backend;
+};
+
+std::shared_ptr<DarlingServer::FD> DarlingServer::Process::_getMemoryFD(int* openError) const {
+	std::unique_lock lock(_memoryFDLock);
+
+	if (_memoryFD || _memoryFDUnavailable) {
+		if (openError) {
+			*openError = _memoryFDOpenError;
+		}
+		return _memoryFD;
+	}
+
+	// the fd is opened once and reused for every access until the process execs or dies.
+	// it's opened read-write because writes through /proc/<pid>/mem ignore page protections,
+	// so we can write to read-only pages without having to ask the client to mprotect them first.
+	int fd = open(("/proc/" + std::to_string(_pid) + "/mem").c_str(), O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		int code = errno;
+		processMemoryAccessLog.info() << *this << ": failed to open /proc/<pid>/mem: " << code << " (" << strerror(code) << "); falling back to process_vm_readv/writev" << processMemoryAccessLog.endLog;
+		_memoryFDUnavailable = true;
+		_memoryFDOpenError = code;
+		if (openError) {
+			*openError = code;
+		}
+		return nullptr;
+	}
+
+	_memoryFD = std::make_shared<FD>(fd);
+	_memoryFDOpenError = 0;
+	if (openError) {
+		*openError = 0;
+	}
+	return _memoryFD;
+};
+
+void DarlingServer::Process::_dropMemoryFD(const std::shared_ptr<FD>& staleFD) const {
+	std::unique_lock lock(_memoryFDLock);
+	// someone else may have already replaced it
+	if (_memoryFD == staleFD) {
+		_memoryFD = nullptr;
+		_memoryFDUnavailable = false;
+	}
+};
+
+void DarlingServer::Process::_resetMemoryFD() {
+	std::unique_lock lock(_memoryFDLock);
+	// any in-flight accesses hold their own reference, so the fd is only actually closed once they're done
+	_memoryFD = nullptr;
+	_memoryFDUnavailable = false;
+};
+
+bool DarlingServer::Process::_readOrWriteMemoryProcFS(const FD& memoryFD, bool isWrite, uintptr_t remoteAddress, void* localBuffer, size_t length, int* errorCode) const {
+	size_t offset = 0;
+
+	while (offset < length) {
+		auto result = isWrite
+			? pwrite(memoryFD.fd(), (const char*)localBuffer + offset, length - offset, remoteAddress + offset)
+			: pread(memoryFD.fd(), (char*)localBuffer + offset, length - offset, remoteAddress + offset);
+
+		if (result < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			// procfs reports a bad address as EIO; report it the same way process_vm_readv/writev would
+			*errorCode = (errno == EIO) ? EFAULT : errno;
+			return false;
+		} else if (result == 0) {
+			// the address space this descriptor refers to is gone (e.g. the process exec'd or exited)
+			*errorCode = ESRCH;
+			return false;
+		}
+
+		offset += result;
+	}
+
+	*errorCode = 0;
+	return true;
+};
+
+bool DarlingServer::Process::_readOrWriteMemoryVM(bool isWrite, uintptr_t remoteAddress, void* localBuffer, size_t length, int* errorCode) const {
 	struct iovec local;
 	struct iovec remote;
 	const auto func = isWrite ? process_vm_writev : process_vm_readv;
-	static DarlingServer::Log processMemoryAccessLog("procmem");
+
+	local.iov_base = localBuffer;
+	local.iov_len = length;
+
+	remote.iov_base = (void*)remoteAddress;
+	remote.iov_len = length;
+
+	if (func(id(), &local, 1, &remote, 1, 0) < 0) {
+		*errorCode = errno;
+		return false;
+	}
+
+	*errorCode = 0;
+	return true;
+};
+
+bool DarlingServer::Process::_readOrWriteMemory(bool isWrite, uintptr_t remoteAddress, void* localBuffer, size_t length, int* errorCode) const {
+	int code = 0;
+	bool ok = false;
+	const char* backendName = nullptr;
 
 	if (isDead()) {
 		processMemoryAccessLog.error()
@@ -210,14 +345,63 @@ bool DarlingServer::Process::_readOrWriteMemory(bool isWrite, uintptr_t remoteAd
 		return false;
 	}
 
-	local.iov_base = localBuffer;
-	local.iov_len = length;
+	auto backend = memoryBackend();
+	int openError = 0;
+	std::shared_ptr<FD> memoryFD = nullptr;
 
-	remote.iov_base = (void*)remoteAddress;
-	remote.iov_len = length;
+	auto tryProcFS = [&]() {
+		memoryFD = _getMemoryFD(&openError);
+		if (!memoryFD) {
+			return;
+		}
 
-	if (func(id(), &local, 1, &remote, 1, 0) < 0) {
-		int code = errno;
+		backendName = "procfs";
+		ok = _readOrWriteMemoryProcFS(*memoryFD, isWrite, remoteAddress, localBuffer, length, &code);
+
+		if (!ok && code == ESRCH) {
+			// the cached descriptor may refer to an address space that's gone (e.g. the process exec'd but the new image hasn't checked in yet);
+			// reopen it and try once more
+			_dropMemoryFD(memoryFD);
+			memoryFD = _getMemoryFD(&openError);
+			if (memoryFD) {
+				ok = _readOrWriteMemoryProcFS(*memoryFD, isWrite, remoteAddress, localBuffer, length, &code);
+			} else {
+				code = openError;
+			}
+		}
+	};
+
+	auto tryVM = [&]() {
+		backendName = "vm";
+		ok = _readOrWriteMemoryVM(isWrite, remoteAddress, localBuffer, length, &code);
+	};
+
+	if (backend == MemoryBackend::ProcFS || (backend == MemoryBackend::Automatic && length <= automaticProcFSMaximumLength)) {
+		tryProcFS();
+
+		// in automatic mode, if /proc/<pid>/mem is unavailable or the access failed for a reason other than a bad address
+		// or a dead address space (neither of which process_vm_readv/writev would do any better with), give process_vm_readv/writev a shot
+		if (!ok && backend == MemoryBackend::Automatic && (!memoryFD || (code != EFAULT && code != ESRCH))) {
+			tryVM();
+		}
+	} else {
+		tryVM();
+
+		// process_vm_writev honors page protections (and reports a write to a read-only page as EFAULT), but writes through /proc/<pid>/mem don't,
+		// so in automatic mode, a failed write gets another shot with procfs rather than making the client mprotect the pages first.
+		// a failed read only gets one if it wasn't due to a bad address.
+		if (!ok && backend == MemoryBackend::Automatic && code != ESRCH && (isWrite || code != EFAULT)) {
+			tryProcFS();
+		}
+	}
+
+	if (!backendName) {
+		// we were told to only use /proc/<pid>/mem but we couldn't open it
+		backendName = "procfs";
+		code = openError;
+	}
+
+	if (!ok) {
 		processMemoryAccessLog.error()
 			<< "Failed to "
 			<< (isWrite ? "write " : "read ")
@@ -228,7 +412,9 @@ bool DarlingServer::Process::_readOrWriteMemory(bool isWrite, uintptr_t remoteAd
 			<< id()
 			<< " ("
 			<< nsid()
-			<< "): "
+			<< ") using "
+			<< backendName
+			<< ": "
 			<< code
 			<< " ("
 			<< strerror(code)
@@ -249,7 +435,8 @@ bool DarlingServer::Process::_readOrWriteMemory(bool isWrite, uintptr_t remoteAd
 			<< id()
 			<< " ("
 			<< nsid()
-			<< ")"
+			<< ") using "
+			<< backendName
 			<< processMemoryAccessLog.endLog;
 		if (errorCode) {
 			*errorCode = 0;
@@ -272,6 +459,9 @@ void DarlingServer::Process::notifyCheckin(Architecture architecture) {
 
 	bool didExec = _pendingReplacement;
 
+	// the client re-advertises its S2C features after every checkin
+	_s2cFeatures = 0;
+
 	if (didExec) {
 		// exec case
 
@@ -309,15 +499,13 @@ void DarlingServer::Process::notifyCheckin(Architecture architecture) {
 		auto newThread = dtape_thread_create(_dtapeTask, mainThread->_nstid, mainThread.get());
 		mainThread->_dtapeThread = newThread;
 
-		// destroy the main thread's old S2C semaphores
-		dtape_semaphore_destroy(mainThread->_s2cPerformSempahore);
-		mainThread->_s2cPerformSempahore = nullptr;
-		dtape_semaphore_destroy(mainThread->_s2cReplySempahore);
-		mainThread->_s2cReplySempahore = nullptr;
-		dtape_semaphore_destroy(mainThread->_s2cInterruptEnterSemaphore);
-		mainThread->_s2cInterruptEnterSemaphore = nullptr;
-		dtape_semaphore_destroy(mainThread->_s2cInterruptExitSemaphore);
-		mainThread->_s2cInterruptExitSemaphore = nullptr;
+		// destroy the main thread's old S2C semaphores (if it had any);
+		// new ones will be created for the new task the next time they're needed
+		mainThread->_destroyS2CSemaphores();
+
+		// the old memory fd and the VM arena refer to the old address space
+		_resetMemoryFD();
+		_resetArena();
 
 		// destroy the fork-wait semaphore
 		dtape_semaphore_destroy(_dtapeForkWaitSemaphore);
@@ -331,12 +519,6 @@ void DarlingServer::Process::notifyCheckin(Architecture architecture) {
 
 		// create a new fork-wait semaphore for the new task
 		_dtapeForkWaitSemaphore = dtape_semaphore_create(_dtapeTask, 0);
-
-		// create new S2C semaphores for the main thread
-		mainThread->_s2cPerformSempahore = dtape_semaphore_create(_dtapeTask, 1);
-		mainThread->_s2cReplySempahore = dtape_semaphore_create(_dtapeTask, 0);
-		mainThread->_s2cInterruptEnterSemaphore = dtape_semaphore_create(_dtapeTask, 0);
-		mainThread->_s2cInterruptExitSemaphore = dtape_semaphore_create(_dtapeTask, 0);
 	} else {
 		// fork case
 
@@ -566,21 +748,30 @@ std::shared_ptr<DarlingServer::Thread> DarlingServer::Process::_pickS2CThread(vo
 		return Thread::currentThread();
 	}
 
-	// otherwise, pick any thread to perform the call
+	// otherwise, pick a thread to perform the call.
+	// prefer threads that are blocked waiting for a reply from us; those can receive the S2C call inline in their receive loop,
+	// whereas any other thread has to be interrupted with a signal first.
 
-	std::shared_ptr<Thread> thread = nullptr;
+	std::vector<std::shared_ptr<Thread>> candidates;
 
 	{
 		std::shared_lock lock(_rwlock);
 		for (auto& [id, weakThread]: _threads) {
-			thread = weakThread.lock();
-			if (thread) {
-				break;
+			if (auto thread = weakThread.lock()) {
+				candidates.push_back(thread);
 			}
 		}
 	}
 
-	return thread;
+	// NOTE: we check this without holding our lock to avoid taking the thread's lock while holding ours.
+	//       it's fine if the thread stops waiting before we perform the call; _s2cPerform falls back to signaling in that case.
+	for (auto& thread: candidates) {
+		if (thread->waitingForReply()) {
+			return thread;
+		}
+	}
+
+	return candidates.empty() ? nullptr : candidates.front();
 };
 
 std::string DarlingServer::Process::executablePath() const {
@@ -593,6 +784,221 @@ void DarlingServer::Process::setExecutablePath(std::string path) {
 	_executablePath = std::move(path);
 };
 
+uint64_t DarlingServer::Process::s2cFeatures() const {
+	std::shared_lock lock(_rwlock);
+	return _s2cFeatures;
+};
+
+void DarlingServer::Process::setS2CFeatures(uint64_t features) {
+	std::unique_lock lock(_rwlock);
+	_s2cFeatures = features;
+};
+
+// the VM arena is an opt-in optimization (enabled with DSERVER_VM_ARENA=1) for processes that allocate and free lots of memory.
+// we reserve large chunks of read-write memory in the client and hand out allocations from them ourselves,
+// so that allocating memory doesn't require an S2C call. freeing memory still requires an S2C call (to give the pages back to the OS
+// and re-zero them), but growing the arena and freeing are the only operations that do.
+//
+// free space is tracked both by address (for merging and clipping) and by size (for best-fit allocation), so allocating
+// doesn't have to scan every free range. chunks that become completely free are unmapped again, except for one spare
+// (so that a process hovering around a chunk boundary doesn't keep mapping and unmapping a whole chunk).
+//
+// note that this assumes the client doesn't munmap memory in the arena on its own (i.e. without going through Mach).
+static bool vmArenaEnabled() {
+	static const bool enabled = []() {
+		const char* value = getenv("DSERVER_VM_ARENA");
+		return value && (value[0] == '1' || value[0] == 't' || value[0] == 'T');
+	}();
+	return enabled;
+};
+
+// size of each chunk we reserve in the client for the arena
+static constexpr size_t vmArenaChunkSize = 256ull * 1024 * 1024;
+
+// allocations larger than this bypass the arena to avoid fragmenting it
+static constexpr size_t vmArenaMaxAllocationSize = vmArenaChunkSize / 4;
+
+bool DarlingServer::Process::_arenaUsable() const {
+	// we only use the arena for 64-bit processes; 32-bit processes don't have enough address space to spare
+	return vmArenaEnabled() && _pid >= 0 && is64Bit();
+};
+
+uintptr_t DarlingServer::Process::_arenaAllocate(size_t size) {
+	std::unique_lock lock(_arenaLock);
+
+	// best-fit (the smallest free range that's big enough, and the lowest one of those)
+	auto bySize = _arenaFreeRangesBySize.lower_bound({ size, 0 });
+
+	if (bySize == _arenaFreeRangesBySize.end()) {
+		return 0;
+	}
+
+	auto [rangeSize, address] = *bySize;
+
+	_arenaEraseFreeRangeLocked(_arenaFreeRanges.find(address));
+
+	if (rangeSize > size) {
+		_arenaSetFreeRangeLocked(address + size, rangeSize - size);
+	}
+
+	return address;
+};
+
+void DarlingServer::Process::_arenaSetFreeRangeLocked(uintptr_t address, size_t size) {
+	auto [it, inserted] = _arenaFreeRanges.try_emplace(address, size);
+
+	if (!inserted) {
+		_arenaFreeRangesBySize.erase({ it->second, address });
+		it->second = size;
+	}
+
+	_arenaFreeRangesBySize.emplace(size, address);
+};
+
+std::map<uintptr_t, size_t>::iterator DarlingServer::Process::_arenaEraseFreeRangeLocked(std::map<uintptr_t, size_t>::iterator it) {
+	_arenaFreeRangesBySize.erase({ it->second, it->first });
+	return _arenaFreeRanges.erase(it);
+};
+
+void DarlingServer::Process::_arenaAddFreeRange(uintptr_t address, size_t size) {
+	std::unique_lock lock(_arenaLock);
+
+	uintptr_t end = address + size;
+	uintptr_t current = address;
+	std::vector<std::pair<uintptr_t, uintptr_t>> pieces;
+
+	// free ranges must never overlap, otherwise _arenaAllocate would hand out the same pages twice.
+	// the given range can overlap existing free ranges if the client deallocates the same memory twice
+	// or deallocates arena memory we never handed out, so clip off any part of it that's already free.
+	auto it = _arenaFreeRanges.upper_bound(address);
+
+	if (it != _arenaFreeRanges.begin()) {
+		--it;
+	}
+
+	for (; it != _arenaFreeRanges.end() && it->first < end; ++it) {
+		uintptr_t rangeStart = it->first;
+		uintptr_t rangeEnd = rangeStart + it->second;
+
+		if (rangeEnd <= current) {
+			continue;
+		}
+
+		if (rangeStart > current) {
+			pieces.emplace_back(current, rangeStart);
+		}
+
+		current = std::max(current, rangeEnd);
+	}
+
+	if (current < end) {
+		pieces.emplace_back(current, end);
+	}
+
+	if (pieces.size() != 1 || pieces.front().first != address || pieces.front().second != end) {
+		processLog.warning() << *this << ": freed arena range 0x" << std::hex << address << "-0x" << end << std::dec << " overlaps memory that was already free" << processLog.endLog;
+	}
+
+	for (auto [start, stop]: pieces) {
+		_arenaInsertFreeRangeLocked(start, stop - start);
+	}
+};
+
+void DarlingServer::Process::_arenaInsertFreeRangeLocked(uintptr_t address, size_t size) {
+	auto next = _arenaFreeRanges.lower_bound(address);
+
+	// merge with the following range
+	if (next != _arenaFreeRanges.end() && next->first == address + size) {
+		size += next->second;
+		next = _arenaEraseFreeRangeLocked(next);
+	}
+
+	// merge with the preceding range
+	if (next != _arenaFreeRanges.begin()) {
+		auto prev = std::prev(next);
+		if (prev->first + prev->second == address) {
+			_arenaSetFreeRangeLocked(prev->first, prev->second + size);
+			return;
+		}
+	}
+
+	_arenaSetFreeRangeLocked(address, size);
+};
+
+void DarlingServer::Process::_arenaClaimRange(uintptr_t address, size_t size) {
+	std::unique_lock lock(_arenaLock);
+	_arenaClaimRangeLocked(address, size);
+};
+
+void DarlingServer::Process::_arenaClaimRangeLocked(uintptr_t address, size_t size) {
+	uintptr_t end = address + size;
+	auto it = _arenaFreeRanges.upper_bound(address);
+
+	if (it != _arenaFreeRanges.begin()) {
+		--it;
+	}
+
+	// remove (or trim) every free range that overlaps the given range
+	while (it != _arenaFreeRanges.end() && it->first < end) {
+		auto [rangeStart, rangeSize] = *it;
+		uintptr_t rangeEnd = rangeStart + rangeSize;
+
+		if (rangeEnd <= address) {
+			++it;
+			continue;
+		}
+
+		it = _arenaEraseFreeRangeLocked(it);
+
+		if (rangeStart < address) {
+			_arenaSetFreeRangeLocked(rangeStart, address - rangeStart);
+		}
+
+		if (rangeEnd > end) {
+			// this is past the given range, so we're done
+			_arenaSetFreeRangeLocked(end, rangeEnd - end);
+			break;
+		}
+	}
+};
+
+std::vector<std::pair<uintptr_t, size_t>> DarlingServer::Process::_arenaTakeReleasableChunks() {
+	std::unique_lock lock(_arenaLock);
+	std::vector<std::pair<uintptr_t, size_t>> releasable;
+	bool keptSpare = false;
+
+	for (auto it = _arenaChunks.begin(); it != _arenaChunks.end();) {
+		auto [chunkStart, chunkSize] = *it;
+
+		// adjacent chunks may have been merged into a single free range, so look for the range containing this chunk
+		auto range = _arenaFreeRanges.upper_bound(chunkStart);
+		bool free = false;
+		if (range != _arenaFreeRanges.begin()) {
+			--range;
+			free = range->first + range->second >= chunkStart + chunkSize;
+		}
+
+		if (!free || !keptSpare) {
+			keptSpare = keptSpare || free;
+			++it;
+			continue;
+		}
+
+		_arenaClaimRangeLocked(chunkStart, chunkSize);
+		releasable.emplace_back(chunkStart, chunkSize);
+		it = _arenaChunks.erase(it);
+	}
+
+	return releasable;
+};
+
+void DarlingServer::Process::_resetArena() {
+	std::unique_lock lock(_arenaLock);
+	_arenaChunks.clear();
+	_arenaFreeRanges.clear();
+	_arenaFreeRangesBySize.clear();
+};
+
 uintptr_t DarlingServer::Process::allocatePages(size_t pageCount, int protection, uintptr_t addressHint, bool fixed, bool overwrite) {
 	auto thread = _pickS2CThread();
 
@@ -600,7 +1006,39 @@ uintptr_t DarlingServer::Process::allocatePages(size_t pageCount, int protection
 		throw std::system_error(ESRCH, std::generic_category());
 	}
 
-	return thread->allocatePages(pageCount, protection, addressHint, fixed, overwrite);
+	size_t size = pageCount * sysconf(_SC_PAGESIZE);
+
+	if (!fixed && addressHint == 0 && protection == (PROT_READ | PROT_WRITE) && size <= vmArenaMaxAllocationSize && _arenaUsable()) {
+		if (auto address = _arenaAllocate(size)) {
+			return address;
+		}
+
+		// the arena is full (or we haven't created it yet); grow it
+		// NOTE: we must not hold the arena lock while performing the S2C call, since it may suspend us
+		try {
+			auto chunk = thread->allocatePages(vmArenaChunkSize / sysconf(_SC_PAGESIZE), PROT_READ | PROT_WRITE, 0, false, false);
+			{
+				std::unique_lock lock(_arenaLock);
+				_arenaChunks.emplace_back(chunk, vmArenaChunkSize);
+			}
+			_arenaAddFreeRange(chunk, vmArenaChunkSize);
+		} catch (const std::system_error& e) {
+			processLog.warning() << *this << ": failed to grow VM arena: " << e.what() << processLog.endLog;
+		}
+
+		if (auto address = _arenaAllocate(size)) {
+			return address;
+		}
+	}
+
+	auto result = thread->allocatePages(pageCount, protection, addressHint, fixed, overwrite);
+
+	if (fixed && _arenaUsable()) {
+		// if this mapping replaced part of the arena, make sure we don't hand out that part anymore
+		_arenaClaimRange(result, size);
+	}
+
+	return result;
 };
 
 void DarlingServer::Process::freePages(uintptr_t address, size_t pageCount) {
@@ -610,17 +1048,109 @@ void DarlingServer::Process::freePages(uintptr_t address, size_t pageCount) {
 		throw std::system_error(ESRCH, std::generic_category());
 	}
 
-	return thread->freePages(address, pageCount);
+	if (!_arenaUsable()) {
+		return thread->freePages(address, pageCount);
+	}
+
+	const auto pageSize = sysconf(_SC_PAGESIZE);
+	uintptr_t end = address + pageCount * pageSize;
+	std::vector<std::pair<uintptr_t, uintptr_t>> arenaRanges;
+
+	{
+		std::unique_lock lock(_arenaLock);
+		for (auto [chunkStart, chunkSize]: _arenaChunks) {
+			uintptr_t start = std::max(address, chunkStart);
+			uintptr_t stop = std::min(end, chunkStart + chunkSize);
+			if (start < stop) {
+				arenaRanges.emplace_back(start, stop);
+			}
+		}
+	}
+
+	if (arenaRanges.empty()) {
+		return thread->freePages(address, pageCount);
+	}
+
+	std::sort(arenaRanges.begin(), arenaRanges.end());
+
+	// anything outside the arena is unmapped as usual;
+	// anything inside it is replaced with fresh zero-filled pages (releasing the old ones) and given back to the arena.
+	// all of this is done in a single S2C batch.
+	std::vector<dserver_s2c_batch_op_t> ops;
+	uintptr_t current = address;
+	auto pushUnmap = [&](uintptr_t start, uintptr_t stop) {
+		dserver_s2c_batch_op_t op {};
+		op.op = dserver_s2c_msgnum_munmap;
+		op.fd = -1;
+		op.address = start;
+		op.length = stop - start;
+		ops.push_back(op);
+	};
+	for (auto [start, stop]: arenaRanges) {
+		if (current < start) {
+			pushUnmap(current, start);
+		}
+
+		dserver_s2c_batch_op_t op {};
+		op.op = dserver_s2c_msgnum_mmap;
+		op.fd = -1;
+		op.address = start;
+		op.length = stop - start;
+		op.protection = PROT_READ | PROT_WRITE;
+		op.flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED;
+		ops.push_back(op);
+
+		current = stop;
+	}
+	if (current < end) {
+		pushUnmap(current, end);
+	}
+
+	auto results = thread->_s2cBatch(ops);
+	int error = 0;
+
+	// give back every arena range that was successfully replaced, even if a later operation failed
+	for (size_t i = 0; i < ops.size(); ++i) {
+		if (results[i].errno_result != 0) {
+			if (error == 0) {
+				error = results[i].errno_result;
+			}
+			continue;
+		}
+
+		if (ops[i].op == dserver_s2c_msgnum_mmap) {
+			_arenaAddFreeRange(ops[i].address, ops[i].length);
+		}
+	}
+
+	if (error != 0) {
+		throw std::system_error(error, std::generic_category(), "S2C batch call failed");
+	}
+
+	// if that emptied out whole chunks, give them back to the OS (we no longer hand them out, even if this fails)
+	for (auto [chunkStart, chunkSize]: _arenaTakeReleasableChunks()) {
+		try {
+			thread->freePages(chunkStart, chunkSize / pageSize);
+		} catch (const std::system_error& e) {
+			processLog.warning() << *this << ": failed to release VM arena chunk: " << e.what() << processLog.endLog;
+		}
+	}
 };
 
-uintptr_t DarlingServer::Process::mapFile(int fd, size_t pageCount, int protection, uintptr_t addressHint, size_t pageOffset, bool fixed, bool overwrite) {
+uintptr_t DarlingServer::Process::mapFile(int fd, size_t pageCount, int protection, uintptr_t addressHint, size_t pageOffset, bool fixed, bool overwrite, bool copyOnWrite) {
 	auto thread = _pickS2CThread();
 
 	if (!thread) {
 		throw std::system_error(ESRCH, std::generic_category());
 	}
 
-	return thread->mapFile(fd, pageCount, protection, addressHint, pageOffset, fixed, overwrite);
+	auto result = thread->mapFile(fd, pageCount, protection, addressHint, pageOffset, fixed, overwrite, copyOnWrite);
+
+	if (fixed && _arenaUsable()) {
+		_arenaClaimRange(result, pageCount * sysconf(_SC_PAGESIZE));
+	}
+
+	return result;
 };
 
 void DarlingServer::Process::changeProtection(uintptr_t address, size_t pageCount, int protection) {
@@ -643,6 +1173,104 @@ void DarlingServer::Process::syncMemory(uintptr_t address, size_t size, int sync
 	return thread->syncMemory(address, size, sync_flags);
 };
 
+void DarlingServer::Process::performMemoryOps(dtape_memory_op_t* ops, size_t opCount) {
+	if (opCount == 0) {
+		return;
+	}
+
+	const auto pageSize = sysconf(_SC_PAGESIZE);
+	auto thread = _pickS2CThread();
+	size_t failedIndex = opCount;
+
+	if (!thread) {
+		failedIndex = 0;
+		ops[0].result = 0;
+		ops[0].error = ESRCH;
+	} else if (_arenaUsable()) {
+		// the arena has to see every allocation and deallocation, so go through the usual methods
+		for (size_t i = 0; i < opCount && failedIndex == opCount; ++i) {
+			auto& op = ops[i];
+
+			try {
+				switch (op.type) {
+					case dtape_memory_op_allocate_pages:
+						op.result = allocatePages(op.page_count, op.protection, op.address, op.flags & dtape_memory_flag_fixed, op.flags & dtape_memory_flag_overwrite);
+						break;
+					case dtape_memory_op_map_file:
+						op.result = mapFile(op.fd, op.page_count, op.protection, op.address, op.page_offset, op.flags & dtape_memory_flag_fixed, op.flags & dtape_memory_flag_overwrite, op.flags & dtape_memory_flag_private);
+						break;
+					case dtape_memory_op_free_pages:
+						freePages(op.address, op.page_count);
+						op.result = 0;
+						break;
+				}
+				op.error = 0;
+			} catch (const std::system_error& e) {
+				op.result = 0;
+				op.error = e.code().value();
+				failedIndex = i;
+			}
+		}
+	} else {
+		std::vector<dserver_s2c_batch_op_t> batchOps(opCount);
+
+		for (size_t i = 0; i < opCount; ++i) {
+			const auto& op = ops[i];
+			auto& batchOp = batchOps[i];
+			int fixedFlags = 0;
+
+			memset(&batchOp, 0, sizeof(batchOp));
+			batchOp.fd = -1;
+
+			// these flags must match what Thread::allocatePages and Thread::mapFile use
+			if ((op.flags & dtape_memory_flag_fixed) && (op.flags & dtape_memory_flag_overwrite)) {
+				fixedFlags = MAP_FIXED;
+			} else if (op.flags & dtape_memory_flag_fixed) {
+				fixedFlags = MAP_FIXED_NOREPLACE;
+			}
+
+			switch (op.type) {
+				case dtape_memory_op_allocate_pages:
+					batchOp.op = dserver_s2c_msgnum_mmap;
+					batchOp.address = op.address;
+					batchOp.length = op.page_count * pageSize;
+					batchOp.protection = op.protection;
+					batchOp.flags = MAP_PRIVATE | MAP_ANONYMOUS | fixedFlags;
+					break;
+				case dtape_memory_op_map_file:
+					batchOp.op = dserver_s2c_msgnum_mmap;
+					batchOp.fd = op.fd;
+					batchOp.address = op.address;
+					batchOp.length = op.page_count * pageSize;
+					batchOp.protection = op.protection;
+					batchOp.flags = ((op.flags & dtape_memory_flag_private) ? MAP_PRIVATE : MAP_SHARED) | fixedFlags;
+					batchOp.offset = op.page_offset * pageSize;
+					break;
+				case dtape_memory_op_free_pages:
+					batchOp.op = dserver_s2c_msgnum_munmap;
+					batchOp.address = op.address;
+					batchOp.length = op.page_count * pageSize;
+					break;
+			}
+		}
+
+		auto results = thread->_s2cBatch(batchOps);
+
+		for (size_t i = 0; i < opCount && failedIndex == opCount; ++i) {
+			ops[i].error = results[i].errno_result;
+			ops[i].result = (ops[i].error == 0 && ops[i].type != dtape_memory_op_free_pages) ? results[i].return_value : 0;
+			if (ops[i].error != 0) {
+				failedIndex = i;
+			}
+		}
+	}
+
+	for (size_t i = failedIndex + 1; i < opCount; ++i) {
+		ops[i].result = 0;
+		ops[i].error = DTAPE_MEMORY_OP_ERROR_SKIPPED;
+	}
+};
+
 static const std::regex memoryRegionEntryAddressRegex("([0-9a-fA-F]+)\\-([0-9a-fA-F]+)");
 
 uintptr_t DarlingServer::Process::getNextRegion(uintptr_t address) const {
@@ -686,12 +1314,17 @@ void DarlingServer::Process::notifyDead() {
 
 		processLog.info() << *this << ": process dying" << processLog.endLog;
 		_dead = true;
+
+		DSERVER_PROBE2(process__death, _pid, _nspid);
 		threads = _threads;
 
 		// clear out all kqchannels we own
 		_kqchannels.clear();
 	}
 
+	_resetMemoryFD();
+	_resetArena();
+
 	// keep ourselves alive until the duct-taped context is done
 	_selfReference = shared_from_this();
 
@@ -0,0 +1,316 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2022 Darling developers
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <darlingserver/sched-trace.hpp>
+#include <darlingserver/thread.hpp>
+#include <darlingserver/call.hpp>
+#include <darlingserver/call-stats.hpp>
+#include <darlingserver/duct-tape.h>
+#include <darlingserver/logging.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <mutex>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+static DarlingServer::Log schedTraceLog("schedtrace");
+
+//
+// block categories
+//
+// a category is either one of the non-waitq block reasons or a waitq block with a particular XNU block hint.
+//
+
+enum : uint32_t {
+	categoryOther,
+	categoryMutex,
+	categoryCondvar,
+	categoryUserSuspended,
+	categoryWaitqBase,
+};
+
+// XNU's block hints currently go up to 0x14; anything beyond this is lumped in with the last one
+static constexpr uint32_t maxBlockHint = 31;
+static constexpr uint32_t categoryCount = categoryWaitqBase + maxBlockHint + 1;
+
+static uint32_t categoryForBlockInfo(const dtape_block_info_t& info) {
+	switch (info.reason) {
+		case dtape_block_reason_waitq:
+			return categoryWaitqBase + std::min<uint32_t>(info.hint, maxBlockHint);
+		case dtape_block_reason_mutex:
+			return categoryMutex;
+		case dtape_block_reason_condvar:
+			return categoryCondvar;
+		case dtape_block_reason_user_suspended:
+			return categoryUserSuspended;
+		default:
+			return categoryOther;
+	}
+};
+
+static std::string categoryName(uint32_t category) {
+	switch (category) {
+		case categoryOther:
+			// suspensions that didn't come from duct-tape (e.g. a kernel thread terminating itself)
+			return "other";
+		case categoryMutex:
+			return "mutex";
+		case categoryCondvar:
+			return "condvar";
+		case categoryUserSuspended:
+			return "user-suspended";
+		default:
+			return std::string("waitq:") + dtape_block_hint_name(category - categoryWaitqBase);
+	}
+};
+
+//
+// aggregated statistics
+//
+
+static DarlingServer::LogHistogram blockHistograms[categoryCount];
+static DarlingServer::LogHistogram runnableDelayHistogram;
+static DarlingServer::LogHistogram runSliceHistogram;
+
+namespace {
+	enum class OffCPUFrame: uint32_t {
+		Blocked,
+		RunQueue,
+	};
+
+	static constexpr uint32_t noCallNumber = UINT32_MAX;
+};
+
+// keyed by offCPUKey(); values are in nanoseconds
+static std::mutex offCPULock;
+static std::unordered_map<uint64_t, uint64_t> offCPUTotals;
+
+static uint64_t offCPUKey(uint32_t callNumber, OffCPUFrame frame, uint32_t category) {
+	return ((uint64_t)callNumber << 32) | ((uint64_t)frame << 16) | category;
+};
+
+static void addOffCPU(uint32_t callNumber, OffCPUFrame frame, uint32_t category, uint64_t duration) {
+	std::unique_lock lock(offCPULock);
+	offCPUTotals[offCPUKey(callNumber, frame, category)] += duration;
+};
+
+//
+// hooks
+//
+
+bool DarlingServer::SchedTrace::enabled() {
+	static const bool isEnabled = []() {
+		const char* value = getenv("DSERVER_SCHED_TRACE");
+		return value && (value[0] == '1' || value[0] == 't' || value[0] == 'T');
+	}();
+	return isEnabled;
+};
+
+void DarlingServer::SchedTrace::blocked(Thread& thread) {
+	if (!enabled()) {
+		return;
+	}
+
+	auto& state = thread._schedState;
+	auto now = CallStats::now();
+
+	// when impersonating, duct-tape thinks the impersonated thread is the one blocking
+	dtape_thread_t* dtapeThread = thread._impersonating ? thread._impersonating->_dtapeThread : thread._dtapeThread;
+	dtape_block_info_t info;
+	dtape_thread_get_block_info(dtapeThread, &info);
+
+	state.blockCategory = categoryForBlockInfo(info);
+	state.blockHasCall = !!thread._activeCall;
+	state.blockCallNumber = thread._activeCall ? static_cast<uint32_t>(thread._activeCall->number()) : 0;
+
+	uint64_t runningSince = state.runningSince.exchange(0, std::memory_order_relaxed);
+	if (runningSince != 0) {
+		runSliceHistogram.record(now - runningSince);
+	}
+
+	state.blockedAt.store(now, std::memory_order_release);
+};
+
+void DarlingServer::SchedTrace::runnable(Thread& thread) {
+	if (!enabled()) {
+		return;
+	}
+
+	auto& state = thread._schedState;
+	auto now = CallStats::now();
+
+	uint64_t blockedAt = state.blockedAt.exchange(0, std::memory_order_acquire);
+	if (blockedAt != 0) {
+		uint64_t duration = now - blockedAt;
+		blockHistograms[state.blockCategory].record(duration);
+		addOffCPU(state.blockHasCall ? state.blockCallNumber : noCallNumber, OffCPUFrame::Blocked, state.blockCategory, duration);
+	}
+
+	// if it's already runnable, the delay counts from the first time it was queued
+	uint64_t expected = 0;
+	state.runnableAt.compare_exchange_strong(expected, now, std::memory_order_relaxed);
+};
+
+void DarlingServer::SchedTrace::running(Thread& thread, const Call* call) {
+	if (!enabled()) {
+		return;
+	}
+
+	auto& state = thread._schedState;
+	auto now = CallStats::now();
+
+	uint64_t runnableAt = state.runnableAt.exchange(0, std::memory_order_relaxed);
+	if (runnableAt != 0) {
+		uint64_t delay = now - runnableAt;
+		runnableDelayHistogram.record(delay);
+		addOffCPU(call ? static_cast<uint32_t>(call->number()) : noCallNumber, OffCPUFrame::RunQueue, 0, delay);
+	}
+
+	state.runningSince.store(now, std::memory_order_relaxed);
+};
+
+void DarlingServer::SchedTrace::stopped(Thread& thread) {
+	if (!enabled()) {
+		return;
+	}
+
+	// if the thread suspended, blocked() already ended the slice
+	uint64_t runningSince = thread._schedState.runningSince.exchange(0, std::memory_order_relaxed);
+	if (runningSince != 0) {
+		runSliceHistogram.record(CallStats::now() - runningSince);
+	}
+};
+
+//
+// reporting
+//
+
+static void appendHistogramLine(std::string& result, const char* name, const DarlingServer::LogHistogram& histogram) {
+	char line[512];
+
+	snprintf(line, sizeof(line), "%-40s %10llu %12.1f %10.1f %10.1f %10.1f %10.1f\n",
+		name,
+		(unsigned long long)histogram.count(),
+		(double)histogram.sum() / 1e6,
+		(double)histogram.percentile(50) / 1e3,
+		(double)histogram.percentile(90) / 1e3,
+		(double)histogram.percentile(99) / 1e3,
+		(double)histogram.max() / 1e3
+	);
+	result += line;
+};
+
+std::string DarlingServer::SchedTrace::report() {
+	std::string result;
+	char line[512];
+
+	snprintf(line, sizeof(line), "%-40s %10s %12s %10s %10s %10s %10s\n",
+		"block reason", "count", "total(ms)", "p50(us)", "p90(us)", "p99(us)", "max(us)");
+	result += line;
+
+	for (uint32_t category = 0; category < categoryCount; ++category) {
+		if (blockHistograms[category].count() == 0) {
+			continue;
+		}
+		appendHistogramLine(result, categoryName(category).c_str(), blockHistograms[category]);
+	}
+
+	appendHistogramLine(result, "(runnable-to-running delay)", runnableDelayHistogram);
+	appendHistogramLine(result, "(run slice)", runSliceHistogram);
+
+	return result;
+};
+
+void DarlingServer::SchedTrace::logReport() {
+	if (!enabled() || !schedTraceLog.infoEnabled()) {
+		return;
+	}
+
+	auto text = report();
+	size_t start = 0;
+
+	while (start < text.size()) {
+		size_t end = text.find('\n', start);
+		if (end == std::string::npos) {
+			end = text.size();
+		}
+		schedTraceLog.info() << text.substr(start, end - start) << schedTraceLog.endLog;
+		start = end + 1;
+	}
+};
+
+bool DarlingServer::SchedTrace::writeOffCPU(const std::string& path) {
+	std::vector<std::pair<uint64_t, uint64_t>> totals;
+
+	{
+		std::unique_lock lock(offCPULock);
+		totals.assign(offCPUTotals.begin(), offCPUTotals.end());
+	}
+
+	std::string text;
+
+	for (const auto& [key, total]: totals) {
+		uint32_t callNumber = key >> 32;
+		auto frame = static_cast<OffCPUFrame>((key >> 16) & 0xffff);
+		uint32_t category = key & 0xffff;
+
+		text += (callNumber == noCallNumber) ? "(no call)" : CallStats::callName(callNumber);
+
+		if (frame == OffCPUFrame::RunQueue) {
+			text += ";runqueue";
+		} else {
+			text += ";blocked;";
+			text += categoryName(category);
+		}
+
+		// flame graph tools expect integer sample counts, so use microseconds
+		text += ' ';
+		text += std::to_string(total / 1000);
+		text += '\n';
+	}
+
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		return false;
+	}
+
+	const char* data = text.data();
+	size_t remaining = text.size();
+
+	while (remaining > 0) {
+		ssize_t written = write(fd, data, remaining);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			close(fd);
+			return false;
+		}
+		data += written;
+		remaining -= written;
+	}
+
+	close(fd);
+	return true;
+};
@@ -33,14 +33,70 @@
 #include <sys/eventfd.h>
 #include <darlingserver/duct-tape.h>
 #include <sys/timerfd.h>
+#include <time.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/signalfd.h>
+#include <signal.h>
 
 #include <darlingserver/logging.hpp>
+#include <darlingserver/trace.hpp>
+#include <darlingserver/call-stats.hpp>
+#include <darlingserver/metrics.hpp>
+#include <darlingserver/sched-trace.hpp>
+#include <darlingserver/probes.h>
 
 static DarlingServer::Server* sharedInstancePointer = nullptr;
 
+static DarlingServer::Log serverLog("server");
+
+static void handleCrashSignal(int signal) {
+	// the handler was installed with SA_RESETHAND, so re-raising the signal after dumping the trace will run the default action (i.e. crash for real).
+	// the last few log records (usually the errors explaining the crash, e.g. before an abort()) are likely still buffered, so write them out too.
+	DarlingServer::Log::flushForCrash();
+	DarlingServer::Trace::dumpForCrash();
+	raise(signal);
+};
+
+// written to by the SIGTERM handler to ask the main loop to shut down
+static int terminationFD = -1;
+static volatile sig_atomic_t terminationRequested = 0;
+
+static void handleTermSignal(int signal) {
+	// this runs on whichever thread gets the signal, so all it does for the first SIGTERM is wake up the main loop,
+	// which saves the call statistics and then exits (see the termination monitor in the constructor).
+	// if the main loop is stuck and never gets to it, another SIGTERM stops us right away: like the crash handler,
+	// it writes out any buffered log records and then re-raises the signal with the default action.
+	if (!terminationRequested && terminationFD >= 0) {
+		terminationRequested = 1;
+		uint64_t value = 1;
+		if (write(terminationFD, &value, sizeof(value)) == sizeof(value)) {
+			return;
+		}
+	}
+
+	DarlingServer::Log::flushForCrash();
+
+	struct sigaction defaultAction;
+	memset(&defaultAction, 0, sizeof(defaultAction));
+	defaultAction.sa_handler = SIG_DFL;
+	sigemptyset(&defaultAction.sa_mask);
+	sigaction(signal, &defaultAction, NULL);
+	raise(signal);
+};
+
+static void saveCallStats(const std::string& prefix) {
+	auto statsPath = prefix + "/private/var/log/dserver-call-stats.txt";
+	int statsFD = open(statsPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (statsFD < 0 || !DarlingServer::CallStats::writeReport(statsFD)) {
+		serverLog.warning() << "Failed to write call statistics" << serverLog.endLog;
+	}
+	if (statsFD >= 0) {
+		close(statsFD);
+	}
+};
+
 struct DTapeHooks {
 	static void dtape_hook_thread_suspend(void* thread_context, dtape_thread_continuation_callback_f continuationCallback, void* continuationContext, libsimple_lock_t* unlockMe) {
 		if (auto thread = DarlingServer::Thread::currentThread()) {
@@ -89,29 +145,56 @@ struct DTapeHooks {
 		return thread->_dtapeThread;
 	};
 
-	static void dtape_hook_timer_arm(uint64_t deadline_ns, bool override) {
+	static void dtape_hook_timer_arm(uint64_t deadline_ns, uint64_t leeway_ns, bool override) {
 		auto& server = DarlingServer::Server::sharedInstance();
 
 		if (deadline_ns == UINT64_MAX) {
 			deadline_ns = 0;
 		}
 
-		struct itimerspec newSpec;
-		memset(&newSpec.it_interval, 0, sizeof(newSpec.it_interval));
-		newSpec.it_value.tv_sec = deadline_ns / 1000000000ull;
-		newSpec.it_value.tv_nsec = deadline_ns % 1000000000ull;
+		if (deadline_ns == 0) {
+			leeway_ns = 0;
+		}
 
 		std::unique_lock lock(server._timerLock);
 
+		++server._timerStats.armRequests;
+		++server._timerStatsWindow.armRequests;
+
+		// if the timer is already going to fire somewhere within the window this deadline allows, leave it alone.
+		// XNU pads deadlines with some leeway (depending on the timer's urgency and whether it asked for a specific leeway),
+		// so this lets timers with nearby deadlines share a single timerfd expiration instead of re-programming it every time.
+		if (deadline_ns != 0 && server._currentTimerDeadline != 0 && server._currentTimerDeadline <= deadline_ns && deadline_ns - server._currentTimerDeadline <= leeway_ns) {
+			++server._timerStats.coalesced;
+			++server._timerStatsWindow.coalesced;
+			return;
+		}
+
 		if (!override && server._currentTimerDeadline != 0 && deadline_ns >= server._currentTimerDeadline) {
 			return;
 		}
 
+		// no point in disarming the timer if it's already disarmed
+		if (deadline_ns == 0 && server._currentTimerDeadline == 0) {
+			return;
+		}
+
+		struct itimerspec newSpec;
+		memset(&newSpec.it_interval, 0, sizeof(newSpec.it_interval));
+		newSpec.it_value.tv_sec = deadline_ns / 1000000000ull;
+		newSpec.it_value.tv_nsec = deadline_ns % 1000000000ull;
+
 		server._currentTimerDeadline = deadline_ns;
 
 		if (timerfd_settime(server._timerFD, TFD_TIMER_ABSTIME, &newSpec, NULL) < 0) {
 			throw std::system_error(errno, std::generic_category(), "Failed to set timerfd expiration deadline");
 		}
+
+		DSERVER_PROBE2(timer__arm, deadline_ns, leeway_ns);
+
+		++server._timerStats.arms;
+		++server._timerStatsWindow.arms;
+		server._rollTimerStats();
 	};
 
 	static void dtape_hook_log(dtape_log_level_t level, const char* message) {
@@ -152,6 +235,7 @@ struct DTapeHooks {
 		auto thread = std::make_shared<DarlingServer::Thread>(DarlingServer::Thread::KernelThreadConstructorTag());
 		thread->registerWithProcess();
 		DarlingServer::threadRegistry().registerEntry(thread, true);
+		DSERVER_PROBE3(thread__register, thread->id(), thread->nsid(), -1);
 		return thread->_dtapeThread;
 	};
 
@@ -290,12 +374,16 @@ struct DTapeHooks {
 
 	static uintptr_t dtape_hook_task_map_file(void* task_context, int fd, size_t page_count, int protection, uintptr_t address_hint, size_t page_offset, dtape_memory_flags_t flags) {
 		try {
-			return static_cast<DarlingServer::Process*>(task_context)->mapFile(fd, page_count, protection, address_hint, page_offset, flags & dtape_memory_flag_fixed, flags & dtape_memory_flag_overwrite);
+			return static_cast<DarlingServer::Process*>(task_context)->mapFile(fd, page_count, protection, address_hint, page_offset, flags & dtape_memory_flag_fixed, flags & dtape_memory_flag_overwrite, flags & dtape_memory_flag_private);
 		} catch (std::system_error e) {
 			return 0;
 		}
 	};
 
+	static void dtape_hook_task_batch_memory(void* task_context, dtape_memory_op_t* ops, size_t op_count) {
+		static_cast<DarlingServer::Process*>(task_context)->performMemoryOps(ops, op_count);
+	};
+
 	static uintptr_t dtape_hook_task_get_next_region(void* task_context, uintptr_t address) {
 		return static_cast<DarlingServer::Process*>(task_context)->getNextRegion(address);
 	};
@@ -378,6 +466,7 @@ struct DTapeHooks {
 		.task_allocate_pages = dtape_hook_task_allocate_pages,
 		.task_free_pages = dtape_hook_task_free_pages,
 		.task_map_file = dtape_hook_task_map_file,
+		.task_batch_memory = dtape_hook_task_batch_memory,
 		.task_get_next_region = dtape_hook_task_get_next_region,
 		.task_change_protection = dtape_hook_task_change_protection,
 		.task_sync_memory = dtape_hook_task_sync_memory,
@@ -467,6 +556,94 @@ DarlingServer::Server::Server(std::string prefix):
 	if (epoll_ctl(_epollFD, EPOLL_CTL_ADD, _timerFD, &settings) < 0) {
 		throw std::system_error(errno, std::generic_category(), "Failed to add timer descriptor to epoll context");
 	}
+
+	// write out the trace rings if we crash so that we can see what led up to it
+	Trace::setDumpDirectory(_prefix + "/private/var/log");
+
+	struct sigaction crashAction;
+	memset(&crashAction, 0, sizeof(crashAction));
+	crashAction.sa_handler = handleCrashSignal;
+	crashAction.sa_flags = SA_RESETHAND | SA_NODEFER;
+	sigemptyset(&crashAction.sa_mask);
+	for (int crashSignal: { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT }) {
+		sigaction(crashSignal, &crashAction, NULL);
+	}
+
+	// SIGTERM is left unblocked so that it can always stop us; its handler just wakes us up so that we can save the call statistics here,
+	// on the main loop, before exiting
+	terminationFD = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (terminationFD < 0) {
+		throw std::system_error(errno, std::generic_category(), "Failed to create termination descriptor");
+	}
+
+	addMonitor(std::make_shared<Monitor>(std::make_shared<FD>(terminationFD), Monitor::Event::Readable, false, false, [](std::shared_ptr<Monitor> monitor, Monitor::Event events) {
+		eventfd_t value;
+		if (eventfd_read(monitor->fd()->fd(), &value) < 0) {
+			return;
+		}
+
+		serverLog.info() << "Received SIGTERM; shutting down" << serverLog.endLog;
+		CallStats::logReport();
+		saveCallStats(Server::sharedInstance().prefix());
+
+		// make sure everything we've logged (including the report) is written out, then let the signal kill us like it normally would
+		Log::flush();
+
+		struct sigaction defaultAction;
+		memset(&defaultAction, 0, sizeof(defaultAction));
+		defaultAction.sa_handler = SIG_DFL;
+		sigemptyset(&defaultAction.sa_mask);
+		sigaction(SIGTERM, &defaultAction, NULL);
+		raise(SIGTERM);
+	}));
+
+	struct sigaction termAction;
+	memset(&termAction, 0, sizeof(termAction));
+	termAction.sa_handler = handleTermSignal;
+	sigemptyset(&termAction.sa_mask);
+	sigaction(SIGTERM, &termAction, NULL);
+
+	// SIGUSR2 is blocked in main() before we're created, so we can handle it synchronously here on the main loop
+	sigset_t statsSignals;
+	sigemptyset(&statsSignals);
+	sigaddset(&statsSignals, SIGUSR2);
+
+	int statsSignalFD = signalfd(-1, &statsSignals, SFD_CLOEXEC | SFD_NONBLOCK);
+	if (statsSignalFD < 0) {
+		throw std::system_error(errno, std::generic_category(), "Failed to create signal descriptor");
+	}
+
+	addMonitor(std::make_shared<Monitor>(std::make_shared<FD>(statsSignalFD), Monitor::Event::Readable, false, false, [](std::shared_ptr<Monitor> monitor, Monitor::Event events) {
+		struct signalfd_siginfo info;
+
+		while (read(monitor->fd()->fd(), &info, sizeof(info)) == sizeof(info)) {
+			// dump all the stats we have
+			Server::sharedInstance().logTimerStats();
+			dtape_log_timer_stats();
+			dtape_log_zone_stats();
+			dtape_log_lock_stats();
+			dtape_lock_profile_dump();
+			CallStats::logReport();
+
+			// also save the call statistics on their own, since they're the part that's usually wanted after the fact
+			saveCallStats(Server::sharedInstance().prefix());
+
+			if (SchedTrace::enabled()) {
+				SchedTrace::logReport();
+				if (!SchedTrace::writeOffCPU(Server::sharedInstance().prefix() + "/private/var/log/dserver-offcpu.folded")) {
+					serverLog.warning() << "Failed to write off-CPU profile" << serverLog.endLog;
+				}
+			}
+
+			if (!Trace::dump()) {
+				serverLog.warning() << "Failed to write trace dump" << serverLog.endLog;
+			}
+		}
+	}));
+
+	if (MetricsEndpoint::enabled()) {
+		_metrics = std::make_unique<MetricsEndpoint>(*this, _prefix + "/.darlingserver-metrics.sock");
+	}
 };
 
 DarlingServer::Server::~Server() {
@@ -559,6 +736,16 @@ void DarlingServer::Server::start() {
 					continue;
 				}
 
+				// the timerfd is disarmed once it expires
+				_currentTimerDeadline = 0;
+
+				Trace::record(Trace::Event::TimerFire, -1, -1, expirations);
+				DSERVER_PROBE1(timer__fire, expirations);
+
+				++_timerStats.fires;
+				++_timerStatsWindow.fires;
+				_rollTimerStats();
+
 				// we're done handling the timerfd;
 				// we don't need to lock anymore (and the following call might need to arm the timer again)
 				lock.unlock();
@@ -605,9 +792,49 @@ void DarlingServer::Server::start() {
 	}
 
 	// shouldn't ever be reached (exiting the main loop would be an error), but just in case
+	saveCallStats(_prefix);
 	dtape_deinit();
 };
 
+void DarlingServer::Server::_rollTimerStats() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	uint64_t nowNS = (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+
+	if (_timerStatsWindowStart == 0) {
+		_timerStatsWindowStart = nowNS;
+		return;
+	}
+
+	uint64_t elapsed = nowNS - _timerStatsWindowStart;
+
+	if (elapsed < 1000000000ull) {
+		return;
+	}
+
+	// the window might be longer than a second if the timer has been idle; scale the counts down to a per-second rate
+	_timerStatsPerSecond.armRequests = _timerStatsWindow.armRequests * 1000000000ull / elapsed;
+	_timerStatsPerSecond.coalesced = _timerStatsWindow.coalesced * 1000000000ull / elapsed;
+	_timerStatsPerSecond.arms = _timerStatsWindow.arms * 1000000000ull / elapsed;
+	_timerStatsPerSecond.fires = _timerStatsWindow.fires * 1000000000ull / elapsed;
+
+	_timerStatsWindow = TimerStats();
+	_timerStatsWindowStart = nowNS;
+};
+
+void DarlingServer::Server::logTimerStats() {
+	std::unique_lock lock(_timerLock);
+
+	serverLog.info()
+		<< "timer: "
+		<< _timerStats.armRequests << " arm requests (" << _timerStatsPerSecond.armRequests << "/s), "
+		<< _timerStats.coalesced << " coalesced (" << _timerStatsPerSecond.coalesced << "/s), "
+		<< _timerStats.arms << " timerfd arms (" << _timerStatsPerSecond.arms << "/s), "
+		<< _timerStats.fires << " fires (" << _timerStatsPerSecond.fires << "/s), "
+		<< dtape_timer_pending_count() << " pending"
+		<< serverLog.endLog;
+};
+
 void DarlingServer::Server::monitorProcess(std::shared_ptr<Process> process) {
 	// the this-capture here is safe because the Server will always out-live everything else
 	std::weak_ptr<Process> weakProcess = process;
@@ -640,6 +867,7 @@ void DarlingServer::Server::_worker(std::shared_ptr<Thread> thread) {
 };
 
 void DarlingServer::Server::scheduleThread(std::shared_ptr<Thread> thread) {
+	SchedTrace::runnable(*thread);
 	_workQueue.push(thread);
 };
 
@@ -99,6 +99,8 @@ void DarlingServer::StackPool::allocate(Stack& stack) {
 		stack.size = _stackSize;
 		stack.usesGuardPages = _useGuardPages;
 	}
+
+	++_inUseCount;
 };
 
 void DarlingServer::StackPool::free(Stack& stack) {
@@ -122,5 +124,11 @@ void DarlingServer::StackPool::free(Stack& stack) {
 #endif
 	}
 
+	--_inUseCount;
 	stack = Stack();
 };
+
+DarlingServer::StackPool::Stats DarlingServer::StackPool::stats() {
+	std::scoped_lock lock(_mutex);
+	return Stats { _stacks.size(), _inUseCount, _stackSize };
+};
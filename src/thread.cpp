@@ -22,6 +22,8 @@
 #include <darlingserver/call.hpp>
 #include <darlingserver/server.hpp>
 #include <darlingserver/logging.hpp>
+#include <darlingserver/trace.hpp>
+#include <darlingserver/probes.h>
 #include <filesystem>
 #include <fstream>
 
@@ -46,6 +48,7 @@
 #include <sys/user.h>
 #include <sys/wait.h>
 #include <vector>
+#include <chrono>
 
 // 64KiB should be enough for us
 #define THREAD_STACK_SIZE (64 * 1024ULL)
@@ -78,6 +81,10 @@ static DarlingServer::Log threadLog("thread");
 
 DarlingServer::StackPool DarlingServer::Thread::stackPool(IDLE_THREAD_STACK_COUNT, THREAD_STACK_SIZE, USE_THREAD_GUARD_PAGES);
 
+DarlingServer::StackPool::Stats DarlingServer::Thread::stackPoolStats() {
+	return stackPool.stats();
+};
+
 DarlingServer::Thread::Thread(std::shared_ptr<Process> process, NSID nsid, void* stackHint):
 	_nstid(nsid),
 	_process(process)
@@ -176,10 +183,6 @@ DarlingServer::Thread::Thread(std::shared_ptr<Process> process, NSID nsid, void*
 
 	// NOTE: it's okay to use raw `this` without a shared pointer because the duct-taped thread will always live for less time than this Thread instance
 	_dtapeThread = dtape_thread_create(process->_dtapeTask, _nstid, this);
-	_s2cPerformSempahore = dtape_semaphore_create(process->_dtapeTask, 1);
-	_s2cReplySempahore = dtape_semaphore_create(process->_dtapeTask, 0);
-	_s2cInterruptEnterSemaphore = dtape_semaphore_create(process->_dtapeTask, 0);
-	_s2cInterruptExitSemaphore = dtape_semaphore_create(process->_dtapeTask, 0);
 
 	threadLog.info() << "New thread created with ID " << _tid << " and NSID " << _nstid << " for process with ID " << (process ? process->id() : -1) << " and NSID " << (process ? process->nsid() : -1);
 };
@@ -334,6 +337,9 @@ void DarlingServer::Thread::microthreadWorker() {
 
 	currentContinuation = nullptr;
 	currentThreadVar->makePendingCallActive();
+	Trace::record(Trace::Event::CallStart, *currentThreadVar, static_cast<uint64_t>(currentThreadVar->_activeCall->number()));
+	DSERVER_PROBE3(call__dispatch, static_cast<unsigned int>(currentThreadVar->_activeCall->number()), (currentThreadVar->_process) ? currentThreadVar->_process->id() : -1, currentThreadVar->_tid);
+	currentThreadVar->_activeCall->statsStarted();
 	currentThreadVar->_activeCall->processCall();
 
 	if (currentThreadVar->_handlingInterruptedCall) {
@@ -436,6 +442,9 @@ void DarlingServer::Thread::doWork() {
 
 		_rwlock.lock();
 
+		SchedTrace::stopped(*this);
+		DSERVER_PROBE3(microthread__switch__out, _tid, _nstid, _suspended ? 1 : 0);
+
 		if (!_suspended || _continuationCallback) {
 			// we discard the old stack when either:
 			//   * we exit normally (i.e. without suspending); this includes syscall returns.
@@ -472,8 +481,16 @@ void DarlingServer::Thread::doWork() {
 			// we were in the middle of processing a call and we need to resume now
 			_suspended = false;
 			_resumeContext.uc_link = &backToThreadTopContext;
+			if (_activeCall) {
+				_activeCall->statsResumed();
+			}
+			SchedTrace::running(*this, _activeCall.get());
 			_rwlock.unlock();
 
+			DSERVER_PROBE3(microthread__switch__in, _tid, _nstid, 1);
+
+			Trace::record(Trace::Event::MicrothreadResume, *this);
+
 			if (_continuationCallback) {
 				// for continuations, we discard the old stack and start with a new one
 				assert(!_stack.isValid());
@@ -501,8 +518,11 @@ void DarlingServer::Thread::doWork() {
 				goto doneWorking;
 			}
 			_suspended = false;
+			SchedTrace::running(*this, _pendingCall.get());
 			_rwlock.unlock();
 
+			DSERVER_PROBE3(microthread__switch__in, _tid, _nstid, 0);
+
 			// we might've had a valid stack if we're overwriting a previous suspension, so handle that.
 			if (_stack.isValid()) {
 				stackPool.free(_stack);
@@ -588,6 +608,7 @@ void DarlingServer::Thread::suspend(std::function<void()> continuationCallback,
 	}
 
 	_rwlock.lock();
+	SchedTrace::blocked(*this);
 	_suspended = true;
 	_rwlock.unlock();
 
@@ -597,6 +618,10 @@ void DarlingServer::Thread::suspend(std::function<void()> continuationCallback,
 
 	_rwlock.lock();
 	if (_suspended) {
+		if (_activeCall) {
+			_activeCall->statsSuspended();
+		}
+
 		if (continuationCallback) {
 			// when suspendeding with a continuation, the current continuation and call are discarded (since they can no longer be safely returned to)
 			currentContinuation = nullptr;
@@ -606,6 +631,8 @@ void DarlingServer::Thread::suspend(std::function<void()> continuationCallback,
 		// jump back to the top of the microthread
 		_rwlock.unlock();
 
+		Trace::record(Trace::Event::MicrothreadSuspend, *this);
+
 #if DSERVER_ASAN
 		// if we have a continuation, we don't expect to come back here
 		__sanitizer_start_switch_fiber((continuationCallback) ? nullptr : &asanOldFakeStack, asanOldStackBottom, asanOldStackSize);
@@ -1001,14 +1028,20 @@ static DarlingServer::Log s2cLog("s2c");
 std::optional<DarlingServer::Message> DarlingServer::Thread::_s2cPerform(Message&& call, dserver_s2c_msgnum_t expectedReplyNumber, size_t expectedReplySize) {
 	std::optional<Message> reply = std::nullopt;
 	bool usingInterrupt = false;
+	auto startTime = std::chrono::steady_clock::now();
+	// this must happen before the call is sent, since the reply is delivered off-microthread (see `Call::callFromMessage`)
+	// and that path can't create the semaphores itself
+	auto& semaphores = _getS2CSemaphores();
 
 	// make sure we're the only one performing an S2C call on this thread
-	if (!dtape_semaphore_down_simple(_s2cPerformSempahore)) {
+	if (!dtape_semaphore_down_simple(semaphores.perform)) {
 		// got interrupted while waiting
 		return std::nullopt;
 	}
 
 	s2cLog.debug() << *this << ": Going to perform S2C call" << s2cLog.endLog;
+	Trace::record(Trace::Event::S2CBegin, *this, expectedReplyNumber);
+	DSERVER_PROBE2(s2c__begin, _tid, static_cast<int>(expectedReplyNumber));
 
 	{
 		std::unique_lock lock(_rwlock);
@@ -1019,9 +1052,9 @@ std::optional<DarlingServer::Message> DarlingServer::Thread::_s2cPerform(Message
 			s2cLog.debug() << *this << ": Sending S2C signal" << s2cLog.endLog;
 			usingInterrupt = true;
 			sendSignal(LINUX_SIGRTMIN + 1);
-			if (!dtape_semaphore_down_simple(_s2cInterruptEnterSemaphore)) {
+			if (!dtape_semaphore_down_simple(semaphores.interruptEnter)) {
 				// got interrupted while waiting
-				dtape_semaphore_up(_s2cPerformSempahore);
+				dtape_semaphore_up(semaphores.perform);
 				return std::nullopt;
 			}
 			s2cLog.debug() << *this << ": Got green light to perform S2C call" << s2cLog.endLog;
@@ -1039,7 +1072,7 @@ std::optional<DarlingServer::Message> DarlingServer::Thread::_s2cPerform(Message
 	// at least for now, in order to wait for the S2C reply, we need the calling thread to be a microthread,
 	// so that waiting on the duct-taped semaphore will work
 	if (!currentThread()) {
-		dtape_semaphore_up(_s2cPerformSempahore);
+		dtape_semaphore_up(semaphores.perform);
 		throw std::runtime_error("Must be in a microthread (any microthread) to wait for S2C reply");
 	}
 
@@ -1049,9 +1082,9 @@ std::optional<DarlingServer::Message> DarlingServer::Thread::_s2cPerform(Message
 	Server::sharedInstance().sendMessage(std::move(call));
 
 	// now let's wait for the reply
-	if (!dtape_semaphore_down_simple(_s2cReplySempahore)) {
+	if (!dtape_semaphore_down_simple(semaphores.reply)) {
 		// got interrupted while waiting
-		dtape_semaphore_up(_s2cPerformSempahore);
+		dtape_semaphore_up(semaphores.perform);
 		return std::nullopt;
 	}
 
@@ -1063,7 +1096,7 @@ std::optional<DarlingServer::Message> DarlingServer::Thread::_s2cPerform(Message
 
 		if (!_s2cReply) {
 			// impossible, but just in case
-			dtape_semaphore_up(_s2cPerformSempahore);
+			dtape_semaphore_up(semaphores.perform);
 			throw std::runtime_error("S2C reply semaphore incremented, but no reply present");
 		}
 
@@ -1080,16 +1113,18 @@ std::optional<DarlingServer::Message> DarlingServer::Thread::_s2cPerform(Message
 		}
 	}
 
-	s2cLog.debug() << *this << ": Done performing S2C call" << s2cLog.endLog;
+	Trace::record(Trace::Event::S2CEnd, *this, expectedReplyNumber);
+	DSERVER_PROBE3(s2c__end, _tid, static_cast<int>(expectedReplyNumber), static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count()));
+	s2cLog.debug() << *this << ": Done performing S2C call " << (usingInterrupt ? "with signal" : "inline") << " in " << std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count() << "us" << s2cLog.endLog;
 
 	// we're done performing the call; allow others to have a chance at performing an S2C call on this thread
-	dtape_semaphore_up(_s2cPerformSempahore);
+	dtape_semaphore_up(semaphores.perform);
 
 	if (usingInterrupt) {
 		// if we used the S2C signal to perform the call, then the s2c_perform call is currently waiting for us to finish;
 		// let it know that we're done
 		s2cLog.debug() << *this << ": Allowing thread to resume from S2C interrupt" << s2cLog.endLog;
-		dtape_semaphore_up(_s2cInterruptExitSemaphore);
+		dtape_semaphore_up(semaphores.interruptExit);
 	}
 
 	// partially validate the reply
@@ -1243,6 +1278,116 @@ int DarlingServer::Thread::_msync(uintptr_t address, size_t size, int sync_flags
 	return reply->return_value;
 };
 
+std::vector<dserver_s2c_batch_result_t> DarlingServer::Thread::_s2cBatch(const std::vector<dserver_s2c_batch_op_t>& ops) {
+	std::vector<dserver_s2c_batch_result_t> results(ops.size());
+	size_t index = 0;
+
+	for (auto& result: results) {
+		result.return_value = (uint64_t)-1;
+		result.errno_result = ECANCELED;
+		result.reserved = 0;
+	}
+
+	if (!_process || (_process->s2cFeatures() & DSERVER_S2C_FEATURE_BATCH) == 0) {
+		_s2cPerformIndividually(ops, results);
+		return results;
+	}
+
+	while (index < ops.size()) {
+		Message callMessage(sizeof(dserver_s2c_call_batch_t), 0);
+		auto call = reinterpret_cast<dserver_s2c_call_batch_t*>(callMessage.data().data());
+		int fds[DSERVER_S2C_BATCH_MAX_FDS];
+		uint32_t fdCount = 0;
+
+		memset(call, 0, sizeof(*call));
+
+		call->header.call_number = dserver_callnum_s2c;
+		call->header.s2c_number = dserver_s2c_msgnum_batch;
+
+		// fill up this batch with as many operations as will fit
+		size_t count = dserver_s2c_batch_pack(call, &ops[index], ops.size() - index, fds, &fdCount);
+
+		for (uint32_t i = 0; i < fdCount; ++i) {
+			auto dupfd = dup(fds[i]);
+			if (dupfd < 0) {
+				// we can't send this batch; report its first operation as failed and stop
+				results[index].errno_result = errno;
+				return results;
+			}
+			callMessage.pushDescriptor(dupfd);
+		}
+
+		s2cLog.debug() << "Performing S2C batch with " << count << " operation(s)" << s2cLog.endLog;
+
+		auto maybeReplyMessage = _s2cPerform(std::move(callMessage), dserver_s2c_msgnum_batch, sizeof(dserver_s2c_reply_batch_t));
+		if (!maybeReplyMessage) {
+			s2cLog.debug() << "S2C batch interrupted" << s2cLog.endLog;
+			for (size_t i = index; i < results.size(); ++i) {
+				results[i].errno_result = EINTR;
+			}
+			return results;
+		}
+
+		auto replyMessage = std::move(*maybeReplyMessage);
+		auto reply = reinterpret_cast<dserver_s2c_reply_batch_t*>(replyMessage.data().data());
+
+		if (reply->op_count > count) {
+			throw std::runtime_error("Invalid S2C reply: client performed more operations than requested");
+		}
+
+		for (size_t i = 0; i < reply->op_count; ++i) {
+			results[index + i] = reply->results[i];
+		}
+
+		s2cLog.debug() << "S2C batch performed " << reply->op_count << " of " << count << " operation(s)" << s2cLog.endLog;
+
+		if (reply->op_count < count || (reply->op_count > 0 && reply->results[reply->op_count - 1].errno_result != 0)) {
+			// something failed; stop here
+			break;
+		}
+
+		index += count;
+	}
+
+	return results;
+};
+
+void DarlingServer::Thread::_s2cPerformIndividually(const std::vector<dserver_s2c_batch_op_t>& ops, std::vector<dserver_s2c_batch_result_t>& results) {
+	for (size_t i = 0; i < ops.size(); ++i) {
+		const auto& op = ops[i];
+		int err = 0;
+
+		switch (op.op) {
+			case dserver_s2c_msgnum_mmap:
+				results[i].return_value = _mmap(op.address, op.length, op.protection, op.flags, op.fd, op.offset, err);
+				break;
+			case dserver_s2c_msgnum_munmap:
+				results[i].return_value = (uint64_t)(int64_t)_munmap(op.address, op.length, err);
+				break;
+			case dserver_s2c_msgnum_mprotect:
+				results[i].return_value = (uint64_t)(int64_t)_mprotect(op.address, op.length, op.protection, err);
+				break;
+			case dserver_s2c_msgnum_msync:
+				results[i].return_value = (uint64_t)(int64_t)_msync(op.address, op.length, op.flags, err);
+				break;
+			default:
+				err = EINVAL;
+				break;
+		}
+
+		results[i].errno_result = err;
+
+		if (err != 0) {
+			if (err == EINTR) {
+				for (size_t j = i + 1; j < results.size(); ++j) {
+					results[j].errno_result = EINTR;
+				}
+			}
+			break;
+		}
+	}
+};
+
 uintptr_t DarlingServer::Thread::allocatePages(size_t pageCount, int protection, uintptr_t addressHint, bool fixed, bool overwrite) {
 	int err = 0;
 	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
@@ -1265,9 +1410,9 @@ void DarlingServer::Thread::freePages(uintptr_t address, size_t pageCount) {
 	}
 };
 
-uintptr_t DarlingServer::Thread::mapFile(int fd, size_t pageCount, int protection, uintptr_t addressHint, size_t pageOffset, bool fixed, bool overwrite) {
+uintptr_t DarlingServer::Thread::mapFile(int fd, size_t pageCount, int protection, uintptr_t addressHint, size_t pageOffset, bool fixed, bool overwrite, bool copyOnWrite) {
 	int err = 0;
-	int flags = MAP_SHARED;
+	int flags = copyOnWrite ? MAP_PRIVATE : MAP_SHARED;
 	if (fixed && overwrite) {
 		flags |= MAP_FIXED;
 	} else if (fixed) {
@@ -1350,6 +1495,10 @@ void DarlingServer::Thread::logToStream(Log::Stream& stream) const {
 };
 
 void DarlingServer::Thread::pushCallReply(std::shared_ptr<Call> expectedCall, Message&& reply) {
+	if (expectedCall) {
+		Trace::record(Trace::Event::CallEnd, *this, static_cast<uint64_t>(expectedCall->number()));
+	}
+
 	std::unique_lock lock(_rwlock);
 
 	if (expectedCall) {
@@ -1444,6 +1593,8 @@ void DarlingServer::Thread::notifyDead() {
 		threadLog.info() << *this << ": thread dying" << threadLog.endLog;
 		_dead = true;
 
+		DSERVER_PROBE3(thread__death, _tid, _nstid, (_process) ? _process->id() : -1);
+
 		if (!_activeCall) {
 			// if we have no active call, we won't ever need to run again,
 			// so set `_terminating` to make sure that doesn't happen
@@ -1481,27 +1632,69 @@ void DarlingServer::Thread::_scheduleRelease() {
 	// dtape_thread_release needs a microthread context, so we call it within a kernel microthread
 	threadLog.debug() << *this << ": scheduling release" << threadLog.endLog;
 	kernelAsync([self = shared_from_this()]() {
-		if (self->_s2cPerformSempahore) {
-			dtape_semaphore_destroy(self->_s2cPerformSempahore);
-			self->_s2cPerformSempahore = nullptr;
-		}
-		if (self->_s2cReplySempahore) {
-			dtape_semaphore_destroy(self->_s2cReplySempahore);
-			self->_s2cReplySempahore = nullptr;
-		}
-		if (self->_s2cInterruptEnterSemaphore) {
-			dtape_semaphore_destroy(self->_s2cInterruptEnterSemaphore);
-			self->_s2cInterruptEnterSemaphore = nullptr;
-		}
-		if (self->_s2cInterruptExitSemaphore) {
-			dtape_semaphore_destroy(self->_s2cInterruptExitSemaphore);
-			self->_s2cInterruptExitSemaphore = nullptr;
-		}
+		self->_destroyS2CSemaphores();
 		dtape_thread_release(self->_dtapeThread);
 		self->_dtapeThread = nullptr;
 	});
 };
 
+DarlingServer::Thread::S2CSemaphores& DarlingServer::Thread::_getS2CSemaphores() {
+	if (auto semaphores = _s2cSemaphores.load(std::memory_order_acquire)) {
+		return *semaphores;
+	}
+
+	auto task = _process->_dtapeTask;
+	auto semaphores = new S2CSemaphores {
+		dtape_semaphore_create(task, 1),
+		dtape_semaphore_create(task, 0),
+		dtape_semaphore_create(task, 0),
+		dtape_semaphore_create(task, 0),
+	};
+
+	if (!semaphores->perform || !semaphores->reply || !semaphores->interruptEnter || !semaphores->interruptExit) {
+		// don't publish a partial set; whoever needed them can fail their call instead
+		for (auto semaphore: { semaphores->perform, semaphores->reply, semaphores->interruptEnter, semaphores->interruptExit }) {
+			if (semaphore) {
+				dtape_semaphore_destroy(semaphore);
+			}
+		}
+		delete semaphores;
+		throw std::system_error(ENOMEM, std::generic_category(), "Failed to create S2C semaphores");
+	}
+
+	S2CSemaphores* expected = nullptr;
+
+	if (!_s2cSemaphores.compare_exchange_strong(expected, semaphores, std::memory_order_acq_rel, std::memory_order_acquire)) {
+		// someone else beat us to it; use theirs
+		dtape_semaphore_destroy(semaphores->perform);
+		dtape_semaphore_destroy(semaphores->reply);
+		dtape_semaphore_destroy(semaphores->interruptEnter);
+		dtape_semaphore_destroy(semaphores->interruptExit);
+		delete semaphores;
+		return *expected;
+	}
+
+	return *semaphores;
+};
+
+DarlingServer::Thread::S2CSemaphores* DarlingServer::Thread::_existingS2CSemaphores() const {
+	return _s2cSemaphores.load(std::memory_order_acquire);
+};
+
+void DarlingServer::Thread::_destroyS2CSemaphores() {
+	auto semaphores = _s2cSemaphores.exchange(nullptr, std::memory_order_acq_rel);
+
+	if (!semaphores) {
+		return;
+	}
+
+	dtape_semaphore_destroy(semaphores->perform);
+	dtape_semaphore_destroy(semaphores->reply);
+	dtape_semaphore_destroy(semaphores->interruptEnter);
+	dtape_semaphore_destroy(semaphores->interruptExit);
+	delete semaphores;
+};
+
 static thread_local std::function<void()> interruptedContinuation = nullptr;
 
 void DarlingServer::Thread::_handleInterruptEnterForCurrentThread() {
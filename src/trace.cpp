@@ -0,0 +1,231 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2022 Darling developers
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <darlingserver/trace.hpp>
+#include <darlingserver/thread.hpp>
+#include <darlingserver/process.hpp>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+// must be a power of 2
+#define TRACE_RING_CAPACITY 16384
+
+// rings are never freed, so this bounds the memory we use for tracing (at 512KiB per ring)
+#define TRACE_MAX_RINGS 256
+
+static_assert(sizeof(dserver_trace_event_t) == 32, "Trace events should be 32 bytes");
+static_assert((TRACE_RING_CAPACITY & (TRACE_RING_CAPACITY - 1)) == 0, "Trace ring capacity must be a power of 2");
+
+namespace {
+	struct TraceRing {
+		uint32_t index;
+		std::atomic<bool> owned;
+
+		// only ever written by the owning thread
+		std::atomic<uint64_t> head;
+
+		dserver_trace_event_t events[TRACE_RING_CAPACITY];
+	};
+
+	// releases the thread's ring when the thread exits so that another thread can reuse it
+	struct TraceRingOwner {
+		TraceRing* ring = nullptr;
+
+		~TraceRingOwner() {
+			if (ring) {
+				ring->owned.store(false, std::memory_order_release);
+			}
+		};
+	};
+};
+
+static TraceRing* rings[TRACE_MAX_RINGS];
+static std::atomic<uint32_t> ringCount = 0;
+static thread_local TraceRingOwner currentRingOwner;
+
+// precomputed so that we don't have to allocate anything when dumping after a crash
+static char dumpPath[4096];
+static char crashDumpPath[4096];
+
+static TraceRing* claimRing() {
+	uint32_t count = ringCount.load(std::memory_order_acquire);
+
+	// try to reuse a ring left behind by a thread that exited
+	for (uint32_t i = 0; i < count; ++i) {
+		bool expected = false;
+		if (rings[i] && rings[i]->owned.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+			return rings[i];
+		}
+	}
+
+	uint32_t index = ringCount.fetch_add(1, std::memory_order_acq_rel);
+	if (index >= TRACE_MAX_RINGS) {
+		ringCount.store(TRACE_MAX_RINGS, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	auto ring = new TraceRing();
+	ring->index = index;
+	ring->owned.store(true, std::memory_order_relaxed);
+	ring->head.store(0, std::memory_order_relaxed);
+
+	// the dumper only looks at non-null entries, so it's fine if it sees the count before the ring
+	__atomic_store_n(&rings[index], ring, __ATOMIC_RELEASE);
+
+	return ring;
+};
+
+static uint64_t clockNanoseconds(clockid_t clock) {
+	struct timespec time;
+	clock_gettime(clock, &time);
+	return (uint64_t)time.tv_sec * 1000000000ull + time.tv_nsec;
+};
+
+void DarlingServer::Trace::record(Event event, pid_t pid, pid_t tid, uint64_t arg) {
+	auto ring = currentRingOwner.ring;
+
+	if (!ring) {
+		ring = currentRingOwner.ring = claimRing();
+		if (!ring) {
+			// out of rings; this thread just won't be traced
+			return;
+		}
+	}
+
+	uint64_t head = ring->head.load(std::memory_order_relaxed);
+	auto& slot = ring->events[head & (TRACE_RING_CAPACITY - 1)];
+
+	slot.timestamp = clockNanoseconds(CLOCK_MONOTONIC);
+	slot.type = static_cast<uint16_t>(event);
+	slot.reserved = 0;
+	slot.ring_index = ring->index;
+	slot.pid = pid;
+	slot.tid = tid;
+	slot.arg = arg;
+
+	ring->head.store(head + 1, std::memory_order_release);
+};
+
+void DarlingServer::Trace::record(Event event, const Thread& thread, uint64_t arg) {
+	auto process = thread.process();
+	auto tid = thread.id();
+	record(event, process ? process->id() : -1, (tid < 0) ? thread.nsid() : tid, arg);
+};
+
+void DarlingServer::Trace::setDumpDirectory(const std::string& directory) {
+	snprintf(dumpPath, sizeof(dumpPath), "%s/dserver-trace.bin", directory.c_str());
+	snprintf(crashDumpPath, sizeof(crashDumpPath), "%s/dserver-trace-crash.bin", directory.c_str());
+};
+
+static bool writeAll(int fd, const void* buffer, size_t size) {
+	auto bytes = static_cast<const char*>(buffer);
+
+	while (size > 0) {
+		ssize_t written = write(fd, bytes, size);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		bytes += written;
+		size -= written;
+	}
+
+	return true;
+};
+
+// NOTE: this must remain async-signal-safe (no allocation, no locks)
+static bool dumpToPath(const char* path) {
+	if (path[0] == '\0') {
+		return false;
+	}
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		return false;
+	}
+
+	dserver_trace_header_t header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, DSERVER_TRACE_MAGIC, sizeof(DSERVER_TRACE_MAGIC));
+	header.version = DSERVER_TRACE_VERSION;
+	header.monotonic_time = clockNanoseconds(CLOCK_MONOTONIC);
+	header.realtime_time = clockNanoseconds(CLOCK_REALTIME);
+
+	uint32_t count = ringCount.load(std::memory_order_acquire);
+	if (count > TRACE_MAX_RINGS) {
+		count = TRACE_MAX_RINGS;
+	}
+
+	// snapshot the rings once so that a ring published while we're dumping can't make the ring count disagree with the rings we write.
+	// this is a plain array (rather than a vector) because we may be called from a crash handler.
+	TraceRing* snapshot[TRACE_MAX_RINGS];
+
+	for (uint32_t i = 0; i < count; ++i) {
+		if (auto ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE)) {
+			snapshot[header.ring_count++] = ring;
+		}
+	}
+
+	bool ok = writeAll(fd, &header, sizeof(header));
+
+	for (uint32_t i = 0; ok && i < header.ring_count; ++i) {
+		auto ring = snapshot[i];
+
+		// the owner may keep recording while we're dumping; that can tear the oldest few events, but that's fine for a trace
+		uint64_t head = ring->head.load(std::memory_order_acquire);
+		uint64_t eventCount = (head < TRACE_RING_CAPACITY) ? head : TRACE_RING_CAPACITY;
+		uint64_t start = head - eventCount;
+
+		dserver_trace_ring_header_t ringHeader;
+		ringHeader.ring_index = ring->index;
+		ringHeader.event_count = eventCount;
+
+		ok = writeAll(fd, &ringHeader, sizeof(ringHeader));
+
+		// write the events oldest-first; this might take two writes if the ring has wrapped around
+		uint64_t startSlot = start & (TRACE_RING_CAPACITY - 1);
+		uint64_t firstPart = (startSlot + eventCount > TRACE_RING_CAPACITY) ? (TRACE_RING_CAPACITY - startSlot) : eventCount;
+
+		if (ok) {
+			ok = writeAll(fd, &ring->events[startSlot], firstPart * sizeof(dserver_trace_event_t));
+		}
+		if (ok && firstPart < eventCount) {
+			ok = writeAll(fd, &ring->events[0], (eventCount - firstPart) * sizeof(dserver_trace_event_t));
+		}
+	}
+
+	close(fd);
+	return ok;
+};
+
+bool DarlingServer::Trace::dump() {
+	return dumpToPath(dumpPath);
+};
+
+void DarlingServer::Trace::dumpForCrash() {
+	dumpToPath(crashDumpPath);
+};
@@ -0,0 +1,242 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2022 Darling developers
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "dtape-test-support.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <new>
+
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static thread_local DTapeTest::Microthread* currentMicrothread = nullptr;
+static dtape_log_level_t minimumLogLevel = dtape_log_level_warning;
+static std::atomic<uint64_t> loggedProblems { 0 };
+static std::atomic<uint64_t> singleMemoryCalls { 0 };
+static std::atomic<uint64_t> batchMemoryCalls { 0 };
+static std::atomic<uint64_t> batchedMemoryOps { 0 };
+static std::atomic<uint64_t> timerArms { 0 };
+
+static void futexWait(std::atomic<uint32_t>* word, uint32_t expected) {
+	syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+};
+
+static void futexWake(std::atomic<uint32_t>* word) {
+	syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+};
+
+namespace DTapeTest {
+	struct Hooks {
+		static void log(dtape_log_level_t level, const char* message) {
+			if (level >= dtape_log_level_warning) {
+				++loggedProblems;
+			}
+			if (level < minimumLogLevel) {
+				return;
+			}
+			static const char* const levelNames[] = { "debug", "info", "warning", "error" };
+			fprintf(stderr, "[dtape:%s] %s\n", levelNames[level], message);
+		};
+
+		static dtape_thread_t* currentThread() {
+			return currentMicrothread ? currentMicrothread->_dtapeThread : nullptr;
+		};
+
+		static dtape_task_t* currentTask() {
+			return nullptr;
+		};
+
+		static void threadSuspend(void* threadContext, dtape_thread_continuation_callback_f continuationCallback, void* continuationContext, libsimple_lock_t* unlockMe) {
+			auto microthread = static_cast<Microthread*>(threadContext);
+
+			// like a real microthread, we're no longer running once we're suspended
+			dtape_thread_exiting(microthread->_dtapeThread);
+
+			if (unlockMe) {
+				libsimple_lock_unlock(unlockMe);
+			}
+
+			// a resume may come in before we actually start waiting, so resumes are counted rather than just flagged
+			uint32_t pending = microthread->_pendingResumes.load(std::memory_order_acquire);
+			while (true) {
+				if (pending == 0) {
+					futexWait(&microthread->_pendingResumes, 0);
+					pending = microthread->_pendingResumes.load(std::memory_order_acquire);
+					continue;
+				}
+				if (microthread->_pendingResumes.compare_exchange_weak(pending, pending - 1, std::memory_order_acquire)) {
+					break;
+				}
+			}
+
+			dtape_thread_entering(microthread->_dtapeThread);
+
+			if (continuationCallback) {
+				continuationCallback(continuationContext);
+			}
+		};
+
+		static void threadResume(void* threadContext) {
+			auto microthread = static_cast<Microthread*>(threadContext);
+			microthread->_pendingResumes.fetch_add(1, std::memory_order_release);
+			futexWake(&microthread->_pendingResumes);
+		};
+
+		static bool taskReadMemory(void* taskContext, uintptr_t remoteAddress, void* localBuffer, size_t length) {
+			memcpy(localBuffer, reinterpret_cast<const void*>(remoteAddress), length);
+			return true;
+		};
+
+		static bool taskWriteMemory(void* taskContext, uintptr_t remoteAddress, const void* localBuffer, size_t length) {
+			memcpy(reinterpret_cast<void*>(remoteAddress), localBuffer, length);
+			return true;
+		};
+
+		static uintptr_t allocatePages(size_t pageCount, int protection, uintptr_t addressHint) {
+			void* address = mmap(reinterpret_cast<void*>(addressHint), pageCount * sysconf(_SC_PAGESIZE), protection, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			return (address == MAP_FAILED) ? 0 : reinterpret_cast<uintptr_t>(address);
+		};
+
+		static int freePages(uintptr_t address, size_t pageCount) {
+			return munmap(reinterpret_cast<void*>(address), pageCount * sysconf(_SC_PAGESIZE));
+		};
+
+		static uintptr_t mapFile(int fd, size_t pageCount, int protection, uintptr_t addressHint, size_t pageOffset, dtape_memory_flags_t flags) {
+			int mapFlags = (flags & dtape_memory_flag_private) ? MAP_PRIVATE : MAP_SHARED;
+			void* address = mmap(reinterpret_cast<void*>(addressHint), pageCount * sysconf(_SC_PAGESIZE), protection, mapFlags, fd, pageOffset * sysconf(_SC_PAGESIZE));
+			return (address == MAP_FAILED) ? 0 : reinterpret_cast<uintptr_t>(address);
+		};
+
+		static uintptr_t taskAllocatePages(void* taskContext, size_t pageCount, int protection, uintptr_t addressHint, dtape_memory_flags_t flags) {
+			++singleMemoryCalls;
+			return allocatePages(pageCount, protection, addressHint);
+		};
+
+		static int taskFreePages(void* taskContext, uintptr_t address, size_t pageCount) {
+			++singleMemoryCalls;
+			return freePages(address, pageCount);
+		};
+
+		static uintptr_t taskMapFile(void* taskContext, int fd, size_t pageCount, int protection, uintptr_t addressHint, size_t pageOffset, dtape_memory_flags_t flags) {
+			++singleMemoryCalls;
+			return mapFile(fd, pageCount, protection, addressHint, pageOffset, flags);
+		};
+
+		static void timerArm(uint64_t absoluteNs, uint64_t leewayNs, bool override) {
+			// there's no real timer to arm; the tests expire timers themselves (with `dtape_timer_fired`)
+			++timerArms;
+		};
+
+		static void taskBatchMemory(void* taskContext, dtape_memory_op_t* ops, size_t opCount) {
+			bool failed = false;
+
+			++batchMemoryCalls;
+			batchedMemoryOps += opCount;
+
+			for (size_t i = 0; i < opCount; ++i) {
+				auto& op = ops[i];
+
+				if (failed) {
+					op.result = 0;
+					op.error = DTAPE_MEMORY_OP_ERROR_SKIPPED;
+					continue;
+				}
+
+				op.result = 0;
+				op.error = 0;
+
+				switch (op.type) {
+					case dtape_memory_op_allocate_pages:
+						op.result = allocatePages(op.page_count, op.protection, op.address);
+						break;
+					case dtape_memory_op_map_file:
+						op.result = mapFile(op.fd, op.page_count, op.protection, op.address, op.page_offset, op.flags);
+						break;
+					case dtape_memory_op_free_pages:
+						if (freePages(op.address, op.page_count) < 0) {
+							op.error = errno;
+						}
+						break;
+				}
+
+				if (op.type != dtape_memory_op_free_pages && op.result == 0) {
+					op.error = errno;
+				}
+
+				failed = op.error != 0;
+			}
+		};
+	};
+};
+
+static const dtape_hooks_t testHooks = {
+	.current_task = DTapeTest::Hooks::currentTask,
+	.current_thread = DTapeTest::Hooks::currentThread,
+	.timer_arm = DTapeTest::Hooks::timerArm,
+	.log = DTapeTest::Hooks::log,
+	.thread_suspend = DTapeTest::Hooks::threadSuspend,
+	.thread_resume = DTapeTest::Hooks::threadResume,
+	.task_read_memory = DTapeTest::Hooks::taskReadMemory,
+	.task_write_memory = DTapeTest::Hooks::taskWriteMemory,
+	.task_allocate_pages = DTapeTest::Hooks::taskAllocatePages,
+	.task_free_pages = DTapeTest::Hooks::taskFreePages,
+	.task_map_file = DTapeTest::Hooks::taskMapFile,
+	.task_batch_memory = DTapeTest::Hooks::taskBatchMemory,
+};
+
+DTapeTest::Microthread::Microthread() {
+	_dtapeThread = dtape_test_thread_create(this);
+	if (!_dtapeThread) {
+		throw std::bad_alloc();
+	}
+};
+
+DTapeTest::Microthread::~Microthread() {
+	dtape_test_thread_destroy(_dtapeThread);
+};
+
+void DTapeTest::Microthread::enter() {
+	currentMicrothread = this;
+	dtape_thread_entering(_dtapeThread);
+};
+
+void DTapeTest::Microthread::exit() {
+	dtape_thread_exiting(_dtapeThread);
+	currentMicrothread = nullptr;
+};
+
+void DTapeTest::init(dtape_log_level_t minimumLevel) {
+	minimumLogLevel = minimumLevel;
+	dtape_test_init(&testHooks);
+};
+
+uint64_t DTapeTest::problemCount() {
+	return loggedProblems.load();
+};
+
+DTapeTest::MemoryHookCounts DTapeTest::memoryHookCounts() {
+	return { singleMemoryCalls.load(), batchMemoryCalls.load(), batchedMemoryOps.load() };
+};
+
+uint64_t DTapeTest::timerArmCount() {
+	return timerArms.load();
+};
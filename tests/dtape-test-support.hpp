@@ -0,0 +1,107 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2022 Darling developers
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _DARLINGSERVER_TESTS_DTAPE_TEST_SUPPORT_HPP_
+#define _DARLINGSERVER_TESTS_DTAPE_TEST_SUPPORT_HPP_
+
+#include <dtape-test.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+//
+// hooks for running duct-tape code outside the server
+//
+// microthreads are emulated with real threads: a `Microthread` is "running" while a thread has entered it,
+// and suspending it blocks the thread until someone resumes it. the task memory hooks all operate on our own address space
+// (so every task context is equivalent), which is enough to exercise the server-side memory paths.
+//
+
+namespace DTapeTest {
+	class Microthread {
+	private:
+		dtape_thread_t* _dtapeThread;
+		std::atomic<uint32_t> _pendingResumes { 0 };
+
+		friend struct Hooks;
+
+	public:
+		Microthread();
+		~Microthread();
+
+		Microthread(const Microthread&) = delete;
+		Microthread& operator=(const Microthread&) = delete;
+
+		/**
+		 * Makes this the current microthread on the calling thread.
+		 */
+		void enter();
+
+		/**
+		 * Makes the calling thread a plain (non-microthread) thread again.
+		 */
+		void exit();
+	};
+
+	/**
+	 * Installs the test hooks and initializes the duct-tape. Must be called once before anything else.
+	 *
+	 * Log messages below @p minimumLogLevel are dropped.
+	 */
+	void init(dtape_log_level_t minimumLogLevel = dtape_log_level_warning);
+
+	/**
+	 * The number of warnings and errors that the duct-tape has logged so far.
+	 */
+	uint64_t problemCount();
+
+	struct MemoryHookCounts {
+		// calls to the single-operation task memory hooks (allocate, free, and map)
+		uint64_t singleCalls;
+		// calls to `task_batch_memory` and the total number of operations they carried
+		uint64_t batchCalls;
+		uint64_t batchedOps;
+	};
+
+	/**
+	 * How many times the duct-tape has called the task memory hooks so far.
+	 */
+	MemoryHookCounts memoryHookCounts();
+
+	/**
+	 * How many times the duct-tape has asked for the server's timer to be (re)armed so far.
+	 */
+	uint64_t timerArmCount();
+
+	static inline uint64_t nowNs() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	};
+
+	#define DTAPE_TEST_CHECK(condition) do { \
+			if (!(condition)) { \
+				fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+				::exit(1); \
+			} \
+		} while (0)
+};
+
+#endif // _DARLINGSERVER_TESTS_DTAPE_TEST_SUPPORT_HPP_
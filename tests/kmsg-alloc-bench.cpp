@@ -0,0 +1,166 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2022 Darling developers
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//
+// kmsg-alloc-bench: counts the allocations that message ping-pong makes
+//
+// usage: kmsg-alloc-bench [round trips]
+//
+// two threads pass messages back and forth like a client's requests and the server's replies: each side frees the message
+// it received and allocates one to send back (so buffers are allocated on one worker and freed on another).
+// for each message size, this reports how many kalloc/zalloc calls that took (each of which used to be a `malloc`)
+// and how many times we actually reached `malloc`. once the zones have warmed up, we shouldn't be reaching `malloc` at all.
+//
+// this is linked with `--wrap` for the allocation functions, so it sees every `malloc` the duct-tape makes.
+//
+
+#include "dtape-test-support.hpp"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+extern "C" {
+	void* __real_malloc(size_t size);
+	void* __real_calloc(size_t count, size_t size);
+	void* __real_aligned_alloc(size_t alignment, size_t size);
+
+	static std::atomic<uint64_t> mallocCount { 0 };
+
+	void* __wrap_malloc(size_t size) {
+		mallocCount.fetch_add(1, std::memory_order_relaxed);
+		return __real_malloc(size);
+	};
+
+	void* __wrap_calloc(size_t count, size_t size) {
+		mallocCount.fetch_add(1, std::memory_order_relaxed);
+		return __real_calloc(count, size);
+	};
+
+	void* __wrap_aligned_alloc(size_t alignment, size_t size) {
+		mallocCount.fetch_add(1, std::memory_order_relaxed);
+		return __real_aligned_alloc(alignment, size);
+	};
+};
+
+static uint64_t zoneAllocationCount() {
+	uint64_t total = 0;
+	dtape_zone_stats_iterate([](void* context, const dtape_zone_stats_t* stats) {
+		*static_cast<uint64_t*>(context) += stats->alloc_count;
+	}, &total);
+	return total;
+};
+
+// a one-message mailbox
+class Mailbox {
+private:
+	std::mutex _mutex;
+	std::condition_variable _condition;
+	dtape_kmsg_t* _message = nullptr;
+
+public:
+	void send(dtape_kmsg_t* message) {
+		std::unique_lock<std::mutex> lock(_mutex);
+		_condition.wait(lock, [&]() { return _message == nullptr; });
+		_message = message;
+		_condition.notify_all();
+	};
+
+	dtape_kmsg_t* receive() {
+		std::unique_lock<std::mutex> lock(_mutex);
+		_condition.wait(lock, [&]() { return _message != nullptr; });
+		dtape_kmsg_t* message = _message;
+		_message = nullptr;
+		_condition.notify_all();
+		return message;
+	};
+};
+
+static void pingPong(size_t messageSize, size_t roundTrips) {
+	Mailbox requests;
+	Mailbox replies;
+
+	std::thread server([&]() {
+		DTapeTest::Microthread microthread;
+		microthread.enter();
+
+		for (size_t i = 0; i < roundTrips; ++i) {
+			dtape_test_kmsg_free(requests.receive());
+			dtape_kmsg_t* reply = dtape_test_kmsg_alloc(messageSize);
+			DTAPE_TEST_CHECK(reply != nullptr);
+			replies.send(reply);
+		}
+
+		microthread.exit();
+	});
+
+	DTapeTest::Microthread microthread;
+	microthread.enter();
+
+	for (size_t i = 0; i < roundTrips; ++i) {
+		dtape_kmsg_t* request = dtape_test_kmsg_alloc(messageSize);
+		DTAPE_TEST_CHECK(request != nullptr);
+		requests.send(request);
+		dtape_test_kmsg_free(replies.receive());
+	}
+
+	microthread.exit();
+	server.join();
+};
+
+int main(int argc, char** argv) {
+	size_t roundTrips = (argc > 1) ? strtoul(argv[1], NULL, 10) : 100000;
+	bool failed = false;
+
+	DTapeTest::init();
+	dtape_test_ipc_init();
+
+	static const size_t messageSizes[] = { 64, 1024, 8192 };
+
+	printf("%10s  %12s  %16s  %16s  %12s\n", "size", "round trips", "kalloc/zalloc", "malloc (warm-up)", "malloc");
+
+	for (size_t messageSize: messageSizes) {
+		// warm up the zones (and this thread's magazines) first
+		uint64_t warmupMallocs = mallocCount.load();
+		pingPong(messageSize, 1000);
+		warmupMallocs = mallocCount.load() - warmupMallocs;
+
+		uint64_t zoneAllocations = zoneAllocationCount();
+		uint64_t mallocs = mallocCount.load();
+		auto start = DTapeTest::nowNs();
+
+		pingPong(messageSize, roundTrips);
+
+		auto elapsed = DTapeTest::nowNs() - start;
+		mallocs = mallocCount.load() - mallocs;
+		zoneAllocations = zoneAllocationCount() - zoneAllocations;
+
+		printf("%10zu  %12zu  %16llu  %16llu  %12llu  (%.0f ns per round trip)\n", messageSize, roundTrips, (unsigned long long)zoneAllocations, (unsigned long long)warmupMallocs, (unsigned long long)mallocs, static_cast<double>(elapsed) / roundTrips);
+
+		// starting the server thread may allocate a little (e.g. its stack), but the messages themselves shouldn't
+		if (mallocs > 16) {
+			fprintf(stderr, "%zu-byte messages still reach malloc after warm-up\n", messageSize);
+			failed = true;
+		}
+	}
+
+	DTAPE_TEST_CHECK(DTapeTest::problemCount() == 0);
+
+	return failed ? 1 : 0;
+};
@@ -0,0 +1,197 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2022 Darling developers
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//
+// log-bench: measures what debug logging costs on a hot path when the debug level is disabled
+//
+// usage: log-bench [iterations]
+//
+// this is built with the server's real `src/logging.cpp` and runs with debug logging off (the default),
+// so none of these ever reach the log writer. each case logs the same message that `callFromMessage` logs for every call it receives:
+//   * guarded: the current `callFromMessage`, which checks `debugEnabled()` before building the PID/TID strings.
+//   * unguarded: builds the PID/TID strings anyway and writes them to a disabled `debug()` stream.
+//   * stream only: writes the raw numbers (and a Loggable) to a disabled `debug()` stream, without building any strings first.
+//   * always formatted: formats the whole message into an `ostringstream` and then drops it (what a stream that doesn't check its level would do).
+// it prints the cost per message for each.
+//
+
+#include <darlingserver/logging.hpp>
+#include <darlingserver/server.hpp>
+#include <darlingserver/thread.hpp>
+#include <darlingserver/process.hpp>
+#include <darlingserver/rpc.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+//
+// `logging.cpp` only needs these when a message is actually written out, which never happens here
+//
+
+DarlingServer::Server& DarlingServer::Server::sharedInstance() {
+	fprintf(stderr, "log-bench: debug logging must be disabled (unset DSERVER_LOG_LEVEL)\n");
+	abort();
+};
+
+std::string DarlingServer::Server::prefix() const {
+	abort();
+};
+
+std::shared_ptr<DarlingServer::Thread> DarlingServer::Thread::currentThread() {
+	return nullptr;
+};
+
+std::shared_ptr<DarlingServer::Process> DarlingServer::Process::currentProcess() {
+	return nullptr;
+};
+
+DarlingServer::Thread::ID DarlingServer::Thread::id() const {
+	abort();
+};
+
+DarlingServer::Thread::NSID DarlingServer::Thread::nsid() const {
+	abort();
+};
+
+DarlingServer::Process::ID DarlingServer::Process::id() const {
+	abort();
+};
+
+DarlingServer::Process::NSID DarlingServer::Process::nsid() const {
+	abort();
+};
+
+// stands in for the registered process and thread `callFromMessage` looks up
+struct FakeEntity {
+	pid_t id;
+	pid_t nsid;
+};
+
+struct FakeHeader {
+	dserver_callnum_t number;
+	pid_t pid;
+	pid_t tid;
+};
+
+// stands in for the server's Loggable objects (e.g. kqchannels)
+class FakeLoggable: public DarlingServer::Loggable {
+public:
+	pid_t id;
+
+	void logToStream(DarlingServer::Log::Stream& stream) const override {
+		stream << "<entity " << id << ">";
+	};
+};
+
+static DarlingServer::Log callLog("calls");
+
+static uint64_t nowNs() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (uint64_t)time.tv_sec * 1000000000ull + time.tv_nsec;
+};
+
+static void logGuarded(const FakeHeader& header, const FakeEntity& process, const FakeEntity& thread) {
+	if (callLog.debugEnabled()) {
+		auto pidString = std::to_string(process.id) + " (" + std::to_string(process.nsid) + ")";
+		auto tidString = std::to_string(thread.id) + " (" + std::to_string(thread.nsid) + ")";
+		callLog.debug() << "Received call #" << header.number << " (" << dserver_callnum_to_string(header.number) << ") from PID " << pidString << ", TID " << tidString << callLog.endLog;
+	}
+};
+
+static void logUnguarded(const FakeHeader& header, const FakeEntity& process, const FakeEntity& thread) {
+	auto pidString = std::to_string(process.id) + " (" + std::to_string(process.nsid) + ")";
+	auto tidString = std::to_string(thread.id) + " (" + std::to_string(thread.nsid) + ")";
+	callLog.debug() << "Received call #" << header.number << " (" << dserver_callnum_to_string(header.number) << ") from PID " << pidString << ", TID " << tidString << callLog.endLog;
+};
+
+static void logStreamOnly(const FakeHeader& header, const FakeEntity& process, const FakeEntity& thread) {
+	FakeLoggable loggable;
+	loggable.id = thread.id;
+	callLog.debug() << "Received call #" << header.number << " (" << dserver_callnum_to_string(header.number) << ") from PID " << process.id << " (" << process.nsid << "), TID " << thread.id << " (" << thread.nsid << ") on " << loggable << callLog.endLog;
+};
+
+static size_t alwaysFormattedLength = 0;
+
+static void logAlwaysFormatted(const FakeHeader& header, const FakeEntity& process, const FakeEntity& thread) {
+	auto pidString = std::to_string(process.id) + " (" + std::to_string(process.nsid) + ")";
+	auto tidString = std::to_string(thread.id) + " (" + std::to_string(thread.nsid) + ")";
+	std::ostringstream buffer;
+	buffer << "Received call #" << header.number << " (" << dserver_callnum_to_string(header.number) << ") from PID " << pidString << ", TID " << tidString;
+	// keep the compiler from throwing the message away
+	alwaysFormattedLength += buffer.str().size();
+};
+
+static double run(size_t iterations, void (*log)(const FakeHeader&, const FakeEntity&, const FakeEntity&)) {
+	FakeHeader header;
+	FakeEntity process;
+	FakeEntity thread;
+
+	auto start = nowNs();
+
+	for (size_t i = 0; i < iterations; ++i) {
+		// vary the values like real calls would (so the number formatting isn't always the same length)
+		header.number = dserver_callnum_s2c;
+		header.pid = process.id = 1000 + (i % 50000);
+		process.nsid = 1 + (i % 300);
+		header.tid = thread.id = process.id + (i % 17);
+		thread.nsid = process.nsid + (i % 17);
+		log(header, process, thread);
+	}
+
+	return static_cast<double>(nowNs() - start) / iterations;
+};
+
+int main(int argc, char** argv) {
+	size_t iterations = (argc > 1) ? strtoul(argv[1], NULL, 10) : 10000000;
+
+	if (callLog.debugEnabled()) {
+		fprintf(stderr, "log-bench: debug logging must be disabled (unset DSERVER_LOG_LEVEL)\n");
+		return 1;
+	}
+
+	struct {
+		const char* name;
+		void (*log)(const FakeHeader&, const FakeEntity&, const FakeEntity&);
+	} const cases[] = {
+		{ "guarded", logGuarded },
+		{ "unguarded", logUnguarded },
+		{ "stream only", logStreamOnly },
+		{ "always formatted", logAlwaysFormatted },
+	};
+
+	// warm up the allocator and the caches
+	for (auto& entry: cases) {
+		run(iterations / 10 + 1, entry.log);
+	}
+
+	printf("%-20s  %12s  %16s\n", "debug disabled", "ns/message", "messages per sec");
+
+	for (auto& entry: cases) {
+		double perMessage = run(iterations, entry.log);
+		printf("%-20s  %12.1f  %16.0f\n", entry.name, perMessage, 1e9 / perMessage);
+	}
+
+	if (alwaysFormattedLength == 0) {
+		return 1;
+	}
+
+	return 0;
+};
@@ -0,0 +1,472 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2022 Darling developers
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//
+// metrics-check: scrapes a metrics socket and checks what it serves
+//
+// usage: metrics-check [--socket <path>]
+//
+// by default, this starts a fixture listener that serves a fixed set of metrics the same way `MetricsEndpoint` does
+// (with the same `MetricsWriter` for the exposition text, request handling, and responses) and scrapes that.
+// with `--socket`, it scrapes a running server's socket instead (the server must have been started with DSERVER_METRICS=1;
+// the socket is `<prefix>/.darlingserver-metrics.sock`).
+//
+// this connects to the socket like any scraper would (with a plain socket, no HTTP library) and requests the metrics three ways:
+// as an HTTP request, as a raw request line, and with no request at all. it checks that the HTTP response is well-formed
+// (status line, content type, and a content length that matches the body), that every body parses as the Prometheus text format,
+// that the same metrics are in every body, and that the registry and WorkQueue metrics are there.
+// for the fixture, it also checks that every body is exactly what was rendered (including escaped label values). exits non-zero if anything is off.
+//
+
+#include <darlingserver/metrics-format.hpp>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <string>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+static const char* const requiredMetrics[] = {
+	// registries
+	"dserver_processes",
+	"dserver_threads",
+	// WorkQueue
+	"dserver_workqueue_pending",
+	"dserver_workqueue_workers",
+	"dserver_workqueue_idle_workers",
+};
+
+static bool failed = false;
+
+static void fail(const char* mode, const std::string& message) {
+	fprintf(stderr, "%s: %s\n", mode, message.c_str());
+	failed = true;
+};
+
+/**
+ * Connects to the metrics socket, sends @p request (if any), closes our end for writing, and reads everything the server sends back.
+ */
+static bool scrape(const std::string& socketPath, const std::string& request, std::string& response) {
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		perror("socket");
+		return false;
+	}
+
+	// don't hang forever if the server never answers
+	struct timeval timeout = { 5, 0 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	struct sockaddr_un addr;
+	addr.sun_family = AF_UNIX;
+	addr.sun_path[sizeof(addr.sun_path) - 1] = '\0';
+	strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+	if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		fprintf(stderr, "Failed to connect to %s: %s\n", socketPath.c_str(), strerror(errno));
+		close(fd);
+		return false;
+	}
+
+	for (size_t sent = 0; sent < request.size();) {
+		ssize_t count = send(fd, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+		if (count < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("send");
+			close(fd);
+			return false;
+		}
+		sent += count;
+	}
+
+	shutdown(fd, SHUT_WR);
+
+	response.clear();
+	char buffer[4096];
+	while (true) {
+		ssize_t count = recv(fd, buffer, sizeof(buffer), 0);
+		if (count < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("recv");
+			close(fd);
+			return false;
+		}
+		if (count == 0) {
+			break;
+		}
+		response.append(buffer, count);
+	}
+
+	close(fd);
+	return true;
+};
+
+static bool isMetricNameCharacter(char character, bool first) {
+	return (character >= 'a' && character <= 'z') || (character >= 'A' && character <= 'Z') || character == '_' || character == ':' || (!first && character >= '0' && character <= '9');
+};
+
+/**
+ * Checks that @p body is in the Prometheus text format and collects the names of the metrics it declares (with `# TYPE`).
+ */
+static void checkBody(const char* mode, const std::string& body, std::set<std::string>& metrics) {
+	std::set<std::string> sampled;
+	size_t lineStart = 0;
+	size_t lineNumber = 0;
+
+	if (body.empty() || body.back() != '\n') {
+		fail(mode, "body is empty or doesn't end with a newline");
+		return;
+	}
+
+	while (lineStart < body.size()) {
+		size_t lineEnd = body.find('\n', lineStart);
+		std::string line = body.substr(lineStart, lineEnd - lineStart);
+		lineStart = lineEnd + 1;
+		++lineNumber;
+
+		auto where = [&]() {
+			return "line " + std::to_string(lineNumber) + " (\"" + line + "\"): ";
+		};
+
+		if (line.rfind("# TYPE ", 0) == 0) {
+			auto nameEnd = line.find(' ', 7);
+			if (nameEnd == std::string::npos) {
+				fail(mode, where() + "TYPE line without a type");
+				continue;
+			}
+			metrics.insert(line.substr(7, nameEnd - 7));
+			continue;
+		}
+
+		if (line.rfind("# HELP ", 0) == 0) {
+			continue;
+		}
+
+		if (line.empty() || line[0] == '#') {
+			fail(mode, where() + "unexpected line");
+			continue;
+		}
+
+		// a sample: `name[{labels}] value`
+		size_t nameEnd = 0;
+		while (nameEnd < line.size() && isMetricNameCharacter(line[nameEnd], nameEnd == 0)) {
+			++nameEnd;
+		}
+		if (nameEnd == 0) {
+			fail(mode, where() + "sample without a metric name");
+			continue;
+		}
+
+		size_t valueStart = nameEnd;
+		if (valueStart < line.size() && line[valueStart] == '{') {
+			valueStart = line.find("} ", valueStart);
+			if (valueStart == std::string::npos) {
+				fail(mode, where() + "unterminated labels");
+				continue;
+			}
+			++valueStart;
+		}
+
+		if (valueStart >= line.size() || line[valueStart] != ' ') {
+			fail(mode, where() + "sample without a value");
+			continue;
+		}
+
+		const char* value = line.c_str() + valueStart + 1;
+		char* valueEnd = nullptr;
+		strtod(value, &valueEnd);
+		if (valueEnd == value || *valueEnd != '\0') {
+			if (strcmp(value, "+Inf") != 0 && strcmp(value, "-Inf") != 0 && strcmp(value, "NaN") != 0) {
+				fail(mode, where() + "value isn't a number");
+				continue;
+			}
+		}
+
+		sampled.insert(line.substr(0, nameEnd));
+	}
+
+	for (auto& name: sampled) {
+		// histogram samples are named after their metric with a suffix
+		bool declared = metrics.count(name) > 0;
+		for (const char* suffix: { "_bucket", "_sum", "_count" }) {
+			size_t suffixLength = strlen(suffix);
+			if (!declared && name.size() > suffixLength && name.compare(name.size() - suffixLength, suffixLength, suffix) == 0) {
+				declared = metrics.count(name.substr(0, name.size() - suffixLength)) > 0;
+			}
+		}
+		if (!declared) {
+			fail(mode, "sample for " + name + " without a TYPE line");
+		}
+	}
+
+	for (const char* required: requiredMetrics) {
+		if (metrics.count(required) == 0 || sampled.count(required) == 0) {
+			fail(mode, std::string("missing metric ") + required);
+		}
+	}
+};
+
+//
+// the fixture
+//
+
+using DarlingServer::MetricsWriter;
+
+// one of the fixture's call names needs every kind of escaping there is
+static const char* const fixtureCallNames[] = {
+	"dserver_callnum_checkin",
+	"weird \"call\"\\name\n",
+};
+
+static std::string renderFixture() {
+	MetricsWriter writer;
+
+	writer.addMetric("dserver_processes", "gauge", "Number of registered processes.", 3);
+	writer.addMetric("dserver_threads", "gauge", "Number of registered threads.", 17);
+	writer.addMetric("dserver_workqueue_pending", "gauge", "Number of microthreads waiting for a worker.", 0);
+	writer.addMetric("dserver_workqueue_workers", "gauge", "Number of worker threads.", 4);
+	writer.addMetric("dserver_workqueue_idle_workers", "gauge", "Number of worker threads waiting for work.", 3);
+
+	writer.addHeader("dserver_calls_total", "counter", "Number of completed calls.");
+	for (const char* name: fixtureCallNames) {
+		writer.addSample("dserver_calls_total", "call=\"" + MetricsWriter::escapeLabelValue(name) + "\"", "42");
+	}
+
+	writer.addHeader("dserver_call_latency_seconds", "summary", "In-server call latency, from receipt to reply.");
+	for (const char* name: fixtureCallNames) {
+		auto label = "call=\"" + MetricsWriter::escapeLabelValue(name) + "\"";
+		writer.addSample("dserver_call_latency_seconds", label + ",quantile=\"0.5\"", MetricsWriter::formatSeconds(1500));
+		writer.addSample("dserver_call_latency_seconds", label + ",quantile=\"1\"", MetricsWriter::formatSeconds(2000000000));
+		writer.addSample("dserver_call_latency_seconds_sum", label, MetricsWriter::formatSeconds(123456789));
+		writer.addSample("dserver_call_latency_seconds_count", label, "42");
+	}
+
+	return writer.take();
+};
+
+/**
+ * Accepts @p connectionCount connections on @p listener and answers each one like `MetricsEndpoint` does.
+ */
+static void serveFixture(int listener, size_t connectionCount) {
+	for (size_t i = 0; i < connectionCount; ++i) {
+		int client = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+		if (client < 0) {
+			if (errno == EINTR) {
+				--i;
+				continue;
+			}
+			// the listener was shut down (because the checks gave up early)
+			return;
+		}
+
+		std::string request;
+		bool endOfInput = false;
+		char buffer[1024];
+
+		while (!MetricsWriter::isRequestComplete(request, endOfInput)) {
+			ssize_t count = recv(client, buffer, sizeof(buffer), 0);
+			if (count < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				perror("recv");
+				break;
+			}
+			if (count == 0) {
+				endOfInput = true;
+			} else {
+				request.append(buffer, count);
+			}
+		}
+
+		auto response = MetricsWriter::response(request, renderFixture());
+
+		for (size_t sent = 0; sent < response.size();) {
+			ssize_t count = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+			if (count < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				perror("send");
+				break;
+			}
+			sent += count;
+		}
+
+		close(client);
+	}
+};
+
+//
+// the checks
+//
+
+/**
+ * Scrapes the socket three ways and checks the responses. If @p expectedBody is given, every body must match it exactly.
+ */
+static void checkEndpoint(const std::string& socketPath, const std::string* expectedBody) {
+	std::string response;
+
+	auto checkExpected = [&](const char* mode, const std::string& body) {
+		if (expectedBody && body != *expectedBody) {
+			fail(mode, "body doesn't match what was rendered");
+		}
+	};
+
+	// HTTP
+	std::set<std::string> httpMetrics;
+	if (!scrape(socketPath, "GET /metrics HTTP/1.1\r\nHost: localhost\r\nAccept: text/plain\r\n\r\n", response)) {
+		fail("http", "scrape failed");
+		return;
+	}
+
+	auto headerEnd = response.find("\r\n\r\n");
+	if (response.rfind("HTTP/1.0 200 OK\r\n", 0) != 0 || headerEnd == std::string::npos) {
+		fail("http", "malformed response: \"" + response.substr(0, 64) + "\"");
+	} else {
+		std::string headers = response.substr(0, headerEnd + 2);
+		std::string body = response.substr(headerEnd + 4);
+
+		if (headers.find("\r\nContent-Type: text/plain; version=0.0.4") == std::string::npos) {
+			fail("http", "missing or wrong Content-Type");
+		}
+
+		auto lengthStart = headers.find("\r\nContent-Length: ");
+		if (lengthStart == std::string::npos) {
+			fail("http", "missing Content-Length");
+		} else if (strtoull(headers.c_str() + lengthStart + 18, nullptr, 10) != body.size()) {
+			fail("http", "Content-Length doesn't match the body (" + std::to_string(body.size()) + " bytes)");
+		}
+
+		checkBody("http", body, httpMetrics);
+		checkExpected("http", body);
+	}
+
+	// raw, with a request line that isn't HTTP
+	std::set<std::string> rawMetrics;
+	if (!scrape(socketPath, "metrics\n", response)) {
+		fail("raw", "scrape failed");
+		return;
+	}
+	if (response.rfind("HTTP/", 0) == 0) {
+		fail("raw", "got an HTTP response to a raw request");
+	} else {
+		checkBody("raw", response, rawMetrics);
+		checkExpected("raw", response);
+	}
+
+	// raw, without any request
+	std::set<std::string> emptyMetrics;
+	if (!scrape(socketPath, "", response)) {
+		fail("empty", "scrape failed");
+		return;
+	}
+	if (response.rfind("HTTP/", 0) == 0) {
+		fail("empty", "got an HTTP response without a request");
+	} else {
+		checkBody("empty", response, emptyMetrics);
+		checkExpected("empty", response);
+	}
+
+	if (httpMetrics != rawMetrics || httpMetrics != emptyMetrics) {
+		fail("all", "the HTTP and raw responses don't have the same metrics");
+	}
+
+	printf("%zu metrics in both HTTP and raw responses\n", httpMetrics.size());
+};
+
+int main(int argc, char** argv) {
+	std::string socketPath;
+
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+			socketPath = argv[++i];
+		} else {
+			fprintf(stderr, "Usage: %s [--socket <path>]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (!socketPath.empty()) {
+		checkEndpoint(socketPath, nullptr);
+		return failed ? 1 : 0;
+	}
+
+	// the writer has to produce exactly this for the odd call name
+	std::string expectedBody = renderFixture();
+	if (expectedBody.find("dserver_calls_total{call=\"weird \\\"call\\\"\\\\name\\n\"} 42\n") == std::string::npos) {
+		fail("fixture", "label value wasn't escaped correctly");
+	}
+
+	char directory[] = "/tmp/metrics-check.XXXXXX";
+	if (!mkdtemp(directory)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	socketPath = std::string(directory) + "/metrics.sock";
+
+	int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listener < 0) {
+		perror("socket");
+		rmdir(directory);
+		return 1;
+	}
+
+	struct sockaddr_un addr;
+	addr.sun_family = AF_UNIX;
+	addr.sun_path[sizeof(addr.sun_path) - 1] = '\0';
+	strncpy(addr.sun_path, socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+	if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, SOMAXCONN) != 0) {
+		perror("bind/listen");
+		close(listener);
+		rmdir(directory);
+		return 1;
+	}
+
+	// one connection for each way `checkEndpoint` scrapes
+	std::thread fixture(serveFixture, listener, 3);
+
+	checkEndpoint(socketPath, &expectedBody);
+
+	// wakes up the fixture if the checks gave up before making all of their connections
+	shutdown(listener, SHUT_RDWR);
+	fixture.join();
+
+	close(listener);
+	unlink(socketPath.c_str());
+	rmdir(directory);
+
+	if (failed) {
+		return 1;
+	}
+
+	printf("ok\n");
+	return 0;
+};
@@ -0,0 +1,100 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2022 Darling developers
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//
+// mutex-bench: measures dtape_mutex lock/unlock cost with 1 to 8 contending microthreads
+//
+// usage: mutex-bench [acquisitions per thread]
+//
+// each microthread runs on its own worker and repeatedly takes a shared mutex around a short critical section.
+// this is run twice: once with the owner staying on its worker for the whole critical section (the case spinning is meant for)
+// and once with the owner leaving its worker while holding the lock (like a microthread that suspends with a lock held),
+// where contenders should go to sleep instead of spinning. the duct-tape's lock statistics (spins vs. sleeps, cumulative) are logged after each run.
+//
+
+#include "dtape-test-support.hpp"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+static void run(size_t threadCount, size_t acquisitions, bool ownerLeavesWorker) {
+	dtape_mutex_t* mutex = dtape_test_mutex_create();
+	DTAPE_TEST_CHECK(mutex != nullptr);
+
+	// only touched with the mutex held
+	volatile uint64_t counter = 0;
+
+	std::vector<std::thread> threads;
+	auto start = DTapeTest::nowNs();
+
+	for (size_t i = 0; i < threadCount; ++i) {
+		threads.emplace_back([&]() {
+			DTapeTest::Microthread microthread;
+			microthread.enter();
+
+			for (size_t j = 0; j < acquisitions; ++j) {
+				dtape_test_mutex_lock(mutex);
+
+				if (ownerLeavesWorker && (j % 16) == 0) {
+					// act like we suspended with the lock held; anyone contending now should sleep rather than spin
+					microthread.exit();
+					std::this_thread::sleep_for(std::chrono::microseconds(50));
+					microthread.enter();
+				}
+
+				counter = counter + 1;
+
+				dtape_test_mutex_unlock(mutex);
+			}
+
+			microthread.exit();
+		});
+	}
+
+	for (auto& thread: threads) {
+		thread.join();
+	}
+
+	auto elapsed = DTapeTest::nowNs() - start;
+
+	DTAPE_TEST_CHECK(counter == threadCount * acquisitions);
+
+	printf("%s, %zu thread(s): %.1f ns per acquisition\n", ownerLeavesWorker ? "owner leaves worker" : "owner stays on worker", threadCount, static_cast<double>(elapsed) / (threadCount * acquisitions));
+	dtape_log_lock_stats();
+
+	dtape_test_mutex_destroy(mutex);
+};
+
+int main(int argc, char** argv) {
+	size_t acquisitions = (argc > 1) ? strtoul(argv[1], NULL, 10) : 200000;
+
+	// the lock statistics are logged at the info level
+	DTapeTest::init(dtape_log_level_info);
+
+	for (bool ownerLeavesWorker: { false, true }) {
+		for (size_t threadCount = 1; threadCount <= 8; threadCount *= 2) {
+			run(threadCount, ownerLeavesWorker ? acquisitions / 16 : acquisitions, ownerLeavesWorker);
+		}
+	}
+
+	DTAPE_TEST_CHECK(DTapeTest::problemCount() == 0);
+
+	return 0;
+};
@@ -0,0 +1,169 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2022 Darling developers
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//
+// mutex-stress: hammers a few dtape mutexes with a mix of microthread and native (non-microthread) lockers
+//
+// usage: mutex-stress [acquisitions per thread]
+//
+// microthread waiters suspend and native waiters park on a futex (see `dtape_mutex_park_locked`), and both kinds
+// are woken by whoever unlocks, so this checks that mutual exclusion holds and that no wakeup is ever lost between the two.
+// some microthreads also leave their worker while holding a lock (like they would if they suspended), and some lockers use try_lock.
+//
+// a lost wakeup shows up as a hang, so a watchdog fails the test if no one makes progress for 10 seconds.
+//
+
+#include "dtape-test-support.hpp"
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+static constexpr size_t mutexCount = 3;
+static constexpr size_t microthreadCount = 6;
+static constexpr size_t nativeThreadCount = 4;
+static constexpr auto watchdogTimeout = std::chrono::seconds(10);
+
+struct Guarded {
+	dtape_mutex_t* mutex;
+	// both of these are only supposed to be touched with the mutex held; they're atomic so that a violation is reported rather than racy
+	std::atomic<uint32_t> holders { 0 };
+	std::atomic<uint64_t> count { 0 };
+};
+
+static Guarded guarded[mutexCount];
+static std::atomic<uint64_t> progress { 0 };
+
+static void criticalSection(Guarded& guard) {
+	DTAPE_TEST_CHECK(guard.holders.fetch_add(1) == 0);
+	guard.count.fetch_add(1, std::memory_order_relaxed);
+	DTAPE_TEST_CHECK(guard.holders.fetch_sub(1) == 1);
+	progress.fetch_add(1, std::memory_order_relaxed);
+};
+
+static void locker(DTapeTest::Microthread* microthread, size_t seed, size_t acquisitions, std::vector<uint64_t>& expected) {
+	std::minstd_rand random(seed);
+
+	if (microthread) {
+		microthread->enter();
+	}
+
+	for (size_t i = 0; i < acquisitions; ++i) {
+		size_t index = random() % mutexCount;
+		auto& guard = guarded[index];
+
+		if (random() % 8 == 0) {
+			if (!dtape_test_mutex_try_lock(guard.mutex)) {
+				continue;
+			}
+		} else {
+			dtape_test_mutex_lock(guard.mutex);
+		}
+
+		criticalSection(guard);
+		++expected[index];
+
+		if (microthread && random() % 32 == 0) {
+			// hold the lock while off the worker so that others have to queue up behind us (and must not spin on us)
+			microthread->exit();
+			std::this_thread::yield();
+			microthread->enter();
+		}
+
+		dtape_test_mutex_unlock(guard.mutex);
+	}
+
+	if (microthread) {
+		microthread->exit();
+	}
+};
+
+int main(int argc, char** argv) {
+	size_t acquisitions = (argc > 1) ? strtoul(argv[1], NULL, 10) : 100000;
+
+	// native lockers always log a warning (locking without an active thread), so only show errors
+	DTapeTest::init(dtape_log_level_error);
+
+	for (auto& guard: guarded) {
+		guard.mutex = dtape_test_mutex_create();
+		DTAPE_TEST_CHECK(guard.mutex != nullptr);
+	}
+
+	std::atomic<bool> done { false };
+	std::thread watchdog([&]() {
+		uint64_t lastProgress = progress.load();
+		auto lastChange = std::chrono::steady_clock::now();
+
+		while (!done.load()) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+			uint64_t current = progress.load();
+			if (current != lastProgress) {
+				lastProgress = current;
+				lastChange = std::chrono::steady_clock::now();
+			} else if (std::chrono::steady_clock::now() - lastChange > watchdogTimeout) {
+				fprintf(stderr, "no progress for %lld seconds (after %llu acquisitions); a wakeup was probably lost\n", (long long)watchdogTimeout.count(), (unsigned long long)current);
+				exit(1);
+			}
+		}
+	});
+
+	std::vector<std::unique_ptr<DTapeTest::Microthread>> microthreads;
+	std::vector<std::vector<uint64_t>> expected(microthreadCount + nativeThreadCount, std::vector<uint64_t>(mutexCount, 0));
+	std::vector<std::thread> threads;
+
+	auto start = DTapeTest::nowNs();
+
+	for (size_t i = 0; i < microthreadCount + nativeThreadCount; ++i) {
+		DTapeTest::Microthread* microthread = nullptr;
+		if (i < microthreadCount) {
+			microthreads.push_back(std::make_unique<DTapeTest::Microthread>());
+			microthread = microthreads.back().get();
+		}
+		threads.emplace_back(locker, microthread, i + 1, acquisitions, std::ref(expected[i]));
+	}
+
+	for (auto& thread: threads) {
+		thread.join();
+	}
+
+	auto elapsed = DTapeTest::nowNs() - start;
+
+	done = true;
+	watchdog.join();
+
+	for (size_t index = 0; index < mutexCount; ++index) {
+		uint64_t total = 0;
+		for (auto& counts: expected) {
+			total += counts[index];
+		}
+		DTAPE_TEST_CHECK(guarded[index].count.load() == total);
+	}
+
+	printf("%zu microthread(s) and %zu native thread(s), %llu acquisitions in %.1f ms\n", microthreadCount, nativeThreadCount, (unsigned long long)progress.load(), static_cast<double>(elapsed) / 1e6);
+
+	for (auto& guard: guarded) {
+		dtape_test_mutex_destroy(guard.mutex);
+	}
+
+	return 0;
+};
@@ -0,0 +1,187 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2022 Darling developers
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//
+// ool-batch-test: checks that copying out several OOL regions and tearing them down again uses batched task memory calls
+//
+// usage: ool-batch-test [iterations]
+//
+// this copies messages' worth of regions (a mix of memfd-backed and kernel buffer copies) from one VM map into another,
+// checking what the receiver got and how many task memory hook calls that took: setting up all the destinations of a message
+// should take a single `task_batch_memory` call (per 16 regions) instead of one call per region, and so should deallocating them.
+// it then reports the cost per region of copying and deallocating with and without batching.
+//
+
+#include "dtape-test-support.hpp"
+
+#include <cstring>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+static const size_t pageSize = sysconf(_SC_PAGESIZE);
+
+// large enough (and page-aligned) to go through a memfd
+static const size_t largeSize = 64 * pageSize;
+// small and misaligned, so it goes through a kernel buffer
+static constexpr size_t smallSize = 300;
+static constexpr size_t smallMisalignment = 24;
+
+struct Regions {
+	std::vector<uintptr_t> sources;
+	std::vector<size_t> sizes;
+};
+
+static Regions makeRegions(uint8_t* buffer, size_t count) {
+	Regions regions;
+
+	for (size_t i = 0; i < count; ++i) {
+		// every region gets its own slice of the buffer (and its own contents)
+		uint8_t* slice = buffer + i * largeSize;
+		bool large = (i % 2) == 0;
+		size_t size = large ? largeSize : smallSize;
+		uint8_t* source = large ? slice : slice + smallMisalignment;
+
+		for (size_t j = 0; j < size; ++j) {
+			source[j] = static_cast<uint8_t>(i * 131 + j);
+		}
+
+		regions.sources.push_back(reinterpret_cast<uintptr_t>(source));
+		regions.sizes.push_back(size);
+	}
+
+	return regions;
+};
+
+static void checkCopies(const Regions& regions, const std::vector<uintptr_t>& destinations) {
+	for (size_t i = 0; i < destinations.size(); ++i) {
+		DTAPE_TEST_CHECK(destinations[i] != 0);
+		DTAPE_TEST_CHECK(memcmp(reinterpret_cast<const void*>(destinations[i]), reinterpret_cast<const void*>(regions.sources[i]), regions.sizes[i]) == 0);
+	}
+};
+
+static void testBatching(dtape_map_t* sender, dtape_map_t* receiver, uint8_t* buffer) {
+	for (size_t count: { 1, 2, 8, 16, 17, 40 }) {
+		auto regions = makeRegions(buffer, count);
+		std::vector<uintptr_t> destinations(count, 0);
+		size_t expectedBatches = (count < 2) ? 0 : (count + 15) / 16;
+
+		auto before = DTapeTest::memoryHookCounts();
+		DTAPE_TEST_CHECK(dtape_test_map_copy_many(sender, regions.sources.data(), regions.sizes.data(), count, receiver, destinations.data()) == 0);
+		auto after = DTapeTest::memoryHookCounts();
+
+		checkCopies(regions, destinations);
+
+		// a single region isn't worth batching (it'd take one call either way)
+		if (count < 2) {
+			DTAPE_TEST_CHECK(after.batchCalls == before.batchCalls);
+			DTAPE_TEST_CHECK(after.singleCalls - before.singleCalls == 1);
+		} else {
+			DTAPE_TEST_CHECK(after.batchCalls - before.batchCalls == expectedBatches);
+			DTAPE_TEST_CHECK(after.batchedOps - before.batchedOps == count);
+			DTAPE_TEST_CHECK(after.singleCalls == before.singleCalls);
+		}
+
+		// the receiver can write to what it got without affecting the sender
+		memset(reinterpret_cast<void*>(destinations[0]), 0xff, regions.sizes[0]);
+		DTAPE_TEST_CHECK(*reinterpret_cast<const uint8_t*>(regions.sources[0]) == 0);
+
+		before = DTapeTest::memoryHookCounts();
+		DTAPE_TEST_CHECK(dtape_test_map_deallocate_many(receiver, destinations.data(), regions.sizes.data(), count) == 0);
+		after = DTapeTest::memoryHookCounts();
+
+		DTAPE_TEST_CHECK(after.singleCalls == before.singleCalls);
+		DTAPE_TEST_CHECK(after.batchCalls - before.batchCalls == (count + 15) / 16);
+		DTAPE_TEST_CHECK(after.batchedOps - before.batchedOps == count);
+
+		// the regions really are gone
+		for (uintptr_t destination: destinations) {
+			DTAPE_TEST_CHECK(msync(reinterpret_cast<void*>(destination & ~(pageSize - 1)), pageSize, MS_ASYNC) != 0);
+		}
+	}
+};
+
+// returns the cost per region (in ns) of copying `count` regions and deallocating them again
+static double measure(dtape_map_t* sender, dtape_map_t* receiver, const Regions& regions, bool batched, size_t iterations) {
+	size_t count = regions.sources.size();
+	std::vector<uintptr_t> destinations(count, 0);
+	uint64_t total = 0;
+
+	for (size_t i = 0; i < iterations; ++i) {
+		auto start = DTapeTest::nowNs();
+
+		if (batched) {
+			DTAPE_TEST_CHECK(dtape_test_map_copy_many(sender, regions.sources.data(), regions.sizes.data(), count, receiver, destinations.data()) == 0);
+			DTAPE_TEST_CHECK(dtape_test_map_deallocate_many(receiver, destinations.data(), regions.sizes.data(), count) == 0);
+		} else {
+			for (size_t j = 0; j < count; ++j) {
+				DTAPE_TEST_CHECK(dtape_test_map_copy(sender, regions.sources[j], regions.sizes[j], receiver, &destinations[j]) == 0);
+			}
+			for (size_t j = 0; j < count; ++j) {
+				DTAPE_TEST_CHECK(dtape_test_map_deallocate(receiver, destinations[j], regions.sizes[j]) == 0);
+			}
+		}
+
+		total += DTapeTest::nowNs() - start;
+	}
+
+	return static_cast<double>(total) / (iterations * count);
+};
+
+int main(int argc, char** argv) {
+	size_t iterations = (argc > 1) ? strtoul(argv[1], NULL, 10) : 200;
+	static constexpr size_t maximumCount = 40;
+
+	DTapeTest::init();
+
+	// the maps' locks are meant to be taken by microthreads
+	DTapeTest::Microthread microthread;
+	microthread.enter();
+
+	dtape_map_t* sender = dtape_test_map_create(nullptr);
+	dtape_map_t* receiver = dtape_test_map_create(nullptr);
+	DTAPE_TEST_CHECK(sender && receiver);
+
+	auto buffer = static_cast<uint8_t*>(mmap(NULL, maximumCount * largeSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+	DTAPE_TEST_CHECK(buffer != MAP_FAILED);
+
+	testBatching(sender, receiver, buffer);
+
+	// in here, the hooks are plain function calls, so this mostly shows the duct-tape's own overhead;
+	// in the server, every hook call that batching saves is a round trip to the client
+	printf("%8s  %16s  %16s\n", "regions", "one by one (ns)", "batched (ns)");
+
+	for (size_t count = 1; count <= 32; count *= 2) {
+		auto regions = makeRegions(buffer, count);
+		double single = measure(sender, receiver, regions, false, iterations);
+		double batched = measure(sender, receiver, regions, true, iterations);
+		printf("%8zu  %16.1f  %16.1f\n", count, single, batched);
+	}
+
+	munmap(buffer, maximumCount * largeSize);
+	dtape_test_map_destroy(receiver);
+	dtape_test_map_destroy(sender);
+
+	microthread.exit();
+
+	DTAPE_TEST_CHECK(DTapeTest::problemCount() == 0);
+
+	return 0;
+};
@@ -0,0 +1,114 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2022 Darling developers
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//
+// ool-bench: measures the throughput of out-of-line memory transfers (`vm_map_copyin` + `vm_map_copyout`)
+//
+// usage: ool-bench [iterations]
+//
+// copies regions from 4 KiB up to 64 MiB from one VM map into another, both page-aligned (which uses the memfd path
+// once the region is at least 256 KiB) and misaligned (which always goes through a kernel buffer), and has the receiver
+// read every byte of what it got, so the numbers include faulting in the receiver's mapping.
+//
+
+#include "dtape-test-support.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+static constexpr size_t minimumSize = 4 * 1024;
+static constexpr size_t maximumSize = 64 * 1024 * 1024;
+static constexpr size_t misalignment = 16;
+
+static uint64_t checksum(const uint8_t* data, size_t size) {
+	uint64_t sum = 0;
+	for (size_t i = 0; i < size; i += sizeof(uint64_t)) {
+		uint64_t word;
+		memcpy(&word, data + i, sizeof(word));
+		sum += word;
+	}
+	return sum;
+};
+
+static double measure(dtape_map_t* sender, dtape_map_t* receiver, const uint8_t* source, size_t size, uint64_t expectedChecksum, size_t iterations) {
+	uint64_t total = 0;
+
+	for (size_t i = 0; i < iterations; ++i) {
+		uintptr_t destination = 0;
+		auto start = DTapeTest::nowNs();
+
+		DTAPE_TEST_CHECK(dtape_test_map_copy(sender, reinterpret_cast<uintptr_t>(source), size, receiver, &destination) == 0);
+		uint64_t sum = checksum(reinterpret_cast<const uint8_t*>(destination), size);
+
+		total += DTapeTest::nowNs() - start;
+
+		DTAPE_TEST_CHECK(sum == expectedChecksum);
+		DTAPE_TEST_CHECK(dtape_test_map_deallocate(receiver, destination, size) == 0);
+	}
+
+	// MiB/s
+	return (static_cast<double>(size) * iterations / (1024.0 * 1024.0)) / (static_cast<double>(total) / 1e9);
+};
+
+int main(int argc, char** argv) {
+	size_t iterations = (argc > 1) ? strtoul(argv[1], NULL, 10) : 20;
+
+	DTapeTest::init();
+
+	// the maps' locks are meant to be taken by microthreads (like everything else in the duct-tape)
+	DTapeTest::Microthread microthread;
+	microthread.enter();
+
+	dtape_map_t* sender = dtape_test_map_create(nullptr);
+	dtape_map_t* receiver = dtape_test_map_create(nullptr);
+	DTAPE_TEST_CHECK(sender && receiver);
+
+	// one extra page so the misaligned copies stay in bounds
+	size_t bufferSize = maximumSize + sysconf(_SC_PAGESIZE);
+	auto buffer = static_cast<uint8_t*>(mmap(NULL, bufferSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+	DTAPE_TEST_CHECK(buffer != MAP_FAILED);
+	for (size_t i = 0; i < bufferSize; ++i) {
+		buffer[i] = static_cast<uint8_t>(i * 31 + 7);
+	}
+
+	printf("%10s  %16s  %16s\n", "size", "aligned (MiB/s)", "misaligned (MiB/s)");
+
+	for (size_t size = minimumSize; size <= maximumSize; size *= 4) {
+		// keep the total amount copied per size roughly constant
+		size_t scaledIterations = std::max<size_t>(1, iterations * (1024 * 1024) / size);
+
+		double aligned = measure(sender, receiver, buffer, size, checksum(buffer, size), scaledIterations);
+		double misaligned = measure(sender, receiver, buffer + misalignment, size, checksum(buffer + misalignment, size), scaledIterations);
+
+		printf("%10zu  %16.1f  %16.1f\n", size, aligned, misaligned);
+	}
+
+	munmap(buffer, bufferSize);
+	dtape_test_map_destroy(receiver);
+	dtape_test_map_destroy(sender);
+
+	microthread.exit();
+
+	DTAPE_TEST_CHECK(DTapeTest::problemCount() == 0);
+
+	return 0;
+};
@@ -0,0 +1,203 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2022 Darling developers
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//
+// procmem-bench: compares the two client memory access backends (see `Process::_readOrWriteMemory`)
+//
+// usage: procmem-bench [iterations]
+//
+// forks a child with a 16 MiB buffer and reads from it (and writes to it) with both a persistent /proc/<pid>/mem descriptor
+// and process_vm_readv/writev, for sizes from 64 bytes up to 16 MiB. it also checks how each backend reports an access
+// to an unmapped address, since the server relies on that to tell a bad address apart from a stale descriptor,
+// and that only procfs can write to a read-only page.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static constexpr size_t bufferSize = 16 * 1024 * 1024;
+
+static bool accessProcFS(int fd, bool isWrite, uintptr_t address, char* buffer, size_t length, int* code) {
+	size_t offset = 0;
+	while (offset < length) {
+		auto result = isWrite
+			? pwrite(fd, buffer + offset, length - offset, address + offset)
+			: pread(fd, buffer + offset, length - offset, address + offset);
+		if (result < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			*code = errno;
+			return false;
+		} else if (result == 0) {
+			*code = 0;
+			return false;
+		}
+		offset += result;
+	}
+	return true;
+};
+
+static bool accessVM(pid_t pid, bool isWrite, uintptr_t address, char* buffer, size_t length, int* code) {
+	struct iovec local = { buffer, length };
+	struct iovec remote = { (void*)address, length };
+	auto result = isWrite
+		? process_vm_writev(pid, &local, 1, &remote, 1, 0)
+		: process_vm_readv(pid, &local, 1, &remote, 1, 0);
+	if (result < 0) {
+		*code = errno;
+		return false;
+	}
+	return true;
+};
+
+int main(int argc, char** argv) {
+	size_t iterations = (argc > 1) ? strtoul(argv[1], NULL, 10) : 2000;
+	int pipeFDs[2];
+
+	if (pipe(pipeFDs) < 0) {
+		perror("pipe");
+		return 1;
+	}
+
+	// map it before forking so that the child has it at the same address;
+	// there's an extra page at the end that the child makes read-only
+	const size_t pageSize = sysconf(_SC_PAGESIZE);
+	char* remoteBuffer = (char*)mmap(NULL, bufferSize + pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (remoteBuffer == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	pid_t child = fork();
+	if (child < 0) {
+		perror("fork");
+		return 1;
+	} else if (child == 0) {
+		memset(remoteBuffer, 0x5a, bufferSize);
+		if (mprotect(remoteBuffer + bufferSize, pageSize, PROT_READ) < 0) {
+			_exit(1);
+		}
+		close(pipeFDs[0]);
+		char ready = 1;
+		if (write(pipeFDs[1], &ready, 1) != 1) {
+			_exit(1);
+		}
+		pause();
+		_exit(0);
+	}
+
+	close(pipeFDs[1]);
+	char ready;
+	if (read(pipeFDs[0], &ready, 1) != 1) {
+		fprintf(stderr, "child failed to start\n");
+		return 1;
+	}
+
+	// the child has its own copy now; we only need the address
+	munmap(remoteBuffer, bufferSize + pageSize);
+
+	int memFD = open(("/proc/" + std::to_string(child) + "/mem").c_str(), O_RDWR | O_CLOEXEC);
+	if (memFD < 0) {
+		perror("open /proc/<pid>/mem");
+		kill(child, SIGKILL);
+		return 1;
+	}
+
+	std::vector<char> localBuffer(bufferSize);
+	int status = 0;
+
+	printf("%-8s %-6s %10s %12s %12s\n", "backend", "op", "size", "ns/op", "MiB/s");
+
+	// every power of two, so the crossover point (which the automatic backend selection relies on) shows up
+	for (size_t size = 64; size <= bufferSize; size *= 2) {
+		// scale the iteration count down for big transfers so every size takes roughly as long
+		size_t count = std::max<size_t>(iterations * 64 / (size / 64 + 64), 16);
+
+		for (int isWrite = 0; isWrite < 2; ++isWrite) {
+			for (int useVM = 0; useVM < 2; ++useVM) {
+				int code = 0;
+				auto start = std::chrono::steady_clock::now();
+				for (size_t i = 0; i < count; ++i) {
+					bool ok = useVM
+						? accessVM(child, isWrite, (uintptr_t)remoteBuffer, localBuffer.data(), size, &code)
+						: accessProcFS(memFD, isWrite, (uintptr_t)remoteBuffer, localBuffer.data(), size, &code);
+					if (!ok) {
+						fprintf(stderr, "%s %s of %zu bytes failed: %s\n", useVM ? "vm" : "procfs", isWrite ? "write" : "read", size, strerror(code));
+						status = 1;
+						break;
+					}
+				}
+				auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+				double perOp = elapsed / count;
+				printf("%-8s %-6s %10zu %12.0f %12.1f\n", useVM ? "vm" : "procfs", isWrite ? "write" : "read", size, perOp, (size / (1024.0 * 1024.0)) / (perOp / 1e9));
+			}
+		}
+	}
+
+	// an unmapped address must fail with a real error (EIO for procfs, EFAULT for vm), not a short (0-byte) access;
+	// the server only treats a 0-byte access as a stale descriptor
+	uintptr_t badAddress = 0x1000;
+	int procfsCode = 0;
+	int vmCode = 0;
+	bool procfsOK = accessProcFS(memFD, false, badAddress, localBuffer.data(), 64, &procfsCode);
+	bool vmOK = accessVM(child, false, badAddress, localBuffer.data(), 64, &vmCode);
+	printf("bad address: procfs -> %s, vm -> %s\n", procfsOK ? "ok" : (procfsCode ? strerror(procfsCode) : "0 bytes"), vmOK ? "ok" : strerror(vmCode));
+	if (procfsOK || procfsCode != EIO || vmOK || vmCode != EFAULT) {
+		fprintf(stderr, "unexpected result for bad address access\n");
+		status = 1;
+	}
+
+	// a write to a read-only page fails with process_vm_writev but works through procfs
+	// (the automatic backend retries failed writes with procfs instead of asking the client to mprotect the page)
+	uintptr_t readOnlyAddress = (uintptr_t)remoteBuffer + bufferSize;
+	vmOK = accessVM(child, true, readOnlyAddress, localBuffer.data(), 64, &vmCode);
+	procfsOK = accessProcFS(memFD, true, readOnlyAddress, localBuffer.data(), 64, &procfsCode);
+	printf("read-only page write: procfs -> %s, vm -> %s\n", procfsOK ? "ok" : (procfsCode ? strerror(procfsCode) : "0 bytes"), vmOK ? "ok" : strerror(vmCode));
+	if (!procfsOK || vmOK || vmCode != EFAULT) {
+		fprintf(stderr, "unexpected result for read-only page write\n");
+		status = 1;
+	}
+
+	// once the process is gone, a procfs read returns 0 bytes (that's the staleness signal the server reopens on)
+	kill(child, SIGKILL);
+	waitpid(child, NULL, 0);
+	procfsOK = accessProcFS(memFD, false, (uintptr_t)remoteBuffer, localBuffer.data(), 64, &procfsCode);
+	printf("dead process: procfs -> %s\n", procfsOK ? "ok" : (procfsCode ? strerror(procfsCode) : "0 bytes"));
+	if (procfsOK || procfsCode != 0) {
+		fprintf(stderr, "unexpected result for dead process access\n");
+		status = 1;
+	}
+
+	close(memFD);
+	return status;
+};
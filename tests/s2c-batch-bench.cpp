@@ -0,0 +1,592 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2022 Darling developers
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//
+// s2c-batch-bench: checks the S2C batch packing and client-side handling, and measures the per-operation cost of batches of 1 to 64 operations
+//
+// usage: s2c-batch-bench [rounds]
+//
+// the first part checks `dserver_s2c_batch_pack` (splitting at `DSERVER_S2C_BATCH_MAX_OPS` operations and `DSERVER_S2C_BATCH_MAX_FDS`
+// descriptors, and turning descriptors into indices) and `dserver_s2c_batch_perform` (stopping at the first failure and rejecting
+// malformed calls), and sends a few batches with descriptors over a socket to a "client" thread to check they arrive intact.
+//
+// the second part does `mprotect`s through that client thread in three ways: one exchange per operation (like individual S2C calls),
+// batches capped at `DSERVER_S2C_BATCH_MAX_OPS` (what the server actually sends), and a single uncapped exchange for all the operations
+// (what raising the cap as far as the message size allows would approach). it reports the cost per operation of each,
+// which shows how much of a round trip batching saves and how little there is left to gain past the cap.
+//
+// the third part measures what a single S2C operation costs on each of the two paths `Thread::_s2cPerform` can take.
+// inline: the client thread is already blocked waiting for a message from the server (it has a call in progress), so the server just sends the call.
+// signal: the client thread is somewhere else (here, blocked in an unrelated syscall), so the server has to send it a real-time signal;
+// the handler sends interrupt_enter, handles the S2C call, and then sends interrupt_exit and waits for the server to answer it.
+// it reports the latency the server sees (until it has the reply) and the latency of the whole exchange (until the interrupt is over) for the signal path.
+//
+
+#include <darlingserver/rpc-supplement.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define CHECK(condition) do { \
+		if (!(condition)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+			::exit(1); \
+		} \
+	} while (0)
+
+static const size_t pageSize = sysconf(_SC_PAGESIZE);
+static constexpr size_t maximumOpCount = 64;
+
+// not a real S2C message; an uncapped batch: a header, an operation count, and that many operations (without descriptors)
+static constexpr int wideBatchNumber = 0x1000;
+
+// not real S2C messages either; these stand in for the interrupt_enter and interrupt_exit calls a signalled client makes
+static constexpr int interruptEnterNumber = 0x1001;
+static constexpr int interruptExitNumber = 0x1002;
+
+struct WideBatchCall {
+	dserver_s2c_callhdr_t header;
+	uint32_t op_count;
+	dserver_s2c_batch_op_t ops[maximumOpCount];
+};
+
+struct WideBatchReply {
+	dserver_s2c_replyhdr_t header;
+	uint32_t op_count;
+	dserver_s2c_batch_result_t results[maximumOpCount];
+};
+
+static uint64_t nowNs() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+};
+
+static void performOp(void* context, const dserver_s2c_batch_op_t* op, int fd, dserver_s2c_batch_result_t* result) {
+	int status = 0;
+
+	switch (op->op) {
+		case dserver_s2c_msgnum_mmap: {
+			void* address = mmap(reinterpret_cast<void*>(op->address), op->length, op->protection, op->flags, fd, op->offset);
+			result->return_value = reinterpret_cast<uintptr_t>(address);
+			result->errno_result = (address == MAP_FAILED) ? errno : 0;
+			return;
+		}
+		case dserver_s2c_msgnum_munmap:
+			status = munmap(reinterpret_cast<void*>(op->address), op->length);
+			break;
+		case dserver_s2c_msgnum_mprotect:
+			status = mprotect(reinterpret_cast<void*>(op->address), op->length, op->protection);
+			break;
+		case dserver_s2c_msgnum_msync:
+			status = msync(reinterpret_cast<void*>(op->address), op->length, op->flags);
+			break;
+		default:
+			status = -1;
+			errno = EINVAL;
+			break;
+	}
+
+	result->return_value = static_cast<uint64_t>(static_cast<int64_t>(status));
+	result->errno_result = (status < 0) ? errno : 0;
+};
+
+static dserver_s2c_batch_op_t makeOp(dserver_s2c_msgnum_t number, uintptr_t address, size_t length, int protection = 0, int flags = 0, int fd = -1) {
+	dserver_s2c_batch_op_t op;
+	memset(&op, 0, sizeof(op));
+	op.op = number;
+	op.fd = fd;
+	op.address = address;
+	op.length = length;
+	op.protection = protection;
+	op.flags = flags;
+	return op;
+};
+
+//
+// the "client": receives calls on its end of a socket pair, performs them, and replies
+//
+
+static void clientLoop(int socket) {
+	alignas(8) char buffer[sizeof(WideBatchCall)];
+	alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * DSERVER_S2C_BATCH_MAX_FDS)];
+
+	while (true) {
+		struct iovec iov = { buffer, sizeof(buffer) };
+		struct msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = &iov;
+		message.msg_iovlen = 1;
+		message.msg_control = control;
+		message.msg_controllen = sizeof(control);
+
+		auto size = recvmsg(socket, &message, 0);
+		CHECK(size >= 0);
+		if (size == 0) {
+			// we're done
+			return;
+		}
+		CHECK((message.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) == 0);
+
+		int fds[DSERVER_S2C_BATCH_MAX_FDS];
+		uint32_t fdCount = 0;
+		for (auto cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+				fdCount = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+				memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * fdCount);
+			}
+		}
+
+		auto header = reinterpret_cast<const dserver_s2c_callhdr_t*>(buffer);
+
+		if (header->s2c_number == dserver_s2c_msgnum_batch) {
+			auto call = reinterpret_cast<const dserver_s2c_call_batch_t*>(buffer);
+			dserver_s2c_reply_batch_t reply;
+			memset(&reply, 0, sizeof(reply));
+			reply.header.s2c_number = dserver_s2c_msgnum_batch;
+			CHECK(dserver_s2c_batch_perform(call, fds, fdCount, &reply, performOp, nullptr));
+			CHECK(send(socket, &reply, sizeof(reply), 0) == sizeof(reply));
+		} else {
+			CHECK(header->s2c_number == wideBatchNumber);
+			auto call = reinterpret_cast<const WideBatchCall*>(buffer);
+			WideBatchReply reply;
+			reply.header.s2c_number = static_cast<dserver_s2c_msgnum_t>(wideBatchNumber);
+			reply.op_count = 0;
+			for (uint32_t i = 0; i < call->op_count; ++i) {
+				performOp(nullptr, &call->ops[i], -1, &reply.results[i]);
+				++reply.op_count;
+				if (reply.results[i].errno_result != 0) {
+					break;
+				}
+			}
+			size_t replySize = offsetof(WideBatchReply, results) + sizeof(dserver_s2c_batch_result_t) * reply.op_count;
+			CHECK(send(socket, &reply, replySize, 0) == static_cast<ssize_t>(replySize));
+		}
+
+		for (uint32_t i = 0; i < fdCount; ++i) {
+			close(fds[i]);
+		}
+	}
+};
+
+//
+// the signalled "client": a thread that's busy with something else until the server sends it a signal
+//
+
+static int signalSocket = -1;
+
+// stands in for the client's S2C signal handler; this only uses async-signal-safe calls (except when a check fails)
+static void s2cSignalHandler(int signalNumber) {
+	int savedErrno = errno;
+
+	dserver_s2c_callhdr_t interrupt;
+	memset(&interrupt, 0, sizeof(interrupt));
+	interrupt.s2c_number = static_cast<dserver_s2c_msgnum_t>(interruptEnterNumber);
+	CHECK(send(signalSocket, &interrupt, sizeof(interrupt), 0) == sizeof(interrupt));
+
+	// now the server sends us the call, just like it would if we were already waiting for a reply
+	dserver_s2c_call_batch_t call;
+	CHECK(recv(signalSocket, &call, sizeof(call), 0) == sizeof(call));
+	CHECK(call.header.s2c_number == dserver_s2c_msgnum_batch);
+
+	dserver_s2c_reply_batch_t reply;
+	memset(&reply, 0, sizeof(reply));
+	reply.header.s2c_number = dserver_s2c_msgnum_batch;
+	CHECK(dserver_s2c_batch_perform(&call, nullptr, 0, &reply, performOp, nullptr));
+	CHECK(send(signalSocket, &reply, sizeof(reply), 0) == sizeof(reply));
+
+	interrupt.s2c_number = static_cast<dserver_s2c_msgnum_t>(interruptExitNumber);
+	CHECK(send(signalSocket, &interrupt, sizeof(interrupt), 0) == sizeof(interrupt));
+	CHECK(recv(signalSocket, &interrupt, sizeof(interrupt), 0) == sizeof(interrupt));
+
+	errno = savedErrno;
+};
+
+static void signalledClientLoop(int stopPipe) {
+	// the "user code" is blocked in a syscall that has nothing to do with the server, until we're told to stop
+	char byte;
+	while (read(stopPipe, &byte, 1) < 0) {
+		CHECK(errno == EINTR);
+	}
+};
+
+//
+// the "server" side
+//
+
+// performs the given operations through the client in batches (like `Thread::_s2cBatch`); returns how many were performed
+static size_t sendBatches(int socket, const std::vector<dserver_s2c_batch_op_t>& ops, std::vector<dserver_s2c_batch_result_t>& results, size_t* outExchanges = nullptr) {
+	size_t index = 0;
+	size_t exchanges = 0;
+
+	results.assign(ops.size(), dserver_s2c_batch_result_t {});
+
+	while (index < ops.size()) {
+		dserver_s2c_call_batch_t call;
+		int fds[DSERVER_S2C_BATCH_MAX_FDS];
+		uint32_t fdCount = 0;
+
+		memset(&call, 0, sizeof(call));
+		call.header.s2c_number = dserver_s2c_msgnum_batch;
+		uint32_t count = dserver_s2c_batch_pack(&call, &ops[index], ops.size() - index, fds, &fdCount);
+		CHECK(count > 0);
+
+		// like the server, we only reserve control space for the descriptors we actually attach
+		alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int) * DSERVER_S2C_BATCH_MAX_FDS)];
+		struct iovec iov = { &call, sizeof(call) };
+		struct msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = &iov;
+		message.msg_iovlen = 1;
+		if (fdCount > 0) {
+			message.msg_control = control;
+			message.msg_controllen = CMSG_SPACE(sizeof(int) * fdCount);
+			auto cmsg = CMSG_FIRSTHDR(&message);
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_RIGHTS;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fdCount);
+			memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fdCount);
+		}
+		CHECK(sendmsg(socket, &message, 0) == sizeof(call));
+
+		dserver_s2c_reply_batch_t reply;
+		CHECK(recv(socket, &reply, sizeof(reply), 0) == sizeof(reply));
+		++exchanges;
+
+		CHECK(reply.op_count <= count);
+		for (uint32_t i = 0; i < reply.op_count; ++i) {
+			results[index + i] = reply.results[i];
+		}
+
+		if (reply.op_count < count || (reply.op_count > 0 && reply.results[reply.op_count - 1].errno_result != 0)) {
+			index += reply.op_count;
+			break;
+		}
+
+		index += count;
+	}
+
+	if (outExchanges) {
+		*outExchanges = exchanges;
+	}
+
+	return index;
+};
+
+static void sendWideBatch(int socket, const std::vector<dserver_s2c_batch_op_t>& ops) {
+	WideBatchCall call;
+	call.header.s2c_number = static_cast<dserver_s2c_msgnum_t>(wideBatchNumber);
+	call.op_count = ops.size();
+	std::copy(ops.begin(), ops.end(), call.ops);
+
+	size_t callSize = offsetof(WideBatchCall, ops) + sizeof(dserver_s2c_batch_op_t) * ops.size();
+	CHECK(send(socket, &call, callSize, 0) == static_cast<ssize_t>(callSize));
+
+	WideBatchReply reply;
+	CHECK(recv(socket, &reply, sizeof(reply), 0) >= static_cast<ssize_t>(offsetof(WideBatchReply, results)));
+	CHECK(reply.op_count == ops.size());
+};
+
+//
+// checks
+//
+
+static void testPack() {
+	dserver_s2c_call_batch_t call;
+	int fds[DSERVER_S2C_BATCH_MAX_FDS];
+	uint32_t fdCount = 0;
+
+	// 10 operations, 6 of which need a descriptor: the first batch is cut off by the operation limit (with 4 descriptors),
+	// and the second one gets the rest
+	std::vector<dserver_s2c_batch_op_t> ops;
+	for (int i = 0; i < 10; ++i) {
+		bool withFD = (i % 2) == 0 || i == 9;
+		ops.push_back(makeOp(dserver_s2c_msgnum_mmap, 0, pageSize, PROT_READ, MAP_SHARED, withFD ? 100 + i : -1));
+	}
+
+	CHECK(dserver_s2c_batch_pack(&call, ops.data(), ops.size(), fds, &fdCount) == DSERVER_S2C_BATCH_MAX_OPS);
+	CHECK(call.op_count == DSERVER_S2C_BATCH_MAX_OPS);
+	CHECK(fdCount == 4);
+	CHECK(fds[0] == 100 && fds[1] == 102 && fds[2] == 104 && fds[3] == 106);
+	CHECK(call.ops[0].fd == 0 && call.ops[1].fd == -1 && call.ops[2].fd == 1 && call.ops[6].fd == 3 && call.ops[7].fd == -1);
+
+	CHECK(dserver_s2c_batch_pack(&call, &ops[8], 2, fds, &fdCount) == 2);
+	CHECK(fdCount == 2 && fds[0] == 108 && fds[1] == 109);
+	CHECK(call.ops[0].fd == 0 && call.ops[1].fd == 1);
+
+	// 5 operations that all need a descriptor: the descriptor limit cuts off the first batch
+	ops.clear();
+	for (int i = 0; i < 5; ++i) {
+		ops.push_back(makeOp(dserver_s2c_msgnum_mmap, 0, pageSize, PROT_READ, MAP_SHARED, 200 + i));
+	}
+	CHECK(dserver_s2c_batch_pack(&call, ops.data(), ops.size(), fds, &fdCount) == DSERVER_S2C_BATCH_MAX_FDS);
+	CHECK(fdCount == DSERVER_S2C_BATCH_MAX_FDS);
+	CHECK(dserver_s2c_batch_pack(&call, &ops[4], 1, fds, &fdCount) == 1);
+	CHECK(fdCount == 1 && fds[0] == 204);
+
+	// descriptors are only attached for mmap
+	ops.clear();
+	ops.push_back(makeOp(dserver_s2c_msgnum_munmap, 0x1000, pageSize, 0, 0, 300));
+	CHECK(dserver_s2c_batch_pack(&call, ops.data(), ops.size(), fds, &fdCount) == 1);
+	CHECK(fdCount == 0 && call.ops[0].fd == -1);
+
+	CHECK(dserver_s2c_batch_pack(&call, ops.data(), 0, fds, &fdCount) == 0);
+};
+
+static void testPerform() {
+	auto page = static_cast<char*>(mmap(NULL, 2 * pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+	CHECK(page != MAP_FAILED);
+
+	// the third operation fails (a misaligned munmap), so the fourth one is never performed
+	dserver_s2c_call_batch_t call;
+	memset(&call, 0, sizeof(call));
+	call.op_count = 4;
+	call.ops[0] = makeOp(dserver_s2c_msgnum_mprotect, reinterpret_cast<uintptr_t>(page), pageSize, PROT_READ);
+	call.ops[1] = makeOp(dserver_s2c_msgnum_msync, reinterpret_cast<uintptr_t>(page), pageSize, 0, MS_ASYNC);
+	call.ops[2] = makeOp(dserver_s2c_msgnum_munmap, reinterpret_cast<uintptr_t>(page) + 1, pageSize);
+	call.ops[3] = makeOp(dserver_s2c_msgnum_munmap, reinterpret_cast<uintptr_t>(page) + pageSize, pageSize);
+
+	dserver_s2c_reply_batch_t reply;
+	memset(&reply, 0xcc, sizeof(reply));
+	CHECK(dserver_s2c_batch_perform(&call, nullptr, 0, &reply, performOp, nullptr));
+	CHECK(reply.op_count == 3);
+	CHECK(reply.results[0].errno_result == 0 && reply.results[0].return_value == 0);
+	CHECK(reply.results[1].errno_result == 0);
+	CHECK(reply.results[2].errno_result == EINVAL);
+	CHECK(reply.results[2].return_value == static_cast<uint64_t>(-1));
+
+	// the fourth one really wasn't performed: the second page is still mapped (and writable)
+	page[pageSize] = 1;
+
+	// malformed calls are rejected without performing anything
+	call.op_count = DSERVER_S2C_BATCH_MAX_OPS + 1;
+	CHECK(!dserver_s2c_batch_perform(&call, nullptr, 0, &reply, performOp, nullptr));
+
+	call.op_count = 2;
+	call.ops[0] = makeOp(dserver_s2c_msgnum_mprotect, reinterpret_cast<uintptr_t>(page) + pageSize, pageSize, PROT_NONE);
+	call.ops[1] = makeOp(dserver_s2c_msgnum_mmap, 0, pageSize, PROT_READ, MAP_SHARED, 1);
+	int fd = 0;
+	CHECK(!dserver_s2c_batch_perform(&call, &fd, 1, &reply, performOp, nullptr));
+	// (the mprotect would've made this fault)
+	page[pageSize] = 2;
+
+	munmap(page, 2 * pageSize);
+};
+
+// maps several memfds through the client in batches and checks that each mapping got the right descriptor
+static void testEndToEnd(int socket) {
+	static constexpr size_t memfdCount = 6;
+	std::vector<int> memfds;
+	std::vector<dserver_s2c_batch_op_t> ops;
+
+	for (size_t i = 0; i < memfdCount; ++i) {
+		int memfd = memfd_create("s2c-batch-bench", MFD_CLOEXEC);
+		CHECK(memfd >= 0);
+		CHECK(ftruncate(memfd, pageSize) == 0);
+		char marker = 'a' + i;
+		CHECK(pwrite(memfd, &marker, 1, 0) == 1);
+		memfds.push_back(memfd);
+
+		ops.push_back(makeOp(dserver_s2c_msgnum_mmap, 0, pageSize, PROT_READ, MAP_SHARED, memfd));
+		// something without a descriptor in between
+		ops.push_back(makeOp(dserver_s2c_msgnum_msync, 0, 0, 0, MS_ASYNC));
+	}
+
+	std::vector<dserver_s2c_batch_result_t> results;
+	size_t exchanges = 0;
+	CHECK(sendBatches(socket, ops, results, &exchanges) == ops.size());
+	// 12 operations with 6 descriptors: 8 operations (4 descriptors) and then the other 4
+	CHECK(exchanges == 2);
+
+	for (size_t i = 0; i < memfdCount; ++i) {
+		auto& result = results[2 * i];
+		CHECK(result.errno_result == 0);
+		CHECK(*reinterpret_cast<const char*>(result.return_value) == 'a' + static_cast<char>(i));
+		CHECK(munmap(reinterpret_cast<void*>(result.return_value), pageSize) == 0);
+		close(memfds[i]);
+	}
+
+	// a failure in the first batch stops everything after it
+	ops.clear();
+	ops.push_back(makeOp(dserver_s2c_msgnum_munmap, 1, pageSize));
+	for (size_t i = 0; i < DSERVER_S2C_BATCH_MAX_OPS; ++i) {
+		ops.push_back(makeOp(dserver_s2c_msgnum_msync, 0, 0, 0, MS_ASYNC));
+	}
+	CHECK(sendBatches(socket, ops, results, &exchanges) == 1);
+	CHECK(exchanges == 1);
+	CHECK(results[0].errno_result == EINVAL);
+};
+
+//
+// measurements
+//
+
+static void reportLatency(const char* name, std::vector<uint64_t>& samples) {
+	std::sort(samples.begin(), samples.end());
+
+	double total = 0;
+	for (auto sample: samples) {
+		total += sample;
+	}
+
+	printf("%-24s  %10.1f  %10.1f  %10.1f\n", name, total / samples.size(), static_cast<double>(samples[samples.size() / 2]), static_cast<double>(samples[(samples.size() * 99) / 100]));
+};
+
+// performs single mprotects inline (through the client blocked in `clientLoop`) and through a signalled client, alternating between the two
+static void measureS2CPaths(int inlineSocket, char* page, size_t rounds) {
+	int signalSockets[2];
+	CHECK(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, signalSockets) == 0);
+	signalSocket = signalSockets[1];
+
+	int stopPipe[2];
+	CHECK(pipe2(stopPipe, O_CLOEXEC) == 0);
+
+	// no SA_RESTART, like the client's handler; the loop retries the read itself
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = s2cSignalHandler;
+	sigemptyset(&action.sa_mask);
+	CHECK(sigaction(SIGRTMIN + 1, &action, NULL) == 0);
+
+	std::thread client(signalledClientLoop, stopPipe[0]);
+
+	std::vector<dserver_s2c_batch_result_t> results;
+	std::vector<uint64_t> inlineSamples(rounds);
+	std::vector<uint64_t> signalReplySamples(rounds);
+	std::vector<uint64_t> signalExitSamples(rounds);
+
+	for (size_t round = 0; round < rounds; ++round) {
+		std::vector<dserver_s2c_batch_op_t> ops { makeOp(dserver_s2c_msgnum_mprotect, reinterpret_cast<uintptr_t>(page), pageSize, (round % 2) ? (PROT_READ | PROT_WRITE) : PROT_READ) };
+
+		auto start = nowNs();
+		CHECK(sendBatches(inlineSocket, ops, results) == 1);
+		inlineSamples[round] = nowNs() - start;
+
+		start = nowNs();
+		CHECK(pthread_kill(client.native_handle(), SIGRTMIN + 1) == 0);
+
+		// wait for the green light
+		dserver_s2c_callhdr_t interrupt;
+		CHECK(recv(signalSockets[0], &interrupt, sizeof(interrupt), 0) == sizeof(interrupt));
+		CHECK(interrupt.s2c_number == interruptEnterNumber);
+
+		CHECK(sendBatches(signalSockets[0], ops, results) == 1);
+		signalReplySamples[round] = nowNs() - start;
+
+		CHECK(recv(signalSockets[0], &interrupt, sizeof(interrupt), 0) == sizeof(interrupt));
+		CHECK(interrupt.s2c_number == interruptExitNumber);
+		CHECK(send(signalSockets[0], &interrupt, sizeof(interrupt), 0) == sizeof(interrupt));
+		signalExitSamples[round] = nowNs() - start;
+	}
+
+	printf("%-24s  %10s  %10s  %10s\n", "single S2C operation", "mean (ns)", "p50 (ns)", "p99 (ns)");
+	reportLatency("inline", inlineSamples);
+	reportLatency("signal (until reply)", signalReplySamples);
+	reportLatency("signal (until exit)", signalExitSamples);
+
+	close(stopPipe[1]);
+	client.join();
+
+	signal(SIGRTMIN + 1, SIG_DFL);
+	close(stopPipe[0]);
+	close(signalSockets[0]);
+	close(signalSockets[1]);
+	signalSocket = -1;
+};
+
+int main(int argc, char** argv) {
+	size_t rounds = (argc > 1) ? strtoul(argv[1], NULL, 10) : 2000;
+
+	int sockets[2];
+	CHECK(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets) == 0);
+
+	std::thread client(clientLoop, sockets[1]);
+
+	testPack();
+	testPerform();
+	testEndToEnd(sockets[0]);
+
+	// each operation flips the protection of its own page
+	auto pages = static_cast<char*>(mmap(NULL, maximumOpCount * pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+	CHECK(pages != MAP_FAILED);
+
+	printf("%8s  %18s  %18s  %18s\n", "ops", "one by one (ns/op)", "capped (ns/op)", "uncapped (ns/op)");
+
+	for (size_t opCount = 1; opCount <= maximumOpCount; opCount *= 2) {
+		std::vector<dserver_s2c_batch_op_t> ops[2];
+		for (size_t i = 0; i < opCount; ++i) {
+			for (int flip = 0; flip < 2; ++flip) {
+				ops[flip].push_back(makeOp(dserver_s2c_msgnum_mprotect, reinterpret_cast<uintptr_t>(pages) + i * pageSize, pageSize, flip ? (PROT_READ | PROT_WRITE) : PROT_READ));
+			}
+		}
+
+		std::vector<dserver_s2c_batch_result_t> results;
+		uint64_t individualTotal = 0;
+		uint64_t cappedTotal = 0;
+		uint64_t uncappedTotal = 0;
+
+		for (size_t round = 0; round < rounds; ++round) {
+			auto& roundOps = ops[round % 2];
+
+			auto start = nowNs();
+			for (auto& op: roundOps) {
+				std::vector<dserver_s2c_batch_op_t> single { op };
+				CHECK(sendBatches(sockets[0], single, results) == 1);
+			}
+			individualTotal += nowNs() - start;
+
+			start = nowNs();
+			CHECK(sendBatches(sockets[0], roundOps, results) == opCount);
+			cappedTotal += nowNs() - start;
+
+			start = nowNs();
+			sendWideBatch(sockets[0], roundOps);
+			uncappedTotal += nowNs() - start;
+		}
+
+		auto perOp = [&](uint64_t total) {
+			return static_cast<double>(total) / (rounds * opCount);
+		};
+
+		printf("%8zu  %18.1f  %18.1f  %18.1f\n", opCount, perOp(individualTotal), perOp(cappedTotal), perOp(uncappedTotal));
+	}
+
+	printf("\n");
+	measureS2CPaths(sockets[0], pages, rounds);
+
+	shutdown(sockets[0], SHUT_WR);
+	client.join();
+
+	munmap(pages, maximumOpCount * pageSize);
+	close(sockets[0]);
+	close(sockets[1]);
+
+	return 0;
+};
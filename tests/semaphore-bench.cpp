@@ -0,0 +1,141 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2022 Darling developers
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//
+// semaphore-bench: measures dtape_semaphore round-trip latency, like the handshake in an S2C call
+//
+// usage: semaphore-bench [round trips]
+//
+// two microthreads (each on its own worker) ping-pong over a pair of semaphores, the way a thread making an S2C call and the
+// thread handling the reply hand off to each other. this is run three ways:
+//   * uncontended: a single microthread ups and then downs the same semaphore (the atomic fast path on its own).
+//   * immediate reply: the other side answers right away, so the down is usually satisfied while spinning.
+//   * delayed reply: the other side waits before answering (like a client taking a while to handle the call),
+//     so the down runs out of spins and has to suspend the microthread until it's woken up.
+// it prints the mean, median, and 99th percentile round trip for each; for the delayed reply, the delay itself is subtracted.
+//
+
+#include "dtape-test-support.hpp"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+// long enough that the waiting side gives up spinning
+static constexpr uint64_t replyDelayNs = 50 * 1000;
+
+static void waitFor(uint64_t durationNs) {
+	// busy-wait; sleeping would add the kernel's timer slack to every round trip
+	auto end = DTapeTest::nowNs() + durationNs;
+	while (DTapeTest::nowNs() < end);
+};
+
+static void report(const char* name, std::vector<uint64_t>& samples, uint64_t overheadNs) {
+	std::sort(samples.begin(), samples.end());
+
+	double total = 0;
+	for (auto sample: samples) {
+		total += sample;
+	}
+
+	auto adjust = [&](double value) {
+		return (value > overheadNs) ? (value - overheadNs) : 0.0;
+	};
+
+	printf("%-16s  %10.1f  %10.1f  %10.1f\n", name, adjust(total / samples.size()), adjust(samples[samples.size() / 2]), adjust(samples[(samples.size() * 99) / 100]));
+};
+
+static void runUncontended(size_t roundTrips) {
+	dtape_semaphore_t* semaphore = dtape_test_semaphore_create(0);
+	DTAPE_TEST_CHECK(semaphore != nullptr);
+
+	std::vector<uint64_t> samples(roundTrips);
+
+	for (size_t i = 0; i < roundTrips; ++i) {
+		auto start = DTapeTest::nowNs();
+		dtape_semaphore_up(semaphore);
+		DTAPE_TEST_CHECK(dtape_semaphore_down_simple(semaphore));
+		samples[i] = DTapeTest::nowNs() - start;
+	}
+
+	report("uncontended", samples, 0);
+
+	dtape_semaphore_destroy(semaphore);
+};
+
+static void runPingPong(size_t roundTrips, uint64_t delayNs) {
+	dtape_semaphore_t* ping = dtape_test_semaphore_create(0);
+	dtape_semaphore_t* pong = dtape_test_semaphore_create(0);
+	DTAPE_TEST_CHECK(ping != nullptr && pong != nullptr);
+
+	std::vector<uint64_t> samples(roundTrips);
+
+	std::thread responder([&]() {
+		DTapeTest::Microthread microthread;
+		microthread.enter();
+
+		for (size_t i = 0; i < roundTrips; ++i) {
+			DTAPE_TEST_CHECK(dtape_semaphore_down_simple(ping));
+			if (delayNs != 0) {
+				waitFor(delayNs);
+			}
+			dtape_semaphore_up(pong);
+		}
+
+		microthread.exit();
+	});
+
+	for (size_t i = 0; i < roundTrips; ++i) {
+		auto start = DTapeTest::nowNs();
+		dtape_semaphore_up(ping);
+		DTAPE_TEST_CHECK(dtape_semaphore_down_simple(pong));
+		samples[i] = DTapeTest::nowNs() - start;
+	}
+
+	responder.join();
+
+	report((delayNs == 0) ? "immediate reply" : "delayed reply", samples, delayNs);
+
+	dtape_semaphore_destroy(pong);
+	dtape_semaphore_destroy(ping);
+};
+
+int main(int argc, char** argv) {
+	size_t roundTrips = (argc > 1) ? strtoul(argv[1], NULL, 10) : 100000;
+
+	DTapeTest::init();
+	dtape_test_semaphore_init();
+
+	// this is the calling side of each round trip; the semaphores' locks are also meant to be taken by microthreads
+	DTapeTest::Microthread microthread;
+	microthread.enter();
+
+	printf("%-16s  %10s  %10s  %10s\n", "round trip", "mean (ns)", "p50 (ns)", "p99 (ns)");
+
+	runUncontended(roundTrips);
+	runPingPong(roundTrips, 0);
+	// every one of these takes at least the delay, so there are fewer of them
+	runPingPong(std::max<size_t>(roundTrips / 100, 100), replyDelayNs);
+
+	microthread.exit();
+
+	DTAPE_TEST_CHECK(DTapeTest::problemCount() == 0);
+
+	return 0;
+};
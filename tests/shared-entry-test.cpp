@@ -0,0 +1,232 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2022 Darling developers
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//
+// shared-entry-test: checks how a map's shared entries are trimmed, split, and released, and times lookups with many entries
+//
+// usage: shared-entry-test [maximum entry count]
+//
+// the first part removes pieces of a shared entry (its start, its end, and the middle) and maps a new entry over existing ones,
+// checking each resulting entry's address, size, and page offset (which must keep pointing at the same memfd pages),
+// and checks that a memfd is closed as soon as the last entry using it goes away (but not before).
+//
+// the second part fills a map with thousands of one-page entries (with gaps in between) and reports the cost of inserting them,
+// looking them up (both hits and misses), and removing them in random order. lookups are a single tree descent,
+// so the per-operation cost should grow only logarithmically with the entry count.
+//
+
+#include "dtape-test-support.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <random>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static const uint64_t pageSize = sysconf(_SC_PAGESIZE);
+static constexpr uint64_t base = 0x100000000ull;
+
+static bool isOpen(int fd) {
+	return fcntl(fd, F_GETFD) != -1 || errno != EBADF;
+};
+
+static int createMemfd(size_t pageCount) {
+	int memfd = memfd_create("shared-entry-test", MFD_CLOEXEC);
+	DTAPE_TEST_CHECK(memfd >= 0);
+	DTAPE_TEST_CHECK(ftruncate(memfd, pageCount * pageSize) == 0);
+	return memfd;
+};
+
+// checks that the entries in the map (in the region we use) are exactly the expected ones; addresses, sizes, and offsets are in pages
+static void expectEntries(dtape_map_t* map, std::vector<dtape_test_shared_entry_t> expected) {
+	dtape_test_shared_entry_t entries[8];
+	size_t count = dtape_test_map_find_shared_entries(map, base, 64 * pageSize, entries, 8);
+
+	DTAPE_TEST_CHECK(count == expected.size());
+	for (size_t i = 0; i < count; ++i) {
+		DTAPE_TEST_CHECK(entries[i].address == base + expected[i].address * pageSize);
+		DTAPE_TEST_CHECK(entries[i].size == expected[i].size * pageSize);
+		DTAPE_TEST_CHECK(entries[i].page_offset == expected[i].page_offset);
+		DTAPE_TEST_CHECK(entries[i].memfd == expected[i].memfd);
+	}
+};
+
+static void testTrimAndSplit() {
+	dtape_map_t* map = dtape_test_map_create(nullptr);
+	DTAPE_TEST_CHECK(map != nullptr);
+
+	int memfd = createMemfd(16);
+	auto descriptor = dtape_test_shared_descriptor_create(memfd, 16 * pageSize);
+	DTAPE_TEST_CHECK(descriptor != nullptr);
+	DTAPE_TEST_CHECK(dtape_test_map_insert_shared_entry(map, descriptor, base, 16 * pageSize, 0));
+	// from here on, only the entries keep the memfd alive
+	dtape_test_shared_descriptor_release(descriptor);
+
+	expectEntries(map, { { 0, 16, 0, memfd } });
+
+	// trim the start; the entry now starts 2 pages into the memfd
+	dtape_test_map_remove_shared_entries(map, base, 2 * pageSize);
+	expectEntries(map, { { 2, 14, 2, memfd } });
+
+	// trim the end (with a region that extends past it)
+	dtape_test_map_remove_shared_entries(map, base + 14 * pageSize, 4 * pageSize);
+	expectEntries(map, { { 2, 12, 2, memfd } });
+
+	// split it; the tail keeps pointing at the same memfd pages it did before
+	dtape_test_map_remove_shared_entries(map, base + 6 * pageSize, 2 * pageSize);
+	expectEntries(map, { { 2, 4, 2, memfd }, { 8, 6, 8, memfd } });
+
+	// removing a region that no entry overlaps does nothing
+	dtape_test_map_remove_shared_entries(map, base + 6 * pageSize, 2 * pageSize);
+	expectEntries(map, { { 2, 4, 2, memfd }, { 8, 6, 8, memfd } });
+
+	// mapping something over both entries replaces the overlapping parts
+	int otherMemfd = createMemfd(6);
+	auto otherDescriptor = dtape_test_shared_descriptor_create(otherMemfd, 6 * pageSize);
+	DTAPE_TEST_CHECK(otherDescriptor != nullptr);
+	DTAPE_TEST_CHECK(dtape_test_map_insert_shared_entry(map, otherDescriptor, base + 4 * pageSize, 6 * pageSize, 0));
+	dtape_test_shared_descriptor_release(otherDescriptor);
+	expectEntries(map, { { 2, 2, 2, memfd }, { 4, 6, 0, otherMemfd }, { 10, 4, 10, memfd } });
+
+	// lookups only return the entries that overlap the region
+	dtape_test_shared_entry_t found[4];
+	DTAPE_TEST_CHECK(dtape_test_map_find_shared_entries(map, base + 11 * pageSize, pageSize, found, 4) == 1);
+	DTAPE_TEST_CHECK(found[0].address == base + 10 * pageSize);
+	DTAPE_TEST_CHECK(dtape_test_map_find_shared_entries(map, base + 3 * pageSize, 2 * pageSize, found, 4) == 2);
+	DTAPE_TEST_CHECK(found[0].address == base + 2 * pageSize && found[1].address == base + 4 * pageSize);
+	DTAPE_TEST_CHECK(dtape_test_map_find_shared_entries(map, base, 2 * pageSize, found, 4) == 0);
+
+	// remove the whole middle entry (along with the adjacent parts of the others); its memfd goes with it
+	DTAPE_TEST_CHECK(isOpen(otherMemfd));
+	dtape_test_map_remove_shared_entries(map, base + 3 * pageSize, 8 * pageSize);
+	expectEntries(map, { { 2, 1, 2, memfd }, { 11, 3, 11, memfd } });
+	DTAPE_TEST_CHECK(!isOpen(otherMemfd));
+
+	// the first memfd is still in use by both remaining entries
+	dtape_test_map_remove_shared_entries(map, base, 4 * pageSize);
+	expectEntries(map, { { 11, 3, 11, memfd } });
+	DTAPE_TEST_CHECK(isOpen(memfd));
+
+	dtape_test_map_remove_shared_entries(map, base, 16 * pageSize);
+	expectEntries(map, {});
+	DTAPE_TEST_CHECK(!isOpen(memfd));
+
+	// destroying a map releases whatever entries it still has
+	memfd = createMemfd(4);
+	descriptor = dtape_test_shared_descriptor_create(memfd, 4 * pageSize);
+	DTAPE_TEST_CHECK(descriptor != nullptr);
+	DTAPE_TEST_CHECK(dtape_test_map_insert_shared_entry(map, descriptor, base, 4 * pageSize, 0));
+	dtape_test_shared_descriptor_release(descriptor);
+	dtape_test_map_remove_shared_entries(map, base + pageSize, pageSize);
+	DTAPE_TEST_CHECK(isOpen(memfd));
+
+	dtape_test_map_destroy(map);
+	DTAPE_TEST_CHECK(!isOpen(memfd));
+};
+
+static void benchmark(size_t entryCount) {
+	dtape_map_t* map = dtape_test_map_create(nullptr);
+	DTAPE_TEST_CHECK(map != nullptr);
+
+	// every entry shares one memfd (so we don't run out of descriptors); nothing is actually mapped, so it doesn't need a size
+	int memfd = memfd_create("shared-entry-test", MFD_CLOEXEC);
+	DTAPE_TEST_CHECK(memfd >= 0);
+	auto descriptor = dtape_test_shared_descriptor_create(memfd, entryCount * pageSize);
+	DTAPE_TEST_CHECK(descriptor != nullptr);
+
+	// entry `i` is the page at `base + 2 * i` pages
+	auto entryAddress = [](size_t i) {
+		return base + 2 * i * pageSize;
+	};
+
+	std::vector<size_t> order(entryCount);
+	for (size_t i = 0; i < entryCount; ++i) {
+		order[i] = i;
+	}
+	std::minstd_rand random(entryCount);
+	std::shuffle(order.begin(), order.end(), random);
+
+	auto start = DTapeTest::nowNs();
+	for (size_t i: order) {
+		DTAPE_TEST_CHECK(dtape_test_map_insert_shared_entry(map, descriptor, entryAddress(i), pageSize, i));
+	}
+	double insertNs = static_cast<double>(DTapeTest::nowNs() - start) / entryCount;
+
+	dtape_test_shared_descriptor_release(descriptor);
+
+	static constexpr size_t lookupCount = 100000;
+	dtape_test_shared_entry_t found;
+
+	start = DTapeTest::nowNs();
+	for (size_t j = 0; j < lookupCount; ++j) {
+		size_t i = order[j % entryCount];
+		DTAPE_TEST_CHECK(dtape_test_map_find_shared_entries(map, entryAddress(i), pageSize, &found, 1) == 1);
+		DTAPE_TEST_CHECK(found.page_offset == i);
+	}
+	double hitNs = static_cast<double>(DTapeTest::nowNs() - start) / lookupCount;
+
+	start = DTapeTest::nowNs();
+	for (size_t j = 0; j < lookupCount; ++j) {
+		// the gap just after the entry
+		DTAPE_TEST_CHECK(dtape_test_map_find_shared_entries(map, entryAddress(order[j % entryCount]) + pageSize, pageSize, &found, 1) == 0);
+	}
+	double missNs = static_cast<double>(DTapeTest::nowNs() - start) / lookupCount;
+
+	std::shuffle(order.begin(), order.end(), random);
+
+	start = DTapeTest::nowNs();
+	for (size_t i: order) {
+		dtape_test_map_remove_shared_entries(map, entryAddress(i), pageSize);
+	}
+	double removeNs = static_cast<double>(DTapeTest::nowNs() - start) / entryCount;
+
+	DTAPE_TEST_CHECK(dtape_test_map_find_shared_entries(map, base, entryAddress(entryCount), &found, 1) == 0);
+	DTAPE_TEST_CHECK(!isOpen(memfd));
+
+	printf("%10zu  %12.1f  %12.1f  %12.1f  %12.1f\n", entryCount, insertNs, hitNs, missNs, removeNs);
+
+	dtape_test_map_destroy(map);
+};
+
+int main(int argc, char** argv) {
+	size_t maximumEntryCount = (argc > 1) ? strtoul(argv[1], NULL, 10) : 100000;
+
+	DTapeTest::init();
+
+	// the maps' locks are meant to be taken by microthreads
+	DTapeTest::Microthread microthread;
+	microthread.enter();
+
+	testTrimAndSplit();
+
+	printf("%10s  %12s  %12s  %12s  %12s\n", "entries", "insert (ns)", "hit (ns)", "miss (ns)", "remove (ns)");
+
+	for (size_t entryCount = 1000; entryCount <= maximumEntryCount; entryCount *= 10) {
+		benchmark(entryCount);
+	}
+
+	microthread.exit();
+
+	DTAPE_TEST_CHECK(DTapeTest::problemCount() == 0);
+
+	return 0;
+};
@@ -0,0 +1,132 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2022 Darling developers
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//
+// thread-lifecycle-bench: measures thread creation/teardown throughput with eagerly and lazily created S2C semaphores
+//
+// usage: thread-lifecycle-bench [threads]
+//
+// every server thread has a set of four S2C semaphores (see `Thread::_getS2CSemaphores`). they used to be created along with
+// the thread; now they're only created when the thread first performs an S2C call. this creates and tears down duct-taped threads
+// the way the server does for short-lived client threads, once creating the semaphores for every thread (eager)
+// and then only for the given fraction of threads (lazy), and reports the throughput and cost per thread of each.
+//
+// note that the test glue's threads are much cheaper to create than real ones (they skip the IPC and task setup),
+// so the difference here is the absolute amount saved per thread, not the relative speedup the server sees.
+//
+
+#include "dtape-test-support.hpp"
+
+#include <algorithm>
+#include <vector>
+
+struct S2CSemaphores {
+	dtape_semaphore_t* perform;
+	dtape_semaphore_t* reply;
+	dtape_semaphore_t* interruptEnter;
+	dtape_semaphore_t* interruptExit;
+};
+
+static void createSemaphores(S2CSemaphores& semaphores) {
+	// same initial values as Thread::_getS2CSemaphores
+	semaphores.perform = dtape_test_semaphore_create(1);
+	semaphores.reply = dtape_test_semaphore_create(0);
+	semaphores.interruptEnter = dtape_test_semaphore_create(0);
+	semaphores.interruptExit = dtape_test_semaphore_create(0);
+	DTAPE_TEST_CHECK(semaphores.perform && semaphores.reply && semaphores.interruptEnter && semaphores.interruptExit);
+};
+
+static void destroySemaphores(S2CSemaphores& semaphores) {
+	dtape_semaphore_destroy(semaphores.perform);
+	dtape_semaphore_destroy(semaphores.reply);
+	dtape_semaphore_destroy(semaphores.interruptEnter);
+	dtape_semaphore_destroy(semaphores.interruptExit);
+};
+
+// creates and destroys `count` threads (in batches, so that several are alive at once like in a real process);
+// every `s2cInterval`th thread gets semaphores (0 means none do). returns the cost per thread in ns.
+static double run(size_t count, size_t s2cInterval) {
+	static constexpr size_t batchSize = 64;
+
+	std::vector<dtape_thread_t*> threads(batchSize);
+	std::vector<S2CSemaphores> semaphores(batchSize);
+	std::vector<bool> hasSemaphores(batchSize);
+
+	auto start = DTapeTest::nowNs();
+
+	for (size_t created = 0; created < count; created += batchSize) {
+		size_t batch = std::min(batchSize, count - created);
+
+		for (size_t i = 0; i < batch; ++i) {
+			threads[i] = dtape_test_thread_create(nullptr);
+			DTAPE_TEST_CHECK(threads[i] != nullptr);
+
+			hasSemaphores[i] = s2cInterval != 0 && ((created + i) % s2cInterval) == 0;
+			if (hasSemaphores[i]) {
+				createSemaphores(semaphores[i]);
+			}
+		}
+
+		for (size_t i = 0; i < batch; ++i) {
+			if (hasSemaphores[i]) {
+				destroySemaphores(semaphores[i]);
+			}
+			dtape_test_thread_destroy(threads[i]);
+		}
+	}
+
+	return static_cast<double>(DTapeTest::nowNs() - start) / count;
+};
+
+int main(int argc, char** argv) {
+	size_t count = (argc > 1) ? strtoul(argv[1], NULL, 10) : 1000000;
+
+	DTapeTest::init();
+	dtape_test_semaphore_init();
+
+	// creating and destroying semaphores takes the owning task's lock, which is meant to be taken by microthreads
+	DTapeTest::Microthread microthread;
+	microthread.enter();
+
+	// warm up the zones so that the first run doesn't pay for growing them
+	run(count / 10 + 1, 1);
+
+	printf("%-24s  %14s  %16s\n", "semaphores", "ns per thread", "threads per sec");
+
+	struct {
+		const char* name;
+		size_t s2cInterval;
+	} const modes[] = {
+		{ "eager", 1 },
+		{ "lazy, 1 in 10 use S2C", 10 },
+		{ "lazy, 1 in 100 use S2C", 100 },
+		{ "lazy, none use S2C", 0 },
+	};
+
+	for (auto& mode: modes) {
+		double perThread = run(count, mode.s2cInterval);
+		printf("%-24s  %14.1f  %16.0f\n", mode.name, perThread, 1e9 / perThread);
+	}
+
+	microthread.exit();
+
+	DTAPE_TEST_CHECK(DTapeTest::problemCount() == 0);
+
+	return 0;
+};
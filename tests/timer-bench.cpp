@@ -0,0 +1,134 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2022 Darling developers
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//
+// timer-bench: measures the cost of arming, re-arming, cancelling, and expiring XNU timer calls with 10^3 to 10^6 of them pending
+//
+// usage: timer-bench [maximum timer count]
+//
+// all the duct-tape's timer calls share one mpqueue, which keeps them in a pairing heap ordered by deadline (see `duct-tape/src/timer.c`).
+// if that holds up, the per-operation cost should only grow logarithmically with the number of pending timers (a sorted list would grow linearly).
+// the timers are armed with shuffled deadlines far in the future (so nothing expires while we're measuring), re-armed with new shuffled deadlines,
+// and cancelled in shuffled order; then they're all armed with deadlines in the past and expired in a single pass.
+// it also reports how often the server's timer would have been re-armed per operation (each of those is a `timerfd_settime` in the server).
+//
+
+#include "dtape-test-support.hpp"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+static void countExpiry(void* context) {
+	++*static_cast<size_t*>(context);
+};
+
+static void run(size_t count, std::mt19937_64& random) {
+	static constexpr uint64_t futureOffset = 3600ull * 1000000000ull;
+	static constexpr uint64_t deadlineSpread = 1000000000ull;
+
+	size_t expired = 0;
+	std::vector<dtape_test_timer_t*> timers(count);
+	std::vector<uint64_t> deadlines(count);
+	std::vector<size_t> order(count);
+
+	for (size_t i = 0; i < count; ++i) {
+		timers[i] = dtape_test_timer_create(countExpiry, &expired);
+		DTAPE_TEST_CHECK(timers[i] != nullptr);
+		order[i] = i;
+	}
+
+	auto shuffleDeadlines = [&](uint64_t base) {
+		for (auto& deadline: deadlines) {
+			deadline = base + (random() % deadlineSpread);
+		}
+	};
+
+	// arm
+	shuffleDeadlines(DTapeTest::nowNs() + futureOffset);
+	uint64_t armsBefore = DTapeTest::timerArmCount();
+	uint64_t start = DTapeTest::nowNs();
+	for (size_t i = 0; i < count; ++i) {
+		dtape_test_timer_arm(timers[i], deadlines[i]);
+	}
+	double armCost = static_cast<double>(DTapeTest::nowNs() - start) / count;
+	double armsPerArm = static_cast<double>(DTapeTest::timerArmCount() - armsBefore) / count;
+	DTAPE_TEST_CHECK(dtape_timer_pending_count() == count);
+
+	// re-arm (each timer is already pending, so it has to be moved)
+	shuffleDeadlines(DTapeTest::nowNs() + futureOffset);
+	start = DTapeTest::nowNs();
+	for (size_t i = 0; i < count; ++i) {
+		DTAPE_TEST_CHECK(dtape_test_timer_arm(timers[i], deadlines[i]));
+	}
+	double rearmCost = static_cast<double>(DTapeTest::nowNs() - start) / count;
+	DTAPE_TEST_CHECK(dtape_timer_pending_count() == count);
+
+	// cancel, in an order that has nothing to do with the deadlines
+	std::shuffle(order.begin(), order.end(), random);
+	armsBefore = DTapeTest::timerArmCount();
+	start = DTapeTest::nowNs();
+	for (size_t i = 0; i < count; ++i) {
+		DTAPE_TEST_CHECK(dtape_test_timer_cancel(timers[order[i]]));
+	}
+	double cancelCost = static_cast<double>(DTapeTest::nowNs() - start) / count;
+	double armsPerCancel = static_cast<double>(DTapeTest::timerArmCount() - armsBefore) / count;
+	DTAPE_TEST_CHECK(dtape_timer_pending_count() == 0);
+
+	// expire: everything is already due, so a single pass should get all of them
+	uint64_t now = DTapeTest::nowNs();
+	for (size_t i = 0; i < count; ++i) {
+		dtape_test_timer_arm(timers[i], now - 1 - (random() % (now / 2)));
+	}
+	start = DTapeTest::nowNs();
+	dtape_timer_fired();
+	double expireCost = static_cast<double>(DTapeTest::nowNs() - start) / count;
+	DTAPE_TEST_CHECK(expired == count);
+	DTAPE_TEST_CHECK(dtape_timer_pending_count() == 0);
+
+	printf("%8zu  %10.1f  %10.1f  %10.1f  %10.1f  %12.3f  %12.3f\n", count, armCost, rearmCost, cancelCost, expireCost, armsPerArm, armsPerCancel);
+
+	for (auto timer: timers) {
+		dtape_test_timer_destroy(timer);
+	}
+};
+
+int main(int argc, char** argv) {
+	size_t maximumCount = (argc > 1) ? strtoul(argv[1], NULL, 10) : 1000000;
+	std::mt19937_64 random(42);
+
+	DTapeTest::init();
+	dtape_test_timer_init();
+
+	// the timer queue's locks are meant to be taken by microthreads
+	DTapeTest::Microthread microthread;
+	microthread.enter();
+
+	printf("%8s  %10s  %10s  %10s  %10s  %12s  %12s\n", "timers", "arm (ns)", "re-arm (ns)", "cancel (ns)", "expire (ns)", "arms/arm", "arms/cancel");
+
+	for (size_t count = 1000; count <= maximumCount; count *= 10) {
+		run(count, random);
+	}
+
+	microthread.exit();
+
+	DTAPE_TEST_CHECK(DTapeTest::problemCount() == 0);
+
+	return 0;
+};
@@ -0,0 +1,79 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2022 Darling developers
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//
+// dserver-callstats: prints a running darlingserver's per-call-type statistics
+//
+// usage: dserver-callstats [--prefix <prefix>]
+//
+// like dserver-logctl, this must be run outside the container by root or by the user running darlingserver.
+//
+
+#include "unmanaged-call.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+
+int main(int argc, char** argv) {
+	std::string prefix = DarlingServerTools::defaultPrefix();
+
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--prefix") == 0 && i + 1 < argc) {
+			prefix = argv[++i];
+		} else {
+			fprintf(stderr, "Usage: %s [--prefix <prefix>]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	// the server writes the whole report before replying, so give it a memfd rather than a pipe (which could fill up)
+	int output = memfd_create("dserver-callstats", MFD_CLOEXEC);
+	if (output < 0) {
+		perror("memfd_create");
+		return 1;
+	}
+
+	dserver_rpc_call_call_stats_dump_t call;
+	memset(&call, 0, sizeof(call));
+	call.header.number = dserver_callnum_call_stats_dump;
+	call.body.output_fd = 0; // index of the descriptor in the message
+
+	int code = DarlingServerTools::performUnmanagedCall(prefix, &call, sizeof(call), output);
+
+	if (code == EPERM) {
+		fprintf(stderr, "Permission denied; run this outside the container as root or as the user running darlingserver\n");
+		return 1;
+	} else if (code != 0) {
+		fprintf(stderr, "Failed to get call statistics: %s\n", strerror((code < 0) ? -code : code));
+		return 1;
+	}
+
+	char buffer[4096];
+	ssize_t count;
+	lseek(output, 0, SEEK_SET);
+	while ((count = read(output, buffer, sizeof(buffer))) > 0) {
+		fwrite(buffer, 1, count, stdout);
+	}
+
+	close(output);
+	return 0;
+};
@@ -0,0 +1,100 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2022 Darling developers
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//
+// dserver-logctl: changes a running darlingserver's logging settings
+//
+// usage: dserver-logctl [--prefix <prefix>] <spec>
+//
+// the spec is a comma-separated list of settings, e.g. `info,kqchan=debug,s2c=debug,stderr=on`
+// (see `Log::configure` for the full syntax). the prefix defaults to $DPREFIX or ~/.darling.
+//
+// this talks to the server directly over its socket as an unmanaged caller, so it must be run outside the container
+// by root or by the user running darlingserver.
+//
+
+#include "unmanaged-call.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+
+static int sendSpec(const std::string& prefix, const std::string& spec) {
+	int pipeFDs[2];
+	if (pipe(pipeFDs) < 0) {
+		return -errno;
+	}
+
+	// the server reads the spec until EOF, so write it all and close our end before making the call
+	// (specs are tiny, so this won't fill up the pipe)
+	if (write(pipeFDs[1], spec.data(), spec.size()) != (ssize_t)spec.size()) {
+		int err = errno;
+		close(pipeFDs[0]);
+		close(pipeFDs[1]);
+		return -err;
+	}
+	close(pipeFDs[1]);
+
+	dserver_rpc_call_log_control_t call;
+	memset(&call, 0, sizeof(call));
+	call.header.number = dserver_callnum_log_control;
+	call.body.spec_pipe = 0; // index of the descriptor in the message
+
+	int code = DarlingServerTools::performUnmanagedCall(prefix, &call, sizeof(call), pipeFDs[0]);
+	close(pipeFDs[0]);
+	return code;
+};
+
+int main(int argc, char** argv) {
+	std::string prefix = DarlingServerTools::defaultPrefix();
+	const char* spec = nullptr;
+
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--prefix") == 0 && i + 1 < argc) {
+			prefix = argv[++i];
+		} else if (!spec) {
+			spec = argv[i];
+		} else {
+			spec = nullptr;
+			break;
+		}
+	}
+
+	if (!spec) {
+		fprintf(stderr, "Usage: %s [--prefix <prefix>] <spec>\n", argv[0]);
+		fprintf(stderr, "  e.g. %s info,kqchan=debug,calls=default,stderr=on\n", argv[0]);
+		return 1;
+	}
+
+	int code = sendSpec(prefix, spec);
+
+	if (code == EINVAL) {
+		fprintf(stderr, "Invalid logging spec: %s\n", spec);
+		return 1;
+	} else if (code == EPERM) {
+		fprintf(stderr, "Permission denied; run this outside the container as root or as the user running darlingserver\n");
+		return 1;
+	} else if (code != 0) {
+		fprintf(stderr, "Failed to update logging settings: %s\n", strerror((code < 0) ? -code : code));
+		return 1;
+	}
+
+	return 0;
+};
@@ -0,0 +1,223 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2022 Darling developers
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+//
+// dserver-trace-decode: turns darlingserver trace dumps into text or Chrome trace-event JSON
+//
+// usage: dserver-trace-decode [--json] <dump-file>
+//
+// the JSON output can be loaded into chrome://tracing or Perfetto. each microthread becomes a Chrome "thread" (grouped by process);
+// calls and S2C calls become duration events and everything else becomes an instant event.
+//
+
+#include <darlingserver/trace-format.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+static const char* eventName(uint16_t type) {
+	switch (type) {
+		case dserver_trace_event_type_call_start: return "call-start";
+		case dserver_trace_event_type_call_end: return "call-end";
+		case dserver_trace_event_type_microthread_suspend: return "microthread-suspend";
+		case dserver_trace_event_type_microthread_resume: return "microthread-resume";
+		case dserver_trace_event_type_s2c_begin: return "s2c-begin";
+		case dserver_trace_event_type_s2c_end: return "s2c-end";
+		case dserver_trace_event_type_kqchan_notify: return "kqchan-notify";
+		case dserver_trace_event_type_timer_fire: return "timer-fire";
+		default: return "unknown";
+	}
+};
+
+static const char* argName(uint16_t type) {
+	switch (type) {
+		case dserver_trace_event_type_call_start:
+		case dserver_trace_event_type_call_end:
+			return "call";
+		case dserver_trace_event_type_s2c_begin:
+		case dserver_trace_event_type_s2c_end:
+			return "s2c";
+		case dserver_trace_event_type_kqchan_notify:
+			return "notification";
+		case dserver_trace_event_type_timer_fire:
+			return "expirations";
+		default:
+			return nullptr;
+	}
+};
+
+static bool readDump(const char* path, dserver_trace_header_t& header, std::vector<dserver_trace_event_t>& events) {
+	std::ifstream file(path, std::ios::binary);
+
+	if (!file) {
+		std::cerr << "Failed to open " << path << std::endl;
+		return false;
+	}
+
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+		std::cerr << "Truncated trace header" << std::endl;
+		return false;
+	}
+
+	if (memcmp(header.magic, DSERVER_TRACE_MAGIC, sizeof(DSERVER_TRACE_MAGIC)) != 0) {
+		std::cerr << path << " is not a darlingserver trace dump" << std::endl;
+		return false;
+	}
+
+	if (header.version != DSERVER_TRACE_VERSION) {
+		std::cerr << "Unsupported trace version " << header.version << " (expected " << DSERVER_TRACE_VERSION << ")" << std::endl;
+		return false;
+	}
+
+	for (uint32_t i = 0; i < header.ring_count; ++i) {
+		dserver_trace_ring_header_t ringHeader;
+
+		if (!file.read(reinterpret_cast<char*>(&ringHeader), sizeof(ringHeader))) {
+			std::cerr << "Truncated ring header (ring " << i << ")" << std::endl;
+			return false;
+		}
+
+		size_t oldSize = events.size();
+		events.resize(oldSize + ringHeader.event_count);
+
+		if (!file.read(reinterpret_cast<char*>(&events[oldSize]), ringHeader.event_count * sizeof(dserver_trace_event_t))) {
+			std::cerr << "Truncated events (ring " << ringHeader.ring_index << ")" << std::endl;
+			return false;
+		}
+	}
+
+	// rings may have been torn by a concurrent writer during the dump; drop anything that doesn't look like a valid event
+	events.erase(std::remove_if(events.begin(), events.end(), [](const dserver_trace_event_t& event) {
+		return event.type == dserver_trace_event_type_invalid || event.type > dserver_trace_event_type_timer_fire;
+	}), events.end());
+
+	std::stable_sort(events.begin(), events.end(), [](const dserver_trace_event_t& a, const dserver_trace_event_t& b) {
+		return a.timestamp < b.timestamp;
+	});
+
+	return true;
+};
+
+static void printText(const dserver_trace_header_t& header, const std::vector<dserver_trace_event_t>& events) {
+	printf("# dump taken at monotonic %" PRIu64 "ns; %zu events\n", header.monotonic_time, events.size());
+
+	for (const auto& event: events) {
+		// show times relative to the dump so it's easy to see how long before the dump (or crash) something happened
+		double relative = ((double)event.timestamp - (double)header.monotonic_time) / 1e6;
+		auto name = argName(event.type);
+
+		printf("%+14.3fms ring=%-3" PRIu32 " pid=%-7" PRId32 " tid=%-7" PRId32 " %-20s", relative, event.ring_index, event.pid, event.tid, eventName(event.type));
+
+		if (name) {
+			printf(" %s=%" PRIu64, name, event.arg);
+		}
+
+		printf("\n");
+	}
+};
+
+static void printJSON(const dserver_trace_header_t& header, const std::vector<dserver_trace_event_t>& events) {
+	uint64_t base = events.empty() ? header.monotonic_time : events.front().timestamp;
+	bool first = true;
+
+	printf("{\"displayTimeUnit\":\"ns\",\"otherData\":{\"monotonicTime\":%" PRIu64 ",\"realtimeTime\":%" PRIu64 "},\"traceEvents\":[\n", header.monotonic_time, header.realtime_time);
+
+	for (const auto& event: events) {
+		const char* phase = "i";
+		const char* name = eventName(event.type);
+
+		switch (event.type) {
+			case dserver_trace_event_type_call_start:
+			case dserver_trace_event_type_s2c_begin:
+				phase = "B";
+				break;
+			case dserver_trace_event_type_call_end:
+			case dserver_trace_event_type_s2c_end:
+				phase = "E";
+				break;
+		}
+
+		// B/E pairs must have the same name to be matched up
+		if (event.type == dserver_trace_event_type_call_start || event.type == dserver_trace_event_type_call_end) {
+			name = "call";
+		} else if (event.type == dserver_trace_event_type_s2c_begin || event.type == dserver_trace_event_type_s2c_end) {
+			name = "s2c";
+		}
+
+		// key everything by microthread rather than by ring: a microthread can be suspended on one worker and resumed on another,
+		// so a call's begin and end may be recorded on different rings, but they'll always be recorded for the same microthread
+		printf("%s{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":%" PRId32 ",\"tid\":%" PRId32, first ? "" : ",\n", name, phase, (double)(event.timestamp - base) / 1e3, event.pid, event.tid);
+
+		if (phase[0] == 'i') {
+			printf(",\"s\":\"t\"");
+		}
+
+		printf(",\"args\":{\"ring\":%" PRIu32, event.ring_index);
+
+		if (auto arg = argName(event.type)) {
+			printf(",\"%s\":%" PRIu64, arg, event.arg);
+		}
+
+		printf("}}");
+		first = false;
+	}
+
+	printf("\n]}\n");
+};
+
+int main(int argc, char** argv) {
+	bool json = false;
+	const char* path = nullptr;
+
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--json") == 0) {
+			json = true;
+		} else if (!path) {
+			path = argv[i];
+		} else {
+			path = nullptr;
+			break;
+		}
+	}
+
+	if (!path) {
+		std::cerr << "Usage: " << argv[0] << " [--json] <dump-file>" << std::endl;
+		return 1;
+	}
+
+	dserver_trace_header_t header;
+	std::vector<dserver_trace_event_t> events;
+
+	if (!readDump(path, header, events)) {
+		return 1;
+	}
+
+	if (json) {
+		printJSON(header, events);
+	} else {
+		printText(header, events);
+	}
+
+	return 0;
+};
@@ -0,0 +1,128 @@
+/**
+ * This file is part of Darling.
+ *
+ * Copyright (C) 2022 Darling developers
+ *
+ * Darling is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Darling is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Darling.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _DARLINGSERVER_TOOLS_UNMANAGED_CALL_HPP_
+#define _DARLINGSERVER_TOOLS_UNMANAGED_CALL_HPP_
+
+//
+// helpers for the darlingserver administration tools, which talk to the server directly over its socket as unmanaged callers
+// (i.e. without the client-side RPC wrappers, which expect to be running inside the container)
+//
+
+#include <darlingserver/rpc.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace DarlingServerTools {
+	static inline std::string defaultPrefix() {
+		if (auto prefix = getenv("DPREFIX")) {
+			return prefix;
+		}
+
+		auto home = getenv("HOME");
+		return std::string(home ? home : "") + "/.darling";
+	};
+
+	/**
+	 * Sends a call with a single descriptor (at index 0) and no reply body to the server and waits for the reply.
+	 *
+	 * `call` must start with a `dserver_rpc_callhdr_t`; its `number` must already be set (the rest of the header is filled in here).
+	 * Returns the reply's result code or a negative errno if communication with the server failed.
+	 */
+	static inline int performUnmanagedCall(const std::string& prefix, void* call, size_t callSize, int fd) {
+		auto socketPath = prefix + "/.darlingserver.sock";
+		auto header = static_cast<dserver_rpc_callhdr_t*>(call);
+
+		header->pid = getpid();
+		header->tid = syscall(SYS_gettid);
+		header->architecture = dserver_rpc_architecture_invalid;
+
+		int sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+		if (sock < 0) {
+			return -errno;
+		}
+
+		// autobind to an abstract address so the server has somewhere to send the reply
+		struct sockaddr_un ourAddress;
+		memset(&ourAddress, 0, sizeof(ourAddress));
+		ourAddress.sun_family = AF_UNIX;
+		if (bind(sock, (struct sockaddr*)&ourAddress, sizeof(sa_family_t)) < 0) {
+			int err = errno;
+			close(sock);
+			return -err;
+		}
+
+		struct sockaddr_un serverAddress;
+		memset(&serverAddress, 0, sizeof(serverAddress));
+		serverAddress.sun_family = AF_UNIX;
+		strncpy(serverAddress.sun_path, socketPath.c_str(), sizeof(serverAddress.sun_path) - 1);
+
+		struct iovec callData;
+		callData.iov_base = call;
+		callData.iov_len = callSize;
+
+		char control[CMSG_SPACE(sizeof(int))];
+		memset(control, 0, sizeof(control));
+
+		struct msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_name = &serverAddress;
+		message.msg_namelen = sizeof(serverAddress);
+		message.msg_iov = &callData;
+		message.msg_iovlen = 1;
+		message.msg_control = control;
+		message.msg_controllen = sizeof(control);
+
+		auto controlHeader = CMSG_FIRSTHDR(&message);
+		controlHeader->cmsg_level = SOL_SOCKET;
+		controlHeader->cmsg_type = SCM_RIGHTS;
+		controlHeader->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(controlHeader), &fd, sizeof(int));
+
+		if (sendmsg(sock, &message, 0) < 0) {
+			int err = errno;
+			close(sock);
+			return -err;
+		}
+
+		dserver_rpc_replyhdr_t reply;
+		ssize_t received;
+		while ((received = recv(sock, &reply, sizeof(reply), 0)) < 0 && errno == EINTR);
+
+		int err = errno;
+		close(sock);
+
+		if (received < 0) {
+			return -err;
+		} else if (received != sizeof(reply) || reply.number != header->number) {
+			return -EBADMSG;
+		}
+
+		return reply.code;
+	};
+};
+
+#endif // _DARLINGSERVER_TOOLS_UNMANAGED_CALL_HPP_